@@ -17,6 +17,9 @@ set(USE_FREEBIND ${LINUX})
 set(USE_PMTU ${LINUX})
 set(USE_PKTINFO ${LINUX})
 set(USE_PACKET_MARK ${LINUX})
+set(USE_BUSY_POLL ${LINUX})
+set(USE_UDP_GSO ${LINUX})
+set(USE_UDP_GRO ${LINUX})
 
 
 if(ANDROID)
@@ -48,6 +51,12 @@ else(LINUX AND NOT ANDROID)
   set(ENABLE_SYSTEMD FALSE)
 endif(LINUX AND NOT ANDROID)
 
+if(LINUX AND NOT ANDROID)
+  set(USE_IO_URING FALSE CACHE BOOL "Use io_uring instead of epoll (requires liburing and Linux 6.0 or newer)")
+else(LINUX AND NOT ANDROID)
+  set(USE_IO_URING FALSE)
+endif(LINUX AND NOT ANDROID)
+
 if(USE_USER)
   set(WITH_CMDLINE_USER TRUE CACHE BOOL "Include support for setting user/group related options on the command line")
 else(USE_USER)
@@ -61,6 +70,12 @@ set(WITH_CMDLINE_COMMANDS TRUE CACHE BOOL "Include support for setting handler s
 set(WITH_DYNAMIC_PEERS TRUE CACHE BOOL "Include support for dynamic peers (using on-verify handlers)")
 set(WITH_STATUS_SOCKET TRUE CACHE BOOL "Include support for the status socket")
 
+if(USE_EPOLL)
+  set(WITH_WORKERS TRUE CACHE BOOL "Include support for processing packets on multiple worker threads")
+else(USE_EPOLL)
+  set(WITH_WORKERS FALSE)
+endif(USE_EPOLL)
+
 set(MAX_CONFIG_DEPTH 10 CACHE STRING "Maximum config include depth")
 
 
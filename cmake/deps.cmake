@@ -60,3 +60,12 @@ else(WITH_STATUS_SOCKET)
   set(JSON_C_LIBRARIES "")
   set(JSON_C_LDFLAGS_OTHER "")
 endif(WITH_STATUS_SOCKET)
+
+if(USE_IO_URING)
+  find_package(liburing REQUIRED)
+else(USE_IO_URING)
+  set(LIBURING_INCLUDE_DIR "")
+  set(LIBURING_LIBRARIES "")
+  set(LIBURING_CFLAGS_OTHER "")
+  set(LIBURING_LDFLAGS_OTHER "")
+endif(USE_IO_URING)
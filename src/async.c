@@ -32,6 +32,8 @@
 
 #include "async.h"
 #include "fastd.h"
+#include "offload.h"
+#include "reorder.h"
 
 #include <sys/uio.h>
 
@@ -94,6 +96,17 @@ static void handle_verify_return(const fastd_async_verify_return_t *verify_retur
 
 #endif
 
+#ifdef WITH_WORKERS
+
+/** Handles a request of a worker to schedule the task of a peer's reorder buffer */
+static void handle_reorder(const fastd_async_reorder_t *reorder) {
+	fastd_peer_t *peer = fastd_peer_find_by_id(reorder->peer_id);
+	if (peer)
+		fastd_reorder_schedule(peer);
+}
+
+#endif
+
 
 /** Reads and handles a single notification from the async notification socket */
 void fastd_async_handle(void) {
@@ -131,13 +144,31 @@ void fastd_async_handle(void) {
 		break;
 #endif
 
+#ifdef WITH_WORKERS
+	case ASYNC_TYPE_RECEIVE:
+		fastd_receive_async((const fastd_async_receive_t *)buf);
+		break;
+
+	case ASYNC_TYPE_REORDER:
+		handle_reorder((const fastd_async_reorder_t *)buf);
+		break;
+#endif
+
+	case ASYNC_TYPE_OFFLOAD_DONE:
+		fastd_offload_handle();
+		break;
+
 	default:
 		exit_bug("fastd_async_handle: unknown type");
 	}
 }
 
-/** Enqueues a new async notification */
-void fastd_async_enqueue(fastd_async_type_t type, const void *data, size_t len) {
+/**
+   Enqueues a new async notification
+
+   \return false if the notification couldn't be sent (e.g. because the socket buffer is full)
+*/
+bool fastd_async_enqueue(fastd_async_type_t type, const void *data, size_t len) {
 	fastd_async_hdr_t header;
 	/* use memset to zero the holes in the struct to make valgrind happy */
 	memset(&header, 0, sizeof(header));
@@ -153,6 +184,10 @@ void fastd_async_enqueue(fastd_async_type_t type, const void *data, size_t len)
 		.msg_iovlen = len ? 2 : 1,
 	};
 
-	if (sendmsg(ctx.async_wfd, &msg, 0) < 0)
+	if (sendmsg(ctx.async_wfd, &msg, 0) < 0) {
 		pr_warn_errno("fastd_async_enqueue: sendmsg");
+		return false;
+	}
+
+	return true;
 }
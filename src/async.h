@@ -41,6 +41,9 @@ typedef enum fastd_async_type {
 	ASYNC_TYPE_NOP,				/**< Does nothing (is used to ensure poll returns quickly after a signal has occurred) */
 	ASYNC_TYPE_RESOLVE_RETURN,		/**< A DNS resolver response */
 	ASYNC_TYPE_VERIFY_RETURN,		/**< A on-verify return */
+	ASYNC_TYPE_RECEIVE,			/**< A packet received on a worker thread */
+	ASYNC_TYPE_REORDER,			/**< A worker has held back a packet in a peer's reorder buffer */
+	ASYNC_TYPE_OFFLOAD_DONE,		/**< Jobs on the offload thread pool have finished */
 } fastd_async_type_t;
 
 
@@ -68,7 +71,31 @@ typedef struct fastd_async_verify_return {
 	uint8_t protocol_data[] __attribute__((aligned(8))); /**< Protocol-specific data */
 } fastd_async_verify_return_t;
 
+#ifdef WITH_WORKERS
+
+/** A packet received on a worker thread which must be handled by the main thread */
+typedef struct fastd_async_receive {
+	size_t sock_index;			/**< The index of the socket in ctx.socks corresponding to the worker socket the packet was received on */
+
+	fastd_peer_address_t local_addr;	/**< The local address the packet was received on */
+	fastd_peer_address_t remote_addr;	/**< The address the packet was received from */
+
+	size_t len;				/**< The length of the packet */
+	uint8_t data[] __attribute__((aligned(8))); /**< The packet data (including the packet type) */
+} fastd_async_receive_t;
+
+/** A request to schedule the task of a reorder buffer */
+typedef struct fastd_async_reorder {
+	uint64_t peer_id;			/**< The ID of the peer the reorder buffer belongs to */
+} fastd_async_reorder_t;
+
+#endif
+
 
 void fastd_async_init(void);
 void fastd_async_handle(void);
-void fastd_async_enqueue(fastd_async_type_t type, const void *data, size_t len);
+bool fastd_async_enqueue(fastd_async_type_t type, const void *data, size_t len);
+
+#ifdef WITH_WORKERS
+void fastd_receive_async(const fastd_async_receive_t *receive);
+#endif
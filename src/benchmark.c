@@ -0,0 +1,521 @@
+/*
+  Copyright (c) 2012-2016, Matthias Schiffer <mschiffer@universe-factory.net>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   \file
+
+   The --benchmark mode
+
+   The benchmark runs all cipher and MAC implementations available on the
+   local CPU and the encryption and decryption of all configured methods over
+   a range of packet sizes. The timer wheel of the task queue is compared
+   against the pairing heap it has replaced, and MAC implementations can provide
+   a simpler variant (like GHASH with a reduction after every block) which is
+   measured alongside them.
+
+   Every result is printed as a single line of space-separated key=value pairs
+   on stdout, so the output can be parsed easily. The cycle counts are taken from
+   the time stamp counter on x86 CPUs and are omitted on other architectures.
+*/
+
+
+#include "benchmark.h"
+#include "crypto.h"
+#include "fastd.h"
+#include "method.h"
+#include "pqueue.h"
+#include "timer_wheel.h"
+
+#include <time.h>
+
+
+/** The number of operations between two timestamps */
+#define BENCHMARK_BATCH 16
+
+/** The numbers of tasks the timer wheel and pairing heap are compared with */
+static const size_t timer_tasks[] = { 1000, 10000, 100000 };
+
+/** The maximum time in milliseconds until a task is rescheduled, roughly the keepalive interval */
+#define TIMER_SPREAD 20000
+
+/** The packet sizes to benchmark (only those smaller than the maximum payload size are used) */
+static const size_t packet_sizes[] = { 64, 128, 256, 512, 1024 };
+
+
+/** Returns a monotonic timestamp in nanoseconds */
+static inline int64_t get_time_nsec(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (1000000000*(int64_t)ts.tv_sec) + ts.tv_nsec;
+}
+
+/** Returns the value of the CPU's cycle counter, or 0 if there is none */
+static inline uint64_t get_cycles(void) {
+#if defined(__i386__) || defined(__x86_64__)
+	uint32_t lo, hi;
+	__asm__ __volatile__ ("rdtsc" : "=a"(lo), "=d"(hi));
+	return ((uint64_t)hi << 32) | lo;
+#else
+	return 0;
+#endif
+}
+
+/** Starts a measurement */
+static inline void benchmark_begin(fastd_benchmark_result_t *result) {
+	result->start_cycles = get_cycles();
+	result->start_time = get_time_nsec();
+}
+
+/** Ends a measurement of \e runs operations, adding it to the result */
+static inline void benchmark_end(fastd_benchmark_result_t *result, uint64_t runs) {
+	result->time += get_time_nsec() - result->start_time;
+	result->cycles += get_cycles() - result->start_cycles;
+	result->runs += runs;
+}
+
+/** Checks if a benchmark has run for at least \e limit milliseconds */
+static inline bool benchmark_done(const fastd_benchmark_result_t *result, int64_t limit) {
+	return result->time >= limit*1000000;
+}
+
+
+/**
+   Measures a cipher implementation on buffers of \e len bytes
+
+   The measurement runs for \e limit milliseconds. Returns false if the implementation fails.
+*/
+bool fastd_benchmark_cipher(const fastd_cipher_info_t *info, const fastd_cipher_t *cipher, size_t len, int64_t limit, fastd_benchmark_result_t *result) {
+	size_t size = alignto(len, sizeof(fastd_block128_t));
+	fastd_block128_t *buf = fastd_alloc_aligned(size, 16);
+	memset(buf, 0, size);
+
+	uint8_t key[info->key_length ?: 1], iv[info->iv_length ?: 1];
+	memset(key, 0xa5, sizeof(key));
+	memset(iv, 0x5a, sizeof(iv));
+
+	fastd_cipher_state_t *state = cipher->init(key);
+
+	/* The first run warms up the caches and isn't counted */
+	bool ok = cipher->crypt(state, buf, buf, size, iv);
+
+	while (ok && !benchmark_done(result, limit)) {
+		size_t i;
+
+		benchmark_begin(result);
+		for (i = 0; ok && i < BENCHMARK_BATCH; i++)
+			ok = cipher->crypt(state, buf, buf, size, iv);
+		benchmark_end(result, i);
+	}
+
+	cipher->free(state);
+	free(buf);
+
+	return ok;
+}
+
+/**
+   Measures a MAC implementation on buffers of \e len bytes
+
+   The measurement runs for \e limit milliseconds. Returns false if the implementation fails.
+*/
+bool fastd_benchmark_mac(const fastd_mac_info_t *info, const fastd_mac_t *mac, size_t len, int64_t limit, fastd_benchmark_result_t *result) {
+	/* UHASH reads whole 32-byte blocks, so the zero padding must be part of the buffer */
+	size_t size = alignto(len, sizeof(fastd_block128_t));
+	size_t alloc_size = alignto(len, 2*sizeof(fastd_block128_t));
+	fastd_block128_t *buf = fastd_alloc_aligned(alloc_size, 16);
+	memset(buf, 0, alloc_size);
+
+	uint8_t key[info->key_length];
+	memset(key, 0xa5, sizeof(key));
+
+	fastd_mac_state_t *state = mac->init(key);
+	fastd_block128_t tag;
+
+	bool ok = mac->digest(state, &tag, buf, size);
+
+	while (ok && !benchmark_done(result, limit)) {
+		size_t i;
+
+		benchmark_begin(result);
+		for (i = 0; ok && i < BENCHMARK_BATCH; i++)
+			ok = mac->digest(state, &tag, buf, size);
+		benchmark_end(result, i);
+	}
+
+	mac->free(state);
+	free(buf);
+
+	return ok;
+}
+
+
+/** Prints the packet and byte rates of a benchmark on packets of \e len bytes, finishing the current line */
+static void print_throughput(const fastd_benchmark_result_t *result, size_t len) {
+	double rate = fastd_benchmark_rate(result);
+
+	printf(" size=%u packets_per_sec=%.0f bytes_per_sec=%.0f", (unsigned)len, rate, rate*len);
+	if (result->cycles)
+		printf(" cycles_per_byte=%.2f", (double)result->cycles / (result->runs * len));
+	printf("\n");
+
+	fflush(stdout);
+}
+
+/** Prints the rate of the operations of a benchmark (called \e unit), finishing the current line */
+static void print_rate(const fastd_benchmark_result_t *result, const char *unit) {
+	printf(" %ss_per_sec=%.0f", unit, fastd_benchmark_rate(result));
+	if (result->cycles)
+		printf(" cycles_per_%s=%.0f", unit, (double)result->cycles / result->runs);
+	printf("\n");
+
+	fflush(stdout);
+}
+
+
+/** Benchmarks all available implementations of all ciphers */
+static void benchmark_ciphers(const size_t *sizes, size_t n_sizes) {
+	fastd_crypto_impl_status_t status;
+	size_t i, j, k;
+
+	for (i = 0; fastd_cipher_get_status(i, &status); i++) {
+		const fastd_cipher_info_t *info = fastd_cipher_info_get_by_name(status.name);
+		if (!info)
+			continue;
+
+		const fastd_cipher_t *cipher;
+		const char *impl;
+		for (j = 0; (cipher = fastd_cipher_get_impl(info, j, &impl)); j++) {
+			for (k = 0; k < n_sizes; k++) {
+				fastd_benchmark_result_t result = {};
+				if (!fastd_benchmark_cipher(info, cipher, sizes[k], BENCHMARK_TIME, &result)) {
+					pr_error("cipher `%s', implementation `%s' failed", status.name, impl);
+					break;
+				}
+
+				printf("cipher=%s implementation=%s", status.name, impl);
+				print_throughput(&result, sizes[k]);
+			}
+		}
+	}
+}
+
+/** Benchmarks all available implementations of all MACs */
+static void benchmark_macs(const size_t *sizes, size_t n_sizes) {
+	fastd_crypto_impl_status_t status;
+	size_t i, j, k;
+
+	for (i = 0; fastd_mac_get_status(i, &status); i++) {
+		const fastd_mac_info_t *info = fastd_mac_info_get_by_name(status.name);
+		if (!info)
+			continue;
+
+		const fastd_mac_t *mac;
+		const char *impl;
+		for (j = 0; (mac = fastd_mac_get_impl(info, j, &impl)); j++) {
+			for (k = 0; k < n_sizes; k++) {
+				fastd_benchmark_result_t result = {};
+				if (!fastd_benchmark_mac(info, mac, sizes[k], BENCHMARK_TIME, &result)) {
+					pr_error("MAC `%s', implementation `%s' failed", status.name, impl);
+					break;
+				}
+
+				printf("mac=%s implementation=%s", status.name, impl);
+				print_throughput(&result, sizes[k]);
+
+				if (!mac->benchmark_variant)
+					continue;
+
+				result = (fastd_benchmark_result_t){};
+				if (!fastd_benchmark_mac(info, mac->benchmark_variant, sizes[k], BENCHMARK_TIME, &result)) {
+					pr_error("MAC `%s', implementation `%s', variant `%s' failed", status.name, impl, mac->benchmark_variant_name);
+					continue;
+				}
+
+				printf("mac=%s implementation=%s variant=%s", status.name, impl, mac->benchmark_variant_name);
+				print_throughput(&result, sizes[k]);
+			}
+		}
+	}
+}
+
+
+/** Measures the session setup of a method */
+static void benchmark_session_init(const fastd_method_info_t *method, const uint8_t *secret) {
+	fastd_benchmark_result_t result = {};
+
+	while (!benchmark_done(&result, BENCHMARK_TIME)) {
+		fastd_method_session_state_t *session;
+
+		benchmark_begin(&result);
+		session = method->provider->session_init(method->method, secret, true);
+		method->provider->session_free(session);
+		benchmark_end(&result, 1);
+	}
+
+	printf("method=%s operation=session_init", method->name);
+	print_rate(&result, "session");
+}
+
+/**
+   Measures encryption and decryption of a method on packets of \e len bytes
+
+   The packets go through the same batch functions and use the same head and tail space as
+   in the data path. Each batch of packets is encrypted by the initiator's session and then
+   copied to fresh buffers (like received packets) and decrypted by the responder's session;
+   only the encryption and decryption are measured.
+*/
+static bool benchmark_packets(const fastd_method_info_t *method, const uint8_t *secret, size_t len) {
+	const fastd_method_provider_t *provider = method->provider;
+	fastd_method_session_state_t *initiator = provider->session_init(method->method, secret, true);
+	fastd_method_session_state_t *responder = provider->session_init(method->method, secret, false);
+
+	fastd_benchmark_result_t encrypt = {}, decrypt = {};
+	fastd_buffer_t buffers[CRYPTO_BATCH_SIZE];
+	bool ok[CRYPTO_BATCH_SIZE], reordered[CRYPTO_BATCH_SIZE];
+	fastd_packet_seq_t seq[CRYPTO_BATCH_SIZE];
+	bool success = true;
+	size_t i;
+
+	while (success && !(benchmark_done(&encrypt, BENCHMARK_TIME) && benchmark_done(&decrypt, BENCHMARK_TIME))) {
+		for (i = 0; i < CRYPTO_BATCH_SIZE; i++) {
+			buffers[i] = fastd_buffer_alloc(len, conf.min_encrypt_head_space, conf.min_encrypt_tail_space);
+			memset(buffers[i].data, i, len);
+		}
+
+		benchmark_begin(&encrypt);
+		fastd_method_encrypt_batch(provider, NULL, initiator, buffers, CRYPTO_BATCH_SIZE, ok);
+		benchmark_end(&encrypt, CRYPTO_BATCH_SIZE);
+
+		for (i = 0; i < CRYPTO_BATCH_SIZE; i++) {
+			if (!ok[i])
+				success = false;
+
+			fastd_buffer_t buffer = fastd_buffer_alloc(buffers[i].len, conf.min_decrypt_head_space, conf.min_decrypt_tail_space);
+			memcpy(buffer.data, buffers[i].data, buffers[i].len);
+			fastd_buffer_free(buffers[i]);
+			buffers[i] = buffer;
+		}
+
+		if (success) {
+			benchmark_begin(&decrypt);
+			fastd_method_decrypt_batch(provider, NULL, responder, buffers, CRYPTO_BATCH_SIZE, ok, reordered, seq);
+			benchmark_end(&decrypt, CRYPTO_BATCH_SIZE);
+
+			for (i = 0; i < CRYPTO_BATCH_SIZE; i++) {
+				if (!ok[i] || buffers[i].len != len)
+					success = false;
+			}
+		}
+
+		for (i = 0; i < CRYPTO_BATCH_SIZE; i++)
+			fastd_buffer_free(buffers[i]);
+	}
+
+	provider->session_free(initiator);
+	provider->session_free(responder);
+
+	if (!success)
+		return false;
+
+	printf("method=%s operation=encrypt", method->name);
+	print_throughput(&encrypt, len);
+	printf("method=%s operation=decrypt", method->name);
+	print_throughput(&decrypt, len);
+
+	return true;
+}
+
+/** Benchmarks a configured method */
+static void benchmark_method(const fastd_method_info_t *method, const size_t *sizes, size_t n_sizes) {
+	size_t key_length = method->provider->key_length(method->method);
+	uint8_t secret[key_length ?: 1];
+	memset(secret, 0xa5, sizeof(secret));
+
+	benchmark_session_init(method, secret);
+
+	size_t i;
+	for (i = 0; i < n_sizes; i++) {
+		if (!benchmark_packets(method, secret, sizes[i])) {
+			pr_error("method `%s' failed to encrypt or decrypt a packet", method->name);
+			break;
+		}
+	}
+}
+
+
+/** A small xorshift PRNG, so the timer wheel and the pairing heap get the same sequence of timeouts */
+static inline uint32_t timer_random(uint32_t *state) {
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+
+	return x;
+}
+
+/** Returns a random timeout after \e now */
+static inline int64_t timer_timeout(uint32_t *state, int64_t now) {
+	return now + 1 + timer_random(state) % TIMER_SPREAD;
+}
+
+/**
+   Measures the timer wheel with \e n_tasks tasks
+
+   Like the peer tasks, every task is rescheduled when it has expired. For each expired
+   task, another random task is rescheduled before its timeout, as it happens for
+   the peer tasks when packets are received. Each reschedule counts as one operation.
+*/
+static void benchmark_timer_wheel(size_t n_tasks, fastd_benchmark_result_t *result) {
+	fastd_timer_wheel_t *wheel = fastd_new0(fastd_timer_wheel_t);
+	fastd_timer_wheel_entry_t *tasks = fastd_new0_array(n_tasks, fastd_timer_wheel_entry_t);
+	uint32_t seed = 1;
+	int64_t now = 0;
+	size_t i;
+
+	for (i = 0; i < n_tasks; i++) {
+		tasks[i].value = timer_timeout(&seed, now);
+		fastd_timer_wheel_insert(wheel, &tasks[i]);
+	}
+
+	while (!benchmark_done(result, BENCHMARK_TIME)) {
+		uint64_t runs = 0;
+
+		benchmark_begin(result);
+
+		for (i = 0; i < BENCHMARK_BATCH; i++) {
+			fastd_timer_wheel_entry_t *task;
+
+			now = fastd_timer_wheel_next(wheel);
+			while ((task = fastd_timer_wheel_expire(wheel, now))) {
+				task->value = timer_timeout(&seed, now);
+				fastd_timer_wheel_insert(wheel, task);
+
+				task = &tasks[timer_random(&seed) % n_tasks];
+				fastd_timer_wheel_remove(wheel, task);
+				task->value = timer_timeout(&seed, now);
+				fastd_timer_wheel_insert(wheel, task);
+
+				runs += 2;
+			}
+		}
+
+		benchmark_end(result, runs);
+	}
+
+	free(tasks);
+	free(wheel);
+}
+
+/** Measures the pairing heap with \e n_tasks tasks, using the same workload as benchmark_timer_wheel() */
+static void benchmark_pqueue(size_t n_tasks, fastd_benchmark_result_t *result) {
+	fastd_pqueue_t *queue = NULL;
+	fastd_pqueue_t *tasks = fastd_new0_array(n_tasks, fastd_pqueue_t);
+	uint32_t seed = 1;
+	int64_t now = 0;
+	size_t i;
+
+	for (i = 0; i < n_tasks; i++) {
+		tasks[i].value = timer_timeout(&seed, now);
+		fastd_pqueue_insert(&queue, &tasks[i]);
+	}
+
+	while (!benchmark_done(result, BENCHMARK_TIME)) {
+		uint64_t runs = 0;
+
+		benchmark_begin(result);
+
+		for (i = 0; i < BENCHMARK_BATCH; i++) {
+			fastd_pqueue_t *task;
+
+			now = queue->value;
+			while (queue->value <= now) {
+				task = queue;
+				fastd_pqueue_remove(task);
+				task->value = timer_timeout(&seed, now);
+				fastd_pqueue_insert(&queue, task);
+
+				task = &tasks[timer_random(&seed) % n_tasks];
+				fastd_pqueue_remove(task);
+				task->value = timer_timeout(&seed, now);
+				fastd_pqueue_insert(&queue, task);
+
+				runs += 2;
+			}
+		}
+
+		benchmark_end(result, runs);
+	}
+
+	free(tasks);
+}
+
+/** Compares the timer wheel with the pairing heap */
+static void benchmark_timers(void) {
+	size_t i;
+	for (i = 0; i < array_size(timer_tasks); i++) {
+		fastd_benchmark_result_t result = {};
+
+		benchmark_timer_wheel(timer_tasks[i], &result);
+		printf("timer=wheel tasks=%u", (unsigned)timer_tasks[i]);
+		print_rate(&result, "operation");
+
+		result = (fastd_benchmark_result_t){};
+
+		benchmark_pqueue(timer_tasks[i], &result);
+		printf("timer=pqueue tasks=%u", (unsigned)timer_tasks[i]);
+		print_rate(&result, "operation");
+	}
+}
+
+
+/** Runs the --benchmark mode; the methods must have been configured */
+void fastd_benchmark(void) {
+	size_t max_len = fastd_max_payload(conf.mtu);
+	size_t sizes[array_size(packet_sizes)+1];
+	size_t n_sizes = 0, i;
+
+	for (i = 0; i < array_size(packet_sizes); i++) {
+		if (packet_sizes[i] < max_len)
+			sizes[n_sizes++] = packet_sizes[i];
+	}
+
+	sizes[n_sizes++] = max_len;
+
+	fastd_update_time();
+
+	benchmark_ciphers(sizes, n_sizes);
+	benchmark_macs(sizes, n_sizes);
+
+	/* Let the methods use the same implementations as fastd would use with this configuration */
+	fastd_cipher_autoselect(max_len);
+	fastd_mac_autoselect(max_len);
+
+	for (i = 0; conf.methods[i].name; i++)
+		benchmark_method(&conf.methods[i], sizes, n_sizes);
+
+	benchmark_timers();
+}
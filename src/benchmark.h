@@ -0,0 +1,61 @@
+/*
+  Copyright (c) 2012-2016, Matthias Schiffer <mschiffer@universe-factory.net>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   \file
+
+   Benchmarks of the methods, ciphers and MACs
+*/
+
+
+#pragma once
+
+#include "types.h"
+
+
+/** Accumulated measurements of a benchmark */
+struct fastd_benchmark_result {
+	uint64_t runs;				/**< The number of measured operations */
+	int64_t time;				/**< The measured time in nanoseconds */
+	uint64_t cycles;			/**< The measured number of CPU cycles, or 0 if there is no cycle counter */
+
+	int64_t start_time;			/**< The time at the start of the current measurement */
+	uint64_t start_cycles;			/**< The cycle counter at the start of the current measurement */
+};
+
+
+void fastd_benchmark(void);
+
+bool fastd_benchmark_cipher(const fastd_cipher_info_t *info, const fastd_cipher_t *cipher, size_t len, int64_t time, fastd_benchmark_result_t *result);
+bool fastd_benchmark_mac(const fastd_mac_info_t *info, const fastd_mac_t *mac, size_t len, int64_t time, fastd_benchmark_result_t *result);
+
+
+/** Returns the number of measured operations per second */
+static inline double fastd_benchmark_rate(const fastd_benchmark_result_t *result) {
+	if (!result->time)
+		return 0;
+
+	return result->runs * 1e9 / result->time;
+}
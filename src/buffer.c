@@ -0,0 +1,248 @@
+/*
+  Copyright (c) 2012-2016, Matthias Schiffer <mschiffer@universe-factory.net>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   \file
+
+   Pool of packet buffers
+
+   Allocating and freeing a buffer for each packet shows up prominently in
+   profiles of the data path, so freed buffers are kept in per-thread freelists
+   and reused by later allocations of the same size class.
+*/
+
+
+#include "fastd.h"
+#include "worker.h"
+
+
+/** Returns the buffer pool of the current thread */
+static inline fastd_buffer_pool_t * current_pool(void) {
+#ifdef WITH_WORKERS
+	if (fastd_worker_self)
+		return &fastd_worker_self->buffer_pool;
+#endif
+
+	return &ctx.buffer_pool;
+}
+
+/**
+   Increments a counter of the current thread's pool
+
+   The counters are only written by the thread owning the pool, but they are read by
+   fastd_buffer_pool_get_stats() on the main thread, so they are stored atomically.
+*/
+#define POOL_COUNTER_ADD(counter, n) __atomic_store_n(&(counter), (counter) + (n), __ATOMIC_RELAXED)
+
+
+/** Returns the smallest size class a buffer of the given size fits into, or NULL */
+static fastd_buffer_freelist_t * find_class(fastd_buffer_pool_t *pool, size_t size) {
+	fastd_buffer_freelist_t *ret = NULL;
+
+	size_t i;
+	for (i = 0; i < BUFFER_CLASS_MAX; i++) {
+		fastd_buffer_freelist_t *class = &pool->classes[i];
+
+		if (class->size && size <= class->size && (!ret || class->size < ret->size))
+			ret = class;
+	}
+
+	return ret;
+}
+
+/**
+   Allocates the memory for a buffer
+
+   \param base_len The needed size; set to the actual size of the returned memory area
+*/
+void * fastd_buffer_pool_alloc(size_t *base_len) {
+	fastd_buffer_pool_t *pool = current_pool();
+	fastd_buffer_freelist_t *class = find_class(pool, *base_len);
+
+	if (!class) {
+		POOL_COUNTER_ADD(pool->oversized, 1);
+		return fastd_alloc_aligned(*base_len, 16);
+	}
+
+	*base_len = class->size;
+
+	if (!class->head) {
+		POOL_COUNTER_ADD(class->misses, 1);
+		return fastd_alloc_aligned(class->size, 16);
+	}
+
+	void *ret = class->head;
+	class->head = *(void **)ret;
+	POOL_COUNTER_ADD(class->len, -1);
+	POOL_COUNTER_ADD(class->hits, 1);
+
+	return ret;
+}
+
+/** Returns the memory of a buffer to the pool, or frees it if it doesn't fit into a size class */
+void fastd_buffer_pool_release(void *base, size_t base_len) {
+	if (!base)
+		return;
+
+	fastd_buffer_pool_t *pool = current_pool();
+
+	size_t i;
+	for (i = 0; i < BUFFER_CLASS_MAX; i++) {
+		fastd_buffer_freelist_t *class = &pool->classes[i];
+
+		if (class->size != base_len)
+			continue;
+
+		if (class->len >= BUFFER_POOL_MAX_FREE)
+			break;
+
+		*(void **)base = class->head;
+		class->head = base;
+		POOL_COUNTER_ADD(class->len, 1);
+		return;
+	}
+
+	free(base);
+}
+
+/** Frees the unused buffers of a size class */
+static void flush_class(fastd_buffer_freelist_t *class) {
+	while (class->head) {
+		void *next = *(void **)class->head;
+		free(class->head);
+		class->head = next;
+	}
+
+	__atomic_store_n(&class->len, 0, __ATOMIC_RELAXED);
+}
+
+/** Sets the size classes of a pool, dropping the unused buffers of classes whose size has changed */
+static void configure_pool(fastd_buffer_pool_t *pool, const size_t sizes[BUFFER_CLASS_MAX]) {
+	size_t i;
+	for (i = 0; i < BUFFER_CLASS_MAX; i++) {
+		fastd_buffer_freelist_t *class = &pool->classes[i];
+
+		if (class->size == sizes[i])
+			continue;
+
+		flush_class(class);
+		__atomic_store_n(&class->size, sizes[i], __ATOMIC_RELAXED);
+	}
+}
+
+/**
+   Determines the sizes of the buffer pool's size classes
+
+   Must be called on the main thread whenever the maximum MTU may have changed. The
+   pools of the worker threads are only modified by the workers themselves, so the
+   new configuration is published for fastd_buffer_pool_update_worker().
+*/
+void fastd_buffer_pool_configure(void) {
+	size_t head_space = max_size_t(conf.min_encrypt_head_space, conf.min_decrypt_head_space);
+	size_t tail_space = max_size_t(conf.min_encrypt_tail_space, conf.min_decrypt_tail_space);
+
+	size_t sizes[BUFFER_CLASS_MAX] = {
+		[BUFFER_CLASS_HANDSHAKE] = BUFFER_POOL_HANDSHAKE_SIZE,
+		[BUFFER_CLASS_DATA] = alignto(head_space + 1 + fastd_max_payload(ctx.max_mtu) + conf.max_overhead + tail_space + BUFFER_POOL_DATA_SLACK, 64),
+	};
+
+	configure_pool(&ctx.buffer_pool, sizes);
+
+#ifdef WITH_WORKERS
+	if (!fastd_workers_enabled())
+		return;
+
+	pthread_mutex_lock(&ctx.buffer_pool_lock);
+
+	memcpy(ctx.buffer_pool_sizes, sizes, sizeof(sizes));
+	ctx.worker_max_packet_len = 1 + fastd_max_payload(ctx.max_mtu) + conf.max_overhead;
+	__atomic_add_fetch(&ctx.buffer_pool_generation, 1, __ATOMIC_RELEASE);
+
+	pthread_mutex_unlock(&ctx.buffer_pool_lock);
+#endif
+}
+
+#ifdef WITH_WORKERS
+
+/**
+   Applies a changed buffer pool configuration to the pool of the current worker thread
+
+   Is called by the workers before they handle their input.
+*/
+void fastd_buffer_pool_update_worker(void) {
+	fastd_worker_t *worker = fastd_worker_self;
+
+	if (__atomic_load_n(&ctx.buffer_pool_generation, __ATOMIC_ACQUIRE) == worker->buffer_pool_generation)
+		return;
+
+	pthread_mutex_lock(&ctx.buffer_pool_lock);
+
+	configure_pool(&worker->buffer_pool, ctx.buffer_pool_sizes);
+	worker->max_packet_len = ctx.worker_max_packet_len;
+	worker->buffer_pool_generation = ctx.buffer_pool_generation;
+
+	pthread_mutex_unlock(&ctx.buffer_pool_lock);
+}
+
+#endif
+
+/** Frees the unused buffers of a pool; buffers freed afterwards aren't pooled anymore */
+void fastd_buffer_pool_free(fastd_buffer_pool_t *pool) {
+	size_t i;
+	for (i = 0; i < BUFFER_CLASS_MAX; i++) {
+		flush_class(&pool->classes[i]);
+		pool->classes[i].size = 0;
+	}
+}
+
+/** Adds the counters of a pool to the given statistics, reading them atomically */
+static void add_pool_stats(fastd_buffer_pool_t *stats, const fastd_buffer_pool_t *pool) {
+	size_t i;
+	for (i = 0; i < BUFFER_CLASS_MAX; i++) {
+		stats->classes[i].size = __atomic_load_n(&pool->classes[i].size, __ATOMIC_RELAXED);
+		stats->classes[i].len += __atomic_load_n(&pool->classes[i].len, __ATOMIC_RELAXED);
+		stats->classes[i].hits += __atomic_load_n(&pool->classes[i].hits, __ATOMIC_RELAXED);
+		stats->classes[i].misses += __atomic_load_n(&pool->classes[i].misses, __ATOMIC_RELAXED);
+	}
+
+	stats->oversized += __atomic_load_n(&pool->oversized, __ATOMIC_RELAXED);
+}
+
+/**
+   Adds up the counters of the buffer pools of all threads
+
+   Must be called on the main thread. The freelists of the returned statistics are always empty.
+*/
+void fastd_buffer_pool_get_stats(fastd_buffer_pool_t *stats) {
+	memset(stats, 0, sizeof(*stats));
+
+	add_pool_stats(stats, &ctx.buffer_pool);
+
+#ifdef WITH_WORKERS
+	size_t i;
+	for (i = 0; i < conf.n_workers; i++)
+		add_pool_stats(stats, &ctx.workers[i].buffer_pool);
+#endif
+}
@@ -45,17 +45,58 @@ struct fastd_buffer {
 };
 
 
+/** The size classes of the buffer pool */
+typedef enum fastd_buffer_class {
+	BUFFER_CLASS_HANDSHAKE = 0,	/**< Handshakes and other small packets */
+	BUFFER_CLASS_DATA,		/**< Payload packets of the maximum MTU, with the head and tail space needed by the methods */
+	BUFFER_CLASS_MAX,		/**< The number of size classes */
+} fastd_buffer_class_t;
+
+/** The unused buffers of one size class */
+typedef struct fastd_buffer_freelist {
+	size_t size;			/**< The allocation size of the buffers of this class (0 until the pool is configured) */
+	void *head;			/**< The first unused buffer; each unused buffer starts with a pointer to the next one */
+	size_t len;			/**< The number of unused buffers */
+
+	uint64_t hits;			/**< The number of allocations served from the freelist */
+	uint64_t misses;		/**< The number of allocations that needed to allocate a new buffer */
+} fastd_buffer_freelist_t;
+
+/**
+   A buffer pool
+
+   There is one pool for the main thread and one for each worker thread, so no
+   locking is needed. Buffers may be freed on a different thread than the one that
+   allocated them, in which case they are added to the pool of the freeing thread.
+*/
+struct fastd_buffer_pool {
+	fastd_buffer_freelist_t classes[BUFFER_CLASS_MAX]; /**< The size classes */
+	uint64_t oversized;		/**< The number of allocations that were too large for all size classes */
+};
+
+
+void * fastd_buffer_pool_alloc(size_t *base_len);
+void fastd_buffer_pool_release(void *base, size_t base_len);
+void fastd_buffer_pool_configure(void);
+#ifdef WITH_WORKERS
+void fastd_buffer_pool_update_worker(void);
+#endif
+void fastd_buffer_pool_free(fastd_buffer_pool_t *pool);
+void fastd_buffer_pool_get_stats(fastd_buffer_pool_t *stats);
+
+
 /**
    Allocate a new buffer
 
    A buffer can have head and tail space which allows changing with data size without moving the data.
 
    The buffer is always allocated aligned to 16 bytes to allow efficient access for SIMD instructions
-   etc. in crypto implementations
+   etc. in crypto implementations. Buffers are taken from the buffer pool of the current thread
+   when they fit into one of its size classes, so their base_len may be larger than requested.
 */
 static inline fastd_buffer_t fastd_buffer_alloc(const size_t len, size_t head_space, size_t tail_space) {
 	size_t base_len = head_space+len+tail_space;
-	void *ptr = fastd_alloc_aligned(base_len, 16);
+	void *ptr = fastd_buffer_pool_alloc(&base_len);
 
 	return (fastd_buffer_t){ .base = ptr, .base_len = base_len, .data = ptr+head_space, .len = len };
 }
@@ -67,9 +108,20 @@ static inline fastd_buffer_t fastd_buffer_dup(const fastd_buffer_t buffer, size_
 	return new_buffer;
 }
 
-/** Frees a buffer */
+/** Frees a buffer, returning it to the buffer pool of the current thread */
 static inline void fastd_buffer_free(fastd_buffer_t buffer) {
-	free(buffer.base);
+	fastd_buffer_pool_release(buffer.base, buffer.base_len);
+}
+
+
+/** Returns the number of bytes of head space before the data */
+static inline size_t fastd_buffer_head_space(const fastd_buffer_t *buffer) {
+	return buffer->data - buffer->base;
+}
+
+/** Returns the number of bytes of tail space after the data */
+static inline size_t fastd_buffer_tail_space(const fastd_buffer_t *buffer) {
+	return (buffer->base + buffer->base_len) - (buffer->data + buffer->len);
 }
 
 
@@ -84,6 +84,12 @@ static bool need_cap_net_admin(void) {
 		return true;
 #endif
 
+#ifdef USE_BUSY_POLL
+	/* SO_BUSY_POLL */
+	if (!(ctx.sock_default_v4 || ctx.sock_default_v6) && conf.busy_poll_socket)
+		return true;
+#endif
+
 	return false;
 }
 
@@ -42,6 +42,7 @@
 #include <sys/socket.h>
 
 #include <netinet/in.h>
+#include <netinet/udp.h>
 
 
 #if defined(USE_FREEBIND) && !defined(IP_FREEBIND)
@@ -50,6 +51,17 @@
 #endif
 
 
+#if defined(USE_UDP_GSO) && !defined(UDP_SEGMENT)
+/** Compatiblity define for systems supporting, but not defining UDP_SEGMENT */
+#define UDP_SEGMENT 103
+#endif
+
+#if defined(USE_UDP_GRO) && !defined(UDP_GRO)
+/** Compatiblity define for systems supporting, but not defining UDP_GRO */
+#define UDP_GRO 104
+#endif
+
+
 #ifndef SOCK_NONBLOCK
 /** Defined if SOCK_NONBLOCK doesn't have an effect */
 #define NO_HAVE_SOCK_NONBLOCK
@@ -59,6 +71,51 @@
 #endif
 
 
+#ifndef HAVE_RECVMMSG
+
+/** Replacement for the recvmmsg() message header on systems not supporting recvmmsg() */
+struct mmsghdr {
+	struct msghdr msg_hdr;		/**< The message header */
+	unsigned int msg_len;		/**< The number of bytes received */
+};
+
+/** Replacement function for systems not supporting recvmmsg(), always reading a single message */
+static inline int recvmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags, struct timespec *timeout) {
+	(void)timeout;
+
+	if (!vlen)
+		return 0;
+
+	ssize_t ret = recvmsg(sockfd, &msgvec->msg_hdr, flags);
+	if (ret < 0)
+		return -1;
+
+	msgvec->msg_len = ret;
+	return 1;
+}
+
+#endif
+
+
+#ifndef HAVE_SENDMMSG
+
+/** Replacement function for systems not supporting sendmmsg(), sending the messages one by one */
+static inline int sendmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags) {
+	unsigned int i;
+	for (i = 0; i < vlen; i++) {
+		ssize_t ret = sendmsg(sockfd, &msgvec[i].msg_hdr, flags);
+		if (ret < 0)
+			return i ? (int)i : -1;
+
+		msgvec[i].msg_len = ret;
+	}
+
+	return vlen;
+}
+
+#endif
+
+
 /** The type of the third parameter of getgrouplist */
 #ifdef __APPLE__
 #define GROUPLIST_TYPE int
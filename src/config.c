@@ -67,6 +67,11 @@ static void default_config(void) {
 
 	conf.mtu = 1500;
 	conf.mode = MODE_TAP;
+	conf.packet_budget = DEFAULT_PACKET_BUDGET;
+	conf.replay_window = DEFAULT_REPLAY_WINDOW;
+	conf.reorder_timeout = DEFAULT_REORDER_TIMEOUT;
+	conf.n_handshake_workers = DEFAULT_HANDSHAKE_WORKERS;
+	conf.handshake_queue_limit = DEFAULT_HANDSHAKE_QUEUE_LIMIT;
 	conf.iface_persist = true;
 
 	conf.secure_handshakes = true;
@@ -570,6 +575,15 @@ static void config_check_base(void) {
 		if (!fastd_config_single_iface())
 			exit_error("In Android integration mode exactly one peer must be configured");
 	}
+
+#ifdef WITH_WORKERS
+	if (conf.n_workers && conf.forward)
+		exit_error("config error: packet forwarding can't be used together with worker threads");
+
+	/* The workers open additional queues of the TUN/TAP interface, which isn't possible with an interface passed by Android */
+	if (conf.n_workers && fastd_use_android_integration())
+		exit_error("config error: worker threads can't be used in Android integration mode");
+#endif
 }
 
 /** Performs more checks on the configuration */
@@ -585,6 +599,11 @@ void fastd_config_check(void) {
 	}
 
 	configure_user();
+
+	/* Ciphers and MACs configured to use "auto" are benchmarked on packets of the maximum size */
+	fastd_cipher_autoselect(fastd_max_payload(conf.mtu));
+	fastd_mac_autoselect(fastd_max_payload(conf.mtu));
+
 	configure_methods();
 }
 
@@ -677,6 +696,9 @@ static void configure_peers(bool dirs_only) {
 				fastd_peer_reset(peer);
 		}
 	}
+
+	fastd_buffer_pool_configure();
+	fastd_poll_configure();
 }
 
 /** Initialized the peers not configured through peer directories */
@@ -70,6 +70,9 @@
 %token TOK_ASYNC
 %token TOK_AUTO
 %token TOK_BIND
+%token TOK_BUDGET
+%token TOK_BUFFER
+%token TOK_BUSY
 %token TOK_CAPABILITIES
 %token TOK_CIPHER
 %token TOK_CONNECT
@@ -87,7 +90,9 @@
 %token TOK_FORCE
 %token TOK_FORWARD
 %token TOK_FROM
+%token TOK_GRO
 %token TOK_GROUP
+%token TOK_HANDSHAKE
 %token TOK_HANDSHAKES
 %token TOK_HIDE
 %token TOK_INCLUDE
@@ -107,17 +112,21 @@
 %token TOK_MTU
 %token TOK_MULTITAP
 %token TOK_NO
+%token TOK_OFFLOAD
 %token TOK_ON
 %token TOK_PACKET
 %token TOK_PEER
 %token TOK_PEERS
 %token TOK_PERSIST
 %token TOK_PMTU
+%token TOK_POLL
 %token TOK_PORT
 %token TOK_POST_DOWN
 %token TOK_PRE_UP
 %token TOK_PROTOCOL
 %token TOK_REMOTE
+%token TOK_REORDER
+%token TOK_REPLAY
 %token TOK_SECRET
 %token TOK_SECURE
 %token TOK_SOCKET
@@ -126,6 +135,7 @@
 %token TOK_SYNC
 %token TOK_SYSLOG
 %token TOK_TAP
+%token TOK_TIMEOUT
 %token TOK_TO
 %token TOK_TUN
 %token TOK_UP
@@ -134,6 +144,8 @@
 %token TOK_VERBOSE
 %token TOK_VERIFY
 %token TOK_WARN
+%token TOK_WINDOW
+%token TOK_WORKERS
 %token TOK_YES
 
 
@@ -162,6 +174,9 @@
 %type <uint64> drop_capabilities_enabled
 %type <tristate> autobool
 %type <boolean> sync
+%type <boolean> maybe_busy_poll_socket
+%type <uint64> maybe_reorder_timeout
+%type <uint64> maybe_handshake_queue_limit
 
 %%
 start:		START_CONFIG config
@@ -190,6 +205,11 @@ statement:	peer_group_statement
 	|	TOK_INTERFACE interface ';'
 	|	TOK_BIND bind ';'
 	|	TOK_PACKET TOK_MARK packet_mark ';'
+	|	TOK_PACKET TOK_BUDGET packet_budget ';'
+	|	TOK_REPLAY TOK_WINDOW replay_window ';'
+	|	TOK_REORDER TOK_BUFFER reorder_buffer ';'
+	|	TOK_BUSY TOK_POLL busy_poll ';'
+	|	TOK_OFFLOAD TOK_GRO offload_gro ';'
 	|	TOK_MTU mtu ';'
 	|	TOK_PMTU pmtu ';'
 	|	TOK_MODE mode ';'
@@ -200,6 +220,8 @@ statement:	peer_group_statement
 	|	TOK_ON TOK_POST_DOWN on_post_down ';'
 	|	TOK_STATUS TOK_SOCKET status_socket ';'
 	|	TOK_FORWARD forward ';'
+	|	TOK_WORKERS workers ';'
+	|	TOK_HANDSHAKE TOK_WORKERS handshake_workers ';'
 	;
 
 peer_group_statement:
@@ -381,6 +403,92 @@ packet_mark:	TOK_UINT {
 #endif
 		}
 
+packet_budget:	TOK_UINT {
+			if (!$1 || $1 > MAX_PACKET_BUDGET) {
+				fastd_config_error(&@$, state, "invalid packet budget");
+				YYERROR;
+			}
+
+			conf.packet_budget = $1;
+		}
+
+replay_window:	TOK_UINT {
+			if ($1 < MIN_REPLAY_WINDOW || $1 > MAX_REPLAY_WINDOW || ($1 & ($1-1))) {
+				fastd_config_error(&@$, state, "invalid replay window");
+				YYERROR;
+			}
+
+			conf.replay_window = $1;
+		}
+
+reorder_buffer:	TOK_UINT maybe_reorder_timeout {
+			if ($1 > MAX_REORDER_BUFFER) {
+				fastd_config_error(&@$, state, "invalid reorder buffer size");
+				YYERROR;
+			}
+
+			if (!$2 || $2 > MAX_REORDER_TIMEOUT) {
+				fastd_config_error(&@$, state, "invalid reorder timeout");
+				YYERROR;
+			}
+
+			conf.reorder_buffer = $1;
+			conf.reorder_timeout = $2;
+		}
+
+maybe_reorder_timeout:
+		TOK_TIMEOUT TOK_UINT {
+			$$ = $2;
+		}
+	|	{
+			$$ = DEFAULT_REORDER_TIMEOUT;
+		}
+	;
+
+busy_poll:	TOK_UINT maybe_busy_poll_socket {
+			if ($1 > MAX_BUSY_POLL) {
+				fastd_config_error(&@$, state, "invalid busy poll time");
+				YYERROR;
+			}
+
+			conf.busy_poll = $1;
+#ifdef USE_BUSY_POLL
+			conf.busy_poll_socket = $2 && $1;
+#endif
+		}
+
+maybe_busy_poll_socket:
+		TOK_SOCKET {
+#ifdef USE_BUSY_POLL
+			$$ = true;
+#else
+			fastd_config_error(&@$, state, "socket busy polling is not supported on this system");
+			YYERROR;
+#endif
+		}
+	|	{
+			$$ = false;
+		}
+	;
+
+offload_gro:	boolean {
+#ifdef USE_UDP_GRO
+#ifdef USE_IO_URING
+			if ($1) {
+				fastd_config_error(&@$, state, "UDP GRO is not supported with the io_uring poll backend");
+				YYERROR;
+			}
+#endif
+
+			conf.offload_gro = $1;
+#else
+			if ($1) {
+				fastd_config_error(&@$, state, "UDP GRO is not supported on this system");
+				YYERROR;
+			}
+#endif
+		}
+
 mtu:		TOK_UINT {
 			if ($1 < 576 || $1 > 65535) {
 				fastd_config_error(&@$, state, "invalid MTU");
@@ -603,6 +711,47 @@ on_verify:	sync TOK_STRING {
 forward:	boolean		{ conf.forward = $1; }
 	;
 
+workers:	TOK_UINT {
+#ifdef WITH_WORKERS
+			if ($1 > MAX_WORKERS) {
+				fastd_config_error(&@$, state, "invalid number of workers");
+				YYERROR;
+			}
+
+			conf.n_workers = $1;
+#else
+			fastd_config_error(&@$, state, "worker threads aren't supported by this version of fastd");
+			YYERROR;
+#endif
+		}
+	;
+
+handshake_workers:
+		TOK_UINT maybe_handshake_queue_limit {
+			if ($1 > MAX_HANDSHAKE_WORKERS) {
+				fastd_config_error(&@$, state, "invalid number of handshake workers");
+				YYERROR;
+			}
+
+			if (!$2 || $2 > MAX_HANDSHAKE_QUEUE_LIMIT) {
+				fastd_config_error(&@$, state, "invalid handshake queue limit");
+				YYERROR;
+			}
+
+			conf.n_handshake_workers = $1;
+			conf.handshake_queue_limit = $2;
+		}
+	;
+
+maybe_handshake_queue_limit:
+		TOK_LIMIT TOK_UINT {
+			$$ = $2;
+		}
+	|	{
+			$$ = DEFAULT_HANDSHAKE_QUEUE_LIMIT;
+		}
+	;
+
 
 include:	TOK_PEER TOK_STRING maybe_as {
 			fastd_peer_t *peer = fastd_new0(fastd_peer_t);
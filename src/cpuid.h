@@ -31,6 +31,7 @@
 
 #pragma once
 
+#include <stdbool.h>
 #include <stdint.h>
 
 /** The FXSR bit in the CPUID return value */
@@ -45,6 +46,15 @@
 /** The SSSE3 bit in the CPUID return value */
 #define CPUID_SSSE3	((uint64_t)1 << 41)
 
+/** The AES bit in the CPUID return value */
+#define CPUID_AES	((uint64_t)1 << 57)
+
+/** The OSXSAVE bit in the CPUID return value */
+#define CPUID_OSXSAVE	((uint64_t)1 << 59)
+
+/** The AVX bit in the CPUID return value */
+#define CPUID_AVX	((uint64_t)1 << 60)
+
 
 /** Returns the ECX and EDX return values of CPUID function 1 as a single uint64 */
 static inline uint64_t fastd_cpuid(void) {
@@ -65,4 +75,43 @@ static inline uint64_t fastd_cpuid(void) {
 	return ((uint64_t)cx) << 32 | (uint32_t)dx;
 }
 
+/**
+   Checks if the CPU supports AVX2 and the OS saves the AVX registers
+
+   The AVX2 bit is reported in EBX by CPUID function 7 (subfunction 0), which
+   is only queried when the CPU supports this function.
+*/
+static inline bool fastd_cpuid_avx2(void) {
+	static const uint64_t REQ = CPUID_OSXSAVE|CPUID_AVX;
+
+	if ((fastd_cpuid()&REQ) != REQ)
+		return false;
+
+	/* XGETBV: the XMM and YMM state must be enabled in XCR0 */
+	unsigned long xcr0_lo, xcr0_hi;
+	__asm__ __volatile__ (".byte 0x0f, 0x01, 0xd0" : "=a" (xcr0_lo), "=d" (xcr0_hi) : "c" (0));
+	if ((xcr0_lo & 6) != 6)
+		return false;
+
+	unsigned long ax, bx;
+
+	__asm__ __volatile__ ("mov $0, %%eax \n\t"
+			      "mov %%"REG_PFX"bx, %%"REG_PFX"di \n\t"
+			      "cpuid \n\t"
+			      "mov %%"REG_PFX"di, %%"REG_PFX"bx \n\t"
+			      : "=a" (ax) : : REG_PFX"cx", REG_PFX"dx", REG_PFX"di");
+
+	if ((uint32_t)ax < 7)
+		return false;
+
+	__asm__ __volatile__ ("mov $7, %%eax \n\t"
+			      "xor %%ecx, %%ecx \n\t"
+			      "mov %%"REG_PFX"bx, %%"REG_PFX"di \n\t"
+			      "cpuid \n\t"
+			      "xchg %%"REG_PFX"di, %%"REG_PFX"bx \n\t"
+			      : "=D" (bx) : : REG_PFX"ax", REG_PFX"cx", REG_PFX"dx");
+
+	return bx & (1 << 5);
+}
+
 #undef REG_PFX
@@ -74,15 +74,43 @@ struct fastd_mac {
 	bool (*digest)(const fastd_mac_state_t *state, fastd_block128_t *out, const fastd_block128_t *in, size_t length);
 	/** Frees a MAC context */
 	void (*free)(fastd_mac_state_t *state);
+
+	/** Computes the MAC of data blocks with a one-time key without allocating a MAC context (may be NULL) */
+	bool (*digest_onetime)(fastd_block128_t *out, const uint8_t *key, const fastd_block128_t *in, size_t length);
+
+	/** The name of benchmark_variant */
+	const char *benchmark_variant_name;
+	/** A simpler variant of the implementation which is only measured by --benchmark for comparison (may be NULL) */
+	const fastd_mac_t *benchmark_variant;
+};
+
+/** Describes the implementation chosen for a cipher or MAC */
+struct fastd_crypto_impl_status {
+	const char *name;		/**< The name of the cipher or MAC */
+	const char *impl;		/**< The name of the chosen implementation, or NULL if none is available */
+	bool autoselected;		/**< true if the implementation was chosen by benchmark */
+	uint64_t throughput;		/**< The throughput measured for the chosen implementation in bytes per second */
 };
 
 
 /** Initializes the list of cipher implementations */
 void fastd_cipher_init(void);
 
-/** Configures a cipher to use a specific implementation */
+/** Configures a cipher to use a specific implementation, or to choose one by benchmark if impl is "auto" */
 bool fastd_cipher_config(const char *name, const char *impl);
 
+/** Checks if the implementation of a cipher has been configured explicitly (including "auto") */
+bool fastd_cipher_is_configured(const char *name);
+
+/** Benchmarks the implementations of all ciphers configured to use "auto" on buffers of the given size and chooses the fastest ones */
+void fastd_cipher_autoselect(size_t len);
+
+/** Describes the chosen implementation of the n-th cipher; returns false if there are less than n+1 ciphers */
+bool fastd_cipher_get_status(size_t n, fastd_crypto_impl_status_t *status);
+
+/** Returns the n-th implementation of a cipher that is available on the runtime platform and stores its name in \e impl, or NULL if there are less than n+1 */
+const fastd_cipher_t * fastd_cipher_get_impl(const fastd_cipher_info_t *info, size_t n, const char **impl);
+
 
 /** Returns information about the cipher with the specified name if there is an implementation available */
 const fastd_cipher_info_t * fastd_cipher_info_get_by_name(const char *name);
@@ -94,9 +122,21 @@ const fastd_cipher_t * fastd_cipher_get(const fastd_cipher_info_t *info);
 /** Initializes the list of MAC implementations */
 void fastd_mac_init(void);
 
-/** Configures a MAC to use a specific implementation */
+/** Configures a MAC to use a specific implementation, or to choose one by benchmark if impl is "auto" */
 bool fastd_mac_config(const char *name, const char *impl);
 
+/** Checks if the implementation of a MAC has been configured explicitly (including "auto") */
+bool fastd_mac_is_configured(const char *name);
+
+/** Benchmarks the implementations of all MACs configured to use "auto" on buffers of the given size and chooses the fastest ones */
+void fastd_mac_autoselect(size_t len);
+
+/** Describes the chosen implementation of the n-th MAC; returns false if there are less than n+1 MACs */
+bool fastd_mac_get_status(size_t n, fastd_crypto_impl_status_t *status);
+
+/** Returns the n-th implementation of a MAC that is available on the runtime platform and stores its name in \e impl, or NULL if there are less than n+1 */
+const fastd_mac_t * fastd_mac_get_impl(const fastd_mac_info_t *info, size_t n, const char **impl);
+
 
 /** Returns information about the MAC with the specified name if there is an implementation available */
 const fastd_mac_info_t * fastd_mac_info_get_by_name(const char *name);
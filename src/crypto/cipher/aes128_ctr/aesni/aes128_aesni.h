@@ -0,0 +1,101 @@
+/*
+  Copyright (c) 2012-2016, Matthias Schiffer <mschiffer@universe-factory.net>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   \file
+
+   AES128 primitives using the AES-NI instructions
+
+   This header must only be included by source files compiled with support for the AES-NI instructions.
+*/
+
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <wmmintrin.h>
+#include <emmintrin.h>
+
+
+/** Computes the next round key from the previous one and the output of AESKEYGENASSIST */
+static inline __m128i aes128_aesni_expand_step(__m128i key, __m128i assist) {
+	assist = _mm_shuffle_epi32(assist, 0xff);
+
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+
+	return _mm_xor_si128(key, assist);
+}
+
+/** Computes round key \e i (AESKEYGENASSIST needs the round constant as an immediate) */
+#define AES128_AESNI_EXPAND(rk, i, rcon) ((rk)[i] = aes128_aesni_expand_step((rk)[(i)-1], _mm_aeskeygenassist_si128((rk)[(i)-1], (rcon))))
+
+/** Expands a 16 byte AES128 key into the 11 round keys */
+static inline void aes128_aesni_expand_key(__m128i rk[11], const uint8_t *key) {
+	rk[0] = _mm_loadu_si128((const __m128i *)key);
+
+	AES128_AESNI_EXPAND(rk, 1, 0x01);
+	AES128_AESNI_EXPAND(rk, 2, 0x02);
+	AES128_AESNI_EXPAND(rk, 3, 0x04);
+	AES128_AESNI_EXPAND(rk, 4, 0x08);
+	AES128_AESNI_EXPAND(rk, 5, 0x10);
+	AES128_AESNI_EXPAND(rk, 6, 0x20);
+	AES128_AESNI_EXPAND(rk, 7, 0x40);
+	AES128_AESNI_EXPAND(rk, 8, 0x80);
+	AES128_AESNI_EXPAND(rk, 9, 0x1b);
+	AES128_AESNI_EXPAND(rk, 10, 0x36);
+}
+
+#undef AES128_AESNI_EXPAND
+
+/** Encrypts a single block */
+static inline __m128i aes128_aesni_encrypt(const __m128i rk[11], __m128i b) {
+	size_t r;
+
+	b = _mm_xor_si128(b, rk[0]);
+
+	for (r = 1; r < 10; r++)
+		b = _mm_aesenc_si128(b, rk[r]);
+
+	return _mm_aesenclast_si128(b, rk[10]);
+}
+
+/** Encrypts \e n blocks with interleaved rounds to hide the latency of the AES instructions */
+static inline void aes128_aesni_encrypt_n(const __m128i rk[11], __m128i *b, size_t n) {
+	size_t i, r;
+
+	for (i = 0; i < n; i++)
+		b[i] = _mm_xor_si128(b[i], rk[0]);
+
+	for (r = 1; r < 10; r++) {
+		for (i = 0; i < n; i++)
+			b[i] = _mm_aesenc_si128(b[i], rk[r]);
+	}
+
+	for (i = 0; i < n; i++)
+		b[i] = _mm_aesenclast_si128(b[i], rk[10]);
+}
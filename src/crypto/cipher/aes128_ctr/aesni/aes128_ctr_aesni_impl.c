@@ -0,0 +1,132 @@
+/*
+  Copyright (c) 2012-2016, Matthias Schiffer <mschiffer@universe-factory.net>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   \file
+
+   AES-NI-based aes128-ctr implementation for newer x86 systems: implementation
+*/
+
+
+#include "aes128_ctr_aesni.h"
+#include "aes128_aesni.h"
+#include "../../../../alloc.h"
+
+#include <tmmintrin.h>
+
+
+/** The number of blocks encrypted in parallel to hide the latency of the AES instructions */
+#define PARALLEL_BLOCKS 8
+
+
+/** The cipher state containing the expanded key schedule */
+struct fastd_cipher_state {
+	__m128i round_keys[11];		/**< The AES128 round keys */
+};
+
+
+/** _mm_shuffle_epi8 parameter to reverse the bytes of a __m128i */
+static const __v16qi BYTESWAP_SHUFFLE = {15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0};
+
+/** Reverses the order of the bytes of a __m128i */
+static inline __m128i byteswap(__m128i v) {
+	return _mm_shuffle_epi8(v, (__m128i)BYTESWAP_SHUFFLE);
+}
+
+
+/** Initializes the cipher state, expanding the key */
+fastd_cipher_state_t * fastd_aes128_ctr_aesni_init(const uint8_t *key) {
+	fastd_cipher_state_t *state = fastd_new_aligned(fastd_cipher_state_t, 16);
+	aes128_aesni_expand_key(state->round_keys, key);
+
+	return state;
+}
+
+/**
+   Returns the counter block for a 128bit big-endian counter given as two host-endian halves
+
+   The two halves are stored in the low and high lanes in host order, so reversing all bytes
+   results in the big-endian representation.
+*/
+static inline __m128i counter_block(uint64_t high, uint64_t low) {
+	return byteswap(_mm_set_epi64x(high, low));
+}
+
+/** XORs the input with the AES128-CTR keystream */
+bool fastd_aes128_ctr_aesni_crypt(const fastd_cipher_state_t *state, fastd_block128_t *out, const fastd_block128_t *in, size_t len, const uint8_t *iv) {
+	/* x86 is little-endian, so the byteswapped IV contains the low half of the counter first */
+	uint64_t counter[2];
+	_mm_storeu_si128((__m128i *)counter, byteswap(_mm_loadu_si128((const __m128i *)iv)));
+	uint64_t low = counter[0], high = counter[1];
+
+	size_t n_blocks = len / sizeof(fastd_block128_t);
+	size_t i = 0, j;
+
+	for (; i + PARALLEL_BLOCKS <= n_blocks; i += PARALLEL_BLOCKS) {
+		__m128i b[PARALLEL_BLOCKS];
+
+		for (j = 0; j < PARALLEL_BLOCKS; j++) {
+			b[j] = counter_block(high, low);
+			if (!++low)
+				high++;
+		}
+
+		aes128_aesni_encrypt_n(state->round_keys, b, PARALLEL_BLOCKS);
+
+		for (j = 0; j < PARALLEL_BLOCKS; j++) {
+			__m128i data = _mm_loadu_si128((const __m128i *)&in[i+j]);
+			_mm_storeu_si128((__m128i *)&out[i+j], _mm_xor_si128(data, b[j]));
+		}
+	}
+
+	for (; i < n_blocks; i++) {
+		__m128i b = aes128_aesni_encrypt(state->round_keys, counter_block(high, low));
+		if (!++low)
+			high++;
+
+		__m128i data = _mm_loadu_si128((const __m128i *)&in[i]);
+		_mm_storeu_si128((__m128i *)&out[i], _mm_xor_si128(data, b));
+	}
+
+	size_t rest = len % sizeof(fastd_block128_t);
+	if (rest) {
+		fastd_block128_t keystream, tmp = {};
+		_mm_storeu_si128((__m128i *)&keystream, aes128_aesni_encrypt(state->round_keys, counter_block(high, low)));
+
+		memcpy(&tmp, &in[i], rest);
+		xor_a(&tmp, &keystream);
+		memcpy(&out[i], &tmp, rest);
+	}
+
+	return true;
+}
+
+/** Frees the cipher state */
+void fastd_aes128_ctr_aesni_free(fastd_cipher_state_t *state) {
+	if (state) {
+		secure_memzero(state, sizeof(*state));
+		free(state);
+	}
+}
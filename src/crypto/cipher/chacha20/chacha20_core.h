@@ -0,0 +1,179 @@
+/*
+  Copyright (c) 2012-2016, Matthias Schiffer <mschiffer@universe-factory.net>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   \file
+
+   Portable ChaCha20 core, generating CHACHA20_LANES keystream blocks in parallel
+
+   The state words of all blocks generated in parallel are kept in vectors using the
+   GCC vector extensions, so the compiler can map them to whatever SIMD instructions
+   the target supports (SSE2, AVX2, NEON, ...), or to scalar operations otherwise.
+
+   CHACHA20_LANES must be defined before this header is included.
+*/
+
+
+#pragma once
+
+#include "../../../crypto.h"
+#include "../../../util.h"
+
+
+/** The length of the key used by ChaCha20 */
+#define CHACHA20_KEYBYTES 32
+
+/** The length of the nonce used by ChaCha20 */
+#define CHACHA20_NONCEBYTES 12
+
+/** The size of the keystream generated in one iteration */
+#define CHACHA20_STREAM_BYTES (64*CHACHA20_LANES)
+
+
+/** A vector containing one state word of each of the blocks generated in parallel */
+typedef uint32_t chacha20_vec_t __attribute__((vector_size(4*CHACHA20_LANES)));
+
+
+/** Loads a little-endian 32bit word from an unaligned buffer */
+static inline uint32_t chacha20_load(const uint8_t *p) {
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return le32toh(v);
+}
+
+/** Rotates all words of a vector to the left */
+#define CHACHA20_ROTL(v, n) (((v) << (n)) | ((v) >> (32-(n))))
+
+/** The ChaCha quarterround */
+#define CHACHA20_QUARTERROUND(a, b, c, d) do {					\
+		(a) += (b); (d) = CHACHA20_ROTL((d) ^ (a), 16);			\
+		(c) += (d); (b) = CHACHA20_ROTL((b) ^ (c), 12);			\
+		(a) += (b); (d) = CHACHA20_ROTL((d) ^ (a), 8);			\
+		(c) += (d); (b) = CHACHA20_ROTL((b) ^ (c), 7);			\
+	} while (0)
+
+
+/** Initializes the ChaCha20 input words for a key and nonce, leaving the block counter unset */
+static inline void chacha20_setup(uint32_t j[16], const uint8_t key[CHACHA20_KEYBYTES], const uint8_t nonce[CHACHA20_NONCEBYTES]) {
+	static const uint8_t sigma[16] = "expand 32-byte k";
+	size_t i;
+
+	for (i = 0; i < 4; i++)
+		j[i] = chacha20_load(sigma + 4*i);
+
+	for (i = 0; i < 8; i++)
+		j[4+i] = chacha20_load(key + 4*i);
+
+	for (i = 0; i < 3; i++)
+		j[13+i] = chacha20_load(nonce + 4*i);
+}
+
+/**
+   Generates CHACHA20_LANES keystream blocks starting with the block counter \e counter
+
+   The keystream is XORed with CHACHA20_STREAM_BYTES bytes of \e in and stored in \e out;
+   \e in may be NULL to store the plain keystream.
+*/
+static inline void chacha20_blocks(uint8_t *out, const uint8_t *in, const uint32_t j[16], uint32_t counter) {
+	chacha20_vec_t x[16], w[16];
+	size_t i, b;
+
+	for (i = 0; i < 16; i++) {
+		for (b = 0; b < CHACHA20_LANES; b++)
+			w[i][b] = j[i];
+	}
+
+	for (b = 0; b < CHACHA20_LANES; b++)
+		w[12][b] = counter + b;
+
+	for (i = 0; i < 16; i++)
+		x[i] = w[i];
+
+	for (i = 0; i < 20; i += 2) {
+		CHACHA20_QUARTERROUND(x[0], x[4], x[8], x[12]);
+		CHACHA20_QUARTERROUND(x[1], x[5], x[9], x[13]);
+		CHACHA20_QUARTERROUND(x[2], x[6], x[10], x[14]);
+		CHACHA20_QUARTERROUND(x[3], x[7], x[11], x[15]);
+
+		CHACHA20_QUARTERROUND(x[0], x[5], x[10], x[15]);
+		CHACHA20_QUARTERROUND(x[1], x[6], x[11], x[12]);
+		CHACHA20_QUARTERROUND(x[2], x[7], x[8], x[13]);
+		CHACHA20_QUARTERROUND(x[3], x[4], x[9], x[14]);
+	}
+
+	for (i = 0; i < 16; i++)
+		x[i] += w[i];
+
+	for (b = 0; b < CHACHA20_LANES; b++) {
+		for (i = 0; i < 16; i++) {
+			uint32_t v = htole32(x[i][b]);
+
+			if (in) {
+				uint32_t m;
+				memcpy(&m, in + 64*b + 4*i, sizeof(m));
+				v ^= m;
+			}
+
+			memcpy(out + 64*b + 4*i, &v, sizeof(v));
+		}
+	}
+}
+
+/**
+   XORs data with the ChaCha20 keystream for the given key and nonce
+
+   The block counter starts at 0 for each call.
+*/
+static inline void chacha20_xor(uint8_t *out, const uint8_t *in, size_t len, const uint8_t nonce[CHACHA20_NONCEBYTES], const uint8_t key[CHACHA20_KEYBYTES]) {
+	uint32_t j[16];
+	chacha20_setup(j, key, nonce);
+
+	uint32_t counter = 0;
+
+	while (len >= CHACHA20_STREAM_BYTES) {
+		chacha20_blocks(out, in, j, counter);
+		counter += CHACHA20_LANES;
+
+		in += CHACHA20_STREAM_BYTES;
+		out += CHACHA20_STREAM_BYTES;
+		len -= CHACHA20_STREAM_BYTES;
+	}
+
+	if (len) {
+		uint8_t stream[CHACHA20_STREAM_BYTES];
+		chacha20_blocks(stream, NULL, j, counter);
+
+		size_t i;
+		for (i = 0; i < len; i++)
+			out[i] = in[i] ^ stream[i];
+
+		secure_memzero(stream, sizeof(stream));
+	}
+
+	secure_memzero(j, sizeof(j));
+}
+
+#undef CHACHA20_QUARTERROUND
+#undef CHACHA20_ROTL
@@ -0,0 +1,230 @@
+/*
+  Copyright (c) 2012-2016, Matthias Schiffer <mschiffer@universe-factory.net>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   \file
+
+   AVX2 implementation of the Salsa20 stream cipher family, generating 8 blocks at once
+
+   This header is shared by the salsa20 and salsa2012 avx2 implementations, and must only be
+   included by source files compiled with support for AVX2.
+*/
+
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <immintrin.h>
+
+
+/** The number of 64 byte blocks generated in parallel */
+#define SALSA20_AVX2_BLOCKS 8
+
+/** The size of the keystream generated in one iteration */
+#define SALSA20_AVX2_STREAM_BYTES (64*SALSA20_AVX2_BLOCKS)
+
+
+/** Rotates all 32bit words of a vector to the left */
+static inline __m256i salsa20_avx2_rotl(__m256i v, int n) {
+	return _mm256_or_si256(_mm256_slli_epi32(v, n), _mm256_srli_epi32(v, 32-n));
+}
+
+/** A Salsa20 quarterround step: \e a ^= (b + c) <<< n */
+#define SALSA20_AVX2_STEP(a, b, c, n) ((a) = _mm256_xor_si256((a), salsa20_avx2_rotl(_mm256_add_epi32((b), (c)), (n))))
+
+/**
+   Transposes eight vectors of eight 32bit words
+
+   On input, vector \e i contains the word \e i of all 8 blocks; on output, vector \e i
+   contains the 8 words of block \e i.
+*/
+static inline void salsa20_avx2_transpose(__m256i v[8]) {
+	__m256i t0 = _mm256_unpacklo_epi32(v[0], v[1]);
+	__m256i t1 = _mm256_unpackhi_epi32(v[0], v[1]);
+	__m256i t2 = _mm256_unpacklo_epi32(v[2], v[3]);
+	__m256i t3 = _mm256_unpackhi_epi32(v[2], v[3]);
+	__m256i t4 = _mm256_unpacklo_epi32(v[4], v[5]);
+	__m256i t5 = _mm256_unpackhi_epi32(v[4], v[5]);
+	__m256i t6 = _mm256_unpacklo_epi32(v[6], v[7]);
+	__m256i t7 = _mm256_unpackhi_epi32(v[6], v[7]);
+
+	__m256i u0 = _mm256_unpacklo_epi64(t0, t2);
+	__m256i u1 = _mm256_unpackhi_epi64(t0, t2);
+	__m256i u2 = _mm256_unpacklo_epi64(t1, t3);
+	__m256i u3 = _mm256_unpackhi_epi64(t1, t3);
+	__m256i u4 = _mm256_unpacklo_epi64(t4, t6);
+	__m256i u5 = _mm256_unpackhi_epi64(t4, t6);
+	__m256i u6 = _mm256_unpacklo_epi64(t5, t7);
+	__m256i u7 = _mm256_unpackhi_epi64(t5, t7);
+
+	v[0] = _mm256_permute2x128_si256(u0, u4, 0x20);
+	v[1] = _mm256_permute2x128_si256(u1, u5, 0x20);
+	v[2] = _mm256_permute2x128_si256(u2, u6, 0x20);
+	v[3] = _mm256_permute2x128_si256(u3, u7, 0x20);
+	v[4] = _mm256_permute2x128_si256(u0, u4, 0x31);
+	v[5] = _mm256_permute2x128_si256(u1, u5, 0x31);
+	v[6] = _mm256_permute2x128_si256(u2, u6, 0x31);
+	v[7] = _mm256_permute2x128_si256(u3, u7, 0x31);
+}
+
+/**
+   Generates SALSA20_AVX2_BLOCKS keystream blocks starting with the block counter \e counter
+
+   The input words are given in \e j, with the counter words left unset. The keystream is XORed with
+   SALSA20_AVX2_STREAM_BYTES bytes of \e in and stored in \e out; \e in may be NULL to store the plain keystream.
+*/
+static inline void salsa20_avx2_blocks(uint8_t *out, const uint8_t *in, const uint32_t j[16], uint64_t counter, unsigned rounds) {
+	__m256i x[16], w[16];
+	size_t i;
+
+	for (i = 0; i < 16; i++)
+		w[i] = _mm256_set1_epi32(j[i]);
+
+	uint32_t low[SALSA20_AVX2_BLOCKS], high[SALSA20_AVX2_BLOCKS];
+	for (i = 0; i < SALSA20_AVX2_BLOCKS; i++) {
+		low[i] = counter + i;
+		high[i] = (counter + i) >> 32;
+	}
+
+	w[8] = _mm256_loadu_si256((const __m256i *)low);
+	w[9] = _mm256_loadu_si256((const __m256i *)high);
+
+	for (i = 0; i < 16; i++)
+		x[i] = w[i];
+
+	for (i = 0; i < rounds; i += 2) {
+		/* column round */
+		SALSA20_AVX2_STEP(x[4], x[0], x[12], 7);
+		SALSA20_AVX2_STEP(x[9], x[5], x[1], 7);
+		SALSA20_AVX2_STEP(x[14], x[10], x[6], 7);
+		SALSA20_AVX2_STEP(x[3], x[15], x[11], 7);
+
+		SALSA20_AVX2_STEP(x[8], x[4], x[0], 9);
+		SALSA20_AVX2_STEP(x[13], x[9], x[5], 9);
+		SALSA20_AVX2_STEP(x[2], x[14], x[10], 9);
+		SALSA20_AVX2_STEP(x[7], x[3], x[15], 9);
+
+		SALSA20_AVX2_STEP(x[12], x[8], x[4], 13);
+		SALSA20_AVX2_STEP(x[1], x[13], x[9], 13);
+		SALSA20_AVX2_STEP(x[6], x[2], x[14], 13);
+		SALSA20_AVX2_STEP(x[11], x[7], x[3], 13);
+
+		SALSA20_AVX2_STEP(x[0], x[12], x[8], 18);
+		SALSA20_AVX2_STEP(x[5], x[1], x[13], 18);
+		SALSA20_AVX2_STEP(x[10], x[6], x[2], 18);
+		SALSA20_AVX2_STEP(x[15], x[11], x[7], 18);
+
+		/* row round */
+		SALSA20_AVX2_STEP(x[1], x[0], x[3], 7);
+		SALSA20_AVX2_STEP(x[6], x[5], x[4], 7);
+		SALSA20_AVX2_STEP(x[11], x[10], x[9], 7);
+		SALSA20_AVX2_STEP(x[12], x[15], x[14], 7);
+
+		SALSA20_AVX2_STEP(x[2], x[1], x[0], 9);
+		SALSA20_AVX2_STEP(x[7], x[6], x[5], 9);
+		SALSA20_AVX2_STEP(x[8], x[11], x[10], 9);
+		SALSA20_AVX2_STEP(x[13], x[12], x[15], 9);
+
+		SALSA20_AVX2_STEP(x[3], x[2], x[1], 13);
+		SALSA20_AVX2_STEP(x[4], x[7], x[6], 13);
+		SALSA20_AVX2_STEP(x[9], x[8], x[11], 13);
+		SALSA20_AVX2_STEP(x[14], x[13], x[12], 13);
+
+		SALSA20_AVX2_STEP(x[0], x[3], x[2], 18);
+		SALSA20_AVX2_STEP(x[5], x[4], x[7], 18);
+		SALSA20_AVX2_STEP(x[10], x[9], x[8], 18);
+		SALSA20_AVX2_STEP(x[15], x[14], x[13], 18);
+	}
+
+	for (i = 0; i < 16; i++)
+		x[i] = _mm256_add_epi32(x[i], w[i]);
+
+	salsa20_avx2_transpose(x);
+	salsa20_avx2_transpose(x+8);
+
+	if (in) {
+		for (i = 0; i < SALSA20_AVX2_BLOCKS; i++) {
+			x[i] = _mm256_xor_si256(x[i], _mm256_loadu_si256((const __m256i *)(in + 64*i)));
+			x[8+i] = _mm256_xor_si256(x[8+i], _mm256_loadu_si256((const __m256i *)(in + 64*i + 32)));
+		}
+	}
+
+	for (i = 0; i < SALSA20_AVX2_BLOCKS; i++) {
+		_mm256_storeu_si256((__m256i *)(out + 64*i), x[i]);
+		_mm256_storeu_si256((__m256i *)(out + 64*i + 32), x[8+i]);
+	}
+}
+
+/**
+   XORs data with the keystream of a Salsa20 variant with the given number of rounds
+
+   Like the NaCl implementations, the keystream starts with a block counter of 0 for each call.
+*/
+static inline void salsa20_avx2_xor(uint8_t *out, const uint8_t *in, size_t len, const uint8_t nonce[8], const uint8_t key[32], unsigned rounds) {
+	static const uint8_t sigma[16] = "expand 32-byte k";
+
+	uint32_t j[16];
+	memcpy(&j[0], sigma, 4);
+	memcpy(&j[1], key, 16);
+	memcpy(&j[5], sigma+4, 4);
+	memcpy(&j[6], nonce, 8);
+	memcpy(&j[10], sigma+8, 4);
+	memcpy(&j[11], key+16, 16);
+	memcpy(&j[15], sigma+12, 4);
+
+	uint64_t counter = 0;
+
+	while (len >= SALSA20_AVX2_STREAM_BYTES) {
+		salsa20_avx2_blocks(out, in, j, counter, rounds);
+		counter += SALSA20_AVX2_BLOCKS;
+
+		in += SALSA20_AVX2_STREAM_BYTES;
+		out += SALSA20_AVX2_STREAM_BYTES;
+		len -= SALSA20_AVX2_STREAM_BYTES;
+	}
+
+	if (len) {
+		uint8_t stream[SALSA20_AVX2_STREAM_BYTES] __attribute__((aligned(32)));
+		salsa20_avx2_blocks(stream, NULL, j, counter, rounds);
+
+		size_t i;
+		for (i = 0; i + 32 <= len; i += 32) {
+			__m256i m = _mm256_loadu_si256((const __m256i *)(in + i));
+			__m256i k = _mm256_load_si256((const __m256i *)(stream + i));
+			_mm256_storeu_si256((__m256i *)(out + i), _mm256_xor_si256(m, k));
+		}
+		for (; i < len; i++)
+			out[i] = in[i] ^ stream[i];
+
+		memset(stream, 0, sizeof(stream));
+	}
+
+	memset(j, 0, sizeof(j));
+}
+
+#undef SALSA20_AVX2_STEP
@@ -0,0 +1,182 @@
+/*
+  Copyright (c) 2012-2016, Matthias Schiffer <mschiffer@universe-factory.net>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   \file
+
+   Portable GHASH implementation with a small per-key table
+
+   This implements Shoup's 4-bit method: the state only contains the 16 multiples of
+   the hash key by 4bit values (256 bytes), and the reduction after each 4-bit shift
+   uses a constant table shared by all states. This needs about 3% of the memory of the
+   builtin implementation, at the cost of a lower throughput.
+*/
+
+
+#include "../../../../crypto.h"
+#include "../../../../alloc.h"
+#include "../../../../util.h"
+
+
+/** A 128bit value, split into two 64bit halves in host byte order */
+typedef struct ghash_compact_block {
+	uint64_t hi;			/**< The first 8 bytes */
+	uint64_t lo;			/**< The last 8 bytes */
+} ghash_compact_block_t;
+
+/** MAC state used by this GHASH implmentation */
+struct fastd_mac_state {
+	ghash_compact_block_t M[16];	/**< The multiples of the hash key by the 4bit values */
+};
+
+
+/**
+   Reduction values for the 4 bits shifted out when multiplying by \f$ x^4 \f$
+
+   The values are the multiples of the modulus \f$ x^{128} + x^7 + x^2 + x + 1 \f$,
+   to be XORed into the highest 16 bits of the result.
+*/
+static const uint16_t R[16] = {
+	0x0000, 0x1c20, 0x3840, 0x2460, 0x7080, 0x6ca0, 0x48c0, 0x54e0,
+	0xe100, 0xfd20, 0xd940, 0xc560, 0x9180, 0x8da0, 0xa9c0, 0xb5e0,
+};
+
+
+/** Loads a big-endian 64bit value */
+static inline uint64_t load_be64(const uint8_t *p) {
+	uint32_t h, l;
+	memcpy(&h, p, 4);
+	memcpy(&l, p+4, 4);
+
+	return ((uint64_t)be32toh(h) << 32) | be32toh(l);
+}
+
+/** Stores a 64bit value as big-endian */
+static inline void store_be64(uint8_t *p, uint64_t v) {
+	uint32_t h = htobe32(v >> 32), l = htobe32(v);
+	memcpy(p, &h, 4);
+	memcpy(p+4, &l, 4);
+}
+
+/** Multiplies a value by \f$ x \f$, i.e. shifts it right by one bit and reduces the result */
+static inline ghash_compact_block_t mulx(ghash_compact_block_t v) {
+	uint64_t carry = v.lo & 1;
+
+	v.lo = (v.lo >> 1) | (v.hi << 63);
+	v.hi = (v.hi >> 1) ^ (((uint64_t)0xe1 << 56) & -carry);
+
+	return v;
+}
+
+
+/** Initializes the MAC state with the unpacked key data */
+static fastd_mac_state_t * ghash_init(const uint8_t *key) {
+	fastd_mac_state_t *state = fastd_new(fastd_mac_state_t);
+
+	/* M[8] is H itself, as the most significant bit of a nibble represents x^0 */
+	ghash_compact_block_t H = { .hi = load_be64(key), .lo = load_be64(key+8) };
+
+	memset(state->M, 0, sizeof(state->M));
+
+	size_t i;
+	for (i = 8; i > 0; i >>= 1) {
+		state->M[i] = H;
+		H = mulx(H);
+	}
+
+	for (i = 2; i < 16; i <<= 1) {
+		size_t j;
+		for (j = 1; j < i; j++) {
+			state->M[i+j].hi = state->M[i].hi ^ state->M[j].hi;
+			state->M[i+j].lo = state->M[i].lo ^ state->M[j].lo;
+		}
+	}
+
+	return state;
+}
+
+/** Galois field multiplication of a 128bit value with H */
+static inline void mulH_a(uint8_t x[16], const fastd_mac_state_t *cstate) {
+	ghash_compact_block_t z = {};
+
+	int i;
+	for (i = 15; i >= 0; i--) {
+		unsigned n;
+
+		/* low nibble */
+		n = x[i] & 0xf;
+		if (i != 15) {
+			unsigned rem = z.lo & 0xf;
+			z.lo = (z.lo >> 4) | (z.hi << 60);
+			z.hi = (z.hi >> 4) ^ ((uint64_t)R[rem] << 48);
+		}
+		z.hi ^= cstate->M[n].hi;
+		z.lo ^= cstate->M[n].lo;
+
+		/* high nibble */
+		n = x[i] >> 4;
+		unsigned rem = z.lo & 0xf;
+		z.lo = (z.lo >> 4) | (z.hi << 60);
+		z.hi = (z.hi >> 4) ^ ((uint64_t)R[rem] << 48);
+		z.hi ^= cstate->M[n].hi;
+		z.lo ^= cstate->M[n].lo;
+	}
+
+	store_be64(x, z.hi);
+	store_be64(x+8, z.lo);
+}
+
+/** Calculates the GHASH of the supplied blocks */
+static bool ghash_digest(const fastd_mac_state_t *state, fastd_block128_t *out, const fastd_block128_t *in, size_t length) {
+	if (length % sizeof(fastd_block128_t))
+		exit_bug("ghash_digest (compact): invalid length");
+
+	size_t n_blocks = length / sizeof(fastd_block128_t);
+
+	memset(out, 0, sizeof(fastd_block128_t));
+
+	size_t i;
+	for (i = 0; i < n_blocks; i++) {
+		xor_a(out, &in[i]);
+		mulH_a(out->b, state);
+	}
+
+	return true;
+}
+
+/** Frees the MAC state */
+static void ghash_free(fastd_mac_state_t *state) {
+	if (state) {
+		secure_memzero(state, sizeof(*state));
+		free(state);
+	}
+}
+
+/** The compact GHASH implementation */
+const fastd_mac_t fastd_mac_ghash_compact = {
+	.init = ghash_init,
+	.digest = ghash_digest,
+	.free = ghash_free,
+};
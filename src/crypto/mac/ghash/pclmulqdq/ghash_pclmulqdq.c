@@ -41,6 +41,15 @@ static bool ghash_available(void) {
 	return ((fastd_cpuid()&REQ) == REQ);
 }
 
+/** The pclmulqdq ghash implementation reducing the product after each block, which is benchmarked against the aggregated reduction */
+static const fastd_mac_t ghash_pclmulqdq_per_block = {
+	.available = ghash_available,
+
+	.init = fastd_ghash_pclmulqdq_init,
+	.digest = fastd_ghash_pclmulqdq_digest_per_block,
+	.free = fastd_ghash_pclmulqdq_free,
+};
+
 /** The pclmulqdq ghash implementation */
 const fastd_mac_t fastd_mac_ghash_pclmulqdq = {
 	.available = ghash_available,
@@ -48,4 +57,7 @@ const fastd_mac_t fastd_mac_ghash_pclmulqdq = {
 	.init = fastd_ghash_pclmulqdq_init,
 	.digest = fastd_ghash_pclmulqdq_digest,
 	.free = fastd_ghash_pclmulqdq_free,
+
+	.benchmark_variant_name = "per-block",
+	.benchmark_variant = &ghash_pclmulqdq_per_block,
 };
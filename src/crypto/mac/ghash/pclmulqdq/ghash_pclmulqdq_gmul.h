@@ -0,0 +1,146 @@
+/*
+  Copyright (c) 2012-2016, Matthias Schiffer <mschiffer@universe-factory.net>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   \file
+
+   PCLMULQDQ-based GHASH multiplication
+
+   This header must only be included by source files compiled with support for the PCLMULQDQ and SSSE3 instructions.
+*/
+
+
+#pragma once
+
+#include <wmmintrin.h>
+#include <emmintrin.h>
+#include <tmmintrin.h>
+
+
+/** Left shift on a 128bit integer */
+static inline __m128i shl(__m128i v, int a) {
+	__m128i tmpl = _mm_slli_epi64(v, a);
+	__m128i tmpr = _mm_srli_epi64(v, 64-a);
+	tmpr = _mm_slli_si128(tmpr, 8);
+
+	return _mm_xor_si128(tmpl, tmpr);
+}
+
+/** Right shift on a 128bit integer */
+static inline __m128i shr(__m128i v, int a) {
+	__m128i tmpr = _mm_srli_epi64(v, a);
+	__m128i tmpl = _mm_slli_epi64(v, 64-a);
+	tmpl = _mm_srli_si128(tmpl, 8);
+
+	return _mm_xor_si128(tmpr, tmpl);
+}
+
+/** _mm_shuffle_epi8 parameter to reverse the bytes of a __m128i */
+static const __v16qi BYTESWAP_SHUFFLE = {15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0};
+
+/** Reverses the order of the bytes of a __m128i */
+static inline __m128i byteswap(__m128i v) {
+	return _mm_shuffle_epi8(v, (__m128i)BYTESWAP_SHUFFLE);
+}
+
+/**
+   The partial products of Karatsuba multiplications
+
+   As the reduction is linear, the partial products of several multiplications can be
+   accumulated, so the sum of the products only needs to be reduced once.
+*/
+typedef struct gmul_acc {
+	__m128i z0;			/**< The sum of the products of the high halves */
+	__m128i z1;			/**< The sum of the products of the XORed halves */
+	__m128i z2;			/**< The sum of the products of the low halves */
+} gmul_acc_t;
+
+
+/** Returns an empty accumulator */
+static inline gmul_acc_t gmul_acc_init(void) {
+	return (gmul_acc_t){ _mm_setzero_si128(), _mm_setzero_si128(), _mm_setzero_si128() };
+}
+
+/** Returns the XOR of the two halves of a factor, which is needed for the Karatsuba multiplication and can be precomputed for the hash key */
+static inline __m128i gmul_karatsuba_key(__m128i h) {
+	return _mm_xor_si128(_mm_srli_si128(h, 8), h);
+}
+
+/** Adds the unreduced carryless product of two 128bit integers to an accumulator; \e hk must be gmul_karatsuba_key(h) */
+static inline void gmul_acc_add(gmul_acc_t *acc, __m128i v, __m128i h, __m128i hk) {
+	acc->z0 = _mm_xor_si128(acc->z0, _mm_clmulepi64_si128(v, h, 0x11));
+	acc->z2 = _mm_xor_si128(acc->z2, _mm_clmulepi64_si128(v, h, 0x00));
+	acc->z1 = _mm_xor_si128(acc->z1, _mm_clmulepi64_si128(gmul_karatsuba_key(v), hk, 0x00));
+}
+
+/** Reduces the accumulated products modulo \f$ x^{128} + x^7 + x^2 + x + 1 \f$ */
+static inline __m128i gmul_acc_reduce(const gmul_acc_t *acc) {
+	__m128i z0 = acc->z0, z2 = acc->z2, tmp;
+
+	__m128i z1 = _mm_xor_si128(acc->z1, z0);
+	z1 = _mm_xor_si128(z1, z2);
+
+	tmp = _mm_srli_si128(z1, 8);
+	__m128i pl = _mm_xor_si128(z0, tmp);
+
+	tmp = _mm_slli_si128(z1, 8);
+	__m128i ph = _mm_xor_si128(z2, tmp);
+
+	tmp = _mm_srli_epi64(ph, 63);
+	tmp = _mm_srli_si128(tmp, 8);
+
+	pl = shl(pl, 1);
+	pl = _mm_xor_si128(pl, tmp);
+
+	ph = shl(ph, 1);
+
+	/* reduce */
+	__m128i b, c;
+	b = c = _mm_slli_si128(ph, 8);
+
+	b = _mm_slli_epi64(b, 62);
+	c = _mm_slli_epi64(c, 57);
+
+	tmp = _mm_xor_si128(b, c);
+	__m128i d = _mm_xor_si128(ph, tmp);
+
+	__m128i e = shr(d, 1);
+	__m128i f = shr(d, 2);
+	__m128i g = shr(d, 7);
+
+	pl = _mm_xor_si128(pl, d);
+	pl = _mm_xor_si128(pl, e);
+	pl = _mm_xor_si128(pl, f);
+	pl = _mm_xor_si128(pl, g);
+
+	return pl;
+}
+
+/** Performs a carryless multiplication of two 128bit integers modulo \f$ x^{128} + x^7 + x^2 + x + 1 \f$ */
+static inline __m128i gmul(__m128i v, __m128i h) {
+	gmul_acc_t acc = gmul_acc_init();
+	gmul_acc_add(&acc, v, h, gmul_karatsuba_key(h));
+	return gmul_acc_reduce(&acc);
+}
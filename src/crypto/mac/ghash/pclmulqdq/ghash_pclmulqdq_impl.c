@@ -31,12 +31,9 @@
 
 
 #include "ghash_pclmulqdq.h"
+#include "ghash_pclmulqdq_gmul.h"
 #include "../../../../alloc.h"
 
-#include <wmmintrin.h>
-#include <emmintrin.h>
-#include <tmmintrin.h>
-
 
 /** An union allowing easy access to a block as a SIMD vector and a fastd_block128_t */
 typedef union vecblock {
@@ -44,45 +41,30 @@ typedef union vecblock {
 	fastd_block128_t b;		/**< fastd_block128_t access */
 } vecblock_t;
 
+/** The number of blocks whose products are reduced together */
+#define AGGREGATED_BLOCKS 8
+
+
 /** The MAC state used by this GHASH implementation */
 struct fastd_mac_state {
-	vecblock_t H;			/**< The hash key used by GHASH */
+	vecblock_t H[AGGREGATED_BLOCKS];	/**< The powers \f$ H^1 \f$ to \f$ H^8 \f$ of the hash key */
+	vecblock_t Hk[AGGREGATED_BLOCKS];	/**< The Karatsuba keys of the powers of the hash key */
 };
 
 
-/** Left shift on a 128bit integer */
-static inline __m128i shl(__m128i v, int a) {
-	__m128i tmpl = _mm_slli_epi64(v, a);
-	__m128i tmpr = _mm_srli_epi64(v, 64-a);
-	tmpr = _mm_slli_si128(tmpr, 8);
-
-	return _mm_xor_si128(tmpl, tmpr);
-}
-
-/** Right shift on a 128bit integer */
-static inline __m128i shr(__m128i v, int a) {
-	__m128i tmpr = _mm_srli_epi64(v, a);
-	__m128i tmpl = _mm_slli_epi64(v, 64-a);
-	tmpl = _mm_srli_si128(tmpl, 8);
-
-	return _mm_xor_si128(tmpr, tmpl);
-}
-
-/** _mm_shuffle_epi8 parameter to reverse the bytes of a __m128i */
-static const __v16qi BYTESWAP_SHUFFLE = {15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0};
-
-/** Reverses the order of the bytes of a __m128i */
-static inline __m128i byteswap(__m128i v) {
-	return _mm_shuffle_epi8(v, (__m128i)BYTESWAP_SHUFFLE);
-}
-
-
 /** Initializes the state used by this GHASH implementation */
 fastd_mac_state_t * fastd_ghash_pclmulqdq_init(const uint8_t *key) {
 	fastd_mac_state_t *state = fastd_new_aligned(fastd_mac_state_t, 16);
 
-	memcpy(&state->H, key, sizeof(__m128i));
-	state->H.v = byteswap(state->H.v);
+	memcpy(&state->H[0], key, sizeof(__m128i));
+	state->H[0].v = byteswap(state->H[0].v);
+	state->Hk[0].v = gmul_karatsuba_key(state->H[0].v);
+
+	size_t i;
+	for (i = 1; i < AGGREGATED_BLOCKS; i++) {
+		state->H[i].v = gmul(state->H[i-1].v, state->H[0].v);
+		state->Hk[i].v = gmul_karatsuba_key(state->H[i].v);
+	}
 
 	return state;
 }
@@ -95,62 +77,55 @@ void fastd_ghash_pclmulqdq_free(fastd_mac_state_t *state) {
 	}
 }
 
-/** Performs a carryless multiplication of two 128bit integers modulo \f$ x^{128} + x^7 + x^2 + x + 1 \f$ */
-static __m128i gmul(__m128i v, __m128i h) {
-	/* multiply */
-	__m128i z0, z1, z2, tmp;
-	z0 = _mm_clmulepi64_si128(v, h, 0x11);
-	z2 = _mm_clmulepi64_si128(v, h, 0x00);
-
-	__m128i tmpv = _mm_srli_si128(v, 8);
-	tmpv = _mm_xor_si128(tmpv, v);
-
-	__m128i tmph = _mm_srli_si128(h, 8);
-	tmph = _mm_xor_si128(tmph, h);
-
-	z1 = _mm_clmulepi64_si128(tmpv, tmph, 0x00);
-	z1 = _mm_xor_si128(z1, z0);
-	z1 = _mm_xor_si128(z1, z2);
-
-	tmp = _mm_srli_si128(z1, 8);
-	__m128i pl = _mm_xor_si128(z0, tmp);
+/**
+   Calculates the GHASH of the supplied input blocks
 
-	tmp = _mm_slli_si128(z1, 8);
-	__m128i ph = _mm_xor_si128(z2, tmp);
+   Up to AGGREGATED_BLOCKS blocks are handled at once: instead of multiplying the state by
+   \f$ H \f$ after each block, the \f$ n \f$ blocks are multiplied by \f$ H^n \f$ to
+   \f$ H^1 \f$ respectively, and the sum of the products is reduced only once.
+*/
+bool fastd_ghash_pclmulqdq_digest(const fastd_mac_state_t *state, fastd_block128_t *out, const fastd_block128_t *in, size_t length) {
+	if (length % sizeof(fastd_block128_t))
+		exit_bug("ghash_digest (pclmulqdq): invalid length");
 
-	tmp = _mm_srli_epi64(ph, 63);
-	tmp = _mm_srli_si128(tmp, 8);
+	size_t n_blocks = length / sizeof(fastd_block128_t);
 
-	pl = shl(pl, 1);
-	pl = _mm_xor_si128(pl, tmp);
+	vecblock_t v = {.v = _mm_setzero_si128()};
 
-	ph = shl(ph, 1);
+	size_t i = 0;
+	while (i < n_blocks) {
+		size_t n = n_blocks - i;
+		if (n > AGGREGATED_BLOCKS)
+			n = AGGREGATED_BLOCKS;
 
-	/* reduce */
-	__m128i b, c;
-	b = c = _mm_slli_si128(ph, 8);
+		gmul_acc_t acc = gmul_acc_init();
 
-	b = _mm_slli_epi64(b, 62);
-	c = _mm_slli_epi64(c, 57);
+		size_t j;
+		for (j = 0; j < n; j++) {
+			__m128i b = byteswap(((vecblock_t)in[i+j]).v);
+			if (!j)
+				b = _mm_xor_si128(b, v.v);
 
-	tmp = _mm_xor_si128(b, c);
-	__m128i d = _mm_xor_si128(ph, tmp);
+			gmul_acc_add(&acc, b, state->H[n-1-j].v, state->Hk[n-1-j].v);
+		}
 
-	__m128i e = shr(d, 1);
-	__m128i f = shr(d, 2);
-	__m128i g = shr(d, 7);
+		v.v = gmul_acc_reduce(&acc);
+		i += n;
+	}
 
-	pl = _mm_xor_si128(pl, d);
-	pl = _mm_xor_si128(pl, e);
-	pl = _mm_xor_si128(pl, f);
-	pl = _mm_xor_si128(pl, g);
+	v.v = byteswap(v.v);
+	*out = v.b;
 
-	return pl;
+	return true;
 }
 
+/**
+   Calculates the GHASH of the supplied input blocks, reducing the state after each block
 
-/** Calculates the GHASH of the supplied input blocks */
-bool fastd_ghash_pclmulqdq_digest(const fastd_mac_state_t *state, fastd_block128_t *out, const fastd_block128_t *in, size_t length) {
+   This is the straightforward algorithm the aggregated reduction of fastd_ghash_pclmulqdq_digest()
+   is compared against by --benchmark.
+*/
+bool fastd_ghash_pclmulqdq_digest_per_block(const fastd_mac_state_t *state, fastd_block128_t *out, const fastd_block128_t *in, size_t length) {
 	if (length % sizeof(fastd_block128_t))
 		exit_bug("ghash_digest (pclmulqdq): invalid length");
 
@@ -160,9 +135,8 @@ bool fastd_ghash_pclmulqdq_digest(const fastd_mac_state_t *state, fastd_block128
 
 	size_t i;
 	for (i = 0; i < n_blocks; i++) {
-		__m128i b = ((vecblock_t)in[i]).v;
-		v.v = _mm_xor_si128(v.v, byteswap(b));
-		v.v = gmul(v.v, state->H.v);
+		__m128i b = byteswap(((vecblock_t)in[i]).v);
+		v.v = gmul(_mm_xor_si128(v.v, b), state->H[0].v);
 	}
 
 	v.v = byteswap(v.v);
@@ -0,0 +1,241 @@
+/*
+  Copyright (c) 2012-2016, Matthias Schiffer <mschiffer@universe-factory.net>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   \file
+
+   Poly1305 implementation processing four blocks in parallel using AVX2
+
+   Each of the four 64bit lanes of a ymm register accumulates every fourth block of the message
+   in 26bit limbs, multiplying by \f$ r^4 \f$ after each step; at the end, the lanes are multiplied by
+   \f$ r^4, r^3, r^2 \f$ and \f$ r \f$ respectively and summed up. The remaining blocks and the final
+   reduction are handled by the portable implementation.
+*/
+
+
+#include "poly1305_avx2.h"
+#include "../poly1305_core.h"
+#include "../../../../alloc.h"
+
+#include <immintrin.h>
+
+
+/** Messages with less blocks are authenticated by the portable implementation only */
+#define MIN_BLOCKS 8
+
+
+/** MAC state used by this Poly1305 implementation */
+struct fastd_mac_state {
+	uint8_t key[POLY1305_KEYBYTES];		/**< The one-time key */
+};
+
+
+/** Multiplies two numbers given in 26bit limbs modulo \f$ 2^{130}-5 \f$ (partially reduced) */
+static void mul26(uint32_t out[5], const uint32_t a[5], const uint32_t b[5]) {
+	uint64_t d[5] = {};
+	size_t i, j;
+
+	for (i = 0; i < 5; i++) {
+		for (j = 0; j < 5; j++) {
+			if (i + j < 5)
+				d[i+j] += (uint64_t)a[i] * b[j];
+			else
+				d[i+j-5] += (uint64_t)a[i] * b[j] * 5;
+		}
+	}
+
+	uint64_t c = 0;
+	for (i = 0; i < 5; i++) {
+		d[i] += c;
+		c = d[i] >> 26;
+		out[i] = d[i] & 0x3ffffff;
+	}
+
+	out[0] += c * 5;
+	out[1] += out[0] >> 26;
+	out[0] &= 0x3ffffff;
+}
+
+/**
+   Computes the powers \f$ r^1 \f$ to \f$ r^4 \f$ of the clamped key in 26bit limbs
+
+   This is only done for messages long enough for the vectorized loop.
+*/
+static void key_powers(uint32_t r[4][5], const uint8_t *key) {
+	r[0][0] = (poly1305_load32(key)) & 0x3ffffff;
+	r[0][1] = (poly1305_load32(key+3) >> 2) & 0x3ffff03;
+	r[0][2] = (poly1305_load32(key+6) >> 4) & 0x3ffc0ff;
+	r[0][3] = (poly1305_load32(key+9) >> 6) & 0x3f03fff;
+	r[0][4] = (poly1305_load32(key+12) >> 8) & 0x00fffff;
+
+	size_t i;
+	for (i = 1; i < 4; i++)
+		mul26(r[i], r[i-1], r[0]);
+}
+
+/** Initializes the MAC state with the one-time key */
+fastd_mac_state_t * fastd_poly1305_avx2_init(const uint8_t *key) {
+	fastd_mac_state_t *state = fastd_new(fastd_mac_state_t);
+	memcpy(state->key, key, POLY1305_KEYBYTES);
+
+	return state;
+}
+
+
+/** Multiplies each lane of \e h with the corresponding lane of \e r; \e s contains the values of \e r multiplied by 5 */
+static inline void mul_reduce(__m256i h[5], const __m256i r[5], const __m256i s[5]) {
+	__m256i d0 = _mm256_mul_epu32(h[0], r[0]);
+	__m256i d1 = _mm256_mul_epu32(h[0], r[1]);
+	__m256i d2 = _mm256_mul_epu32(h[0], r[2]);
+	__m256i d3 = _mm256_mul_epu32(h[0], r[3]);
+	__m256i d4 = _mm256_mul_epu32(h[0], r[4]);
+
+	d0 = _mm256_add_epi64(d0, _mm256_mul_epu32(h[1], s[4]));
+	d1 = _mm256_add_epi64(d1, _mm256_mul_epu32(h[1], r[0]));
+	d2 = _mm256_add_epi64(d2, _mm256_mul_epu32(h[1], r[1]));
+	d3 = _mm256_add_epi64(d3, _mm256_mul_epu32(h[1], r[2]));
+	d4 = _mm256_add_epi64(d4, _mm256_mul_epu32(h[1], r[3]));
+
+	d0 = _mm256_add_epi64(d0, _mm256_mul_epu32(h[2], s[3]));
+	d1 = _mm256_add_epi64(d1, _mm256_mul_epu32(h[2], s[4]));
+	d2 = _mm256_add_epi64(d2, _mm256_mul_epu32(h[2], r[0]));
+	d3 = _mm256_add_epi64(d3, _mm256_mul_epu32(h[2], r[1]));
+	d4 = _mm256_add_epi64(d4, _mm256_mul_epu32(h[2], r[2]));
+
+	d0 = _mm256_add_epi64(d0, _mm256_mul_epu32(h[3], s[2]));
+	d1 = _mm256_add_epi64(d1, _mm256_mul_epu32(h[3], s[3]));
+	d2 = _mm256_add_epi64(d2, _mm256_mul_epu32(h[3], s[4]));
+	d3 = _mm256_add_epi64(d3, _mm256_mul_epu32(h[3], r[0]));
+	d4 = _mm256_add_epi64(d4, _mm256_mul_epu32(h[3], r[1]));
+
+	d0 = _mm256_add_epi64(d0, _mm256_mul_epu32(h[4], s[1]));
+	d1 = _mm256_add_epi64(d1, _mm256_mul_epu32(h[4], s[2]));
+	d2 = _mm256_add_epi64(d2, _mm256_mul_epu32(h[4], s[3]));
+	d3 = _mm256_add_epi64(d3, _mm256_mul_epu32(h[4], s[4]));
+	d4 = _mm256_add_epi64(d4, _mm256_mul_epu32(h[4], r[0]));
+
+	const __m256i mask = _mm256_set1_epi64x(0x3ffffff);
+	__m256i c;
+
+	c = _mm256_srli_epi64(d0, 26); d0 = _mm256_and_si256(d0, mask);
+	d1 = _mm256_add_epi64(d1, c); c = _mm256_srli_epi64(d1, 26); d1 = _mm256_and_si256(d1, mask);
+	d2 = _mm256_add_epi64(d2, c); c = _mm256_srli_epi64(d2, 26); d2 = _mm256_and_si256(d2, mask);
+	d3 = _mm256_add_epi64(d3, c); c = _mm256_srli_epi64(d3, 26); d3 = _mm256_and_si256(d3, mask);
+	d4 = _mm256_add_epi64(d4, c); c = _mm256_srli_epi64(d4, 26); d4 = _mm256_and_si256(d4, mask);
+	d0 = _mm256_add_epi64(d0, _mm256_add_epi64(c, _mm256_slli_epi64(c, 2)));
+	c = _mm256_srli_epi64(d0, 26); d0 = _mm256_and_si256(d0, mask);
+	d1 = _mm256_add_epi64(d1, c);
+
+	h[0] = d0;
+	h[1] = d1;
+	h[2] = d2;
+	h[3] = d3;
+	h[4] = d4;
+}
+
+/** Adds four message blocks to the lanes of \e h */
+static inline void add_blocks(__m256i h[5], const uint8_t *m) {
+	const __m256i mask = _mm256_set1_epi64x(0x3ffffff);
+
+	__m256i a = _mm256_loadu_si256((const __m256i *)m);
+	__m256i b = _mm256_loadu_si256((const __m256i *)(m+32));
+
+	__m256i lo = _mm256_permute4x64_epi64(_mm256_unpacklo_epi64(a, b), 0xd8);
+	__m256i hi = _mm256_permute4x64_epi64(_mm256_unpackhi_epi64(a, b), 0xd8);
+
+	h[0] = _mm256_add_epi64(h[0], _mm256_and_si256(lo, mask));
+	h[1] = _mm256_add_epi64(h[1], _mm256_and_si256(_mm256_srli_epi64(lo, 26), mask));
+	h[2] = _mm256_add_epi64(h[2], _mm256_and_si256(_mm256_or_si256(_mm256_srli_epi64(lo, 52), _mm256_slli_epi64(hi, 12)), mask));
+	h[3] = _mm256_add_epi64(h[3], _mm256_and_si256(_mm256_srli_epi64(hi, 14), mask));
+	h[4] = _mm256_add_epi64(h[4], _mm256_or_si256(_mm256_srli_epi64(hi, 40), _mm256_set1_epi64x(1 << 24)));
+}
+
+/** Calculates the Poly1305 tag of a message of any length, keeping the state on the stack */
+bool fastd_poly1305_avx2_digest_onetime(fastd_block128_t *out, const uint8_t *key, const fastd_block128_t *in, size_t length) {
+	const uint8_t *m = (const uint8_t *)in;
+	size_t n_blocks = length / POLY1305_BLOCKBYTES;
+
+	poly1305_state_t st;
+	poly1305_init(&st, key);
+
+	if (n_blocks >= MIN_BLOCKS) {
+		__m256i r4[5], s4[5], rn[5], sn[5], h[5];
+		uint32_t r[4][5];
+		size_t i;
+
+		key_powers(r, key);
+
+		for (i = 0; i < 5; i++) {
+			r4[i] = _mm256_set1_epi64x(r[3][i]);
+			s4[i] = _mm256_set1_epi64x(r[3][i] * 5);
+
+			rn[i] = _mm256_setr_epi64x(r[3][i], r[2][i], r[1][i], r[0][i]);
+			sn[i] = _mm256_setr_epi64x(r[3][i] * 5, r[2][i] * 5, r[1][i] * 5, r[0][i] * 5);
+
+			h[i] = _mm256_setzero_si256();
+		}
+
+		add_blocks(h, m);
+		m += 4*POLY1305_BLOCKBYTES;
+		n_blocks -= 4;
+
+		while (n_blocks >= 4) {
+			mul_reduce(h, r4, s4);
+			add_blocks(h, m);
+
+			m += 4*POLY1305_BLOCKBYTES;
+			n_blocks -= 4;
+		}
+
+		mul_reduce(h, rn, sn);
+
+		uint64_t l[5], lanes[4] __attribute__((aligned(32)));
+		for (i = 0; i < 5; i++) {
+			_mm256_store_si256((__m256i *)lanes, h[i]);
+			l[i] = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+		}
+
+		poly1305_set_h26(&st, l);
+		secure_memzero(r, sizeof(r));
+	}
+
+	poly1305_blocks(&st, m, n_blocks, 1);
+	poly1305_finish(&st, out->b, m + n_blocks*POLY1305_BLOCKBYTES, length % POLY1305_BLOCKBYTES);
+
+	return true;
+}
+
+/** Calculates the Poly1305 tag of a message of any length */
+bool fastd_poly1305_avx2_digest(const fastd_mac_state_t *state, fastd_block128_t *out, const fastd_block128_t *in, size_t length) {
+	return fastd_poly1305_avx2_digest_onetime(out, state->key, in, length);
+}
+
+/** Frees the MAC state */
+void fastd_poly1305_avx2_free(fastd_mac_state_t *state) {
+	if (state) {
+		secure_memzero(state, sizeof(*state));
+		free(state);
+	}
+}
@@ -0,0 +1,85 @@
+/*
+  Copyright (c) 2012-2016, Matthias Schiffer <mschiffer@universe-factory.net>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   \file
+
+   Portable Poly1305 implementation
+*/
+
+
+#include "../poly1305_core.h"
+#include "../../../../alloc.h"
+
+
+/** MAC state used by this Poly1305 implementation */
+struct fastd_mac_state {
+	uint8_t key[POLY1305_KEYBYTES];		/**< The one-time key */
+};
+
+
+/** Initializes the MAC state with the one-time key */
+static fastd_mac_state_t * poly1305_builtin_init(const uint8_t *key) {
+	fastd_mac_state_t *state = fastd_new(fastd_mac_state_t);
+	memcpy(state->key, key, POLY1305_KEYBYTES);
+
+	return state;
+}
+
+/** Calculates the Poly1305 tag of a message of any length, keeping the state on the stack */
+static bool poly1305_builtin_digest_onetime(fastd_block128_t *out, const uint8_t *key, const fastd_block128_t *in, size_t length) {
+	const uint8_t *m = (const uint8_t *)in;
+
+	poly1305_state_t st;
+	poly1305_init(&st, key);
+
+	size_t n_blocks = length / POLY1305_BLOCKBYTES;
+	poly1305_blocks(&st, m, n_blocks, 1);
+	poly1305_finish(&st, out->b, m + n_blocks*POLY1305_BLOCKBYTES, length % POLY1305_BLOCKBYTES);
+
+	return true;
+}
+
+/** Calculates the Poly1305 tag of a message of any length */
+static bool poly1305_builtin_digest(const fastd_mac_state_t *state, fastd_block128_t *out, const fastd_block128_t *in, size_t length) {
+	return poly1305_builtin_digest_onetime(out, state->key, in, length);
+}
+
+/** Frees the MAC state */
+static void poly1305_builtin_free(fastd_mac_state_t *state) {
+	if (state) {
+		secure_memzero(state, sizeof(*state));
+		free(state);
+	}
+}
+
+/** The builtin Poly1305 implementation */
+const fastd_mac_t fastd_mac_poly1305_builtin = {
+	.init = poly1305_builtin_init,
+	.digest = poly1305_builtin_digest,
+	.free = poly1305_builtin_free,
+
+	.digest_onetime = poly1305_builtin_digest_onetime,
+};
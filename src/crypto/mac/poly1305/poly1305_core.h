@@ -0,0 +1,372 @@
+/*
+  Copyright (c) 2012-2016, Matthias Schiffer <mschiffer@universe-factory.net>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   \file
+
+   Portable Poly1305 core
+
+   When the compiler supports 128bit integers, the accumulator and key are stored
+   in three limbs of 44, 44 and 42 bits, so a 16 byte block takes 9 64x64bit
+   multiplications. Otherwise, five 26bit limbs and 32x32bit multiplications are used.
+
+   The algorithm follows poly1305-donna by Andrew Moon (public domain).
+*/
+
+
+#pragma once
+
+#include "../../../crypto.h"
+#include "../../../util.h"
+
+
+/** The length of the key used by Poly1305 */
+#define POLY1305_KEYBYTES 32
+
+/** The length of the Poly1305 tag */
+#define POLY1305_TAGBYTES 16
+
+/** The length of a Poly1305 block */
+#define POLY1305_BLOCKBYTES 16
+
+
+/** Loads a little-endian 32bit word from an unaligned buffer */
+static inline uint32_t poly1305_load32(const uint8_t *p) {
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return le32toh(v);
+}
+
+/** Stores a little-endian 32bit word to an unaligned buffer */
+static inline void poly1305_store32(uint8_t *p, uint32_t v) {
+	v = htole32(v);
+	memcpy(p, &v, sizeof(v));
+}
+
+
+#ifdef __SIZEOF_INT128__
+
+/** An unsigned 128bit integer */
+typedef unsigned __int128 poly1305_uint128_t;
+
+/** The Poly1305 state for one message */
+typedef struct poly1305_state {
+	uint64_t r[3];			/**< The clamped multiplier */
+	uint64_t h[3];			/**< The accumulator */
+	uint32_t pad[4];		/**< The value added at the end */
+} poly1305_state_t;
+
+
+/** Loads a little-endian 64bit word from an unaligned buffer */
+static inline uint64_t poly1305_load64(const uint8_t *p) {
+	return (uint64_t)poly1305_load32(p) | ((uint64_t)poly1305_load32(p+4) << 32);
+}
+
+/** Initializes the state with a key */
+static inline void poly1305_init(poly1305_state_t *st, const uint8_t key[POLY1305_KEYBYTES]) {
+	uint64_t t0 = poly1305_load64(key);
+	uint64_t t1 = poly1305_load64(key+8);
+
+	/* r &= 0xffffffc0ffffffc0ffffffc0fffffff */
+	st->r[0] = t0 & 0xffc0fffffff;
+	st->r[1] = ((t0 >> 44) | (t1 << 20)) & 0xfffffc0ffff;
+	st->r[2] = (t1 >> 24) & 0x00ffffffc0f;
+
+	st->h[0] = st->h[1] = st->h[2] = 0;
+
+	size_t i;
+	for (i = 0; i < 4; i++)
+		st->pad[i] = poly1305_load32(key + 16 + 4*i);
+}
+
+/**
+   Processes full 16 byte blocks
+
+   \e hibit is 1 for full blocks of the message and 0 for the padded last block.
+*/
+static inline void poly1305_blocks(poly1305_state_t *st, const uint8_t *m, size_t n_blocks, uint64_t hibit) {
+	const uint64_t r0 = st->r[0], r1 = st->r[1], r2 = st->r[2];
+	const uint64_t s1 = r1 * (5 << 2), s2 = r2 * (5 << 2);
+	uint64_t h0 = st->h[0], h1 = st->h[1], h2 = st->h[2];
+
+	hibit <<= 40;
+
+	while (n_blocks--) {
+		uint64_t t0 = poly1305_load64(m);
+		uint64_t t1 = poly1305_load64(m+8);
+
+		h0 += t0 & 0xfffffffffff;
+		h1 += ((t0 >> 44) | (t1 << 20)) & 0xfffffffffff;
+		h2 += ((t1 >> 24) & 0x3ffffffffff) | hibit;
+
+		poly1305_uint128_t d0 = (poly1305_uint128_t)h0*r0 + (poly1305_uint128_t)h1*s2 + (poly1305_uint128_t)h2*s1;
+		poly1305_uint128_t d1 = (poly1305_uint128_t)h0*r1 + (poly1305_uint128_t)h1*r0 + (poly1305_uint128_t)h2*s2;
+		poly1305_uint128_t d2 = (poly1305_uint128_t)h0*r2 + (poly1305_uint128_t)h1*r1 + (poly1305_uint128_t)h2*r0;
+
+		uint64_t c;
+		c = (uint64_t)(d0 >> 44); h0 = (uint64_t)d0 & 0xfffffffffff;
+		d1 += c; c = (uint64_t)(d1 >> 44); h1 = (uint64_t)d1 & 0xfffffffffff;
+		d2 += c; c = (uint64_t)(d2 >> 42); h2 = (uint64_t)d2 & 0x3ffffffffff;
+		h0 += c * 5; c = h0 >> 44; h0 &= 0xfffffffffff;
+		h1 += c;
+
+		m += POLY1305_BLOCKBYTES;
+	}
+
+	st->h[0] = h0;
+	st->h[1] = h1;
+	st->h[2] = h2;
+}
+
+/**
+   Sets the accumulator from five 26bit limbs
+
+   The limbs may exceed 26 bits as long as they fit in 58 bits.
+*/
+static inline void poly1305_set_h26(poly1305_state_t *st, const uint64_t l[5]) {
+	uint64_t c, t[5];
+	size_t i;
+
+	for (i = 0; i < 5; i++)
+		t[i] = l[i];
+
+	for (i = 0; i < 4; i++) {
+		t[i+1] += t[i] >> 26;
+		t[i] &= 0x3ffffff;
+	}
+	c = t[4] >> 26; t[4] &= 0x3ffffff;
+	t[0] += c * 5; c = t[0] >> 26; t[0] &= 0x3ffffff;
+	t[1] += c;
+
+	uint64_t h0 = t[0] + ((t[1] & 0x3ffff) << 26);
+	uint64_t h1 = (t[1] >> 18) + (t[2] << 8) + ((t[3] & 0x3ff) << 34);
+	uint64_t h2 = (t[3] >> 10) + (t[4] << 16);
+
+	c = h0 >> 44; h0 &= 0xfffffffffff;
+	h1 += c; c = h1 >> 44; h1 &= 0xfffffffffff;
+	h2 += c;
+
+	st->h[0] = h0;
+	st->h[1] = h1;
+	st->h[2] = h2;
+}
+
+/** Fully reduces the accumulator, adds the pad and stores the tag */
+static inline void poly1305_finish_state(poly1305_state_t *st, uint8_t tag[POLY1305_TAGBYTES]) {
+	uint64_t h0 = st->h[0], h1 = st->h[1], h2 = st->h[2];
+	uint64_t c;
+
+	c = h1 >> 44; h1 &= 0xfffffffffff;
+	h2 += c; c = h2 >> 42; h2 &= 0x3ffffffffff;
+	h0 += c * 5; c = h0 >> 44; h0 &= 0xfffffffffff;
+	h1 += c; c = h1 >> 44; h1 &= 0xfffffffffff;
+	h2 += c; c = h2 >> 42; h2 &= 0x3ffffffffff;
+	h0 += c * 5; c = h0 >> 44; h0 &= 0xfffffffffff;
+	h1 += c;
+
+	/* compute h + -p */
+	uint64_t g0 = h0 + 5; c = g0 >> 44; g0 &= 0xfffffffffff;
+	uint64_t g1 = h1 + c; c = g1 >> 44; g1 &= 0xfffffffffff;
+	uint64_t g2 = h2 + c - ((uint64_t)1 << 42);
+
+	/* select h if h < p, or h + -p if h >= p */
+	uint64_t mask = (g2 >> 63) - 1;
+	h0 = (h0 & ~mask) | (g0 & mask);
+	h1 = (h1 & ~mask) | (g1 & mask);
+	h2 = (h2 & ~mask) | (g2 & mask);
+
+	/* h = (h + pad) % 2^128 */
+	uint64_t t0 = (uint64_t)st->pad[0] | ((uint64_t)st->pad[1] << 32);
+	uint64_t t1 = (uint64_t)st->pad[2] | ((uint64_t)st->pad[3] << 32);
+
+	h0 += t0 & 0xfffffffffff; c = h0 >> 44; h0 &= 0xfffffffffff;
+	h1 += (((t0 >> 44) | (t1 << 20)) & 0xfffffffffff) + c; c = h1 >> 44; h1 &= 0xfffffffffff;
+	h2 += (t1 >> 24) + c;
+
+	h0 = h0 | (h1 << 44);
+	h1 = (h1 >> 20) | (h2 << 24);
+
+	poly1305_store32(tag, h0);
+	poly1305_store32(tag+4, h0 >> 32);
+	poly1305_store32(tag+8, h1);
+	poly1305_store32(tag+12, h1 >> 32);
+}
+
+#else
+
+/** The Poly1305 state for one message */
+typedef struct poly1305_state {
+	uint32_t r[5];			/**< The clamped multiplier */
+	uint32_t h[5];			/**< The accumulator */
+	uint32_t pad[4];		/**< The value added at the end */
+} poly1305_state_t;
+
+
+/** Initializes the state with a key */
+static inline void poly1305_init(poly1305_state_t *st, const uint8_t key[POLY1305_KEYBYTES]) {
+	/* r &= 0xffffffc0ffffffc0ffffffc0fffffff */
+	st->r[0] = (poly1305_load32(key)) & 0x3ffffff;
+	st->r[1] = (poly1305_load32(key+3) >> 2) & 0x3ffff03;
+	st->r[2] = (poly1305_load32(key+6) >> 4) & 0x3ffc0ff;
+	st->r[3] = (poly1305_load32(key+9) >> 6) & 0x3f03fff;
+	st->r[4] = (poly1305_load32(key+12) >> 8) & 0x00fffff;
+
+	memset(st->h, 0, sizeof(st->h));
+
+	size_t i;
+	for (i = 0; i < 4; i++)
+		st->pad[i] = poly1305_load32(key + 16 + 4*i);
+}
+
+/**
+   Processes full 16 byte blocks
+
+   \e hibit is 1 for full blocks of the message and 0 for the padded last block.
+*/
+static inline void poly1305_blocks(poly1305_state_t *st, const uint8_t *m, size_t n_blocks, uint32_t hibit) {
+	const uint32_t r0 = st->r[0], r1 = st->r[1], r2 = st->r[2], r3 = st->r[3], r4 = st->r[4];
+	const uint32_t s1 = r1 * 5, s2 = r2 * 5, s3 = r3 * 5, s4 = r4 * 5;
+	uint32_t h0 = st->h[0], h1 = st->h[1], h2 = st->h[2], h3 = st->h[3], h4 = st->h[4];
+
+	hibit <<= 24;
+
+	while (n_blocks--) {
+		h0 += (poly1305_load32(m)) & 0x3ffffff;
+		h1 += (poly1305_load32(m+3) >> 2) & 0x3ffffff;
+		h2 += (poly1305_load32(m+6) >> 4) & 0x3ffffff;
+		h3 += (poly1305_load32(m+9) >> 6) & 0x3ffffff;
+		h4 += (poly1305_load32(m+12) >> 8) | hibit;
+
+		uint64_t d0 = (uint64_t)h0*r0 + (uint64_t)h1*s4 + (uint64_t)h2*s3 + (uint64_t)h3*s2 + (uint64_t)h4*s1;
+		uint64_t d1 = (uint64_t)h0*r1 + (uint64_t)h1*r0 + (uint64_t)h2*s4 + (uint64_t)h3*s3 + (uint64_t)h4*s2;
+		uint64_t d2 = (uint64_t)h0*r2 + (uint64_t)h1*r1 + (uint64_t)h2*r0 + (uint64_t)h3*s4 + (uint64_t)h4*s3;
+		uint64_t d3 = (uint64_t)h0*r3 + (uint64_t)h1*r2 + (uint64_t)h2*r1 + (uint64_t)h3*r0 + (uint64_t)h4*s4;
+		uint64_t d4 = (uint64_t)h0*r4 + (uint64_t)h1*r3 + (uint64_t)h2*r2 + (uint64_t)h3*r1 + (uint64_t)h4*r0;
+
+		uint32_t c;
+		c = (uint32_t)(d0 >> 26); h0 = (uint32_t)d0 & 0x3ffffff;
+		d1 += c; c = (uint32_t)(d1 >> 26); h1 = (uint32_t)d1 & 0x3ffffff;
+		d2 += c; c = (uint32_t)(d2 >> 26); h2 = (uint32_t)d2 & 0x3ffffff;
+		d3 += c; c = (uint32_t)(d3 >> 26); h3 = (uint32_t)d3 & 0x3ffffff;
+		d4 += c; c = (uint32_t)(d4 >> 26); h4 = (uint32_t)d4 & 0x3ffffff;
+		h0 += c * 5; c = h0 >> 26; h0 &= 0x3ffffff;
+		h1 += c;
+
+		m += POLY1305_BLOCKBYTES;
+	}
+
+	st->h[0] = h0;
+	st->h[1] = h1;
+	st->h[2] = h2;
+	st->h[3] = h3;
+	st->h[4] = h4;
+}
+
+/**
+   Sets the accumulator from five 26bit limbs
+
+   The limbs may exceed 26 bits as long as they fit in 58 bits.
+*/
+static inline void poly1305_set_h26(poly1305_state_t *st, const uint64_t l[5]) {
+	uint64_t c, t[5];
+	size_t i;
+
+	for (i = 0; i < 5; i++)
+		t[i] = l[i];
+
+	for (i = 0; i < 4; i++) {
+		t[i+1] += t[i] >> 26;
+		t[i] &= 0x3ffffff;
+	}
+	c = t[4] >> 26; t[4] &= 0x3ffffff;
+	t[0] += c * 5; c = t[0] >> 26; t[0] &= 0x3ffffff;
+	t[1] += c;
+
+	for (i = 0; i < 5; i++)
+		st->h[i] = t[i];
+}
+
+/** Fully reduces the accumulator, adds the pad and stores the tag */
+static inline void poly1305_finish_state(poly1305_state_t *st, uint8_t tag[POLY1305_TAGBYTES]) {
+	uint32_t h0 = st->h[0], h1 = st->h[1], h2 = st->h[2], h3 = st->h[3], h4 = st->h[4];
+	uint32_t c;
+
+	c = h1 >> 26; h1 &= 0x3ffffff;
+	h2 += c; c = h2 >> 26; h2 &= 0x3ffffff;
+	h3 += c; c = h3 >> 26; h3 &= 0x3ffffff;
+	h4 += c; c = h4 >> 26; h4 &= 0x3ffffff;
+	h0 += c * 5; c = h0 >> 26; h0 &= 0x3ffffff;
+	h1 += c;
+
+	/* compute h + -p */
+	uint32_t g0 = h0 + 5; c = g0 >> 26; g0 &= 0x3ffffff;
+	uint32_t g1 = h1 + c; c = g1 >> 26; g1 &= 0x3ffffff;
+	uint32_t g2 = h2 + c; c = g2 >> 26; g2 &= 0x3ffffff;
+	uint32_t g3 = h3 + c; c = g3 >> 26; g3 &= 0x3ffffff;
+	uint32_t g4 = h4 + c - (1 << 26);
+
+	/* select h if h < p, or h + -p if h >= p */
+	uint32_t mask = (g4 >> 31) - 1;
+	h0 = (h0 & ~mask) | (g0 & mask);
+	h1 = (h1 & ~mask) | (g1 & mask);
+	h2 = (h2 & ~mask) | (g2 & mask);
+	h3 = (h3 & ~mask) | (g3 & mask);
+	h4 = (h4 & ~mask) | (g4 & mask);
+
+	/* h = h % 2^128 */
+	h0 = (h0) | (h1 << 26);
+	h1 = (h1 >> 6) | (h2 << 20);
+	h2 = (h2 >> 12) | (h3 << 14);
+	h3 = (h3 >> 18) | (h4 << 8);
+
+	/* tag = (h + pad) % 2^128 */
+	uint64_t f;
+	f = (uint64_t)h0 + st->pad[0]; h0 = (uint32_t)f;
+	f = (uint64_t)h1 + st->pad[1] + (f >> 32); h1 = (uint32_t)f;
+	f = (uint64_t)h2 + st->pad[2] + (f >> 32); h2 = (uint32_t)f;
+	f = (uint64_t)h3 + st->pad[3] + (f >> 32); h3 = (uint32_t)f;
+
+	poly1305_store32(tag, h0);
+	poly1305_store32(tag+4, h1);
+	poly1305_store32(tag+8, h2);
+	poly1305_store32(tag+12, h3);
+}
+
+#endif
+
+
+/** Processes the last partial block (if any) and stores the tag */
+static inline void poly1305_finish(poly1305_state_t *st, uint8_t tag[POLY1305_TAGBYTES], const uint8_t *m, size_t len) {
+	if (len) {
+		uint8_t block[POLY1305_BLOCKBYTES] = {};
+		memcpy(block, m, len);
+		block[len] = 1;
+
+		poly1305_blocks(st, block, 1, 0);
+	}
+
+	poly1305_finish_state(st, tag);
+	secure_memzero(st, sizeof(*st));
+}
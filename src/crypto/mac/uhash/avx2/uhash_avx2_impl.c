@@ -0,0 +1,93 @@
+/*
+  Copyright (c) 2012-2016, Matthias Schiffer <mschiffer@universe-factory.net>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   \file
+
+   AVX2-based UHASH implementation
+
+   The NH function computes two of its four iterations per 256bit vector; all other
+   parts of UHASH are shared with the builtin implementation.
+*/
+
+
+#include "uhash_avx2.h"
+#include "../uhash_core.h"
+
+#include <immintrin.h>
+
+
+/** Multiplies the corresponding 32bit words of \e a and \e b and adds the 64bit products pairwise to \e y */
+static inline __m256i mul_add(__m256i y, __m256i a, __m256i b) {
+	y = _mm256_add_epi64(y, _mm256_mul_epu32(a, b));
+	return _mm256_add_epi64(y, _mm256_mul_epu32(_mm256_srli_epi64(a, 32), _mm256_srli_epi64(b, 32)));
+}
+
+/**
+   The UHASH NH function (with all four iterations interleaved)
+
+   The 32 bytes of a message chunk are added to the key words of two iterations at once;
+   the halves are then rearranged so the lower 128bit lane of the vectors contains the
+   first and the upper lane the second iteration.
+*/
+static uint64_4_t nh_avx2(const uint32_t *K, const uint32_t *M, size_t length) {
+	__m256i Y01 = _mm256_set_epi64x(0, 8 * length, 0, 8 * length);
+	__m256i Y23 = Y01;
+
+	size_t i;
+	for (i = 0; i < max_size_t(block_count(length, 4), 1); i += 8) {
+		__m256i m = _mm256_loadu_si256((const __m256i *)(M+i));
+
+		__m256i t0 = _mm256_add_epi32(m, _mm256_loadu_si256((const __m256i *)(K+i)));
+		__m256i t1 = _mm256_add_epi32(m, _mm256_loadu_si256((const __m256i *)(K+i+4)));
+		__m256i t2 = _mm256_add_epi32(m, _mm256_loadu_si256((const __m256i *)(K+i+8)));
+		__m256i t3 = _mm256_add_epi32(m, _mm256_loadu_si256((const __m256i *)(K+i+12)));
+
+		Y01 = mul_add(Y01, _mm256_permute2x128_si256(t0, t1, 0x20), _mm256_permute2x128_si256(t0, t1, 0x31));
+		Y23 = mul_add(Y23, _mm256_permute2x128_si256(t2, t3, 0x20), _mm256_permute2x128_si256(t2, t3, 0x31));
+	}
+
+	uint64_t v[8];
+	_mm256_storeu_si256((__m256i *)v, Y01);
+	_mm256_storeu_si256((__m256i *)(v+4), Y23);
+
+	return (uint64_4_t){{v[0] + v[1], v[2] + v[3], v[4] + v[5], v[6] + v[7]}};
+}
+
+
+/** Initializes the state used by this UHASH implementation */
+fastd_mac_state_t * fastd_uhash_avx2_init(const uint8_t *key) {
+	return uhash_init(key);
+}
+
+/** Calculates the UHASH of the supplied input blocks using the AVX2 NH function */
+bool fastd_uhash_avx2_digest(const fastd_mac_state_t *state, fastd_block128_t *out, const fastd_block128_t *in, size_t length) {
+	return uhash_digest(state, out, in, length, nh_avx2);
+}
+
+/** Frees the state used by this UHASH implementation */
+void fastd_uhash_avx2_free(fastd_mac_state_t *state) {
+	uhash_free(state);
+}
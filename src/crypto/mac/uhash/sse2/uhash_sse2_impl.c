@@ -0,0 +1,87 @@
+/*
+  Copyright (c) 2012-2016, Matthias Schiffer <mschiffer@universe-factory.net>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   \file
+
+   SSE2-based UHASH implementation
+
+   The NH function is computed with two 32x32->64bit multiplications per PMULUDQ
+   instruction; all other parts of UHASH are shared with the builtin implementation.
+*/
+
+
+#include "uhash_sse2.h"
+#include "../uhash_core.h"
+
+#include <emmintrin.h>
+
+
+/** The UHASH NH function (with all four iterations interleaved) */
+static uint64_4_t nh_sse2(const uint32_t *K, const uint32_t *M, size_t length) {
+	__m128i Y[4];
+	size_t i, j;
+
+	for (j = 0; j < 4; j++)
+		Y[j] = _mm_set_epi64x(0, 8 * length);
+
+	for (i = 0; i < max_size_t(block_count(length, 4), 1); i += 8) {
+		__m128i mlo = _mm_loadu_si128((const __m128i *)(M+i));
+		__m128i mhi = _mm_loadu_si128((const __m128i *)(M+i+4));
+
+		for (j = 0; j < 4; j++) {
+			__m128i a = _mm_add_epi32(mlo, _mm_loadu_si128((const __m128i *)(K+i+4*j)));
+			__m128i b = _mm_add_epi32(mhi, _mm_loadu_si128((const __m128i *)(K+i+4*j+4)));
+
+			Y[j] = _mm_add_epi64(Y[j], _mm_mul_epu32(a, b));
+			Y[j] = _mm_add_epi64(Y[j], _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32)));
+		}
+	}
+
+	uint64_4_t ret;
+	for (j = 0; j < 4; j++) {
+		uint64_t v[2];
+		_mm_storeu_si128((__m128i *)v, Y[j]);
+		ret.v[j] = v[0] + v[1];
+	}
+
+	return ret;
+}
+
+
+/** Initializes the state used by this UHASH implementation */
+fastd_mac_state_t * fastd_uhash_sse2_init(const uint8_t *key) {
+	return uhash_init(key);
+}
+
+/** Calculates the UHASH of the supplied input blocks using the SSE2 NH function */
+bool fastd_uhash_sse2_digest(const fastd_mac_state_t *state, fastd_block128_t *out, const fastd_block128_t *in, size_t length) {
+	return uhash_digest(state, out, in, length, nh_sse2);
+}
+
+/** Frees the state used by this UHASH implementation */
+void fastd_uhash_sse2_free(fastd_mac_state_t *state) {
+	uhash_free(state);
+}
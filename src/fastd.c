@@ -36,12 +36,15 @@
 
 #include "fastd.h"
 #include "async.h"
+#include "benchmark.h"
 #include "config.h"
 #include "crypto.h"
+#include "offload.h"
 #include "peer.h"
 #include "peer_group.h"
 #include "peer_hashtable.h"
 #include "poll.h"
+#include "worker.h"
 #include <generated/version.h>
 
 #include <grp.h>
@@ -450,6 +453,14 @@ static inline void init_early(void) {
 	fastd_mac_init();
 }
 
+/** Initializes the crypto libraries, which might be needed by the methods */
+static inline void init_crypto(void) {
+#ifdef HAVE_LIBSODIUM
+	if (sodium_init() < 0)
+		exit_error("unable to initialize libsodium");
+#endif
+}
+
 /**
    Performs further initialization after the config has been loaded
 
@@ -466,6 +477,13 @@ static inline void init_config(int *status_fd) {
 		exit(0);
 	}
 
+	if (conf.benchmark) {
+		init_crypto();
+		fastd_config_verify();
+		fastd_benchmark();
+		exit(0);
+	}
+
 	conf.protocol_config = conf.protocol->init();
 
 	if (conf.show_key) {
@@ -489,10 +507,7 @@ static inline void init_config(int *status_fd) {
 	init_log();
 
 	/* Init crypto libs here as fastd_config_check() initializes the methods and might need them */
-#ifdef HAVE_LIBSODIUM
-	if (sodium_init() < 0)
-		exit_error("unable to initialize libsodium");
-#endif
+	init_crypto();
 
 	fastd_config_check();
 }
@@ -526,6 +541,7 @@ static inline void init(int argc, char *argv[]) {
 
 	fastd_cap_acquire();
 
+	ctx.busy_poll_window = conf.busy_poll;
 	fastd_poll_init();
 
 	init_sockets();
@@ -534,6 +550,8 @@ static inline void init(int argc, char *argv[]) {
 	fastd_async_init();
 
 	fastd_socket_bind_all();
+	fastd_workers_init();
+	fastd_offload_init();
 
 	on_pre_up();
 
@@ -573,6 +591,9 @@ static inline void init(int argc, char *argv[]) {
 		set_user();
 
 	fastd_config_load_peer_dirs(true);
+
+	fastd_workers_start();
+	fastd_offload_start();
 }
 
 
@@ -629,6 +650,13 @@ static inline void handle_signals(void) {
 /** A single iteration of fastd's main loop */
 static inline void run(void) {
 	fastd_task_handle();
+
+	/* Send the packets queued while handling the tasks and the input of the last iteration */
+	fastd_send_flush();
+
+	/* Publish peer changes to the workers and free what they can't access anymore */
+	fastd_workers_maintain();
+
 	fastd_poll_handle();
 
 	handle_signals();
@@ -650,6 +678,9 @@ static void delete_peers(void) {
 static inline void cleanup(void) {
 	pr_info("terminating fastd");
 
+	fastd_workers_stop();
+	fastd_offload_free();
+
 	delete_peers();
 
 	if (ctx.iface) {
@@ -658,6 +689,7 @@ static inline void cleanup(void) {
 	}
 
 	fastd_status_close();
+	fastd_workers_free();
 	close_sockets();
 	fastd_poll_free();
 
@@ -668,12 +700,17 @@ static inline void cleanup(void) {
 	pthread_attr_destroy(&ctx.detached_thread);
 
 	VECTOR_FREE(ctx.async_pids);
+	VECTOR_FREE(ctx.send_queues);
+#ifdef USE_IO_URING
+	fastd_send_batches_free();
+#endif
 	VECTOR_FREE(ctx.peers);
 	VECTOR_FREE(ctx.eth_addrs);
 
 	free(ctx.protocol_state);
 
 	fastd_receive_unknown_free();
+	fastd_buffer_pool_free(&ctx.buffer_pool);
 
 	close_log();
 	fastd_config_release();
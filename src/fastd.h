@@ -100,6 +100,22 @@ struct fastd_protocol {
 	/** Sends a payload data packet to the given peer */
 	void (*send)(fastd_peer_t *peer, fastd_buffer_t buffer);
 
+	/** Handles up to CRYPTO_BATCH_SIZE payload packets received from the same peer (optional) */
+	void (*handle_recv_batch)(fastd_peer_t *peer, fastd_buffer_t *buffers, size_t n);
+
+	/** Sends up to CRYPTO_BATCH_SIZE payload data packets to the given peer (optional) */
+	void (*send_batch)(fastd_peer_t *peer, fastd_buffer_t *buffers, size_t n);
+
+#ifdef WITH_WORKERS
+	/**
+	   Handles a received payload packet on a worker thread (with the peer lock held)
+
+	   Returns false without touching the buffer if the packet must be handled by the control thread instead.
+	   When worker threads are used, \e send and \e send_batch may be called on the workers as well.
+	*/
+	bool (*handle_recv_worker)(fastd_peer_t *peer, fastd_buffer_t buffer);
+#endif
+
 
 	/** Initializes the protocol state for a peer */
 	void (*init_peer_state)(fastd_peer_t *peer);
@@ -159,6 +175,21 @@ struct fastd_socket {
 	const fastd_bind_address_t *addr;	/**< The address this socket is supposed to be bound to (or NULL) */
 	fastd_peer_address_t *bound_addr;	/**< The actual address that was bound to (may differ from addr when addr has a random port) */
 	fastd_peer_t *peer;			/**< If the socket belongs to a single peer (as it was create dynamically when sending a handshake), contains that peer */
+	fastd_receive_batch_t *receive_batch;	/**< Buffers for batched receives, holding the packets that have been read, but not handled yet (or NULL) */
+	fastd_send_queue_t *send_queue;		/**< Packets sent by the main thread which are waiting to be sent at the end of the main loop iteration (or NULL) */
+};
+
+/** A packet prepared to be sent with sendmsg() */
+struct fastd_send_msg {
+	struct msghdr msg;			/**< The message header */
+	struct iovec iov[2];			/**< The packet type and the payload */
+	fastd_peer_address_t remote_addr;	/**< The destination address */
+	uint8_t cbuf[64] __attribute__((aligned(8))); /**< Space for the packet info control message */
+	uint8_t packet_type;			/**< The packet type */
+	fastd_buffer_t buffer;			/**< The payload */
+	bool has_peer;				/**< Specifies if the packet is sent to a known peer */
+	uint64_t peer_id;			/**< The ID of the peer the packet is sent to */
+	size_t stat_size;			/**< The size the packet is accounted with in the peer statistics */
 };
 
 /** A TUN/TAP interface */
@@ -175,6 +206,9 @@ struct fastd_iface {
 typedef enum fastd_stat_type {
 	STAT_RX = 0,				/**< Reception statistics (total) */
 	STAT_RX_REORDERED,			/**< Reception statistics (reordered) */
+	STAT_RX_WINDOW_DROPPED,			/**< Reception statistics (dropped because they were older than the replay window) */
+	STAT_RX_REORDER_HELD,			/**< Reception statistics (held back by the reorder buffer) */
+	STAT_RX_REORDER_SKIPPED,		/**< Reception statistics (passed on by the reorder buffer without waiting for the missing packets before them any longer) */
 	STAT_TX,				/**< Transmission statistics (OK) */
 	STAT_TX_DROPPED,			/**< Transmission statistics (dropped because of full queues) */
 	STAT_TX_ERROR,				/**< Transmission statistics (other errors) */
@@ -189,6 +223,13 @@ struct fastd_stats {
 #endif
 };
 
+/** Statistics about packets coalesced with UDP generic segmentation offload */
+struct fastd_gso_stats {
+	uint64_t sends;				/**< The number of coalesced datagrams sent */
+	uint64_t segments;			/**< The number of packets sent as segments of coalesced datagrams */
+	uint64_t fallbacks;			/**< The number of coalesced datagrams rejected by the kernel, whose packets have been sent separately */
+};
+
 
 /** A data structure keeping track of an unknown addresses that a handshakes was received from recently */
 struct fastd_handshake_timeout {
@@ -217,6 +258,17 @@ struct fastd_config {
 
 #ifdef USE_PACKET_MARK
 	uint32_t packet_mark;			/**< The configured packet mark (or 0) */
+#endif
+	unsigned packet_budget;			/**< The maximum number of packets handled per ready file descriptor in each main loop iteration */
+	unsigned replay_window;			/**< The number of sequence numbers before the newest received one which are accepted once (a power of two) */
+	unsigned reorder_buffer;		/**< The number of early packets held back per peer until the packets before them have arrived (0 to disable) */
+	unsigned reorder_timeout;		/**< The maximum time in milliseconds a packet is held back by the reorder buffer */
+#ifdef USE_UDP_GRO
+	bool offload_gro;			/**< Specifies if UDP GRO is enabled on the sockets */
+#endif
+	unsigned busy_poll;			/**< The maximum time in microseconds the main loop spins before it sleeps (0 to disable busy polling) */
+#ifdef USE_BUSY_POLL
+	bool busy_poll_socket;			/**< Specifies if SO_BUSY_POLL is set on the sockets */
 #endif
 	bool forward;				/**< Specifies if packet forwarding is enable */
 	bool secure_handshakes;			/**< Can be set to false to support connections with fastd versions before v11 */
@@ -260,6 +312,12 @@ struct fastd_config {
 	char *status_socket;			/**< The path of the status socket */
 #endif
 
+#ifdef WITH_WORKERS
+	unsigned n_workers;			/**< The number of worker threads to process payload packets on (0 to handle everything on the main thread) */
+#endif
+	unsigned n_handshake_workers;		/**< The number of threads computing handshake keys (0 to compute them on the main thread) */
+	unsigned handshake_queue_limit;		/**< The maximum number of handshakes waiting for a handshake thread */
+
 #ifdef __ANDROID__
 	bool android_integration;		/**< Enable Android GUI integration features */
 #endif
@@ -273,6 +331,7 @@ struct fastd_config {
 	bool machine_readable;			/**< Supresses explanatory messages in the generate_key and show_key commands */
 	bool generate_key;			/**< Makes fastd generate a new keypair and exit */
 	bool show_key;				/**< Makes fastd output the public key for the configured secret and exit */
+	bool benchmark;				/**< Makes fastd benchmark the methods and crypto implementations and exit */
 	bool verify_config;			/**< Does basic verification of the configuration and exits */
 };
 
@@ -288,19 +347,33 @@ struct fastd_context {
 	fastd_iface_t *iface;			/**< The default tunnel interface */
 
 	uint64_t next_peer_id;			/**< An monotonously increasing ID peers are identified with in some components */
+	uint64_t next_session_serial;		/**< An monotonously increasing serial number method sessions are identified with */
 	VECTOR(fastd_peer_t *) peers;		/**< The currectly active peers */
 
 #ifdef WITH_DYNAMIC_PEERS
 	fastd_sem_t verify_limit;		/**< Keeps track of the number of verifier threads */
 #endif
 
-#ifdef USE_EPOLL
+#if defined(USE_IO_URING)
+	fastd_uring_t *uring;			/**< The io_uring instance and the operations submitted to it */
+#elif defined(USE_EPOLL)
 	int epoll_fd;				/**< The file descriptor for the epoll facility */
 #else
 	VECTOR(fastd_poll_fd_t *) fds;		/**< Vector of file descriptors to poll on, indexed by the FD itself */
 	VECTOR(struct pollfd) pollfds;		/**< The vector of pollfds for all file descriptors */
 #endif
 
+	VECTOR(fastd_send_queue_t *) send_queues; /**< The send queues with packets that haven't been sent yet */
+#ifdef USE_IO_URING
+	fastd_send_batch_t *send_batches;	/**< Send batches that are unused after all of their messages have been completed by io_uring */
+#endif
+	VECTOR(fastd_poll_fd_t *) ready_fds;	/**< The file descriptors with pending input (including those which used up their packet budget in the last iteration) */
+	fastd_poll_stats_t poll_stats;		/**< Statistics about the main loop */
+	fastd_buffer_pool_t buffer_pool;	/**< The packet buffer pool of the main thread */
+#ifdef USE_UDP_GSO
+	fastd_gso_stats_t gso_stats;		/**< Statistics about UDP GSO */
+#endif
+
 #ifdef WITH_STATUS_SOCKET
 	fastd_poll_fd_t status_fd;		/**< The file descriptor of the status socket */
 #endif
@@ -313,7 +386,9 @@ struct fastd_context {
 	size_t peer_addr_ht_used;		/**< The current number of entries in the peer address hashtable */
 	VECTOR(fastd_peer_t *) *peer_addr_ht;	/**< An array of hash buckets for the peer hash table */
 
-	fastd_pqueue_t *task_queue;		/**< Priority queue of scheduled tasks */
+	unsigned busy_poll_window;		/**< The current busy polling time in microseconds, adapted to the observed traffic */
+
+	fastd_timer_wheel_t task_queue;		/**< Timer wheel of scheduled tasks */
 	fastd_task_t next_maintenance;		/**< Schedules the next maintenance call */
 
 	VECTOR(pid_t) async_pids;		/**< PIDs of asynchronously executed commands which still have to be reaped */
@@ -322,6 +397,25 @@ struct fastd_context {
 
 	pthread_attr_t detached_thread;		/**< pthread_attr_t for creating detached threads */
 
+	fastd_offload_pool_t *offload_pool;	/**< The thread pool handshake computations are offloaded to (NULL if disabled) */
+
+#ifdef WITH_WORKERS
+	fastd_worker_t *workers;		/**< The worker threads (conf.n_workers elements) */
+	bool workers_running;			/**< Set while the worker threads are running */
+	pthread_mutex_t worker_peer_locks[WORKER_PEER_LOCKS]; /**< Protect the state of the peers (recursive; a peer's lock is selected by its ID) */
+	pthread_mutex_t eth_addr_lock;		/**< Protects eth_addrs against concurrent access from worker threads */
+
+	fastd_worker_peers_t *worker_peers;	/**< The peer table used by the workers (accessed atomically) */
+	bool worker_peers_dirty;		/**< Set when worker_peers must be recreated */
+	VECTOR(fastd_worker_garbage_t) worker_garbage; /**< Memory to free after the next grace period */
+	VECTOR(fastd_worker_garbage_t) worker_garbage_pending; /**< Memory to free after the current grace period */
+
+	pthread_mutex_t buffer_pool_lock;	/**< Protects the buffer pool configuration the workers copy their settings from */
+	unsigned buffer_pool_generation;	/**< Incremented whenever the buffer pool configuration changes (accessed atomically) */
+	size_t buffer_pool_sizes[BUFFER_CLASS_MAX]; /**< The current sizes of the buffer pool's size classes */
+	size_t worker_max_packet_len;		/**< The size of the largest packet that can be received, for use by the workers */
+#endif
+
 #ifdef __ANDROID__
 	int android_ctrl_sock_fd;		/**< The unix domain socket for communicating with Android GUI */
 #endif
@@ -358,11 +452,28 @@ extern fastd_config_t conf;
 void fastd_send(const fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr, fastd_peer_t *peer, fastd_buffer_t buffer, size_t stat_size);
 void fastd_send_handshake(const fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr, fastd_peer_t *peer, fastd_buffer_t buffer);
 void fastd_send_data(fastd_buffer_t buffer, fastd_peer_t *source, fastd_peer_t *dest);
+void fastd_send_data_batch(fastd_buffer_t *buffers, size_t n, fastd_peer_t *dest);
+void fastd_send_queue_init(fastd_socket_t *sock);
+void fastd_send_queue_free(fastd_socket_t *sock);
+void fastd_send_flush(void);
+#ifdef USE_IO_URING
+bool fastd_send_complete(const fastd_poll_fd_t *fd, fastd_send_batch_t *batch, size_t msg, int res);
+void fastd_send_cancel(fastd_send_batch_t *batch, size_t msg);
+void fastd_send_batches_free(void);
+#endif
 
 void fastd_receive_unknown_init(void);
 void fastd_receive_unknown_free(void);
-void fastd_receive(fastd_socket_t *sock);
+size_t fastd_receive(fastd_socket_t *sock, size_t max);
+void fastd_receive_batch_free(fastd_socket_t *sock);
 void fastd_handle_receive(fastd_peer_t *peer, fastd_buffer_t buffer, bool reordered);
+#ifdef USE_IO_URING
+void fastd_receive_message(fastd_socket_t *sock, struct msghdr *message, fastd_buffer_t buffer);
+#endif
+#ifdef WITH_WORKERS
+bool fastd_receive_worker(fastd_socket_t *sock, size_t sock_index);
+bool fastd_receive_pending(const fastd_socket_t *sock);
+#endif
 
 void fastd_close_all_fds(void);
 
@@ -370,16 +481,26 @@ void fastd_socket_bind_all(void);
 fastd_socket_t * fastd_socket_open(fastd_peer_t *peer, int af);
 void fastd_socket_close(fastd_socket_t *sock);
 void fastd_socket_error(fastd_socket_t *sock);
+#ifdef WITH_WORKERS
+bool fastd_socket_open_sibling(fastd_socket_t *sibling, const fastd_socket_t *sock);
+#endif
 
 void fastd_resolve_peer(fastd_peer_t *peer, fastd_remote_t *remote);
 
 fastd_iface_t * fastd_iface_open(fastd_peer_t *peer);
-void fastd_iface_handle(fastd_iface_t *iface);
+size_t fastd_iface_handle(fastd_iface_t *iface, size_t max);
+fastd_buffer_t fastd_iface_buffer_alloc(const fastd_iface_t *iface);
+void fastd_iface_handle_packet(fastd_iface_t *iface, fastd_buffer_t buffer);
 void fastd_iface_write(fastd_iface_t *iface, fastd_buffer_t buffer);
 void fastd_iface_close(fastd_iface_t *iface);
+#ifdef WITH_WORKERS
+fastd_iface_t * fastd_iface_open_queue(const fastd_iface_t *iface);
+void fastd_iface_close_queue(fastd_iface_t *queue);
+#endif
 
 void fastd_random_bytes(void *buffer, size_t len, bool secure);
 int64_t fastd_get_time(void);
+int64_t fastd_get_time_usec(void);
 
 
 #ifdef __ANDROID__
@@ -533,6 +654,24 @@ static inline void fastd_string_stack_free(fastd_string_stack_t *str) {
 	}
 }
 
+#ifdef WITH_WORKERS
+/** Points to the current time of the calling thread (ctx.now on the main thread) */
+extern __thread int64_t *fastd_thread_now;
+#endif
+
+/**
+   Returns the current time of the calling thread
+
+   Worker threads keep their own time, as ctx.now belongs to the main thread.
+*/
+static inline int64_t fastd_now(void) {
+#ifdef WITH_WORKERS
+	return *fastd_thread_now;
+#else
+	return ctx.now;
+#endif
+}
+
 /**
    Checks if a timeout has occured
 
@@ -543,7 +682,7 @@ static inline void fastd_string_stack_free(fastd_string_stack_t *str) {
    \note The current time is updated only once per main loop iteration, after waiting for input.
 */
 static inline bool fastd_timed_out(fastd_timeout_t timeout) {
-	return timeout <= ctx.now;
+	return timeout <= fastd_now();
 }
 
 /** Returns the minimum of two fastd_timeout_t values */
@@ -557,9 +696,13 @@ static inline void fastd_timeout_advance(fastd_timeout_t *a, fastd_timeout_t v)
 		*a = v;
 }
 
-/** Updates the current time */
+/** Updates the current time of the calling thread */
 static inline void fastd_update_time(void) {
+#ifdef WITH_WORKERS
+	*fastd_thread_now = fastd_get_time();
+#else
 	ctx.now = fastd_get_time();
+#endif
 }
 
 /** Checks if a on-verify command is set */
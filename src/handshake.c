@@ -423,7 +423,12 @@ static inline const fastd_method_info_t * get_method_by_name(const fastd_string_
 	return fastd_method_get_by_name(name0);
 }
 
-/** Returns the most appropriate method to negotiate with a peer a handshake was received from */
+/**
+   Returns the most appropriate method to negotiate with a peer a handshake was received from
+
+   This is the first method of the peer's method list which is configured locally as well. Methods unknown to
+   one side (like ones added in newer versions of fastd) are skipped, so peers fall back to a common method.
+*/
 const fastd_method_info_t * fastd_handshake_get_method(const fastd_peer_t *peer, const fastd_handshake_t *handshake) {
 	const fastd_string_stack_t *methods = *fastd_peer_group_lookup_peer(peer, methods);
 
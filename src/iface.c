@@ -37,6 +37,7 @@
 #include "config.h"
 #include "peer.h"
 #include "poll.h"
+#include "worker.h"
 
 #include <net/if.h>
 #include <sys/ioctl.h>
@@ -119,6 +120,13 @@ static bool open_iface_linux(fastd_iface_t *iface, const char *ifname, uint16_t
 	}
 
 	ifr.ifr_flags |= IFF_NO_PI;
+
+#ifdef WITH_WORKERS
+	/* Each worker thread reads from a queue of its own (see fastd_iface_open_queue()) */
+	if (!iface->peer && fastd_workers_enabled())
+		ifr.ifr_flags |= IFF_MULTI_QUEUE;
+#endif
+
 	if (ioctl(iface->fd.fd, TUNSETIFF, &ifr) < 0) {
 		pr_error_errno("unable to open TUN/TAP interface: TUNSETIFF ioctl failed");
 		return false;
@@ -158,6 +166,10 @@ static bool open_iface(fastd_iface_t *iface, const char *ifname, uint16_t mtu) {
 		iface->fd = FASTD_POLL_FD(POLL_TYPE_IFACE, fastd_android_receive_tunfd());
 		fastd_android_send_pid();
 
+		/* The main loop reads from the TUN fd until there are no packets left */
+		if (fcntl(iface->fd.fd, F_SETFL, fcntl(iface->fd.fd, F_GETFL) | O_NONBLOCK) < 0)
+			exit_errno("fcntl");
+
 		return true;
 	} else {
 		/* this requires root on Android */
@@ -449,8 +461,8 @@ static void cleanup_iface(UNUSED fastd_iface_t *iface) {
 #endif
 
 
-/** Reads a packet from the TUN/TAP device */
-void fastd_iface_handle(fastd_iface_t *iface) {
+/** Allocates a buffer for reading a packet from the TUN/TAP device; the buffer length is set to the maximum packet size */
+fastd_buffer_t fastd_iface_buffer_alloc(const fastd_iface_t *iface) {
 	size_t max_len = fastd_max_payload(iface->mtu);
 
 	fastd_buffer_t buffer;
@@ -459,22 +471,72 @@ void fastd_iface_handle(fastd_iface_t *iface) {
 	else
 		buffer = fastd_buffer_alloc(max_len, conf.min_encrypt_head_space, conf.min_encrypt_tail_space);
 
-	ssize_t len = read(iface->fd.fd, buffer.data, max_len);
-	if (len < 0)
-		exit_errno("read");
-
-	buffer.len = len;
+	buffer.len = max_len;
+	return buffer;
+}
 
+/** Handles a packet read from the TUN/TAP device into a buffer allocated by fastd_iface_buffer_alloc() */
+void fastd_iface_handle_packet(fastd_iface_t *iface, fastd_buffer_t buffer) {
 	if (multiaf_tun && get_iface_type() == IFACE_TYPE_TUN)
 		fastd_buffer_push_head(&buffer, 4);
 
 	fastd_send_data(buffer, NULL, iface->peer);
 }
 
-/** Writes a packet to the TUN/TAP device */
+/** Reads a packet from the TUN/TAP device, returning false if there was no packet to read */
+static bool iface_read(fastd_iface_t *iface, fastd_buffer_t *buffer) {
+	*buffer = fastd_iface_buffer_alloc(iface);
+
+	ssize_t len = read(iface->fd.fd, buffer->data, buffer->len);
+	if (len < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			fastd_buffer_free(*buffer);
+			return false;
+		}
+
+		exit_errno("read");
+	}
+
+	buffer->len = len;
+	return true;
+}
+
+/**
+   Reads packets from the TUN/TAP device, returning the number of packets read
+
+   When the interface belongs to a single peer, up to CRYPTO_BATCH_SIZE (but at most \e max) packets
+   are read at once and sent as a batch; otherwise, the destination must be determined for each packet.
+*/
+size_t fastd_iface_handle(fastd_iface_t *iface, size_t max) {
+	fastd_buffer_t buffers[CRYPTO_BATCH_SIZE];
+	size_t n;
+
+	if (!iface->peer)
+		max = 1;
+	else if (max > CRYPTO_BATCH_SIZE)
+		max = CRYPTO_BATCH_SIZE;
+
+	for (n = 0; n < max; n++) {
+		if (!iface_read(iface, &buffers[n]))
+			break;
+
+		if (multiaf_tun && get_iface_type() == IFACE_TYPE_TUN)
+			fastd_buffer_push_head(&buffers[n], 4);
+	}
+
+	if (n == 1)
+		fastd_send_data(buffers[0], NULL, iface->peer);
+	else if (n)
+		fastd_send_data_batch(buffers, n, iface->peer);
+
+	return n;
+}
+
+/** Writes a packet to the TUN/TAP device and frees the buffer */
 void fastd_iface_write(fastd_iface_t *iface, fastd_buffer_t buffer) {
 	if (!buffer.len) {
 		pr_debug("fastd_iface_write: truncated packet");
+		fastd_buffer_free(buffer);
 		return;
 	}
 
@@ -493,6 +555,7 @@ void fastd_iface_write(fastd_iface_t *iface, fastd_buffer_t buffer) {
 
 		default:
 			pr_debug("fastd_iface_write: unknown IP version %u", version);
+			fastd_buffer_free(buffer);
 			return;
 		}
 
@@ -500,8 +563,17 @@ void fastd_iface_write(fastd_iface_t *iface, fastd_buffer_t buffer) {
 		memcpy(buffer.data, &af, 4);
 	}
 
+#ifdef USE_IO_URING
+	if (!fastd_in_worker()) {
+		fastd_poll_write(&iface->fd, buffer);
+		return;
+	}
+#endif
+
 	if (write(iface->fd.fd, buffer.data, buffer.len) < 0)
 		pr_debug2_errno("write");
+
+	fastd_buffer_free(buffer);
 }
 
 /** Opens a new TUN/TAP interface, optionally associated with a specific peer */
@@ -578,13 +650,77 @@ fastd_iface_t * fastd_iface_open(fastd_peer_t *peer) {
 	else
 		pr_debug("TUN/TAP device initialized.");
 
+#ifdef WITH_WORKERS
+	if (fastd_workers_enabled()) {
+		fastd_workers_iface_register(iface);
+		return iface;
+	}
+#endif
+
 	fastd_poll_fd_register(&iface->fd);
 
 	return iface;
 }
 
+#ifdef WITH_WORKERS
+
+/** Closes and frees a TUN/TAP device that isn't polled on anymore */
+static void free_iface(void *arg) {
+	fastd_iface_t *iface = arg;
+
+	if (close(iface->fd.fd) == 0)
+		cleanup_iface(iface);
+	else
+		pr_warn_errno("closing TUN/TAP: close");
+
+	free(iface->name);
+	free(iface);
+}
+
+/**
+   Opens an additional queue of a shared TUN/TAP interface for a worker thread
+
+   The interface must have been opened in multi-queue mode. The queue isn't registered
+   with any poll facility.
+*/
+fastd_iface_t * fastd_iface_open_queue(const fastd_iface_t *iface) {
+	struct ifreq ifr = {};
+	strncpy(ifr.ifr_name, iface->name, IFNAMSIZ-1);
+	ifr.ifr_flags = ((get_iface_type() == IFACE_TYPE_TAP) ? IFF_TAP : IFF_TUN) | IFF_NO_PI | IFF_MULTI_QUEUE;
+
+	int fd = open("/dev/net/tun", O_RDWR|O_NONBLOCK);
+	if (fd < 0)
+		exit_errno("could not open TUN/TAP device file");
+
+	if (ioctl(fd, TUNSETIFF, &ifr) < 0)
+		exit_errno("unable to open TUN/TAP interface queue: TUNSETIFF ioctl failed");
+
+	fastd_iface_t *queue = fastd_new0(fastd_iface_t);
+	queue->fd = FASTD_POLL_FD(POLL_TYPE_IFACE, fd);
+	queue->name = fastd_strdup(iface->name);
+	queue->mtu = iface->mtu;
+
+	return queue;
+}
+
+/** Closes a queue opened by fastd_iface_open_queue() after it has been unregistered from its worker */
+void fastd_iface_close_queue(fastd_iface_t *queue) {
+	fastd_workers_defer(free_iface, queue);
+}
+
+#endif
+
 /** Closes the TUN/TAP device */
 void fastd_iface_close(fastd_iface_t *iface) {
+#ifdef WITH_WORKERS
+	if (fastd_workers_enabled()) {
+		/* A worker may still be reading from the interface */
+		fastd_workers_iface_unregister(iface);
+		fastd_workers_defer(free_iface, iface);
+		return;
+	}
+#endif
+
 	if (fastd_poll_fd_close(&iface->fd))
 		cleanup_iface(iface);
 	else
@@ -66,6 +66,9 @@ static const keyword_t keywords[] = {
 	{ "async", TOK_ASYNC },
 	{ "auto", TOK_AUTO },
 	{ "bind", TOK_BIND },
+	{ "budget", TOK_BUDGET },
+	{ "buffer", TOK_BUFFER },
+	{ "busy", TOK_BUSY },
 	{ "capabilities", TOK_CAPABILITIES },
 	{ "cipher", TOK_CIPHER },
 	{ "connect", TOK_CONNECT },
@@ -83,7 +86,9 @@ static const keyword_t keywords[] = {
 	{ "force", TOK_FORCE },
 	{ "forward", TOK_FORWARD },
 	{ "from", TOK_FROM },
+	{ "gro", TOK_GRO },
 	{ "group", TOK_GROUP },
+	{ "handshake", TOK_HANDSHAKE },
 	{ "handshakes", TOK_HANDSHAKES },
 	{ "hide", TOK_HIDE },
 	{ "include", TOK_INCLUDE },
@@ -103,17 +108,21 @@ static const keyword_t keywords[] = {
 	{ "mtu", TOK_MTU },
 	{ "multitap", TOK_MULTITAP },
 	{ "no", TOK_NO },
+	{ "offload", TOK_OFFLOAD },
 	{ "on", TOK_ON },
 	{ "packet", TOK_PACKET },
 	{ "peer", TOK_PEER },
 	{ "peers", TOK_PEERS },
 	{ "persist", TOK_PERSIST },
 	{ "pmtu", TOK_PMTU },
+	{ "poll", TOK_POLL },
 	{ "port", TOK_PORT },
 	{ "post-down", TOK_POST_DOWN },
 	{ "pre-up", TOK_PRE_UP },
 	{ "protocol", TOK_PROTOCOL },
 	{ "remote", TOK_REMOTE },
+	{ "reorder", TOK_REORDER },
+	{ "replay", TOK_REPLAY },
 	{ "secret", TOK_SECRET },
 	{ "secure", TOK_SECURE },
 	{ "socket", TOK_SOCKET },
@@ -122,6 +131,7 @@ static const keyword_t keywords[] = {
 	{ "sync", TOK_SYNC },
 	{ "syslog", TOK_SYSLOG },
 	{ "tap", TOK_TAP },
+	{ "timeout", TOK_TIMEOUT },
 	{ "to", TOK_TO },
 	{ "tun", TOK_TUN },
 	{ "up", TOK_UP },
@@ -130,6 +140,8 @@ static const keyword_t keywords[] = {
 	{ "verbose", TOK_VERBOSE },
 	{ "verify", TOK_VERIFY },
 	{ "warn", TOK_WARN },
+	{ "window", TOK_WINDOW },
+	{ "workers", TOK_WORKERS },
 	{ "yes", TOK_YES },
 };
 
@@ -35,6 +35,18 @@
 #include "fastd.h"
 
 
+/**
+   Identifies a received packet in the packet sequence of a session
+
+   The session serial number is unique over fastd's whole runtime, so packets of a new
+   session are never mistaken for packets of an old one, even if the new session state
+   has been allocated at the same address.
+*/
+struct fastd_packet_seq {
+	uint64_t session;				/**< The serial number of the session the packet was received with */
+	uint64_t seq;					/**< The packet's sequence number in the session (starting with 1) */
+};
+
 /** Information about a single encryption method */
 struct fastd_method_info {
 	const char *name;				/**< The method name */
@@ -42,7 +54,18 @@ struct fastd_method_info {
 	fastd_method_t *method;				/**< Provider-specific method data */
 };
 
-/** Describes a method provider (an implementation of a class of encryption methods) */
+/**
+   Describes a method provider (an implementation of a class of encryption methods)
+
+   A provider must implement either \e encrypt and \e decrypt or \e encrypt_inplace and
+   \e decrypt_inplace. The in-place functions may only be called with buffers which have
+   at least the minimum head and tail space; fastd_method_encrypt() and fastd_method_decrypt()
+   copy the packet into a new buffer if that isn't the case.
+
+   Providers implementing the in-place functions may additionally implement \e encrypt_batch
+   and \e decrypt_batch to handle several packets of a session at once (e.g. to interleave
+   the packets in SIMD registers). The same buffer requirements apply to each packet of a batch.
+*/
 struct fastd_method_provider {
 	size_t max_overhead;				/**< The maximum number of bytes of overhead the methods may add */
 	size_t min_encrypt_head_space;			/**< The minimum head space needed for encrytion */
@@ -76,14 +99,43 @@ struct fastd_method_provider {
 
 	/** Encrypts a packet for a given session, adding method-specific headers */
 	bool (*encrypt)(fastd_peer_t *peer, fastd_method_session_state_t *session, fastd_buffer_t *out, fastd_buffer_t in);
-	/** Decrypts a packet for a given session, stripping method-specific headers */
-	bool (*decrypt)(fastd_peer_t *peer, fastd_method_session_state_t *session, fastd_buffer_t *out, fastd_buffer_t in, bool *reordered);
+	/**
+	   Decrypts a packet for a given session, stripping method-specific headers
+
+	   Methods which number their packets set \e seq to the packet's session and sequence number;
+	   it is left unchanged by methods which don't.
+	*/
+	bool (*decrypt)(fastd_peer_t *peer, fastd_method_session_state_t *session, fastd_buffer_t *out, fastd_buffer_t in, bool *reordered, fastd_packet_seq_t *seq);
+
+	/** Encrypts a packet for a given session in its own buffer, using the head and tail space for the method-specific headers */
+	bool (*encrypt_inplace)(fastd_peer_t *peer, fastd_method_session_state_t *session, fastd_buffer_t *buffer);
+	/**
+	   Decrypts a packet for a given session in its own buffer
+
+	   When the packet can't be decrypted, the packet data must be left unchanged, so it can be
+	   tried with a different session. The head and tail space may be modified.
+	*/
+	bool (*decrypt_inplace)(fastd_peer_t *peer, fastd_method_session_state_t *session, fastd_buffer_t *buffer, bool *reordered, fastd_packet_seq_t *seq);
+
+	/** Encrypts \e n packets for a given session in their own buffers, setting \e ok[i] to the result of each packet (optional) */
+	void (*encrypt_batch)(fastd_peer_t *peer, fastd_method_session_state_t *session, fastd_buffer_t *buffers, size_t n, bool *ok);
+	/**
+	   Decrypts \e n packets for a given session in their own buffers, setting \e ok[i], \e reordered[i] and \e seq[i] for each packet (optional)
+
+	   Packets which can't be decrypted must be left unchanged, like with \e decrypt_inplace.
+	*/
+	void (*decrypt_batch)(fastd_peer_t *peer, fastd_method_session_state_t *session, fastd_buffer_t *buffers, size_t n, bool *ok, bool *reordered, fastd_packet_seq_t *seq);
 };
 
 
 /** Searches for a provider providing a method and instanciates it */
 bool fastd_method_create_by_name(const char *name, const fastd_method_provider_t **provider, fastd_method_t **method);
 
+bool fastd_method_encrypt(const fastd_method_provider_t *provider, fastd_peer_t *peer, fastd_method_session_state_t *session, fastd_buffer_t *out, fastd_buffer_t in);
+bool fastd_method_decrypt(const fastd_method_provider_t *provider, fastd_peer_t *peer, fastd_method_session_state_t *session, fastd_buffer_t *out, fastd_buffer_t in, bool *reordered, fastd_packet_seq_t *seq);
+void fastd_method_encrypt_batch(const fastd_method_provider_t *provider, fastd_peer_t *peer, fastd_method_session_state_t *session, fastd_buffer_t *buffers, size_t n, bool *ok);
+void fastd_method_decrypt_batch(const fastd_method_provider_t *provider, fastd_peer_t *peer, fastd_method_session_state_t *session, fastd_buffer_t *buffers, size_t n, bool *ok, bool *reordered, fastd_packet_seq_t *seq);
+
 
 /** Finds the fastd_method_info_t for a configured method */
 static inline const fastd_method_info_t * fastd_method_get_by_name(const char *name) {
@@ -0,0 +1,286 @@
+/*
+  Copyright (c) 2012-2016, Matthias Schiffer <mschiffer@universe-factory.net>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   \file
+
+   aesni-gcm method provider
+
+   aesni-gcm provides the aes128-gcm method for x86 CPUs supporting the AES-NI and
+   PCLMULQDQ instructions. Unlike generic-gmac, which runs the cipher and GHASH one after
+   another, the encryption and authentication are done in a single pass over each packet.
+   The packets are compatible with the aes128-gcm packets of generic-gmac.
+*/
+
+
+#include "aesni_gcm.h"
+#include "../../cpuid.h"
+
+
+/**
+   Returns true if the name is "aes128-gcm" and the CPU supports the needed instructions
+
+   The method is left to generic-gmac when an implementation has been configured for the
+   aes128-ctr cipher or the ghash MAC, so such a configuration is honored.
+*/
+static bool method_create_by_name(const char *name, UNUSED fastd_method_t **method) {
+	static const uint64_t REQ = CPUID_FXSR|CPUID_SSSE3|CPUID_PCLMULQDQ|CPUID_AES;
+
+	if (strcmp(name, "aes128-gcm"))
+		return false;
+
+	if (fastd_cipher_is_configured("aes128-ctr") || fastd_mac_is_configured("ghash"))
+		return false;
+
+	return ((fastd_cpuid()&REQ) == REQ);
+}
+
+/** Does nothing as the aesni-gcm provider provides only a single method */
+static void method_destroy(UNUSED fastd_method_t *method) {
+}
+
+/** Returns the AES128 key length */
+static size_t method_key_length(UNUSED const fastd_method_t *method) {
+	return 16;
+}
+
+/** Initializes a session */
+static fastd_method_session_state_t * method_session_init(UNUSED const fastd_method_t *method, const uint8_t *secret, bool initiator) {
+	fastd_method_session_state_t *session = fastd_new_aligned(fastd_method_session_state_t, 16);
+
+	fastd_method_common_init(&session->common, initiator);
+	fastd_aesni_gcm_init_keys(session, secret);
+
+	return session;
+}
+
+/** Checks if the session is currently valid */
+static bool method_session_is_valid(fastd_method_session_state_t *session) {
+	return (session && fastd_method_session_common_is_valid(&session->common));
+}
+
+/** Checks if this side is the initator of the session */
+static bool method_session_is_initiator(fastd_method_session_state_t *session) {
+	return fastd_method_session_common_is_initiator(&session->common);
+}
+
+/** Checks if the session should be refreshed */
+static bool method_session_want_refresh(fastd_method_session_state_t *session) {
+	return fastd_method_session_common_want_refresh(&session->common);
+}
+
+/** Marks the session as superseded */
+static void method_session_superseded(fastd_method_session_state_t *session) {
+	fastd_method_session_common_superseded(&session->common);
+}
+
+/** Frees the session state */
+static void method_session_free(fastd_method_session_state_t *session) {
+	if (session) {
+		fastd_method_common_free(&session->common);
+		secure_memzero(session, sizeof(*session));
+		free(session);
+	}
+}
+
+
+/** Prepares a packet for encryption, returning the location of its tag block and the nonce to use */
+static fastd_block128_t * prepare_encrypt(fastd_method_session_state_t *session, fastd_buffer_t *buf, uint8_t nonce[sizeof(fastd_block128_t)]) {
+	fastd_buffer_pull_head(buf, sizeof(fastd_block128_t));
+	fastd_block128_t *blocks = buf->data;
+
+	fastd_method_expand_nonce(nonce, session->common.send_nonce, sizeof(fastd_block128_t));
+
+	fastd_method_put_common_header(buf, session->common.send_nonce, 0);
+	fastd_method_increment_nonce(&session->common);
+
+	return blocks;
+}
+
+/** Encrypts and authenticates a packet in place */
+static bool method_encrypt(UNUSED fastd_peer_t *peer, fastd_method_session_state_t *session, fastd_buffer_t *buffer) {
+	fastd_buffer_t buf = *buffer;
+	size_t len = buf.len;
+
+	uint8_t nonce[sizeof(fastd_block128_t)] __attribute__((aligned(8)));
+	fastd_block128_t *blocks = prepare_encrypt(session, &buf, nonce);
+
+	fastd_aesni_gcm_seal(session, blocks, len, nonce);
+
+	*buffer = buf;
+	return true;
+}
+
+/**
+   Encrypts and authenticates a batch of packets in place
+
+   The packets are encrypted in pairs by fastd_aesni_gcm_seal_batch(), which interleaves
+   the computations of both packets.
+*/
+static void method_encrypt_batch(UNUSED fastd_peer_t *peer, fastd_method_session_state_t *session, fastd_buffer_t *buffers, size_t n, bool *ok) {
+	fastd_block128_t *blocks[CRYPTO_BATCH_SIZE];
+	size_t len[CRYPTO_BATCH_SIZE];
+	uint8_t nonces[CRYPTO_BATCH_SIZE][sizeof(fastd_block128_t)] __attribute__((aligned(8)));
+
+	size_t i;
+	for (i = 0; i < n; i++) {
+		len[i] = buffers[i].len;
+		blocks[i] = prepare_encrypt(session, &buffers[i], nonces[i]);
+		ok[i] = true;
+	}
+
+	fastd_aesni_gcm_seal_batch(session, blocks, len, nonces, n);
+}
+
+/** Checks the header of a received packet and strips it, returning the packet's nonce and age */
+static bool handle_header(fastd_method_session_state_t *session, fastd_buffer_t *buf, uint8_t in_nonce[COMMON_NONCEBYTES], int64_t *age) {
+	if (buf->len < COMMON_HEADBYTES+sizeof(fastd_block128_t))
+		return false;
+
+	if (!method_session_is_valid(session))
+		return false;
+
+	uint8_t flags;
+	if (!fastd_method_handle_common_header(&session->common, buf, in_nonce, &flags, age))
+		return false;
+
+	return !flags;
+}
+
+/** Strips the tag block of a decrypted packet and updates the replay window */
+static void finish_decrypt(fastd_peer_t *peer, fastd_method_session_state_t *session, fastd_buffer_t *buf, const uint8_t in_nonce[COMMON_NONCEBYTES], int64_t age, bool *reordered, fastd_packet_seq_t *seq) {
+	fastd_buffer_push_head(buf, sizeof(fastd_block128_t));
+
+	fastd_tristate_t reorder_check = fastd_method_reorder_check(peer, &session->common, in_nonce, age, buf->len);
+	if (reorder_check.set) {
+		*reordered = reorder_check.state;
+		*seq = fastd_method_packet_seq(&session->common, in_nonce);
+	}
+	else {
+		buf->len = 0;
+	}
+}
+
+/** Verifies and decrypts a packet in place */
+static bool method_decrypt(fastd_peer_t *peer, fastd_method_session_state_t *session, fastd_buffer_t *buffer, bool *reordered, fastd_packet_seq_t *seq) {
+	fastd_buffer_t buf = *buffer;
+
+	uint8_t in_nonce[COMMON_NONCEBYTES];
+	int64_t age;
+	if (!handle_header(session, &buf, in_nonce, &age))
+		return false;
+
+	uint8_t nonce[sizeof(fastd_block128_t)] __attribute__((aligned(8)));
+	fastd_method_expand_nonce(nonce, in_nonce, sizeof(nonce));
+
+	if (!fastd_aesni_gcm_open(session, buf.data, buf.len-sizeof(fastd_block128_t), nonce))
+		return false;
+
+	finish_decrypt(peer, session, &buf, in_nonce, age, reordered, seq);
+
+	*buffer = buf;
+	return true;
+}
+
+/**
+   Verifies and decrypts a batch of packets in place
+
+   The packets with valid headers are decrypted in pairs by fastd_aesni_gcm_open_batch(). The replay
+   window is updated in the order of the packets afterwards; as the packets before it may have moved
+   the window, the nonce of each packet is checked again at that point.
+*/
+static void method_decrypt_batch(fastd_peer_t *peer, fastd_method_session_state_t *session, fastd_buffer_t *buffers, size_t n, bool *ok, bool *reordered, fastd_packet_seq_t *seq) {
+	fastd_buffer_t bufs[CRYPTO_BATCH_SIZE];
+	uint8_t in_nonces[CRYPTO_BATCH_SIZE][COMMON_NONCEBYTES];
+	uint8_t nonces[CRYPTO_BATCH_SIZE][sizeof(fastd_block128_t)] __attribute__((aligned(8)));
+	fastd_block128_t *blocks[CRYPTO_BATCH_SIZE];
+	size_t len[CRYPTO_BATCH_SIZE], index[CRYPTO_BATCH_SIZE];
+	bool valid[CRYPTO_BATCH_SIZE];
+
+	size_t i, j, m = 0;
+	for (i = 0; i < n; i++) {
+		int64_t age;
+
+		ok[i] = false;
+		bufs[i] = buffers[i];
+
+		if (!handle_header(session, &bufs[i], in_nonces[i], &age))
+			continue;
+
+		fastd_method_expand_nonce(nonces[m], in_nonces[i], sizeof(nonces[m]));
+		blocks[m] = bufs[i].data;
+		len[m] = bufs[i].len-sizeof(fastd_block128_t);
+		index[m] = i;
+		m++;
+	}
+
+	fastd_aesni_gcm_open_batch(session, blocks, len, nonces, m, valid);
+
+	for (j = 0; j < m; j++) {
+		if (!valid[j])
+			continue;
+
+		i = index[j];
+
+		int64_t age;
+		if (fastd_method_is_nonce_valid(&session->common, in_nonces[i], &age)) {
+			finish_decrypt(peer, session, &bufs[i], in_nonces[i], age, &reordered[i], &seq[i]);
+		}
+		else {
+			/* The packets before it have moved the replay window past this one */
+			fastd_buffer_push_head(&bufs[i], sizeof(fastd_block128_t));
+			bufs[i].len = 0;
+		}
+
+		buffers[i] = bufs[i];
+		ok[i] = true;
+	}
+}
+
+/** The aesni-gcm method provider */
+const fastd_method_provider_t fastd_method_aesni_gcm = {
+	.max_overhead = COMMON_HEADBYTES + sizeof(fastd_block128_t),
+	.min_encrypt_head_space = sizeof(fastd_block128_t) + COMMON_HEADBYTES,
+	.min_decrypt_head_space = 0,
+	.min_encrypt_tail_space = 0,
+	.min_decrypt_tail_space = 0,
+
+	.create_by_name = method_create_by_name,
+	.destroy = method_destroy,
+
+	.key_length = method_key_length,
+
+	.session_init = method_session_init,
+	.session_is_valid = method_session_is_valid,
+	.session_is_initiator = method_session_is_initiator,
+	.session_want_refresh = method_session_want_refresh,
+	.session_superseded = method_session_superseded,
+	.session_free = method_session_free,
+
+	.encrypt_inplace = method_encrypt,
+	.decrypt_inplace = method_decrypt,
+	.encrypt_batch = method_encrypt_batch,
+	.decrypt_batch = method_decrypt_batch,
+};
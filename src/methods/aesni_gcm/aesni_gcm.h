@@ -0,0 +1,53 @@
+/*
+  Copyright (c) 2012-2016, Matthias Schiffer <mschiffer@universe-factory.net>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   \file
+
+   aesni-gcm method provider (stitched AES128-GCM using AES-NI and PCLMULQDQ)
+*/
+
+
+#pragma once
+
+#include "../../crypto.h"
+#include "../../method.h"
+#include "../common.h"
+
+
+/** The method-specific session state */
+struct fastd_method_session_state {
+	fastd_method_common_t common;		/**< The common method state */
+
+	fastd_block128_t round_keys[11];	/**< The expanded AES128 key */
+	fastd_block128_t H;			/**< The GHASH key, byteswapped for the PCLMULQDQ multiplication */
+};
+
+
+void fastd_aesni_gcm_init_keys(fastd_method_session_state_t *session, const uint8_t *key);
+void fastd_aesni_gcm_seal(const fastd_method_session_state_t *session, fastd_block128_t *blocks, size_t len, const uint8_t iv[16]);
+bool fastd_aesni_gcm_open(const fastd_method_session_state_t *session, fastd_block128_t *blocks, size_t len, const uint8_t iv[16]);
+void fastd_aesni_gcm_seal_batch(const fastd_method_session_state_t *session, fastd_block128_t *const *blocks, const size_t *len, const uint8_t (*iv)[16], size_t n);
+void fastd_aesni_gcm_open_batch(const fastd_method_session_state_t *session, fastd_block128_t *const *blocks, const size_t *len, const uint8_t (*iv)[16], size_t n, bool *ok);
@@ -0,0 +1,342 @@
+/*
+  Copyright (c) 2012-2016, Matthias Schiffer <mschiffer@universe-factory.net>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   \file
+
+   aesni-gcm method provider: implementation
+*/
+
+
+#include "aesni_gcm.h"
+#include "../../crypto/cipher/aes128_ctr/aesni/aes128_aesni.h"
+#include "../../crypto/mac/ghash/pclmulqdq/ghash_pclmulqdq_gmul.h"
+
+
+/**
+   The number of blocks encrypted per iteration
+
+   The AES rounds of these blocks are interleaved, and can be executed while the GHASH
+   multiplications of the previous blocks are still in progress.
+*/
+#define PARALLEL_BLOCKS 4
+
+
+/** Loads the round keys of a session */
+static inline void load_round_keys(__m128i rk[11], const fastd_method_session_state_t *session) {
+	size_t i;
+	for (i = 0; i < 11; i++)
+		rk[i] = _mm_load_si128((const __m128i *)&session->round_keys[i]);
+}
+
+/**
+   Increments a byteswapped counter block
+
+   Only the lower 64 bits are incremented: the expanded nonce starts with a low half of 1,
+   so it can't overflow.
+*/
+static inline __m128i increment(__m128i ctr) {
+	return _mm_add_epi64(ctr, _mm_set_epi64x(0, 1));
+}
+
+/** Returns the byteswapped GHASH length block for \e len bytes of data */
+static inline __m128i length_block(size_t len) {
+	return _mm_set_epi64x(0, (uint64_t)len << 3);
+}
+
+/** Adds a block to the GHASH value */
+static inline __m128i ghash_update(__m128i X, __m128i H, __m128i block) {
+	return gmul(_mm_xor_si128(X, byteswap(block)), H);
+}
+
+/**
+   Processes a partial last block
+
+   The (zero-padded) block is authenticated before encryption when decrypting,
+   and after encryption otherwise.
+*/
+static inline __m128i crypt_partial(__m128i X, __m128i H, __m128i keystream, uint8_t *data, size_t len, bool decrypt) {
+	fastd_block128_t tmp = {};
+	memcpy(&tmp, data, len);
+
+	__m128i block = _mm_load_si128((const __m128i *)&tmp);
+	if (decrypt)
+		X = ghash_update(X, H, block);
+
+	_mm_store_si128((__m128i *)&tmp, _mm_xor_si128(block, keystream));
+	memset(tmp.b+len, 0, sizeof(tmp)-len);
+
+	if (!decrypt)
+		X = ghash_update(X, H, _mm_load_si128((const __m128i *)&tmp));
+
+	memcpy(data, &tmp, len);
+	return X;
+}
+
+/** Fills \e b with the next \e n counter blocks, advancing the byteswapped counter \e ctr */
+static inline void counter_blocks(__m128i *b, __m128i *ctr, size_t n) {
+	size_t i;
+	for (i = 0; i < n; i++) {
+		b[i] = byteswap(*ctr);
+		*ctr = increment(*ctr);
+	}
+}
+
+/** Applies a keystream block to a data block and adds the ciphertext to the GHASH value */
+static inline __m128i crypt_block(__m128i X, __m128i H, fastd_block128_t *data, __m128i keystream, bool decrypt) {
+	__m128i in = _mm_loadu_si128((const __m128i *)data);
+	__m128i out = _mm_xor_si128(in, keystream);
+	_mm_storeu_si128((__m128i *)data, out);
+
+	return ghash_update(X, H, decrypt ? in : out);
+}
+
+/**
+   Encrypts or decrypts \e len bytes of data in counter mode, computing the GHASH of the ciphertext in the same pass
+
+   The processing starts at block \e i, with \e X being the GHASH value of the blocks before it and \e ctr
+   the byteswapped counter block of block \e i; the final GHASH value is returned.
+*/
+static __m128i crypt_stitched_from(const __m128i rk[11], __m128i H, __m128i ctr, __m128i X, fastd_block128_t *data, size_t i, size_t len, bool decrypt) {
+	size_t n_blocks = len / sizeof(fastd_block128_t);
+	size_t j;
+
+	for (; i + PARALLEL_BLOCKS <= n_blocks; i += PARALLEL_BLOCKS) {
+		__m128i b[PARALLEL_BLOCKS];
+
+		counter_blocks(b, &ctr, PARALLEL_BLOCKS);
+		aes128_aesni_encrypt_n(rk, b, PARALLEL_BLOCKS);
+
+		for (j = 0; j < PARALLEL_BLOCKS; j++)
+			X = crypt_block(X, H, &data[i+j], b[j], decrypt);
+	}
+
+	for (; i < n_blocks; i++) {
+		__m128i keystream = aes128_aesni_encrypt(rk, byteswap(ctr));
+		ctr = increment(ctr);
+
+		X = crypt_block(X, H, &data[i], keystream, decrypt);
+	}
+
+	size_t rest = len % sizeof(fastd_block128_t);
+	if (rest)
+		X = crypt_partial(X, H, aes128_aesni_encrypt(rk, byteswap(ctr)), data[i].b, rest, decrypt);
+
+	return gmul(_mm_xor_si128(X, length_block(len)), H);
+}
+
+/** Encrypts or decrypts \e len bytes of data starting with the byteswapped counter block \e ctr, returning the GHASH value */
+static inline __m128i crypt_stitched(const __m128i rk[11], __m128i H, __m128i ctr, fastd_block128_t *data, size_t len, bool decrypt) {
+	return crypt_stitched_from(rk, H, ctr, _mm_setzero_si128(), data, 0, len, decrypt);
+}
+
+/**
+   Encrypts or decrypts two packets at once, like crypt_stitched()
+
+   The AES rounds of the blocks of both packets are interleaved, and as the GHASH computations
+   of the packets don't depend on each other, the multiplications of one packet are executed while
+   those of the other one are still in progress. A single packet can't be split up like this, as each
+   GHASH multiplication needs the result of the previous one. When one of the packets is shorter,
+   the rest of the other one is processed on its own.
+*/
+static void crypt_stitched_pair(const __m128i rk[11], __m128i H, __m128i ctr[2], fastd_block128_t *data[2], const size_t len[2], bool decrypt, __m128i X[2]) {
+	size_t n_blocks = min_size_t(len[0], len[1]) / sizeof(fastd_block128_t);
+	size_t i, j;
+
+	X[0] = X[1] = _mm_setzero_si128();
+
+	for (i = 0; i + PARALLEL_BLOCKS <= n_blocks; i += PARALLEL_BLOCKS) {
+		__m128i b[2*PARALLEL_BLOCKS];
+
+		counter_blocks(b, &ctr[0], PARALLEL_BLOCKS);
+		counter_blocks(b+PARALLEL_BLOCKS, &ctr[1], PARALLEL_BLOCKS);
+		aes128_aesni_encrypt_n(rk, b, 2*PARALLEL_BLOCKS);
+
+		for (j = 0; j < PARALLEL_BLOCKS; j++) {
+			X[0] = crypt_block(X[0], H, &data[0][i+j], b[j], decrypt);
+			X[1] = crypt_block(X[1], H, &data[1][i+j], b[PARALLEL_BLOCKS+j], decrypt);
+		}
+	}
+
+	for (j = 0; j < 2; j++)
+		X[j] = crypt_stitched_from(rk, H, ctr[j], X[j], data[j], i, len[j], decrypt);
+}
+
+/** Applies the keystream to \e len bytes of data again, restoring the data after a failed verification */
+static void restore(const __m128i rk[11], __m128i ctr, fastd_block128_t *data, size_t len) {
+	size_t i;
+	for (i = 0; i < len; i += sizeof(fastd_block128_t)) {
+		fastd_block128_t keystream;
+		_mm_storeu_si128((__m128i *)&keystream, aes128_aesni_encrypt(rk, byteswap(ctr)));
+		ctr = increment(ctr);
+
+		size_t j, n = min_size_t(len-i, sizeof(fastd_block128_t));
+		for (j = 0; j < n; j++)
+			data->b[j] ^= keystream.b[j];
+
+		data++;
+	}
+}
+
+
+/** Expands the AES128 key and derives the GHASH key */
+void fastd_aesni_gcm_init_keys(fastd_method_session_state_t *session, const uint8_t *key) {
+	__m128i rk[11];
+	aes128_aesni_expand_key(rk, key);
+
+	size_t i;
+	for (i = 0; i < 11; i++)
+		_mm_store_si128((__m128i *)&session->round_keys[i], rk[i]);
+
+	__m128i H = aes128_aesni_encrypt(rk, _mm_setzero_si128());
+	_mm_store_si128((__m128i *)&session->H, byteswap(H));
+
+	secure_memzero(rk, sizeof(rk));
+}
+
+/**
+   Encrypts \e len bytes of data following the first block, and stores the authentication tag in the first block
+
+   The data is encrypted with the counter blocks following the IV, while the IV itself is used to encrypt the tag.
+*/
+void fastd_aesni_gcm_seal(const fastd_method_session_state_t *session, fastd_block128_t *blocks, size_t len, const uint8_t iv[16]) {
+	__m128i rk[11];
+	load_round_keys(rk, session);
+	__m128i H = _mm_load_si128((const __m128i *)&session->H);
+
+	__m128i ctr = byteswap(_mm_loadu_si128((const __m128i *)iv));
+	__m128i tag_key = aes128_aesni_encrypt(rk, byteswap(ctr));
+
+	__m128i X = crypt_stitched(rk, H, increment(ctr), blocks+1, len, false);
+	_mm_storeu_si128((__m128i *)&blocks[0], _mm_xor_si128(byteswap(X), tag_key));
+}
+
+/**
+   Verifies the authentication tag in the first block and decrypts \e len bytes of data following it
+
+   When the verification fails, the data is left unchanged.
+*/
+bool fastd_aesni_gcm_open(const fastd_method_session_state_t *session, fastd_block128_t *blocks, size_t len, const uint8_t iv[16]) {
+	__m128i rk[11];
+	load_round_keys(rk, session);
+	__m128i H = _mm_load_si128((const __m128i *)&session->H);
+
+	__m128i ctr = byteswap(_mm_loadu_si128((const __m128i *)iv));
+	__m128i tag_key = aes128_aesni_encrypt(rk, byteswap(ctr));
+
+	__m128i X = crypt_stitched(rk, H, increment(ctr), blocks+1, len, true);
+
+	__m128i tag = _mm_xor_si128(byteswap(X), tag_key);
+	__m128i diff = _mm_xor_si128(tag, _mm_loadu_si128((const __m128i *)&blocks[0]));
+
+	if (_mm_movemask_epi8(_mm_cmpeq_epi8(diff, _mm_setzero_si128())) == 0xffff)
+		return true;
+
+	restore(rk, increment(ctr), blocks+1, len);
+	return false;
+}
+
+/**
+   Encrypts or decrypts two packets at once, returning their authentication tags
+
+   The layout of the packets is the same as with fastd_aesni_gcm_seal() and fastd_aesni_gcm_open().
+*/
+static void crypt_pair(const __m128i rk[11], __m128i H, fastd_block128_t *const blocks[2], const size_t len[2], const uint8_t *const iv[2], bool decrypt, __m128i tag[2]) {
+	__m128i ctr[2], tag_key[2], X[2];
+	fastd_block128_t *data[2];
+	size_t j;
+
+	for (j = 0; j < 2; j++) {
+		ctr[j] = byteswap(_mm_loadu_si128((const __m128i *)iv[j]));
+		tag_key[j] = byteswap(ctr[j]);
+		ctr[j] = increment(ctr[j]);
+		data[j] = blocks[j]+1;
+	}
+
+	aes128_aesni_encrypt_n(rk, tag_key, 2);
+
+	crypt_stitched_pair(rk, H, ctr, data, len, decrypt, X);
+
+	for (j = 0; j < 2; j++)
+		tag[j] = _mm_xor_si128(byteswap(X[j]), tag_key[j]);
+}
+
+/**
+   Encrypts a batch of packets like fastd_aesni_gcm_seal()
+
+   The packets are processed in pairs, interleaving the computations of both packets.
+*/
+void fastd_aesni_gcm_seal_batch(const fastd_method_session_state_t *session, fastd_block128_t *const *blocks, const size_t *len, const uint8_t (*iv)[16], size_t n) {
+	__m128i rk[11];
+	load_round_keys(rk, session);
+	__m128i H = _mm_load_si128((const __m128i *)&session->H);
+
+	size_t i, j;
+	for (i = 0; i + 2 <= n; i += 2) {
+		const uint8_t *pair_iv[2] = { iv[i], iv[i+1] };
+		__m128i tag[2];
+
+		crypt_pair(rk, H, &blocks[i], &len[i], pair_iv, false, tag);
+
+		for (j = 0; j < 2; j++)
+			_mm_storeu_si128((__m128i *)&blocks[i+j][0], tag[j]);
+	}
+
+	if (i < n)
+		fastd_aesni_gcm_seal(session, blocks[i], len[i], iv[i]);
+}
+
+/**
+   Verifies and decrypts a batch of packets like fastd_aesni_gcm_open(), setting \e ok[i] to the result of each packet
+
+   The packets are processed in pairs, interleaving the computations of both packets. Packets
+   which fail the verification are left unchanged.
+*/
+void fastd_aesni_gcm_open_batch(const fastd_method_session_state_t *session, fastd_block128_t *const *blocks, const size_t *len, const uint8_t (*iv)[16], size_t n, bool *ok) {
+	__m128i rk[11];
+	load_round_keys(rk, session);
+	__m128i H = _mm_load_si128((const __m128i *)&session->H);
+
+	size_t i, j;
+	for (i = 0; i + 2 <= n; i += 2) {
+		const uint8_t *pair_iv[2] = { iv[i], iv[i+1] };
+		__m128i tag[2];
+
+		crypt_pair(rk, H, &blocks[i], &len[i], pair_iv, true, tag);
+
+		for (j = 0; j < 2; j++) {
+			__m128i diff = _mm_xor_si128(tag[j], _mm_loadu_si128((const __m128i *)&blocks[i+j][0]));
+			ok[i+j] = (_mm_movemask_epi8(_mm_cmpeq_epi8(diff, _mm_setzero_si128())) == 0xffff);
+
+			if (!ok[i+j]) {
+				__m128i ctr = byteswap(_mm_loadu_si128((const __m128i *)iv[i+j]));
+				restore(rk, increment(ctr), blocks[i+j]+1, len[i+j]);
+			}
+		}
+	}
+
+	if (i < n)
+		ok[i] = fastd_aesni_gcm_open(session, blocks[i], len[i], iv[i]);
+}
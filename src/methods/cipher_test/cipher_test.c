@@ -125,6 +125,7 @@ static void method_session_superseded(fastd_method_session_state_t *session) {
 /** Frees the session state */
 static void method_session_free(fastd_method_session_state_t *session) {
 	if (session) {
+		fastd_method_common_free(&session->common);
 		session->cipher->free(session->cipher_state);
 		free(session);
 	}
@@ -163,7 +164,7 @@ static bool method_encrypt(UNUSED fastd_peer_t *peer, fastd_method_session_state
 }
 
 /** Decrypts a packet */
-static bool method_decrypt(fastd_peer_t *peer, fastd_method_session_state_t *session, fastd_buffer_t *out, fastd_buffer_t in, bool *reordered) {
+static bool method_decrypt(fastd_peer_t *peer, fastd_method_session_state_t *session, fastd_buffer_t *out, fastd_buffer_t in, bool *reordered, fastd_packet_seq_t *seq) {
 	if (in.len < COMMON_HEADBYTES)
 		return false;
 
@@ -197,9 +198,10 @@ static bool method_decrypt(fastd_peer_t *peer, fastd_method_session_state_t *ses
 		return false;
 	}
 
-	fastd_tristate_t reorder_check = fastd_method_reorder_check(peer, &session->common, in_nonce, age);
+	fastd_tristate_t reorder_check = fastd_method_reorder_check(peer, &session->common, in_nonce, age, out->len);
 	if (reorder_check.set) {
 		*reordered = reorder_check.state;
+		*seq = fastd_method_packet_seq(&session->common, in_nonce);
 	}
 	else {
 		fastd_buffer_free(*out);
@@ -31,44 +31,75 @@
 
 
 #include "common.h"
+#include "../peer.h"
+
+
+/** Returns the number of 64-bit words in the ring bitmap of a session */
+static inline size_t seen_words(const fastd_method_common_t *session) {
+	return 2 * session->replay_window / 64;
+}
+
+/** Returns the ring bitmap word for a nonce */
+static inline uint64_t * seen_word(const fastd_method_common_t *session, uint64_t nonce) {
+	return &session->receive_seen[(nonce >> 7) & (seen_words(session) - 1)];
+}
+
+/** Returns the bit in the ring bitmap word for a nonce */
+static inline uint64_t seen_bit(uint64_t nonce) {
+	return (uint64_t)1 << ((nonce >> 1) & 63);
+}
 
 
 /** Common initialization for a new session */
 void fastd_method_common_init(fastd_method_common_t *session, bool initiator) {
 	memset(session, 0, sizeof(*session));
 
+	session->serial = ++ctx.next_session_serial;
+
 	session->valid_till = ctx.now + KEY_VALID;
 	session->refresh_after = ctx.now + KEY_REFRESH - fastd_rand(0, KEY_REFRESH_SPLAY);
 
+	session->replay_window = conf.replay_window;
+	session->receive_seen = fastd_new0_array(seen_words(session), uint64_t);
+
 	if (initiator) {
 		session->send_nonce[COMMON_NONCEBYTES-1] = 3;
 	}
 	else {
 		session->send_nonce[COMMON_NONCEBYTES-1] = 2;
-		session->receive_nonce[COMMON_NONCEBYTES-1] = 1;
+		session->receive_nonce = 1;
 	}
+
+	*seen_word(session, session->receive_nonce) |= seen_bit(session->receive_nonce);
 }
 
-/** Checks if a received nonce is valid */
-bool fastd_method_is_nonce_valid(const fastd_method_common_t *session, const uint8_t nonce[COMMON_NONCEBYTES], int64_t *age) {
-	if ((nonce[0] & 1) != (session->receive_nonce[0] & 1))
-		return false;
+/** Frees the common state of a session */
+void fastd_method_common_free(fastd_method_common_t *session) {
+	free(session->receive_seen);
+	session->receive_seen = NULL;
+}
 
-	size_t i;
-	*age = 0;
+/**
+   Checks if a nonce may be valid for a session
 
-	for (i = 0; i < COMMON_NONCEBYTES; i++) {
-		*age <<= 8;
-		*age += session->receive_nonce[i] - nonce[i];
-	}
+   Packets which are too old even for an overlapping, slightly outdated session are rejected
+   here before their authentication tag is checked; packets older than the replay window,
+   but younger than twice its size are only dropped by fastd_method_reorder_check(), so they
+   are counted when they turn out to be authentic.
+*/
+bool fastd_method_is_nonce_valid(const fastd_method_common_t *session, const uint8_t nonce[COMMON_NONCEBYTES], int64_t *age) {
+	uint64_t value = fastd_method_nonce_value(nonce);
+
+	if ((value & 1) != (session->receive_nonce & 1))
+		return false;
 
-	*age >>= 1;
+	*age = (int64_t)(session->receive_nonce - value) / 2;
 
 	if (*age >= 0) {
 		if (fastd_timed_out(session->reorder_timeout))
 			return false;
 
-		if (*age > 64)
+		if ((uint64_t)*age >= 2 * session->replay_window)
 			return false;
 	}
 
@@ -82,29 +113,40 @@ bool fastd_method_is_nonce_valid(const fastd_method_common_t *session, const uin
    false if the packet is okay and not reordered and true
    if it is reordered.
 */
-fastd_tristate_t fastd_method_reorder_check(fastd_peer_t *peer, fastd_method_common_t *session, const uint8_t nonce[COMMON_NONCEBYTES], int64_t age) {
-	if (age < 0) {
-		size_t shift = -age;
-
-		if (shift >= 64)
-			session->receive_reorder_seen = 0;
-		else
-			session->receive_reorder_seen <<= shift;
-
-		if (shift <= 64)
-			session->receive_reorder_seen |= ((uint64_t)1 << (shift-1));
+fastd_tristate_t fastd_method_reorder_check(fastd_peer_t *peer, fastd_method_common_t *session, const uint8_t nonce[COMMON_NONCEBYTES], int64_t age, size_t len) {
+	uint64_t value = fastd_method_nonce_value(nonce);
 
-		memcpy(session->receive_nonce, nonce, COMMON_NONCEBYTES);
-		session->reorder_timeout = ctx.now + REORDER_TIME;
+	if (age < 0) {
+		/* Clear the words between the old and the new newest sequence number */
+		uint64_t shift = ((value >> 7) - (session->receive_nonce >> 7));
+
+		if (shift >= seen_words(session)) {
+			memset(session->receive_seen, 0, seen_words(session) * sizeof(uint64_t));
+		}
+		else {
+			uint64_t i;
+			for (i = 1; i <= shift; i++)
+				*seen_word(session, session->receive_nonce + 128*i) = 0;
+		}
+
+		*seen_word(session, value) |= seen_bit(value);
+
+		session->receive_nonce = value;
+		session->reorder_timeout = fastd_now() + REORDER_TIME;
 		return FASTD_TRISTATE_FALSE;
 	}
-	else if (age == 0 || session->receive_reorder_seen & ((uint64_t)1 << (age-1))) {
+	else if ((uint64_t)age >= session->replay_window) {
+		pr_debug2("dropping packet from %P outside of replay window (age %u)", peer, (unsigned)age);
+		fastd_stats_add(peer, STAT_RX_WINDOW_DROPPED, len);
+		return FASTD_TRISTATE_UNDEF;
+	}
+	else if (*seen_word(session, value) & seen_bit(value)) {
 		pr_debug("dropping duplicate packet from %P (age %u)", peer, (unsigned)age);
 		return FASTD_TRISTATE_UNDEF;
 	}
 	else {
 		pr_debug2("accepting reordered packet from %P (age %u)", peer, (unsigned)age);
-		session->receive_reorder_seen |= ((uint64_t)1 << (age-1));
+		*seen_word(session, value) |= seen_bit(value);
 		return FASTD_TRISTATE_TRUE;
 	}
 }
@@ -33,6 +33,7 @@
 #pragma once
 
 #include "../fastd.h"
+#include "../method.h"
 
 
 /** The length of the nonce in the common method packet header */
@@ -50,16 +51,21 @@ typedef struct fastd_method_common {
 	fastd_timeout_t refresh_after;			/**< When to try refreshing the session */
 
 	uint8_t send_nonce[COMMON_NONCEBYTES];		/**< The next nonce to use */
-	uint8_t receive_nonce[COMMON_NONCEBYTES];	/**< The hightest nonce received to far for this session */
+	uint64_t receive_nonce;				/**< The hightest nonce received to far for this session */
 
 	fastd_timeout_t reorder_timeout;		/**< How long to packets with a lower sequence number (nonce) than the newest received */
-	uint64_t receive_reorder_seen;			/**< Bitmap specifying which of the 64 sequence numbers (nonces) before \a receive_nonce have bit seen */
+
+	size_t replay_window;				/**< The number of sequence numbers before \a receive_nonce which are accepted (a power of two) */
+	uint64_t *receive_seen;				/**< Ring bitmap of 2*\a replay_window bits, indexed by sequence number, specifying which sequence numbers have been seen */
+
+	uint64_t serial;				/**< The serial number of the session (see fastd_packet_seq_t) */
 } fastd_method_common_t;
 
 
 void fastd_method_common_init(fastd_method_common_t *session, bool initiator);
+void fastd_method_common_free(fastd_method_common_t *session);
 bool fastd_method_is_nonce_valid(const fastd_method_common_t *session, const uint8_t nonce[COMMON_NONCEBYTES], int64_t *age);
-fastd_tristate_t fastd_method_reorder_check(fastd_peer_t *peer, fastd_method_common_t *session, const uint8_t nonce[COMMON_NONCEBYTES], int64_t age);
+fastd_tristate_t fastd_method_reorder_check(fastd_peer_t *peer, fastd_method_common_t *session, const uint8_t nonce[COMMON_NONCEBYTES], int64_t age, size_t len);
 
 
 /**
@@ -124,6 +130,32 @@ static inline void fastd_method_increment_nonce(fastd_method_common_t *session)
 	}
 }
 
+/** Converts a nonce to an integer */
+static inline uint64_t fastd_method_nonce_value(const uint8_t nonce[COMMON_NONCEBYTES]) {
+	uint64_t ret = 0;
+	size_t i;
+
+	for (i = 0; i < COMMON_NONCEBYTES; i++)
+		ret = (ret << 8) | nonce[i];
+
+	return ret;
+}
+
+/**
+   Returns the sequence number of a received packet
+
+   As the two sides of a session use the odd and even nonces, the sequence number is just
+   the nonce without its lowest bit. The first packet of a session has the sequence number 1.
+*/
+static inline uint64_t fastd_method_nonce_seq(const uint8_t nonce[COMMON_NONCEBYTES]) {
+	return fastd_method_nonce_value(nonce) >> 1;
+}
+
+/** Returns the position of a received packet in the packet sequence of a session */
+static inline fastd_packet_seq_t fastd_method_packet_seq(const fastd_method_common_t *session, const uint8_t nonce[COMMON_NONCEBYTES]) {
+	return (fastd_packet_seq_t){ .session = session->serial, .seq = fastd_method_nonce_seq(nonce) };
+}
+
 /** Adds the common header to a packet buffer */
 static inline void fastd_method_put_common_header(fastd_buffer_t *buffer, const uint8_t nonce[COMMON_NONCEBYTES], uint8_t flags) {
 	fastd_buffer_pull_head_from(buffer, nonce, COMMON_NONCEBYTES);
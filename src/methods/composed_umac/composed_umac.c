@@ -166,6 +166,7 @@ static void method_session_superseded(fastd_method_session_state_t *session) {
 /** Frees the session state */
 static void method_session_free(fastd_method_session_state_t *session) {
 	if (session) {
+		fastd_method_common_free(&session->common);
 		session->cipher->free(session->cipher_state);
 		session->umac_cipher->free(session->umac_cipher_state);
 		session->uhash->free(session->uhash_state);
@@ -174,55 +175,57 @@ static void method_session_free(fastd_method_session_state_t *session) {
 	}
 }
 
-/** Encrypts and authenticates a packet */
-static bool method_encrypt(UNUSED fastd_peer_t *peer, fastd_method_session_state_t *session, fastd_buffer_t *out, fastd_buffer_t in) {
-	size_t tail_len = in.len ? alignto(in.len, 2 * sizeof(fastd_block128_t))-in.len : (2 * sizeof(fastd_block128_t));
+/** Encrypts and authenticates a packet in place */
+static bool method_encrypt(UNUSED fastd_peer_t *peer, fastd_method_session_state_t *session, fastd_buffer_t *buffer) {
+	fastd_buffer_t buf = *buffer;
 
-	*out = fastd_buffer_alloc(sizeof(fastd_block128_t)+in.len, alignto(COMMON_HEADBYTES, 16), sizeof(fastd_block128_t)+tail_len);
+	size_t len = buf.len;
+	size_t tail_len = len ? alignto(len, 2 * sizeof(fastd_block128_t))-len : (2 * sizeof(fastd_block128_t));
 
-	int n_blocks = block_count(in.len, sizeof(fastd_block128_t));
+	fastd_buffer_pull_head(&buf, sizeof(fastd_block128_t));
 
-	fastd_block128_t *inblocks = in.data;
-	fastd_block128_t *outblocks = out->data;
+	int n_blocks = block_count(len, sizeof(fastd_block128_t));
+
+	fastd_block128_t *blocks = buf.data;
 	fastd_block128_t tag;
 
 	uint8_t umac_nonce[session->method->umac_cipher_info->iv_length] __attribute__((aligned(8)));
 	fastd_method_expand_nonce(umac_nonce, session->common.send_nonce, sizeof(umac_nonce));
 
-	bool ok = session->umac_cipher->crypt(session->umac_cipher_state, outblocks, &ZERO_BLOCK, sizeof(fastd_block128_t), umac_nonce);
-
-	if (ok) {
-		uint8_t nonce[session->method->cipher_info->iv_length ?: 1] __attribute__((aligned(8)));
-		fastd_method_expand_nonce(nonce, session->common.send_nonce, session->method->cipher_info->iv_length);
+	if (!session->umac_cipher->crypt(session->umac_cipher_state, blocks, &ZERO_BLOCK, sizeof(fastd_block128_t), umac_nonce))
+		return false;
 
-		ok = session->cipher->crypt(session->cipher_state, outblocks+1, inblocks, n_blocks*sizeof(fastd_block128_t), nonce);
-	}
+	uint8_t nonce[session->method->cipher_info->iv_length ?: 1] __attribute__((aligned(8)));
+	fastd_method_expand_nonce(nonce, session->common.send_nonce, session->method->cipher_info->iv_length);
 
-	if (ok) {
-		if (tail_len)
-			memset(out->data+out->len, 0, tail_len);
+	if (!session->cipher->crypt(session->cipher_state, blocks+1, blocks+1, n_blocks*sizeof(fastd_block128_t), nonce))
+		return false;
 
-		ok = session->uhash->digest(session->uhash_state, &tag, outblocks+1, out->len - sizeof(fastd_block128_t));
-	}
+	if (tail_len)
+		memset(buf.data+buf.len, 0, tail_len);
 
-	if (!ok) {
-		fastd_buffer_free(*out);
+	if (!session->uhash->digest(session->uhash_state, &tag, blocks+1, len))
 		return false;
-	}
 
-	xor_a(&outblocks[0], &tag);
+	xor_a(&blocks[0], &tag);
 
-	fastd_buffer_free(in);
-
-	fastd_method_put_common_header(out, session->common.send_nonce, 0);
+	fastd_method_put_common_header(&buf, session->common.send_nonce, 0);
 	fastd_method_increment_nonce(&session->common);
 
+	*buffer = buf;
 	return true;
 }
 
-/** Verifies and decrypts a packet */
-static bool method_decrypt(fastd_peer_t *peer, fastd_method_session_state_t *session, fastd_buffer_t *out, fastd_buffer_t in, bool *reordered) {
-	if (in.len < COMMON_HEADBYTES+sizeof(fastd_block128_t))
+/**
+   Verifies and decrypts a packet in place
+
+   As the UMAC key stream is generated by a separate cipher, the packet is verified
+   completely before it is decrypted.
+*/
+static bool method_decrypt(fastd_peer_t *peer, fastd_method_session_state_t *session, fastd_buffer_t *buffer, bool *reordered, fastd_packet_seq_t *seq) {
+	fastd_buffer_t buf = *buffer;
+
+	if (buf.len < COMMON_HEADBYTES+sizeof(fastd_block128_t))
 		return false;
 
 	if (!method_session_is_valid(session))
@@ -231,7 +234,7 @@ static bool method_decrypt(fastd_peer_t *peer, fastd_method_session_state_t *ses
 	uint8_t in_nonce[COMMON_NONCEBYTES];
 	uint8_t flags;
 	int64_t age;
-	if (!fastd_method_handle_common_header(&session->common, &in, in_nonce, &flags, &age))
+	if (!fastd_method_handle_common_header(&session->common, &buf, in_nonce, &flags, &age))
 		return false;
 
 	if (flags)
@@ -243,46 +246,41 @@ static bool method_decrypt(fastd_peer_t *peer, fastd_method_session_state_t *ses
 	uint8_t umac_nonce[session->method->umac_cipher_info->iv_length] __attribute__((aligned(8)));
 	fastd_method_expand_nonce(umac_nonce, in_nonce, sizeof(umac_nonce));
 
-	size_t in_len = in.len - sizeof(fastd_block128_t);
+	size_t in_len = buf.len - sizeof(fastd_block128_t);
 	size_t tail_len = in_len ? alignto(in_len, 2 * sizeof(fastd_block128_t))-in_len : (2 * sizeof(fastd_block128_t));
-	*out = fastd_buffer_alloc(in.len, 0, tail_len);
 
-	int n_blocks = block_count(in.len, sizeof(fastd_block128_t));
+	int n_blocks = block_count(buf.len, sizeof(fastd_block128_t));
 
-	fastd_block128_t *inblocks = in.data;
-	fastd_block128_t *outblocks = out->data;
-	fastd_block128_t tag;
+	fastd_block128_t *blocks = buf.data;
+	fastd_block128_t tag, expected;
 
-	bool ok = session->umac_cipher->crypt(session->umac_cipher_state, outblocks, inblocks, sizeof(fastd_block128_t), umac_nonce);
+	if (tail_len)
+		memset(buf.data+buf.len, 0, tail_len);
 
-	if (ok)
-		ok = session->cipher->crypt(session->cipher_state, outblocks+1, inblocks+1, (n_blocks-1)*sizeof(fastd_block128_t), nonce);
+	if (!session->uhash->digest(session->uhash_state, &tag, blocks+1, in_len))
+		return false;
 
-	if (ok) {
-		if (tail_len)
-			memset(in.data+in.len, 0, tail_len);
+	if (!session->umac_cipher->crypt(session->umac_cipher_state, &expected, blocks, sizeof(fastd_block128_t), umac_nonce))
+		return false;
 
-		ok = session->uhash->digest(session->uhash_state, &tag, inblocks+1, in_len);
-	}
+	if (!block_equal(&tag, &expected))
+		return false;
 
-	if (!ok || !block_equal(&tag, &outblocks[0])) {
-		fastd_buffer_free(*out);
+	if (!session->cipher->crypt(session->cipher_state, blocks+1, blocks+1, (n_blocks-1)*sizeof(fastd_block128_t), nonce))
 		return false;
-	}
 
-	fastd_buffer_push_head(out, sizeof(fastd_block128_t));
+	fastd_buffer_push_head(&buf, sizeof(fastd_block128_t));
 
-	fastd_tristate_t reorder_check = fastd_method_reorder_check(peer, &session->common, in_nonce, age);
+	fastd_tristate_t reorder_check = fastd_method_reorder_check(peer, &session->common, in_nonce, age, buf.len);
 	if (reorder_check.set) {
 		*reordered = reorder_check.state;
+		*seq = fastd_method_packet_seq(&session->common, in_nonce);
 	}
 	else {
-		fastd_buffer_free(*out);
-		*out = fastd_buffer_alloc(0, 0, 0);
+		buf.len = 0;
 	}
 
-	fastd_buffer_free(in);
-
+	*buffer = buf;
 	return true;
 }
 
@@ -290,9 +288,9 @@ static bool method_decrypt(fastd_peer_t *peer, fastd_method_session_state_t *ses
 /** The composed-umac method provider */
 const fastd_method_provider_t fastd_method_composed_umac = {
 	.max_overhead = COMMON_HEADBYTES + sizeof(fastd_block128_t),
-	.min_encrypt_head_space = 0,
+	.min_encrypt_head_space = sizeof(fastd_block128_t) + COMMON_HEADBYTES,
 	.min_decrypt_head_space = 0,
-	.min_encrypt_tail_space = sizeof(fastd_block128_t)-1,
+	.min_encrypt_tail_space = 2*sizeof(fastd_block128_t),
 	.min_decrypt_tail_space = 2*sizeof(fastd_block128_t),
 
 	.create_by_name = method_create_by_name,
@@ -307,6 +305,6 @@ const fastd_method_provider_t fastd_method_composed_umac = {
 	.session_superseded = method_session_superseded,
 	.session_free = method_session_free,
 
-	.encrypt = method_encrypt,
-	.decrypt = method_decrypt,
+	.encrypt_inplace = method_encrypt,
+	.decrypt_inplace = method_decrypt,
 };
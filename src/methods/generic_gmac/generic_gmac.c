@@ -158,6 +158,7 @@ static void method_session_superseded(fastd_method_session_state_t *session) {
 /** Frees the session state */
 static void method_session_free(fastd_method_session_state_t *session) {
 	if (session) {
+		fastd_method_common_free(&session->common);
 		session->cipher->free(session->cipher_state);
 		session->ghash->free(session->ghash_state);
 
@@ -176,54 +177,54 @@ static inline void put_size(fastd_block128_t *out, size_t len) {
 }
 
 
-/** Encrypts and authenticates a packet */
-static bool method_encrypt(UNUSED fastd_peer_t *peer, fastd_method_session_state_t *session, fastd_buffer_t *out, fastd_buffer_t in) {
-	fastd_buffer_pull_head_zero(&in, sizeof(fastd_block128_t));
-
-	size_t tail_len = alignto(in.len, sizeof(fastd_block128_t))-in.len;
-	*out = fastd_buffer_alloc(in.len, alignto(COMMON_HEADBYTES, 16), sizeof(fastd_block128_t)+tail_len);
+/** Encrypts and authenticates a packet in place */
+static bool method_encrypt(UNUSED fastd_peer_t *peer, fastd_method_session_state_t *session, fastd_buffer_t *buffer) {
+	fastd_buffer_t buf = *buffer;
+	fastd_buffer_pull_head_zero(&buf, sizeof(fastd_block128_t));
 
+	size_t tail_len = alignto(buf.len, sizeof(fastd_block128_t))-buf.len;
 	if (tail_len)
-		memset(in.data+in.len, 0, tail_len);
+		memset(buf.data+buf.len, 0, tail_len);
 
 	uint8_t nonce[session->method->cipher_info->iv_length] __attribute__((aligned(8)));
 	fastd_method_expand_nonce(nonce, session->common.send_nonce, sizeof(nonce));
 
-	int n_blocks = block_count(in.len, sizeof(fastd_block128_t));
+	int n_blocks = block_count(buf.len, sizeof(fastd_block128_t));
 
-	fastd_block128_t *inblocks = in.data;
-	fastd_block128_t *outblocks = out->data;
+	fastd_block128_t *blocks = buf.data;
 	fastd_block128_t tag;
 
-	bool ok = session->cipher->crypt(session->cipher_state, outblocks, inblocks, n_blocks*sizeof(fastd_block128_t), nonce);
-
-	if (ok) {
-		if (tail_len)
-			memset(out->data+out->len, 0, tail_len);
+	if (!session->cipher->crypt(session->cipher_state, blocks, blocks, n_blocks*sizeof(fastd_block128_t), nonce))
+		return false;
 
-		put_size(&outblocks[n_blocks], in.len-sizeof(fastd_block128_t));
+	if (tail_len)
+		memset(buf.data+buf.len, 0, tail_len);
 
-		ok = session->ghash->digest(session->ghash_state, &tag, outblocks+1, n_blocks*sizeof(fastd_block128_t));
-	}
+	put_size(&blocks[n_blocks], buf.len-sizeof(fastd_block128_t));
 
-	if (!ok) {
-		fastd_buffer_free(*out);
+	if (!session->ghash->digest(session->ghash_state, &tag, blocks+1, n_blocks*sizeof(fastd_block128_t)))
 		return false;
-	}
-
-	xor_a(&outblocks[0], &tag);
 
-	fastd_buffer_free(in);
+	xor_a(&blocks[0], &tag);
 
-	fastd_method_put_common_header(out, session->common.send_nonce, 0);
+	fastd_method_put_common_header(&buf, session->common.send_nonce, 0);
 	fastd_method_increment_nonce(&session->common);
 
+	*buffer = buf;
 	return true;
 }
 
-/** Verifies and decrypts a packet */
-static bool method_decrypt(fastd_peer_t *peer, fastd_method_session_state_t *session, fastd_buffer_t *out, fastd_buffer_t in, bool *reordered) {
-	if (in.len < COMMON_HEADBYTES+sizeof(fastd_block128_t))
+/**
+   Verifies and decrypts a packet in place
+
+   The authentication tag is computed over the ciphertext before decryption; as decrypting
+   with a stream cipher is an involution, a packet that fails verification is restored by
+   decrypting it a second time.
+*/
+static bool method_decrypt(fastd_peer_t *peer, fastd_method_session_state_t *session, fastd_buffer_t *buffer, bool *reordered, fastd_packet_seq_t *seq) {
+	fastd_buffer_t buf = *buffer;
+
+	if (buf.len < COMMON_HEADBYTES+sizeof(fastd_block128_t))
 		return false;
 
 	if (!method_session_is_valid(session))
@@ -232,7 +233,7 @@ static bool method_decrypt(fastd_peer_t *peer, fastd_method_session_state_t *ses
 	uint8_t in_nonce[COMMON_NONCEBYTES];
 	uint8_t flags;
 	int64_t age;
-	if (!fastd_method_handle_common_header(&session->common, &in, in_nonce, &flags, &age))
+	if (!fastd_method_handle_common_header(&session->common, &buf, in_nonce, &flags, &age))
 		return false;
 
 	if (flags)
@@ -241,44 +242,40 @@ static bool method_decrypt(fastd_peer_t *peer, fastd_method_session_state_t *ses
 	uint8_t nonce[session->method->cipher_info->iv_length] __attribute__((aligned(8)));
 	fastd_method_expand_nonce(nonce, in_nonce, sizeof(nonce));
 
-	size_t tail_len = alignto(in.len, sizeof(fastd_block128_t))-in.len;
-	*out = fastd_buffer_alloc(in.len, 0, tail_len);
+	size_t tail_len = alignto(buf.len, sizeof(fastd_block128_t))-buf.len;
+	if (tail_len)
+		memset(buf.data+buf.len, 0, tail_len);
 
-	int n_blocks = block_count(in.len, sizeof(fastd_block128_t));
+	int n_blocks = block_count(buf.len, sizeof(fastd_block128_t));
 
-	fastd_block128_t *inblocks = in.data;
-	fastd_block128_t *outblocks = out->data;
+	fastd_block128_t *blocks = buf.data;
 	fastd_block128_t tag;
 
-	bool ok = session->cipher->crypt(session->cipher_state, outblocks, inblocks, n_blocks*sizeof(fastd_block128_t), nonce);
-
-	if (ok) {
-		if (tail_len)
-			memset(in.data+in.len, 0, tail_len);
+	put_size(&blocks[n_blocks], buf.len-sizeof(fastd_block128_t));
 
-		put_size(&inblocks[n_blocks], in.len-sizeof(fastd_block128_t));
+	if (!session->ghash->digest(session->ghash_state, &tag, blocks+1, n_blocks*sizeof(fastd_block128_t)))
+		return false;
 
-		ok = session->ghash->digest(session->ghash_state, &tag, inblocks+1, n_blocks*sizeof(fastd_block128_t));
-	}
+	if (!session->cipher->crypt(session->cipher_state, blocks, blocks, n_blocks*sizeof(fastd_block128_t), nonce))
+		return false;
 
-	if (!ok || !block_equal(&tag, &outblocks[0])) {
-		fastd_buffer_free(*out);
+	if (!block_equal(&tag, &blocks[0])) {
+		session->cipher->crypt(session->cipher_state, blocks, blocks, n_blocks*sizeof(fastd_block128_t), nonce);
 		return false;
 	}
 
-	fastd_buffer_free(in);
-
-	fastd_buffer_push_head(out, sizeof(fastd_block128_t));
+	fastd_buffer_push_head(&buf, sizeof(fastd_block128_t));
 
-	fastd_tristate_t reorder_check = fastd_method_reorder_check(peer, &session->common, in_nonce, age);
+	fastd_tristate_t reorder_check = fastd_method_reorder_check(peer, &session->common, in_nonce, age, buf.len);
 	if (reorder_check.set) {
 		*reordered = reorder_check.state;
+		*seq = fastd_method_packet_seq(&session->common, in_nonce);
 	}
 	else {
-		fastd_buffer_free(*out);
-		*out = fastd_buffer_alloc(0, 0, 0);
+		buf.len = 0;
 	}
 
+	*buffer = buf;
 	return true;
 }
 
@@ -286,9 +283,9 @@ static bool method_decrypt(fastd_peer_t *peer, fastd_method_session_state_t *ses
 /** The generic-gmac method provider */
 const fastd_method_provider_t fastd_method_generic_gmac = {
 	.max_overhead = COMMON_HEADBYTES + sizeof(fastd_block128_t),
-	.min_encrypt_head_space = sizeof(fastd_block128_t),
+	.min_encrypt_head_space = sizeof(fastd_block128_t) + COMMON_HEADBYTES,
 	.min_decrypt_head_space = 0,
-	.min_encrypt_tail_space = sizeof(fastd_block128_t)-1,
+	.min_encrypt_tail_space = 2*sizeof(fastd_block128_t)-1,
 	.min_decrypt_tail_space = 2*sizeof(fastd_block128_t)-1,
 
 	.create_by_name = method_create_by_name,
@@ -303,6 +300,6 @@ const fastd_method_provider_t fastd_method_generic_gmac = {
 	.session_superseded = method_session_superseded,
 	.session_free = method_session_free,
 
-	.encrypt = method_encrypt,
-	.decrypt = method_decrypt,
+	.encrypt_inplace = method_encrypt,
+	.decrypt_inplace = method_decrypt,
 };
@@ -37,19 +37,18 @@
 #include "../../method.h"
 #include "../common.h"
 
-#include <crypto_onetimeauth_poly1305.h>
-
 
 /** The length of the key used by Poly1305 */
-#define KEYBYTES crypto_onetimeauth_poly1305_KEYBYTES
+#define KEYBYTES 32
 
 /** The length of the authentication tag */
-#define TAGBYTES crypto_onetimeauth_poly1305_BYTES
+#define TAGBYTES 16
 
 
 /** A specific method provided by this provider */
 struct fastd_method {
 	const fastd_cipher_info_t *cipher_info;		/**< The cipher used */
+	const fastd_mac_info_t *poly1305_info;		/**< Poly1305 */
 };
 
 /** The method-specific session state */
@@ -59,6 +58,8 @@ struct fastd_method_session_state {
 	const fastd_method_t *method;			/**< The specific method used */
 	const fastd_cipher_t *cipher;			/**< The cipher implementation used */
 	fastd_cipher_state_t *cipher_state;		/**< The cipher state */
+
+	const fastd_mac_t *poly1305;			/**< The Poly1305 implementation */
 };
 
 
@@ -66,6 +67,10 @@ struct fastd_method_session_state {
 static bool method_create_by_name(const char *name, fastd_method_t **method) {
 	fastd_method_t m;
 
+	m.poly1305_info = fastd_mac_info_get_by_name("poly1305");
+	if (!m.poly1305_info)
+		return false;
+
 	size_t len = strlen(name);
 	if (len < 9)
 		return false;
@@ -109,6 +114,8 @@ static fastd_method_session_state_t * method_session_init(const fastd_method_t *
 	session->cipher = fastd_cipher_get(session->method->cipher_info);
 	session->cipher_state = session->cipher->init(secret);
 
+	session->poly1305 = fastd_mac_get(method->poly1305_info);
+
 	return session;
 }
 
@@ -135,54 +142,73 @@ static void method_session_superseded(fastd_method_session_state_t *session) {
 /** Frees the session state */
 static void method_session_free(fastd_method_session_state_t *session) {
 	if (session) {
+		fastd_method_common_free(&session->common);
 		session->cipher->free(session->cipher_state);
 		free(session);
 	}
 }
 
 
-/** Encrypts and authenticates a packet */
-static bool method_encrypt(UNUSED fastd_peer_t *peer, fastd_method_session_state_t *session, fastd_buffer_t *out, fastd_buffer_t in) {
-	fastd_buffer_pull_head_zero(&in, KEYBYTES);
+/**
+   Computes the Poly1305 tag of a message
+
+   The Poly1305 key is taken from the beginning of each packet's cipher stream, so
+   the one-time digest is used when available to avoid allocating a MAC state per packet.
+*/
+static bool compute_tag(const fastd_method_session_state_t *session, fastd_block128_t *tag, const uint8_t *key, const void *data, size_t len) {
+	if (session->poly1305->digest_onetime)
+		return session->poly1305->digest_onetime(tag, key, data, len);
+
+	fastd_mac_state_t *mac_state = session->poly1305->init(key);
+	bool ok = session->poly1305->digest(mac_state, tag, data, len);
+	session->poly1305->free(mac_state);
+
+	return ok;
+}
 
-	size_t tail_len = alignto(in.len, sizeof(fastd_block128_t))-in.len;
-	*out = fastd_buffer_alloc(in.len, alignto(COMMON_HEADBYTES, 16), sizeof(fastd_block128_t)+tail_len);
 
+/** Encrypts and authenticates a packet in place */
+static bool method_encrypt(UNUSED fastd_peer_t *peer, fastd_method_session_state_t *session, fastd_buffer_t *buffer) {
+	fastd_buffer_t buf = *buffer;
+	fastd_buffer_pull_head_zero(&buf, KEYBYTES);
+
+	size_t tail_len = alignto(buf.len, sizeof(fastd_block128_t))-buf.len;
 	if (tail_len)
-		memset(in.data+in.len, 0, tail_len);
+		memset(buf.data+buf.len, 0, tail_len);
 
 	uint8_t nonce[session->method->cipher_info->iv_length] __attribute__((aligned(8)));
 	fastd_method_expand_nonce(nonce, session->common.send_nonce, sizeof(nonce));
 
-	int n_blocks = block_count(in.len, sizeof(fastd_block128_t));
-
-	fastd_block128_t *inblocks = in.data;
-	fastd_block128_t *outblocks = out->data;
-	uint8_t tag[TAGBYTES] __attribute__((aligned(8)));
+	int n_blocks = block_count(buf.len, sizeof(fastd_block128_t));
 
-	bool ok = session->cipher->crypt(session->cipher_state, outblocks, inblocks, n_blocks*sizeof(fastd_block128_t), nonce);
+	fastd_block128_t *blocks = buf.data;
+	fastd_block128_t tag;
 
-	if (!ok) {
-		fastd_buffer_free(*out);
+	if (!session->cipher->crypt(session->cipher_state, blocks, blocks, n_blocks*sizeof(fastd_block128_t), nonce))
 		return false;
-	}
 
-	crypto_onetimeauth_poly1305(tag, outblocks->b+KEYBYTES, in.len - KEYBYTES, outblocks->b);
-
-	fastd_buffer_push_head(out, KEYBYTES);
-	fastd_buffer_pull_head_from(out, tag, TAGBYTES);
+	if (!compute_tag(session, &tag, blocks->b, blocks->b+KEYBYTES, buf.len - KEYBYTES))
+		return false;
 
-	fastd_buffer_free(in);
+	fastd_buffer_push_head(&buf, KEYBYTES);
+	fastd_buffer_pull_head_from(&buf, &tag, TAGBYTES);
 
-	fastd_method_put_common_header(out, session->common.send_nonce, 0);
+	fastd_method_put_common_header(&buf, session->common.send_nonce, 0);
 	fastd_method_increment_nonce(&session->common);
 
+	*buffer = buf;
 	return true;
 }
 
-/** Verifies and decrypts a packet */
-static bool method_decrypt(fastd_peer_t *peer, fastd_method_session_state_t *session, fastd_buffer_t *out, fastd_buffer_t in, bool *reordered) {
-	if (in.len < COMMON_HEADBYTES+TAGBYTES)
+/**
+   Verifies and decrypts a packet in place
+
+   The Poly1305 key is generated separately, so the packet is only modified after it has been verified.
+*/
+static bool method_decrypt(fastd_peer_t *peer, fastd_method_session_state_t *session, fastd_buffer_t *buffer, bool *reordered, fastd_packet_seq_t *seq) {
+	fastd_buffer_t buf = *buffer;
+
+	if (buf.len < COMMON_HEADBYTES+TAGBYTES)
 		return false;
 
 	if (!method_session_is_valid(session))
@@ -191,7 +217,7 @@ static bool method_decrypt(fastd_peer_t *peer, fastd_method_session_state_t *ses
 	uint8_t in_nonce[COMMON_NONCEBYTES];
 	uint8_t flags;
 	int64_t age;
-	if (!fastd_method_handle_common_header(&session->common, &in, in_nonce, &flags, &age))
+	if (!fastd_method_handle_common_header(&session->common, &buf, in_nonce, &flags, &age))
 		return false;
 
 	if (flags)
@@ -200,50 +226,45 @@ static bool method_decrypt(fastd_peer_t *peer, fastd_method_session_state_t *ses
 	uint8_t nonce[session->method->cipher_info->iv_length] __attribute__((aligned(8)));
 	fastd_method_expand_nonce(nonce, in_nonce, sizeof(nonce));
 
-	uint8_t tag[TAGBYTES] __attribute__((aligned(8)));
-	fastd_buffer_push_head_to(&in, tag, TAGBYTES);
-	fastd_buffer_pull_head_zero(&in, KEYBYTES);
-
-	size_t tail_len = alignto(in.len, sizeof(fastd_block128_t))-in.len;
-	*out = fastd_buffer_alloc(in.len, 0, tail_len);
+	fastd_block128_t tag;
+	fastd_buffer_push_head_to(&buf, &tag, TAGBYTES);
 
-	int n_blocks = block_count(in.len, sizeof(fastd_block128_t));
-	fastd_block128_t *inblocks = in.data;
-	fastd_block128_t *outblocks = out->data;
-
-	bool ok = session->cipher->crypt(session->cipher_state, outblocks, inblocks, n_blocks*sizeof(fastd_block128_t), nonce);
+	fastd_block128_t key[KEYBYTES/sizeof(fastd_block128_t)] = {};
+	bool ok = session->cipher->crypt(session->cipher_state, key, key, KEYBYTES, nonce);
 
 	if (ok) {
-		if (tail_len)
-			memset(in.data+in.len, 0, tail_len);
+		fastd_block128_t verify_tag;
+		ok = compute_tag(session, &verify_tag, key->b, buf.data, buf.len);
 
-		ok = (crypto_onetimeauth_poly1305_verify(tag, in.data + KEYBYTES, in.len - KEYBYTES, out->data) == 0);
+		if (ok)
+			ok = block_equal(&tag, &verify_tag);
 	}
 
-	if (!ok) {
-		fastd_buffer_free(*out);
-
-		/* restore input buffer */
-		fastd_buffer_push_head(&in, KEYBYTES);
-		fastd_buffer_pull_head_from(&in, tag, TAGBYTES);
-		fastd_method_put_common_header(&in, in_nonce, 0);
+	secure_memzero(key, KEYBYTES);
 
+	if (!ok)
 		return false;
-	}
 
-	fastd_buffer_free(in);
+	fastd_buffer_pull_head_zero(&buf, KEYBYTES);
+
+	int n_blocks = block_count(buf.len, sizeof(fastd_block128_t));
+	fastd_block128_t *blocks = buf.data;
+
+	if (!session->cipher->crypt(session->cipher_state, blocks, blocks, n_blocks*sizeof(fastd_block128_t), nonce))
+		return false;
 
-	fastd_buffer_push_head(out, KEYBYTES);
+	fastd_buffer_push_head(&buf, KEYBYTES);
 
-	fastd_tristate_t reorder_check = fastd_method_reorder_check(peer, &session->common, in_nonce, age);
+	fastd_tristate_t reorder_check = fastd_method_reorder_check(peer, &session->common, in_nonce, age, buf.len);
 	if (reorder_check.set) {
 		*reordered = reorder_check.state;
+		*seq = fastd_method_packet_seq(&session->common, in_nonce);
 	}
 	else {
-		fastd_buffer_free(*out);
-		*out = fastd_buffer_alloc(0, 0, 0);
+		buf.len = 0;
 	}
 
+	*buffer = buf;
 	return true;
 }
 
@@ -268,6 +289,6 @@ const fastd_method_provider_t fastd_method_generic_poly1305 = {
 	.session_superseded = method_session_superseded,
 	.session_free = method_session_free,
 
-	.encrypt = method_encrypt,
-	.decrypt = method_decrypt,
+	.encrypt_inplace = method_encrypt,
+	.decrypt_inplace = method_decrypt,
 };
@@ -105,7 +105,7 @@ static bool method_encrypt(UNUSED fastd_peer_t *peer, UNUSED fastd_method_sessio
 }
 
 /** Just returns the input buffer as the output */
-static bool method_decrypt(UNUSED fastd_peer_t *peer, UNUSED fastd_method_session_state_t *session, fastd_buffer_t *out, fastd_buffer_t in, UNUSED bool *reordered) {
+static bool method_decrypt(UNUSED fastd_peer_t *peer, UNUSED fastd_method_session_state_t *session, fastd_buffer_t *out, fastd_buffer_t in, UNUSED bool *reordered, UNUSED fastd_packet_seq_t *seq) {
 	*out = in;
 	return true;
 }
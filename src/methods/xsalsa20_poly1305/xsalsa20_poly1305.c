@@ -105,6 +105,7 @@ static void method_session_superseded(fastd_method_session_state_t *session) {
 /** Frees the session state */
 static void method_session_free(fastd_method_session_state_t *session) {
 	if(session) {
+		fastd_method_common_free(&session->common);
 		secure_memzero(session, sizeof(fastd_method_session_state_t));
 		free(session);
 	}
@@ -146,29 +147,33 @@ static inline bool handle_header(const fastd_method_common_t *session, fastd_buf
 }
 
 
-/** Performs encryption and authentication of a packet */
-static bool method_encrypt(UNUSED fastd_peer_t *peer, fastd_method_session_state_t *session, fastd_buffer_t *out, fastd_buffer_t in) {
-	fastd_buffer_pull_head_zero(&in, crypto_secretbox_xsalsa20poly1305_ZEROBYTES);
-
-	*out = fastd_buffer_alloc(in.len, 0, 0);
+/** Performs encryption and authentication of a packet in place */
+static bool method_encrypt(UNUSED fastd_peer_t *peer, fastd_method_session_state_t *session, fastd_buffer_t *buffer) {
+	fastd_buffer_t buf = *buffer;
+	fastd_buffer_pull_head_zero(&buf, crypto_secretbox_xsalsa20poly1305_ZEROBYTES);
 
 	uint8_t nonce[crypto_secretbox_xsalsa20poly1305_NONCEBYTES] __attribute__((aligned(8))) = {};
 	memcpy_nonce(nonce, session->common.send_nonce);
 
-	crypto_secretbox_xsalsa20poly1305(out->data, in.data, in.len, nonce, session->key);
-
-	fastd_buffer_free(in);
+	crypto_secretbox_xsalsa20poly1305(buf.data, buf.data, buf.len, nonce, session->key);
 
-	fastd_buffer_push_head(out, crypto_secretbox_xsalsa20poly1305_BOXZEROBYTES);
-	put_header(out, session->common.send_nonce, 0);
+	fastd_buffer_push_head(&buf, crypto_secretbox_xsalsa20poly1305_BOXZEROBYTES);
+	put_header(&buf, session->common.send_nonce, 0);
 	fastd_method_increment_nonce(&session->common);
 
+	*buffer = buf;
 	return true;
 }
 
-/** Performs validation and decryption of a packet */
-static bool method_decrypt(fastd_peer_t *peer, fastd_method_session_state_t *session, fastd_buffer_t *out, fastd_buffer_t in, bool *reordered) {
-	if (in.len < COMMON_HEADBYTES)
+/**
+   Performs validation and decryption of a packet in place
+
+   crypto_secretbox_xsalsa20poly1305_open() only writes to its output after a successful validation.
+*/
+static bool method_decrypt(fastd_peer_t *peer, fastd_method_session_state_t *session, fastd_buffer_t *buffer, bool *reordered, fastd_packet_seq_t *seq) {
+	fastd_buffer_t buf = *buffer;
+
+	if (buf.len < COMMON_HEADBYTES)
 		return false;
 
 	if (!method_session_is_valid(session))
@@ -177,7 +182,7 @@ static bool method_decrypt(fastd_peer_t *peer, fastd_method_session_state_t *ses
 	uint8_t in_nonce[COMMON_NONCEBYTES];
 	uint8_t flags;
 	int64_t age;
-	if (!handle_header(&session->common, &in, in_nonce, &flags, &age))
+	if (!handle_header(&session->common, &buf, in_nonce, &flags, &age))
 		return false;
 
 	if (flags)
@@ -186,32 +191,27 @@ static bool method_decrypt(fastd_peer_t *peer, fastd_method_session_state_t *ses
 	uint8_t nonce[crypto_secretbox_xsalsa20poly1305_NONCEBYTES] __attribute__((aligned(8))) = {};
 	memcpy_nonce(nonce, in_nonce);
 
-	fastd_buffer_pull_head_zero(&in, crypto_secretbox_xsalsa20poly1305_BOXZEROBYTES);
-
-	*out = fastd_buffer_alloc(in.len, 0, 0);
+	fastd_buffer_pull_head_zero(&buf, crypto_secretbox_xsalsa20poly1305_BOXZEROBYTES);
 
-	if (crypto_secretbox_xsalsa20poly1305_open(out->data, in.data, in.len, nonce, session->key) != 0) {
-		fastd_buffer_free(*out);
-
-		/* restore input buffer */
-		fastd_buffer_push_head(&in, crypto_secretbox_xsalsa20poly1305_BOXZEROBYTES);
-		put_header(&in, in_nonce, 0);
+	if (crypto_secretbox_xsalsa20poly1305_open(buf.data, buf.data, buf.len, nonce, session->key) != 0) {
+		/* restore the header overwritten by the zero bytes */
+		fastd_buffer_push_head(&buf, crypto_secretbox_xsalsa20poly1305_BOXZEROBYTES);
+		put_header(&buf, in_nonce, 0);
 		return false;
 	}
 
-	fastd_buffer_free(in);
+	fastd_buffer_push_head(&buf, crypto_secretbox_xsalsa20poly1305_ZEROBYTES);
 
-	fastd_tristate_t reorder_check = fastd_method_reorder_check(peer, &session->common, in_nonce, age);
+	fastd_tristate_t reorder_check = fastd_method_reorder_check(peer, &session->common, in_nonce, age, buf.len);
 	if (reorder_check.set) {
 		*reordered = reorder_check.state;
+		*seq = fastd_method_packet_seq(&session->common, in_nonce);
 	}
 	else {
-		fastd_buffer_free(*out);
-		*out = fastd_buffer_alloc(crypto_secretbox_xsalsa20poly1305_ZEROBYTES, 0, 0);
+		buf.len = 0;
 	}
 
-	fastd_buffer_push_head(out, crypto_secretbox_xsalsa20poly1305_ZEROBYTES);
-
+	*buffer = buf;
 	return true;
 }
 
@@ -238,6 +238,6 @@ const fastd_method_provider_t fastd_method_xsalsa20_poly1305 = {
 	.session_superseded = method_session_superseded,
 	.session_free = method_session_free,
 
-	.encrypt = method_encrypt,
-	.decrypt = method_decrypt,
+	.encrypt_inplace = method_encrypt,
+	.decrypt_inplace = method_decrypt,
 };
@@ -0,0 +1,269 @@
+/*
+  Copyright (c) 2012-2016, Matthias Schiffer <mschiffer@universe-factory.net>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   \file
+
+   Thread pool for offloading expensive computations (like handshake key derivations) from the main thread
+
+   Jobs are submitted by the main thread and queued until one of the pool threads picks them up.
+   When the queue limit is reached, the oldest queued jobs are dropped in favour of new ones:
+   during a reconnect storm, the peers which sent the oldest handshakes have most likely given up
+   on them already. Finished jobs are handed back to the main thread through the async notification
+   socket.
+*/
+
+
+#include "offload.h"
+#include "async.h"
+
+
+/** The offload thread pool */
+struct fastd_offload_pool {
+	pthread_mutex_t mutex;			/**< Protects the queues and the stop flag */
+	pthread_cond_t cond;			/**< Signalled when jobs are added to the queue or the pool is stopped */
+	bool stop;				/**< Tells the threads to terminate */
+
+	size_t n_threads;			/**< The number of started threads */
+	pthread_t *threads;			/**< The threads */
+
+	fastd_offload_job_t *queue_head;	/**< The oldest job waiting for a thread */
+	fastd_offload_job_t **queue_tail;	/**< The \e next field of the newest waiting job */
+	size_t queue_len;			/**< The number of jobs waiting for a thread */
+
+	fastd_offload_job_t *done_head;		/**< The first finished job waiting for the main thread */
+	fastd_offload_job_t **done_tail;	/**< The \e next field of the last finished job */
+	bool notified;				/**< Set when the main thread has been notified about finished jobs */
+
+	fastd_offload_stats_t stats;		/**< Statistics (only accessed by the main thread) */
+};
+
+
+/** The main loop of a pool thread */
+static void * offload_thread(void *arg) {
+	fastd_offload_pool_t *pool = arg;
+
+	pthread_mutex_lock(&pool->mutex);
+
+	while (true) {
+		while (!pool->stop && !pool->queue_head)
+			pthread_cond_wait(&pool->cond, &pool->mutex);
+
+		if (pool->stop)
+			break;
+
+		fastd_offload_job_t *job = pool->queue_head;
+		pool->queue_head = job->next;
+		if (!pool->queue_head)
+			pool->queue_tail = &pool->queue_head;
+		pool->queue_len--;
+
+		pthread_mutex_unlock(&pool->mutex);
+
+		job->run(job);
+
+		pthread_mutex_lock(&pool->mutex);
+
+		job->next = NULL;
+		*pool->done_tail = job;
+		pool->done_tail = &job->next;
+
+		if (!pool->notified) {
+			pool->notified = true;
+
+			/* Don't block the other threads while sending the notification */
+			pthread_mutex_unlock(&pool->mutex);
+			bool sent = fastd_async_enqueue(ASYNC_TYPE_OFFLOAD_DONE, NULL, 0);
+			pthread_mutex_lock(&pool->mutex);
+
+			/* Let the next finished job try again */
+			if (!sent)
+				pool->notified = false;
+		}
+	}
+
+	pthread_mutex_unlock(&pool->mutex);
+
+	return NULL;
+}
+
+/**
+   Initializes the offload thread pool (if enabled)
+
+   The threads are only created by fastd_offload_start(); jobs submitted before that
+   wait in the queue.
+*/
+void fastd_offload_init(void) {
+	if (!conf.n_handshake_workers)
+		return;
+
+	fastd_offload_pool_t *pool = fastd_new0(fastd_offload_pool_t);
+
+	if (pthread_mutex_init(&pool->mutex, NULL))
+		exit_bug("pthread_mutex_init");
+	if (pthread_cond_init(&pool->cond, NULL))
+		exit_bug("pthread_cond_init");
+
+	pool->queue_tail = &pool->queue_head;
+	pool->done_tail = &pool->done_head;
+
+	pool->threads = fastd_new_array(conf.n_handshake_workers, pthread_t);
+
+	ctx.offload_pool = pool;
+}
+
+/**
+   Starts the threads of the offload thread pool
+
+   Is called after the privileges have been dropped, so the threads don't keep them.
+*/
+void fastd_offload_start(void) {
+	fastd_offload_pool_t *pool = ctx.offload_pool;
+	if (!pool)
+		return;
+
+	for (; pool->n_threads < conf.n_handshake_workers; pool->n_threads++) {
+		if ((errno = pthread_create(&pool->threads[pool->n_threads], NULL, offload_thread, pool)) != 0)
+			exit_errno("unable to create handshake thread");
+	}
+
+	pr_verbose("started %u handshake threads", conf.n_handshake_workers);
+}
+
+/** Drops all jobs of a list */
+static void drop_jobs(fastd_offload_job_t *job) {
+	while (job) {
+		fastd_offload_job_t *next = job->next;
+		job->drop(job);
+		job = next;
+	}
+}
+
+/** Stops the offload thread pool, dropping all unfinished jobs */
+void fastd_offload_free(void) {
+	fastd_offload_pool_t *pool = ctx.offload_pool;
+	if (!pool)
+		return;
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->stop = true;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	size_t i;
+	for (i = 0; i < pool->n_threads; i++) {
+		if ((errno = pthread_join(pool->threads[i], NULL)) != 0)
+			exit_errno("pthread_join");
+	}
+
+	drop_jobs(pool->queue_head);
+	drop_jobs(pool->done_head);
+
+	pthread_cond_destroy(&pool->cond);
+	pthread_mutex_destroy(&pool->mutex);
+
+	free(pool->threads);
+	free(pool);
+
+	ctx.offload_pool = NULL;
+}
+
+/**
+   Queues a job for computation on the thread pool
+
+   If the queue is full, the oldest queued job is dropped.
+*/
+void fastd_offload_submit(fastd_offload_job_t *job) {
+	fastd_offload_pool_t *pool = ctx.offload_pool;
+	fastd_offload_job_t *shed = NULL;
+
+	job->next = NULL;
+
+	pthread_mutex_lock(&pool->mutex);
+
+	if (pool->queue_len >= conf.handshake_queue_limit) {
+		shed = pool->queue_head;
+		pool->queue_head = shed->next;
+		if (!pool->queue_head)
+			pool->queue_tail = &pool->queue_head;
+		pool->queue_len--;
+	}
+
+	*pool->queue_tail = job;
+	pool->queue_tail = &job->next;
+	pool->queue_len++;
+
+	pthread_cond_signal(&pool->cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	pool->stats.submitted++;
+
+	if (shed) {
+		pr_debug("too many pending handshakes, dropping the oldest one");
+
+		pool->stats.shed++;
+		shed->drop(shed);
+	}
+}
+
+/**
+   Handles the results of all finished jobs
+
+   Is called when a pool thread has sent an ASYNC_TYPE_OFFLOAD_DONE notification, and
+   periodically in case a notification couldn't be sent.
+*/
+void fastd_offload_handle(void) {
+	fastd_offload_pool_t *pool = ctx.offload_pool;
+	if (!pool)
+		return;
+
+	pthread_mutex_lock(&pool->mutex);
+
+	fastd_offload_job_t *job = pool->done_head;
+	pool->done_head = NULL;
+	pool->done_tail = &pool->done_head;
+	pool->notified = false;
+
+	pthread_mutex_unlock(&pool->mutex);
+
+	while (job) {
+		fastd_offload_job_t *next = job->next;
+
+		pool->stats.completed++;
+		job->done(job);
+
+		job = next;
+	}
+}
+
+/** Returns the statistics of the offload thread pool */
+void fastd_offload_get_stats(fastd_offload_stats_t *stats) {
+	fastd_offload_pool_t *pool = ctx.offload_pool;
+
+	pthread_mutex_lock(&pool->mutex);
+	*stats = pool->stats;
+	stats->queued = pool->queue_len;
+	pthread_mutex_unlock(&pool->mutex);
+}
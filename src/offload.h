@@ -0,0 +1,75 @@
+/*
+  Copyright (c) 2012-2016, Matthias Schiffer <mschiffer@universe-factory.net>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   \file
+
+   Thread pool for offloading expensive computations (like handshake key derivations) from the main thread
+*/
+
+
+#pragma once
+
+#include "fastd.h"
+
+
+/**
+   A job executed on the offload thread pool
+
+   Jobs are usually embedded in a larger structure holding their input and output data.
+   Only \e run is called on a pool thread; the job must not access any state which
+   is modified by the main thread in the meantime.
+*/
+struct fastd_offload_job {
+	fastd_offload_job_t *next;			/**< The next job in the queue */
+
+	void (*run)(fastd_offload_job_t *job);		/**< Performs the computation (called on a pool thread) */
+	void (*done)(fastd_offload_job_t *job);		/**< Handles the result and frees the job (called on the main thread) */
+	void (*drop)(fastd_offload_job_t *job);		/**< Frees a job that is discarded without its result being handled (called on the main thread) */
+};
+
+/** Statistics of the offload thread pool */
+struct fastd_offload_stats {
+	uint64_t submitted;			/**< The number of jobs submitted */
+	uint64_t completed;			/**< The number of jobs whose results have been handled */
+	uint64_t shed;				/**< The number of jobs dropped because the queue was full */
+	size_t queued;				/**< The number of jobs currently waiting for a thread */
+};
+
+
+void fastd_offload_init(void);
+void fastd_offload_start(void);
+void fastd_offload_free(void);
+
+void fastd_offload_submit(fastd_offload_job_t *job);
+void fastd_offload_handle(void);
+
+void fastd_offload_get_stats(fastd_offload_stats_t *stats);
+
+
+/** Checks if expensive computations are offloaded to the thread pool */
+static inline bool fastd_offload_enabled(void) {
+	return ctx.offload_pool;
+}
@@ -404,6 +404,11 @@ static void option_show_key(void) {
 	conf.show_key = true;
 }
 
+/** Handles the --benchmark option */
+static void option_benchmark(void) {
+	conf.benchmark = true;
+}
+
 /** Handles the --machine-readable option */
 static void option_machine_readable(void) {
 	conf.machine_readable = true;
@@ -60,4 +60,5 @@ SEPARATOR;
 OPTION(option_verify_config, "--verify-config", "Checks the configuration and exits");
 OPTION(option_generate_key, "--generate-key", "Generates a new keypair");
 OPTION(option_show_key, "--show-key", "Shows the public key corresponding to the configured secret");
+OPTION(option_benchmark, "--benchmark", "Measures the speed of the configured methods and of all cipher and MAC implementations");
 OPTION(option_machine_readable, "--machine-readable", "Suppresses output of explaining text in the --show-key and --generate-key commands");
@@ -33,6 +33,7 @@
 #include "peer_group.h"
 #include "peer_hashtable.h"
 #include "poll.h"
+#include "reorder.h"
 
 #include <arpa/inet.h>
 #include <net/if.h>
@@ -225,13 +226,15 @@ static inline bool has_group_config_constraints(const fastd_peer_group_t *group)
    or a default socket is used.
 */
 void fastd_peer_reset_socket(fastd_peer_t *peer) {
+	fastd_worker_peer_lock(peer);
+
 	if (peer->address.sa.sa_family == AF_UNSPEC) {
 		free_socket(peer);
-		return;
+		goto out;
 	}
 
 	if (!fastd_peer_is_socket_dynamic(peer))
-		return;
+		goto out;
 
 	pr_debug("resetting socket for peer %P", peer);
 
@@ -251,6 +254,9 @@ void fastd_peer_reset_socket(fastd_peer_t *peer) {
 		else
 			peer->sock = fastd_socket_open(peer, AF_INET6);
 	}
+
+ out:
+	fastd_worker_peer_unlock(peer);
 }
 
 /** Schedules the peer maintenance task (or removes the scheduled task if there's nothing to do) */
@@ -317,6 +323,7 @@ static bool is_peer_in_group(const fastd_peer_t *peer, const fastd_peer_group_t
    Disestablished the current connection with the peer (if any) and drops any scheduled handshake.
 
    After a call to reset_peer a peer must be deleted by delete_peer or re-initialized by setup_peer.
+   The peer lock must be held.
 */
 static void reset_peer(fastd_peer_t *peer) {
 	if (fastd_peer_is_established(peer)) {
@@ -327,6 +334,9 @@ static void reset_peer(fastd_peer_t *peer) {
 	free_socket(peer);
 
 	conf.protocol->reset_peer_state(peer);
+	fastd_reorder_free(peer);
+
+	fastd_worker_eth_addr_lock();
 
 	size_t i, deleted = 0;
 	for (i = 0; i < VECTOR_LEN(ctx.eth_addrs); i++) {
@@ -340,6 +350,8 @@ static void reset_peer(fastd_peer_t *peer) {
 
 	VECTOR_RESIZE(ctx.eth_addrs, VECTOR_LEN(ctx.eth_addrs)-deleted);
 
+	fastd_worker_eth_addr_unlock();
+
 	fastd_task_unschedule(&peer->task);
 
 	fastd_peer_hashtable_remove(peer);
@@ -386,8 +398,11 @@ void fastd_peer_handle_resolve(fastd_peer_t *peer, fastd_remote_t *remote, size_
 	remote->n_addresses = n_addresses;
 	remote->current_address = 0;
 
-	if (peer->state == STATE_RESOLVING)
+	if (peer->state == STATE_RESOLVING) {
+		fastd_worker_peer_lock(peer);
 		init_handshake(peer);
+		fastd_worker_peer_unlock(peer);
+	}
 }
 
 /** Initializes a peer */
@@ -494,6 +509,11 @@ void fastd_peer_free(fastd_peer_t *peer) {
 	free(peer);
 }
 
+/** Frees a deleted peer once the workers can't access it anymore */
+static void free_deleted_peer(void *arg) {
+	fastd_peer_free(arg);
+}
+
 /** Deletes a peer */
 static void delete_peer(fastd_peer_t *peer) {
 	if (fastd_peer_is_dynamic(peer) || peer->config_source_dir)
@@ -502,6 +522,8 @@ static void delete_peer(fastd_peer_t *peer) {
 	size_t i = peer_index(peer);
 	VECTOR_DELETE(ctx.peers, i);
 
+	fastd_worker_peer_lock(peer);
+
 	conf.protocol->free_peer_state(peer);
 
 	if (peer->iface && peer->iface->peer) {
@@ -509,7 +531,11 @@ static void delete_peer(fastd_peer_t *peer) {
 		fastd_iface_close(peer->iface);
 	}
 
-	fastd_peer_free(peer);
+	peer->iface = NULL;
+
+	fastd_worker_peer_unlock(peer);
+
+	fastd_workers_defer(free_deleted_peer, peer);
 }
 
 
@@ -576,8 +602,10 @@ static inline void reset_peer_address(fastd_peer_t *peer) {
 		fastd_peer_reset(peer);
 	}
 	else {
+		fastd_worker_peer_lock(peer);
 		fastd_peer_hashtable_remove(peer);
 		peer->address.sa.sa_family = AF_UNSPEC;
+		fastd_worker_peer_unlock(peer);
 	}
 }
 
@@ -660,6 +688,8 @@ bool fastd_peer_claim_address(fastd_peer_t *new_peer, fastd_socket_t *sock, cons
 		}
 	}
 
+	fastd_worker_peer_lock(new_peer);
+
 	fastd_peer_hashtable_remove(new_peer);
 	new_peer->address = *remote_addr;
 	fastd_peer_hashtable_insert(new_peer);
@@ -672,22 +702,31 @@ bool fastd_peer_claim_address(fastd_peer_t *new_peer, fastd_socket_t *sock, cons
 	if (local_addr)
 		new_peer->local_address = *local_addr;
 
+	fastd_worker_peer_unlock(new_peer);
+
 	return true;
 }
 
 /** Resets and re-initializes a peer */
 void fastd_peer_reset(fastd_peer_t *peer) {
+	fastd_worker_peer_lock(peer);
+
 	if (peer->state != STATE_INACTIVE) {
 		pr_debug("resetting peer %P", peer);
 		reset_peer(peer);
 	}
 
 	setup_peer(peer);
+
+	fastd_worker_peer_unlock(peer);
 }
 
 /** Deletes a peer */
 void fastd_peer_delete(fastd_peer_t *peer) {
+	fastd_worker_peer_lock(peer);
 	reset_peer(peer);
+	fastd_worker_peer_unlock(peer);
+
 	delete_peer(peer);
 }
 
@@ -774,9 +813,14 @@ bool fastd_peer_add(fastd_peer_t *peer) {
 				pr_verbose("peer %P has been renamed to %P", other, peer);
 
 			if (peer_configs_equal(other, peer)) {
-				free(other->name);
+				/* The name may be used in log messages of the workers */
+				fastd_worker_peer_lock(other);
+				char *old_name = other->name;
 				other->name = peer->name;
 				peer->name = NULL;
+				fastd_worker_peer_unlock(other);
+
+				fastd_workers_defer(free, old_name);
 
 				fastd_peer_free(peer);
 
@@ -858,17 +902,23 @@ bool fastd_peer_set_established(fastd_peer_t *peer) {
 		return true;
 
 	if (!peer->iface) {
-		peer->iface = fastd_iface_open(peer);
-		if (!peer->iface)
+		fastd_iface_t *iface = fastd_iface_open(peer);
+		if (!iface)
 			return false;
 
+		fastd_worker_peer_lock(peer);
+		peer->iface = iface;
+		fastd_worker_peer_unlock(peer);
+
 		on_up(peer, false);
 	}
 
+	fastd_worker_peer_lock(peer);
 	peer->state = STATE_ESTABLISHED;
 	peer->established = ctx.now;
 	fastd_peer_seen(peer);
 	fastd_peer_clear_keepalive(peer);
+	fastd_worker_peer_unlock(peer);
 
 	schedule_peer_task(peer);
 
@@ -888,8 +938,8 @@ static int peer_eth_addr_cmp(const fastd_peer_eth_addr_t *addr1, const fastd_pee
 	return eth_addr_cmp(&addr1->addr, &addr2->addr);
 }
 
-/** Adds a MAC address to the sorted list of addresses associated with a peer (or updates the timeout of an existing entry) */
-void fastd_peer_eth_addr_add(fastd_peer_t *peer, fastd_eth_addr_t addr) {
+/** Adds a MAC address to the list of known addresses (internal function, see fastd_peer_eth_addr_add()) */
+static void eth_addr_add(fastd_peer_t *peer, fastd_eth_addr_t addr) {
 	size_t min = 0, max = VECTOR_LEN(ctx.eth_addrs);
 
 	if (peer && !fastd_peer_is_established(peer))
@@ -901,7 +951,7 @@ void fastd_peer_eth_addr_add(fastd_peer_t *peer, fastd_eth_addr_t addr) {
 
 		if (cmp == 0) {
 			VECTOR_INDEX(ctx.eth_addrs, cur).peer = peer;
-			VECTOR_INDEX(ctx.eth_addrs, cur).timeout = ctx.now + ETH_ADDR_STALE_TIME;
+			VECTOR_INDEX(ctx.eth_addrs, cur).timeout = fastd_now() + ETH_ADDR_STALE_TIME;
 			return; /* We're done here. */
 		}
 		else if (cmp < 0) {
@@ -912,7 +962,7 @@ void fastd_peer_eth_addr_add(fastd_peer_t *peer, fastd_eth_addr_t addr) {
 		}
 	}
 
-	VECTOR_INSERT(ctx.eth_addrs, ((fastd_peer_eth_addr_t) {addr, peer, ctx.now + ETH_ADDR_STALE_TIME}), min);
+	VECTOR_INSERT(ctx.eth_addrs, ((fastd_peer_eth_addr_t) {addr, peer, fastd_now() + ETH_ADDR_STALE_TIME}), min);
 
 	if (peer)
 		pr_debug("learned new MAC address %E on peer %P", &addr, peer);
@@ -920,16 +970,31 @@ void fastd_peer_eth_addr_add(fastd_peer_t *peer, fastd_eth_addr_t addr) {
 		pr_debug("learned new local MAC address %E", &addr);
 }
 
-/** Finds the peer that is associated with a given MAC address */
+/** Adds a MAC address to the sorted list of addresses associated with a peer (or updates the timeout of an existing entry) */
+void fastd_peer_eth_addr_add(fastd_peer_t *peer, fastd_eth_addr_t addr) {
+	fastd_worker_eth_addr_lock();
+	eth_addr_add(peer, addr);
+	fastd_worker_eth_addr_unlock();
+}
+
+/**
+   Finds the peer that is associated with a given MAC address
+
+   On worker threads, the peer may be disestablished or deleted concurrently, so
+   its state must be checked with the peer lock held.
+*/
 bool fastd_peer_find_by_eth_addr(const fastd_eth_addr_t addr, fastd_peer_t **peer) {
 	const fastd_peer_eth_addr_t key = {.addr = addr};
+
+	fastd_worker_eth_addr_lock();
+
 	fastd_peer_eth_addr_t *peer_eth_addr = VECTOR_BSEARCH(&key, ctx.eth_addrs, peer_eth_addr_cmp);
+	if (peer_eth_addr)
+		*peer = peer_eth_addr->peer;
 
-	if (!peer_eth_addr)
-		return false;
+	fastd_worker_eth_addr_unlock();
 
-	*peer = peer_eth_addr->peer;
-	return true;
+	return peer_eth_addr;
 }
 
 /** Sends a handshake to one peer, if a scheduled handshake is due */
@@ -980,8 +1045,13 @@ static void handle_task_handshake(fastd_peer_t *peer) {
 void fastd_peer_handle_task(fastd_task_t *task) {
 	fastd_peer_t *peer = container_of(task, fastd_peer_t, task);
 
+	/* The reset timeout is updated by the workers */
+	fastd_worker_peer_lock(peer);
+
 	/* check for peer timeout */
 	if (fastd_timed_out(peer->reset_timeout)) {
+		fastd_worker_peer_unlock(peer);
+
 		if (fastd_peer_is_dynamic(peer))
 			fastd_peer_delete(peer);
 		else
@@ -1000,10 +1070,14 @@ void fastd_peer_handle_task(fastd_task_t *task) {
 		handle_task_handshake(peer);
 
 	schedule_peer_task(peer);
+
+	fastd_worker_peer_unlock(peer);
 }
 
 /** Removes all time-outed MAC addresses from \e ctx.eth_addrs */
 void fastd_peer_eth_addr_cleanup(void) {
+	fastd_worker_eth_addr_lock();
+
 	size_t i, deleted = 0;
 
 	for (i = 0; i < VECTOR_LEN(ctx.eth_addrs); i++) {
@@ -1018,6 +1092,8 @@ void fastd_peer_eth_addr_cleanup(void) {
 	}
 
 	VECTOR_RESIZE(ctx.eth_addrs, VECTOR_LEN(ctx.eth_addrs)-deleted);
+
+	fastd_worker_eth_addr_unlock();
 }
 
 /** Resets all peers */
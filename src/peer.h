@@ -33,6 +33,7 @@
 #pragma once
 
 #include "fastd.h"
+#include "worker.h"
 
 
 /** The state of a peer */
@@ -101,6 +102,8 @@ struct fastd_peer {
 	fastd_timeout_t reset_timeout;			/**< The timeout after which the peer is reset */
 	fastd_timeout_t keepalive_timeout;		/**< The timeout after which a keepalive is sent to the peer */
 
+	fastd_reorder_buffer_t *reorder;		/**< The reorder buffer (NULL if none has been needed yet) */
+
 	fastd_stats_t stats;				/**< Traffic statistics */
 
 #ifdef WITH_DYNAMIC_PEERS
@@ -194,14 +197,18 @@ static inline void fastd_peer_unschedule_handshake(fastd_peer_t *peer) {
 static inline void fastd_peer_set_verifying(fastd_peer_t *peer) {
 	peer->verify_timeout = ctx.now + MIN_VERIFY_INTERVAL;
 
+	fastd_worker_peer_lock(peer);
 	fastd_timeout_advance(&peer->reset_timeout, peer->verify_timeout);
+	fastd_worker_peer_unlock(peer);
 }
 
 /** Marks the peer verification as successful or failed */
 static inline void fastd_peer_set_verified(fastd_peer_t *peer, bool ok) {
 	peer->verify_valid_timeout = ctx.now + (ok ? VERIFY_VALID_TIME : 0);
 
+	fastd_worker_peer_lock(peer);
 	fastd_timeout_advance(&peer->reset_timeout, peer->verify_valid_timeout);
+	fastd_worker_peer_unlock(peer);
 }
 #endif
 
@@ -258,7 +265,7 @@ static inline bool fastd_peer_is_established(const fastd_peer_t *peer) {
 
 /** Signals that a valid packet was received from the peer */
 static inline void fastd_peer_seen(fastd_peer_t *peer) {
-	peer->reset_timeout = ctx.now + PEER_STALE_TIME;
+	peer->reset_timeout = fastd_now() + PEER_STALE_TIME;
 }
 
 /** Resets the keepalive timeout */
@@ -287,16 +294,25 @@ static inline bool fastd_eth_addr_is_unicast(fastd_eth_addr_t addr) {
 	return ((addr.data[0] & 1) == 0);
 }
 
-/** Adds statistics for a single packet of a given size */
+/**
+   Adds statistics for a single packet of a given size (only to the global statistics if peer is NULL)
+
+   The statistics are read by the status socket on the main thread, so they are
+   updated atomically. The thread's own statistics have a single writer, while
+   the statistics of a peer may be updated by all threads.
+*/
 static inline void fastd_stats_add(UNUSED fastd_peer_t *peer, UNUSED fastd_stat_type_t stat, UNUSED size_t bytes) {
 #ifdef WITH_STATUS_SOCKET
 	if (!bytes)
 		return;
 
-	ctx.stats.packets[stat]++;
-	ctx.stats.bytes[stat] += bytes;
+	fastd_stats_t *stats = fastd_worker_stats();
+	__atomic_store_n(&stats->packets[stat], stats->packets[stat] + 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&stats->bytes[stat], stats->bytes[stat] + bytes, __ATOMIC_RELAXED);
 
-	peer->stats.packets[stat]++;
-	peer->stats.bytes[stat] += bytes;
+	if (peer) {
+		__atomic_fetch_add(&peer->stats.packets[stat], 1, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&peer->stats.bytes[stat], bytes, __ATOMIC_RELAXED);
+	}
 #endif
 }
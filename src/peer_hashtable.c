@@ -87,6 +87,8 @@ void fastd_peer_hashtable_insert(fastd_peer_t *peer) {
 	if (!peer->address.sa.sa_family)
 		return;
 
+	fastd_workers_peers_changed();
+
 	ctx.peer_addr_ht_used++;
 
 	if (ctx.peer_addr_ht_used > 2*ctx.peer_addr_ht_size) {
@@ -107,6 +109,8 @@ void fastd_peer_hashtable_remove(fastd_peer_t *peer) {
 	if (!peer->address.sa.sa_family)
 		return;
 
+	fastd_workers_peers_changed();
+
 	size_t b = peer_address_bucket(&peer->address);
 
 	size_t i;
@@ -33,11 +33,16 @@
 #include "poll.h"
 #include "async.h"
 #include "peer.h"
+#include "worker.h"
 
 #include <signal.h>
 
 
-#ifdef USE_EPOLL
+#if defined(USE_IO_URING)
+
+#include <liburing.h>
+
+#elif defined(USE_EPOLL)
 
 #include <sys/epoll.h>
 #include <sys/syscall.h>
@@ -65,6 +70,84 @@ static inline int task_timeout(void) {
 }
 
 
+/** Makes busy polling more aggressive after it has (or would have) found events */
+static inline void busy_poll_grow(void) {
+	unsigned window = 2*ctx.busy_poll_window;
+	if (window < conf.busy_poll/16)
+		window = conf.busy_poll/16;
+	if (window > conf.busy_poll || !window)
+		window = conf.busy_poll;
+
+	ctx.busy_poll_window = window;
+}
+
+/** Reduces the busy polling time after spinning has been in vain, stopping it altogether on idle links */
+static inline void busy_poll_shrink(void) {
+	ctx.busy_poll_window /= 2;
+	if (ctx.busy_poll_window < conf.busy_poll/16)
+		ctx.busy_poll_window = 0;
+}
+
+/**
+   Waits for events, spinning for the current busy polling time before going to sleep
+
+   \e wait is called with a timeout of 0 while spinning and with the (remaining)
+   \e timeout when going to sleep. It must return the number of available events,
+   0 on timeout or a negative value when it was interrupted by a signal.
+
+   The busy polling time is adapted to the traffic: it is shortened whenever
+   spinning doesn't find any events, and extended again when an event arrives while
+   spinning or shortly after going to sleep.
+*/
+static int busy_wait(int timeout, int (*wait)(int timeout, void *arg), void *arg) {
+	int ret;
+
+	if (!conf.busy_poll || !timeout)
+		return wait(timeout, arg);
+
+	if (ctx.busy_poll_window) {
+		int64_t start = fastd_get_time_usec(), now;
+		int64_t end = start + ctx.busy_poll_window;
+		if (timeout > 0 && start + 1000*(int64_t)timeout < end)
+			end = start + 1000*(int64_t)timeout;
+
+		do {
+			ret = wait(0, arg);
+			now = fastd_get_time_usec();
+		} while (!ret && now < end);
+
+		ctx.poll_stats.spin_time += now - start;
+
+		if (ret > 0) {
+			ctx.poll_stats.spin_wakeups++;
+			busy_poll_grow();
+		}
+		if (ret)
+			return ret;
+
+		if (now - start >= ctx.busy_poll_window)
+			busy_poll_shrink();
+
+		if (timeout > 0) {
+			timeout -= (now - start) / 1000;
+			if (timeout <= 0)
+				return 0;
+		}
+	}
+
+	ctx.poll_stats.sleep_wakeups++;
+
+	int64_t start = fastd_get_time_usec();
+	ret = wait(timeout, arg);
+
+	/* The event would have been found by spinning for the full busy polling time */
+	if (ret > 0 && fastd_get_time_usec() - start < conf.busy_poll)
+		busy_poll_grow();
+
+	return ret;
+}
+
+
 /** Handles a file descriptor that was selected on */
 static inline void handle_fd(fastd_poll_fd_t *fd, bool input, bool error) {
 	switch (fd->type) {
@@ -83,7 +166,7 @@ static inline void handle_fd(fastd_poll_fd_t *fd, bool input, bool error) {
 		fastd_iface_t *iface = container_of(fd, fastd_iface_t, fd);
 
 		if (input)
-			fastd_iface_handle(iface);
+			fastd_iface_handle(iface, CRYPTO_BATCH_SIZE);
 
 		break;
 	}
@@ -102,7 +185,7 @@ static inline void handle_fd(fastd_poll_fd_t *fd, bool input, bool error) {
 		}
 
 		if (input)
-			fastd_receive(sock);
+			fastd_receive(sock, CRYPTO_BATCH_SIZE);
 
 		break;
 	}
@@ -116,7 +199,700 @@ static inline void handle_fd(fastd_poll_fd_t *fd, bool input, bool error) {
 }
 
 
-#ifdef USE_EPOLL
+#ifndef USE_IO_URING
+
+/** Handles a single input event, returning the number of packets read (0 if there was no more input, at most \e max) */
+static inline size_t handle_fd_input(fastd_poll_fd_t *fd, size_t max) {
+	switch (fd->type) {
+	case POLL_TYPE_IFACE:
+		return fastd_iface_handle(container_of(fd, fastd_iface_t, fd), max);
+
+	case POLL_TYPE_SOCKET:
+		return fastd_receive(container_of(fd, fastd_socket_t, fd), max);
+
+	default:
+		handle_fd(fd, true, false);
+		return 0;
+	}
+}
+
+/**
+   Handles the file descriptors with pending input
+
+   The file descriptors are served round-robin, one packet at a time, until
+   each of them has no more input or has used up its packet budget. Consecutive
+   payload packets of a single peer are handled together in one round, so they
+   can be encrypted or decrypted as a batch; they count against the budget
+   individually. File descriptors with remaining input are kept in the list, so
+   they are served again in the next main loop iteration without waiting for new
+   events (their input may have been read from the kernel in a batch already).
+*/
+static void handle_ready_fds(void) {
+	size_t n_fds = VECTOR_LEN(ctx.ready_fds);
+	if (!n_fds)
+		return;
+
+	size_t budget[n_fds];
+	bool active = true;
+	size_t i;
+
+	for (i = 0; i < n_fds; i++)
+		budget[i] = conf.packet_budget;
+
+	while (active) {
+		active = false;
+
+		for (i = 0; i < n_fds; i++) {
+			fastd_poll_fd_t *fd = VECTOR_INDEX(ctx.ready_fds, i);
+			if (!fd || !budget[i])
+				continue;
+
+			size_t packets = handle_fd_input(fd, budget[i]);
+			if (packets) {
+				ctx.poll_stats.packets += packets;
+				budget[i] -= packets;
+				active = true;
+			}
+			else {
+				VECTOR_INDEX(ctx.ready_fds, i) = NULL;
+			}
+		}
+	}
+
+	size_t n = 0;
+	for (i = 0; i < VECTOR_LEN(ctx.ready_fds); i++) {
+		fastd_poll_fd_t *fd = VECTOR_INDEX(ctx.ready_fds, i);
+		if (!fd)
+			continue;
+
+		ctx.poll_stats.budget_exhausted++;
+		VECTOR_INDEX(ctx.ready_fds, n++) = fd;
+	}
+
+	VECTOR_RESIZE(ctx.ready_fds, n);
+}
+
+/** Adds a file descriptor with pending input to the ready list (unless it is still in the list from the last iteration) */
+static inline void add_ready_fd(fastd_poll_fd_t *fd) {
+	size_t i;
+	for (i = 0; i < VECTOR_LEN(ctx.ready_fds); i++) {
+		if (VECTOR_INDEX(ctx.ready_fds, i) == fd)
+			return;
+	}
+
+	VECTOR_ADD(ctx.ready_fds, fd);
+}
+
+/** Returns the poll timeout, which is 0 if there are file descriptors left with input from the last iteration */
+static inline int ready_fds_timeout(void) {
+	if (VECTOR_LEN(ctx.ready_fds))
+		return 0;
+
+	return task_timeout();
+}
+
+/** Removes a file descriptor that is about to be closed from the ready list */
+static inline void forget_ready_fd(const fastd_poll_fd_t *fd) {
+	size_t i;
+	for (i = 0; i < VECTOR_LEN(ctx.ready_fds); i++) {
+		if (VECTOR_INDEX(ctx.ready_fds, i) == fd)
+			VECTOR_INDEX(ctx.ready_fds, i) = NULL;
+	}
+}
+
+#endif
+
+
+#if defined(USE_IO_URING)
+
+
+/** The space reserved for the ancillary data of each received packet */
+#define URING_CONTROL_LEN 128
+
+
+/** The kinds of operations submitted to io_uring */
+typedef enum fastd_uring_op_type {
+	URING_OP_POLL,				/**< Waits for input on a file descriptor (re-armed after every completion) */
+	URING_OP_RECVMSG,			/**< Multishot receive using the provided buffer ring */
+	URING_OP_READ,				/**< Reads a packet from a TUN/TAP interface (re-armed after every completion) */
+	URING_OP_SENDMSG,			/**< Sends a message of a send batch on a socket */
+	URING_OP_WRITE,				/**< Writes a packet to a TUN/TAP interface */
+} fastd_uring_op_type_t;
+
+/** An operation that has been submitted to io_uring */
+typedef struct fastd_uring_op fastd_uring_op_t;
+
+/** A ring of buffers provided for socket receives */
+typedef struct fastd_uring_buf_ring fastd_uring_buf_ring_t;
+
+/** An operation that has been submitted to io_uring */
+struct fastd_uring_op {
+	fastd_uring_op_t *next;			/**< The next pending operation */
+	fastd_uring_op_t **pprev;		/**< The pointer pointing to this operation */
+
+	fastd_uring_op_type_t type;		/**< The kind of operation */
+	fastd_poll_fd_t *fd;			/**< The file descriptor the operation works on (NULL after it has been closed) */
+
+	fastd_buffer_t buffer;			/**< The packet of URING_OP_READ and URING_OP_WRITE operations */
+	fastd_send_batch_t *batch;		/**< The send batch of URING_OP_SENDMSG operations */
+	size_t msg;				/**< The index of the message in the send batch */
+	const struct msghdr *msghdr;		/**< The message header of URING_OP_SENDMSG operations */
+	fastd_uring_buf_ring_t *buf_ring;	/**< The buffer ring used by URING_OP_RECVMSG operations */
+};
+
+/**
+   A ring of buffers provided to the kernel for socket receives
+
+   When the maximum packet size grows, a new ring with larger buffers is set up and the
+   receives are moved to it. The old ring is freed once its last receive has completed.
+*/
+struct fastd_uring_buf_ring {
+	struct io_uring_buf_ring *ring;		/**< The buffer ring shared with the kernel */
+	uint16_t group;				/**< The buffer group ID of the ring */
+	uint8_t *bufs;				/**< The memory of the provided buffers */
+	size_t buf_size;			/**< The size of each provided buffer */
+	size_t n_ops;				/**< The number of receive operations using the ring */
+};
+
+/** The state of the io_uring poll implementation */
+struct fastd_uring {
+	struct io_uring ring;			/**< The io_uring instance */
+	fastd_uring_op_t *ops;			/**< The list of pending operations */
+	fastd_uring_op_t *free_ops;		/**< Preallocated operations which aren't in use (linked by their next field) */
+	VECTOR(fastd_uring_op_t *) op_chunks;	/**< The arrays the operations are allocated from */
+
+	fastd_uring_buf_ring_t *buf_ring;	/**< The buffer ring new socket receives use (NULL before the first socket is registered) */
+	uint16_t next_buf_group;		/**< The buffer group ID of the next buffer ring */
+	struct msghdr recv_msg;			/**< Determines the layout of the provided buffers for multishot recvmsg */
+};
+
+
+/** Exits with an error message for a negative return value of a liburing function */
+static inline void exit_uring(int ret, const char *message) {
+	errno = -ret;
+	exit_errno(message);
+}
+
+/** Returns a free submission queue entry, submitting the queued entries first if the queue is full */
+static struct io_uring_sqe * uring_get_sqe(void) {
+	struct io_uring_sqe *sqe = io_uring_get_sqe(&ctx.uring->ring);
+	if (sqe)
+		return sqe;
+
+	int ret = io_uring_submit(&ctx.uring->ring);
+	if (ret < 0)
+		exit_uring(ret, "io_uring_submit");
+
+	sqe = io_uring_get_sqe(&ctx.uring->ring);
+	if (!sqe)
+		exit_bug("io_uring: no free submission queue entries");
+
+	return sqe;
+}
+
+/** Takes an operation from the list of unused operations, allocating URING_ENTRIES new ones when it is empty */
+static fastd_uring_op_t * op_alloc(void) {
+	fastd_uring_t *uring = ctx.uring;
+
+	if (!uring->free_ops) {
+		fastd_uring_op_t *chunk = fastd_new_array(URING_ENTRIES, fastd_uring_op_t);
+		VECTOR_ADD(uring->op_chunks, chunk);
+
+		size_t i;
+		for (i = 0; i < URING_ENTRIES; i++) {
+			chunk[i].next = uring->free_ops;
+			uring->free_ops = &chunk[i];
+		}
+	}
+
+	fastd_uring_op_t *op = uring->free_ops;
+	uring->free_ops = op->next;
+
+	return op;
+}
+
+/** Creates a new operation and adds it to the list of pending operations */
+static fastd_uring_op_t * op_new(fastd_uring_op_type_t type, fastd_poll_fd_t *fd) {
+	fastd_uring_op_t *op = op_alloc();
+	*op = (fastd_uring_op_t){
+		.type = type,
+		.fd = fd,
+	};
+
+	op->next = ctx.uring->ops;
+	op->pprev = &ctx.uring->ops;
+	if (op->next)
+		op->next->pprev = &op->next;
+	ctx.uring->ops = op;
+
+	return op;
+}
+
+static void buf_ring_put(fastd_uring_buf_ring_t *buf_ring);
+
+/** Removes an operation from the list of pending operations and returns it to the list of unused operations */
+static void op_free(fastd_uring_op_t *op) {
+	*op->pprev = op->next;
+	if (op->next)
+		op->next->pprev = op->pprev;
+
+	if (op->buf_ring)
+		buf_ring_put(op->buf_ring);
+
+	op->next = ctx.uring->free_ops;
+	ctx.uring->free_ops = op;
+}
+
+/** Queues a submission queue entry for an operation (the entries are submitted in fastd_poll_handle()) */
+static void op_submit(fastd_uring_op_t *op) {
+	struct io_uring_sqe *sqe = uring_get_sqe();
+
+	switch (op->type) {
+	case URING_OP_POLL:
+		io_uring_prep_poll_add(sqe, op->fd->fd, POLLIN);
+		break;
+
+	case URING_OP_RECVMSG:
+		io_uring_prep_recvmsg_multishot(sqe, op->fd->fd, &ctx.uring->recv_msg, 0);
+		sqe->flags |= IOSQE_BUFFER_SELECT;
+		sqe->buf_group = op->buf_ring->group;
+		break;
+
+	case URING_OP_READ:
+		io_uring_prep_read(sqe, op->fd->fd, op->buffer.data, op->buffer.len, -1);
+		break;
+
+	case URING_OP_SENDMSG:
+		io_uring_prep_sendmsg(sqe, op->fd->fd, op->msghdr, 0);
+		break;
+
+	case URING_OP_WRITE:
+		io_uring_prep_write(sqe, op->fd->fd, op->buffer.data, op->buffer.len, -1);
+		break;
+	}
+
+	io_uring_sqe_set_data(sqe, op);
+}
+
+
+/** Returns a buffer of a provided buffer ring */
+static inline uint8_t * recv_buf(const fastd_uring_buf_ring_t *buf_ring, unsigned bid) {
+	return buf_ring->bufs + bid * buf_ring->buf_size;
+}
+
+/** Gives a buffer back to the kernel after its packet has been handled */
+static inline void recycle_buf(fastd_uring_buf_ring_t *buf_ring, unsigned bid) {
+	io_uring_buf_ring_add(buf_ring->ring, recv_buf(buf_ring, bid), buf_ring->buf_size, bid, io_uring_buf_ring_mask(URING_RECV_BUFFERS), 0);
+	io_uring_buf_ring_advance(buf_ring->ring, 1);
+}
+
+/** Returns the size the provided buffers need for the current maximum MTU */
+static size_t recv_buf_size(void) {
+	const struct msghdr *recv_msg = &ctx.uring->recv_msg;
+
+	size_t max_len = 1 + fastd_max_payload(ctx.max_mtu) + conf.max_overhead;
+	return alignto(sizeof(struct io_uring_recvmsg_out) + recv_msg->msg_namelen + recv_msg->msg_controllen + max_len, 16);
+}
+
+/** Sets up a buffer ring for socket receives, with buffers of the given size */
+static fastd_uring_buf_ring_t * buf_ring_new(size_t buf_size) {
+	fastd_uring_t *uring = ctx.uring;
+	fastd_uring_buf_ring_t *buf_ring = fastd_new0(fastd_uring_buf_ring_t);
+
+	buf_ring->group = uring->next_buf_group++;
+	buf_ring->buf_size = buf_size;
+
+	int ret;
+	buf_ring->ring = io_uring_setup_buf_ring(&uring->ring, URING_RECV_BUFFERS, buf_ring->group, 0, &ret);
+	if (!buf_ring->ring)
+		exit_uring(ret, "io_uring_setup_buf_ring");
+
+	buf_ring->bufs = fastd_alloc_aligned(URING_RECV_BUFFERS * buf_size, 16);
+
+	unsigned i;
+	for (i = 0; i < URING_RECV_BUFFERS; i++)
+		io_uring_buf_ring_add(buf_ring->ring, recv_buf(buf_ring, i), buf_size, i, io_uring_buf_ring_mask(URING_RECV_BUFFERS), i);
+
+	io_uring_buf_ring_advance(buf_ring->ring, URING_RECV_BUFFERS);
+
+	return buf_ring;
+}
+
+/** Unregisters and frees a buffer ring */
+static void buf_ring_free(fastd_uring_buf_ring_t *buf_ring) {
+	io_uring_free_buf_ring(&ctx.uring->ring, buf_ring->ring, URING_RECV_BUFFERS, buf_ring->group);
+	free(buf_ring->bufs);
+	free(buf_ring);
+}
+
+/** Releases the reference of a receive operation to a buffer ring, freeing the ring if it has been replaced and isn't used anymore */
+static void buf_ring_put(fastd_uring_buf_ring_t *buf_ring) {
+	if (--buf_ring->n_ops == 0 && buf_ring != ctx.uring->buf_ring)
+		buf_ring_free(buf_ring);
+}
+
+/** Creates a new multishot receive operation for a socket */
+static void recvmsg_new(fastd_poll_fd_t *fd) {
+	fastd_uring_op_t *op = op_new(URING_OP_RECVMSG, fd);
+	op->buf_ring = ctx.uring->buf_ring;
+	op->buf_ring->n_ops++;
+
+	op_submit(op);
+}
+
+/**
+   Makes sure that the buffers provided for socket receives are large enough for the current maximum MTU
+
+   When they aren't, a new buffer ring is set up and the receives of all sockets are
+   cancelled and resubmitted using the new ring.
+*/
+static void update_buf_ring(void) {
+	fastd_uring_t *uring = ctx.uring;
+
+	size_t buf_size = recv_buf_size();
+	if (uring->buf_ring && uring->buf_ring->buf_size >= buf_size)
+		return;
+
+	fastd_uring_buf_ring_t *old = uring->buf_ring;
+	uring->buf_ring = buf_ring_new(buf_size);
+
+	if (!old)
+		return;
+
+	pr_debug("io_uring: enlarging receive buffers to %u bytes", (unsigned)buf_size);
+
+	fastd_uring_op_t *op;
+	for (op = uring->ops; op; op = op->next) {
+		if (op->type != URING_OP_RECVMSG || op->buf_ring != old || !op->fd)
+			continue;
+
+		/* The new receive is added at the head of the list, so it isn't visited again */
+		recvmsg_new(op->fd);
+
+		/* The old operation is freed when its cancellation has completed, like for a closed socket */
+		op->fd = NULL;
+
+		struct io_uring_sqe *sqe = uring_get_sqe();
+		io_uring_prep_cancel(sqe, op, 0);
+		io_uring_sqe_set_data(sqe, NULL);
+	}
+
+	if (!old->n_ops)
+		buf_ring_free(old);
+}
+
+/** Handles a packet received into a provided buffer */
+static void handle_recvmsg(fastd_socket_t *sock, void *buf, int len) {
+	struct msghdr *recv_msg = &ctx.uring->recv_msg;
+
+	struct io_uring_recvmsg_out *out = io_uring_recvmsg_validate(buf, len, recv_msg);
+	if (!out) {
+		pr_warn("io_uring: received invalid message");
+		return;
+	}
+
+	if (out->flags & MSG_TRUNC) {
+		pr_debug("received truncated packet");
+		return;
+	}
+
+	size_t payload_len = io_uring_recvmsg_payload_length(out, len, recv_msg);
+	if (!payload_len)
+		return;
+
+	fastd_peer_address_t recvaddr = {};
+	memcpy(&recvaddr, io_uring_recvmsg_name(out), min_size_t(out->namelen, sizeof(recvaddr)));
+
+	struct msghdr message = {
+		.msg_name = &recvaddr,
+		.msg_namelen = sizeof(recvaddr),
+		.msg_control = (uint8_t *)io_uring_recvmsg_name(out) + recv_msg->msg_namelen,
+		.msg_controllen = out->controllen,
+	};
+
+	fastd_buffer_t buffer = fastd_buffer_alloc(payload_len, conf.min_decrypt_head_space, conf.min_decrypt_tail_space);
+	memcpy(buffer.data, io_uring_recvmsg_payload(out, recv_msg), payload_len);
+
+	fastd_receive_message(sock, &message, buffer);
+}
+
+/** Handles a completion queue entry */
+static void handle_completion(fastd_uring_op_t *op, int res, unsigned flags) {
+	switch (op->type) {
+	case URING_OP_POLL:
+		if (op->fd) {
+			if (res < 0)
+				exit_uring(res, "io_uring: poll");
+
+			handle_fd(op->fd, res & POLLIN, res & (POLLERR|POLLHUP|POLLNVAL));
+		}
+		break;
+
+	case URING_OP_RECVMSG:
+		if (flags & IORING_CQE_F_BUFFER) {
+			unsigned bid = flags >> IORING_CQE_BUFFER_SHIFT;
+
+			if (op->fd && res > 0) {
+				ctx.poll_stats.packets++;
+				handle_recvmsg(container_of(op->fd, fastd_socket_t, fd), recv_buf(op->buf_ring, bid), res);
+			}
+
+			recycle_buf(op->buf_ring, bid);
+		}
+		else if (op->fd && res < 0 && res != -ENOBUFS) {
+			errno = -res;
+			pr_debug_errno("io_uring: recvmsg");
+
+			handle_fd(op->fd, false, true);
+		}
+
+		/* The multishot receive is still active */
+		if (flags & IORING_CQE_F_MORE)
+			return;
+
+		break;
+
+	case URING_OP_READ:
+		if (!op->fd) {
+			fastd_buffer_free(op->buffer);
+			break;
+		}
+
+		if (res < 0)
+			exit_uring(res, "read");
+
+		fastd_iface_t *iface = container_of(op->fd, fastd_iface_t, fd);
+
+		ctx.poll_stats.packets++;
+
+		op->buffer.len = res;
+		fastd_iface_handle_packet(iface, op->buffer);
+
+		if (op->fd)
+			op->buffer = fastd_iface_buffer_alloc(iface);
+
+		break;
+
+	case URING_OP_SENDMSG:
+		if (fastd_send_complete(op->fd, op->batch, op->msg, res))
+			op_submit(op);
+		else
+			op_free(op);
+
+		return;
+
+	case URING_OP_WRITE:
+		if (res < 0) {
+			errno = -res;
+			pr_debug2_errno("write");
+		}
+
+		fastd_buffer_free(op->buffer);
+		op_free(op);
+		return;
+	}
+
+	/* Re-arm the operation unless its file descriptor has been closed */
+	if (op->fd)
+		op_submit(op);
+	else
+		op_free(op);
+}
+
+
+void fastd_poll_init(void) {
+	ctx.uring = fastd_new0(fastd_uring_t);
+
+	int ret = io_uring_queue_init(URING_ENTRIES, &ctx.uring->ring, 0);
+	if (ret < 0)
+		exit_uring(ret, "io_uring_queue_init");
+
+	ctx.uring->recv_msg = (struct msghdr){
+		.msg_namelen = sizeof(fastd_peer_address_t),
+		.msg_controllen = URING_CONTROL_LEN,
+	};
+}
+
+void fastd_poll_free(void) {
+	fastd_uring_t *uring = ctx.uring;
+
+	/* The buffer rings are freed with the last operations using them */
+	fastd_uring_buf_ring_t *buf_ring = uring->buf_ring;
+	uring->buf_ring = NULL;
+	if (buf_ring && !buf_ring->n_ops)
+		buf_ring_free(buf_ring);
+
+	while (uring->ops) {
+		fastd_uring_op_t *op = uring->ops;
+
+		switch (op->type) {
+		case URING_OP_READ:
+		case URING_OP_WRITE:
+			fastd_buffer_free(op->buffer);
+			break;
+
+		case URING_OP_SENDMSG:
+			fastd_send_cancel(op->batch, op->msg);
+			break;
+
+		default:
+			break;
+		}
+
+		op_free(op);
+	}
+
+	io_uring_queue_exit(&uring->ring);
+
+	size_t i;
+	for (i = 0; i < VECTOR_LEN(uring->op_chunks); i++)
+		free(VECTOR_INDEX(uring->op_chunks, i));
+
+	VECTOR_FREE(uring->op_chunks);
+	free(uring);
+}
+
+void fastd_poll_configure(void) {
+	/* The buffer ring is set up when the first socket is registered */
+	if (ctx.uring->buf_ring)
+		update_buf_ring();
+}
+
+
+void fastd_poll_fd_register(fastd_poll_fd_t *fd) {
+	if (fd->fd < 0)
+		exit_bug("fastd_poll_fd_register: invalid FD");
+
+	fastd_uring_op_t *op;
+
+	switch (fd->type) {
+	case POLL_TYPE_SOCKET:
+		update_buf_ring();
+		recvmsg_new(fd);
+		return;
+
+	case POLL_TYPE_IFACE:
+		op = op_new(URING_OP_READ, fd);
+		op->buffer = fastd_iface_buffer_alloc(container_of(fd, fastd_iface_t, fd));
+		break;
+
+	default:
+		op = op_new(URING_OP_POLL, fd);
+	}
+
+	op_submit(op);
+}
+
+bool fastd_poll_fd_close(fastd_poll_fd_t *fd) {
+	fastd_uring_op_t *op;
+	for (op = ctx.uring->ops; op; op = op->next) {
+		if (op->fd != fd)
+			continue;
+
+		op->fd = NULL;
+
+		/* Pending sends and writes are left to complete */
+		if (op->type == URING_OP_SENDMSG || op->type == URING_OP_WRITE)
+			continue;
+
+		struct io_uring_sqe *sqe = uring_get_sqe();
+		io_uring_prep_cancel(sqe, op, 0);
+		io_uring_sqe_set_data(sqe, NULL);
+	}
+
+	/* Submit the cancellations right away, so the kernel releases the file when it is closed */
+	int ret = io_uring_submit(&ctx.uring->ring);
+	if (ret < 0)
+		exit_uring(ret, "io_uring_submit");
+
+	return (close(fd->fd) == 0);
+}
+
+
+void fastd_poll_sendmsg(const fastd_poll_fd_t *fd, fastd_send_batch_t *batch, size_t msg, const struct msghdr *msghdr) {
+	/* The FD is only compared against when it is closed and never modified */
+	fastd_uring_op_t *op = op_new(URING_OP_SENDMSG, (fastd_poll_fd_t *)fd);
+	op->batch = batch;
+	op->msg = msg;
+	op->msghdr = msghdr;
+
+	op_submit(op);
+}
+
+void fastd_poll_write(const fastd_poll_fd_t *fd, fastd_buffer_t buffer) {
+	fastd_uring_op_t *op = op_new(URING_OP_WRITE, (fastd_poll_fd_t *)fd);
+	op->buffer = buffer;
+
+	op_submit(op);
+}
+
+
+/**
+   Submits all queued operations (like the packets sent in the last iteration) and waits for completions
+
+   \return The number of available completions, or -1 if the wait was interrupted
+*/
+static int uring_wait(int timeout, UNUSED void *arg) {
+	fastd_uring_t *uring = ctx.uring;
+	int ret;
+
+	if (timeout == 0) {
+		ret = io_uring_submit(&uring->ring);
+		if (ret < 0 && ret != -EINTR)
+			exit_uring(ret, "io_uring_submit");
+
+		return io_uring_cq_ready(&uring->ring);
+	}
+
+	struct __kernel_timespec ts = {
+		.tv_sec = timeout / 1000,
+		.tv_nsec = (timeout % 1000) * 1000000,
+	};
+
+	sigset_t set;
+	sigemptyset(&set);
+
+	struct io_uring_cqe *cqe;
+
+	ret = io_uring_submit_and_wait_timeout(&uring->ring, &cqe, 1, (timeout >= 0) ? &ts : NULL, &set);
+	if (ret == -EINTR)
+		return -1;
+	if (ret < 0 && ret != -ETIME)
+		exit_uring(ret, "io_uring_submit_and_wait_timeout");
+
+	return io_uring_cq_ready(&uring->ring);
+}
+
+void fastd_poll_handle(void) {
+	fastd_uring_t *uring = ctx.uring;
+	struct io_uring_cqe *cqe;
+
+	busy_wait(task_timeout(), uring_wait, NULL);
+
+	fastd_update_time();
+
+	ctx.poll_stats.loops++;
+
+	size_t i;
+	for (i = 0; i < URING_MAX_COMPLETIONS; i++) {
+		if (io_uring_peek_cqe(&uring->ring, &cqe))
+			break;
+
+		ctx.poll_stats.events++;
+
+		fastd_uring_op_t *op = io_uring_cqe_get_data(cqe);
+		int res = cqe->res;
+		unsigned flags = cqe->flags;
+
+		io_uring_cqe_seen(&uring->ring, cqe);
+
+		/* Cancellations don't have an associated operation */
+		if (op)
+			handle_completion(op, res, flags);
+	}
+}
+
+#elif defined(USE_EPOLL)
 
 
 #ifndef SYS_epoll_pwait
@@ -129,6 +905,15 @@ static inline int epoll_wait_unblocked(int epfd, struct epoll_event *events, int
 	return syscall(SYS_epoll_pwait, epfd, events, maxevents, timeout, buf, sizeof(buf));
 }
 
+/** Waits for up to EPOLL_MAX_EVENTS events, storing them in \e events */
+static int epoll_wait_events(int timeout, void *events) {
+	int ret = epoll_wait_unblocked(ctx.epoll_fd, events, EPOLL_MAX_EVENTS, timeout);
+	if (ret < 0 && errno != EINTR)
+		exit_errno("epoll_pwait");
+
+	return ret;
+}
+
 
 void fastd_poll_init(void) {
 	ctx.epoll_fd = epoll_create(1);
@@ -139,6 +924,8 @@ void fastd_poll_init(void) {
 void fastd_poll_free(void) {
 	if (close(ctx.epoll_fd))
 		pr_warn_errno("closing EPOLL: close");
+
+	VECTOR_FREE(ctx.ready_fds);
 }
 
 
@@ -159,28 +946,37 @@ bool fastd_poll_fd_close(fastd_poll_fd_t *fd) {
 	if (epoll_ctl(ctx.epoll_fd, EPOLL_CTL_DEL, fd->fd, NULL) < 0)
 		exit_errno("epoll_ctl");
 
+	forget_ready_fd(fd);
+
 	return (close(fd->fd) == 0);
 }
 
 
 void fastd_poll_handle(void) {
-	int timeout = task_timeout();
+	struct epoll_event events[EPOLL_MAX_EVENTS];
 
-	struct epoll_event events[16];
-	int ret = epoll_wait_unblocked(ctx.epoll_fd, events, 16, timeout);
-	if (ret < 0 && errno != EINTR)
-		exit_errno("epoll_pwait");
+	int ret = busy_wait(ready_fds_timeout(), epoll_wait_events, events);
 
 	fastd_update_time();
 
+	ctx.poll_stats.loops++;
+
 	if (ret < 0)
 		return;
 
+	ctx.poll_stats.events += ret;
+
 	size_t i;
-	for (i = 0; i < (size_t)ret; i++)
-		handle_fd(events[i].data.ptr,
-			  events[i].events & EPOLLIN,
-			  events[i].events & (EPOLLERR|EPOLLHUP));
+	for (i = 0; i < (size_t)ret; i++) {
+		fastd_poll_fd_t *fd = events[i].data.ptr;
+
+		if (events[i].events & (EPOLLERR|EPOLLHUP))
+			handle_fd(fd, events[i].events & EPOLLIN, true);
+		else if (events[i].events & EPOLLIN)
+			add_ready_fd(fd);
+	}
+
+	handle_ready_fds();
 }
 
 #else
@@ -191,6 +987,7 @@ void fastd_poll_init(void) {
 void fastd_poll_free(void) {
 	VECTOR_FREE(ctx.fds);
 	VECTOR_FREE(ctx.pollfds);
+	VECTOR_FREE(ctx.ready_fds);
 }
 
 
@@ -214,38 +1011,19 @@ bool fastd_poll_fd_close(fastd_poll_fd_t *fd) {
 
 	VECTOR_RESIZE(ctx.pollfds, 0);
 
+	forget_ready_fd(fd);
+
 	return (close(fd->fd) == 0);
 }
 
 
-void fastd_poll_handle(void) {
-	size_t i;
-
-	int timeout = task_timeout();
-
-	if (!VECTOR_LEN(ctx.pollfds)) {
-		for (i = 0; i < VECTOR_LEN(ctx.fds); i++) {
-			fastd_poll_fd_t *fd = VECTOR_INDEX(ctx.fds, i);
-			if (!fd)
-				continue;
-
-			struct pollfd pollfd = {
-				.fd = fd->fd,
-				.events = POLLIN,
-				.revents = 0,
-			};
-			VECTOR_ADD(ctx.pollfds, pollfd);
-		}
-	}
-
-	sigset_t set, oldset;
-	sigemptyset(&set);
-	pthread_sigmask(SIG_SETMASK, &set, &oldset);
-
+/** Waits for events on the file descriptors in ctx.pollfds */
+static int poll_wait(int timeout, UNUSED void *arg) {
 	int ret = 0;
 
 #ifdef USE_SELECT
 	/* Inefficient implementation for OSX... */
+	size_t i;
 	fd_set readfds;
 	FD_ZERO(&readfds);
 	int maxfd = -1;
@@ -300,20 +1078,61 @@ void fastd_poll_handle(void) {
 		exit_errno("poll");
 #endif
 
+	return ret;
+}
+
+void fastd_poll_handle(void) {
+	size_t i;
+
+	int timeout = ready_fds_timeout();
+
+	if (!VECTOR_LEN(ctx.pollfds)) {
+		for (i = 0; i < VECTOR_LEN(ctx.fds); i++) {
+			fastd_poll_fd_t *fd = VECTOR_INDEX(ctx.fds, i);
+			if (!fd)
+				continue;
+
+			struct pollfd pollfd = {
+				.fd = fd->fd,
+				.events = POLLIN,
+				.revents = 0,
+			};
+			VECTOR_ADD(ctx.pollfds, pollfd);
+		}
+	}
+
+	sigset_t set, oldset;
+	sigemptyset(&set);
+	pthread_sigmask(SIG_SETMASK, &set, &oldset);
+
+	int ret = busy_wait(timeout, poll_wait, NULL);
+
 	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
 	fastd_update_time();
 
+	ctx.poll_stats.loops++;
+
 	if (ret <= 0)
 		return;
 
+	ctx.poll_stats.events += ret;
+
 	for (i = 0; i < VECTOR_LEN(ctx.pollfds) && ret > 0; i++) {
 		struct pollfd *pollfd = &VECTOR_INDEX(ctx.pollfds, i);
+		fastd_poll_fd_t *fd = VECTOR_INDEX(ctx.fds, pollfd->fd);
 
-		if (pollfd->revents)
-			ret--;
+		if (!pollfd->revents)
+			continue;
 
-		handle_fd(VECTOR_INDEX(ctx.fds, pollfd->fd), pollfd->revents & POLLIN, pollfd->revents & (POLLERR|POLLHUP|POLLNVAL));
+		ret--;
+
+		if (pollfd->revents & (POLLERR|POLLHUP|POLLNVAL))
+			handle_fd(fd, pollfd->revents & POLLIN, true);
+		else if (pollfd->revents & POLLIN)
+			add_ready_fd(fd);
 	}
+
+	handle_ready_fds();
 }
 
 #endif
@@ -43,6 +43,18 @@ struct fastd_poll_fd {
 };
 
 
+/** Statistics about the main loop */
+struct fastd_poll_stats {
+	uint64_t loops;				/**< The number of times the main loop has waited for events */
+	uint64_t events;			/**< The number of events handled */
+	uint64_t packets;			/**< The number of packets read from sockets and TUN/TAP interfaces */
+	uint64_t budget_exhausted;		/**< The number of times a file descriptor still had input after its packet budget was used up */
+	uint64_t spin_wakeups;			/**< The number of times events were found while busy polling */
+	uint64_t sleep_wakeups;			/**< The number of times the main loop went to sleep to wait for events */
+	uint64_t spin_time;			/**< The total time spent busy polling in microseconds */
+};
+
+
 /** Initializes the poll interface */
 void fastd_poll_init(void);
 /** Frees the poll interface */
@@ -58,3 +70,20 @@ bool fastd_poll_fd_close(fastd_poll_fd_t *fd);
 
 /** Waits for the next input event */
 void fastd_poll_handle(void);
+
+#ifdef USE_IO_URING
+
+/** Adapts the receive buffers to a changed maximum MTU */
+void fastd_poll_configure(void);
+
+/** Submits a message of a send batch to be sent on a socket; its completion is passed to fastd_send_complete() */
+void fastd_poll_sendmsg(const fastd_poll_fd_t *fd, fastd_send_batch_t *batch, size_t msg, const struct msghdr *msghdr);
+/** Submits a packet to be written to a TUN/TAP interface; the buffer is freed when the write has completed */
+void fastd_poll_write(const fastd_poll_fd_t *fd, fastd_buffer_t buffer);
+
+#else
+
+/** Does nothing, as the packets are received into buffers of the buffer pool */
+static inline void fastd_poll_configure(void) {}
+
+#endif
@@ -124,53 +124,124 @@ static inline bool use_old_session(const fastd_protocol_peer_state_t *state) {
 	return true;
 }
 
-/** Handles a payload packet received from a peer */
-static void protocol_handle_recv(fastd_peer_t *peer, fastd_buffer_t buffer) {
+/** Updates the session state after a packet has been received successfully with the current session */
+static void session_received(fastd_peer_t *peer) {
+	if (peer->protocol_state->old_session.method) {
+		pr_debug("invalidating old session with %P", peer);
+		peer->protocol_state->old_session.method->provider->session_free(peer->protocol_state->old_session.method_state);
+		peer->protocol_state->old_session = (protocol_session_t){};
+	}
+
+	if (!peer->protocol_state->session.handshakes_cleaned) {
+		pr_debug("cleaning left handshakes with %P", peer);
+		fastd_peer_unschedule_handshake(peer);
+		peer->protocol_state->session.handshakes_cleaned = true;
+
+		if (peer->protocol_state->session.method->provider->session_is_initiator(peer->protocol_state->session.method_state))
+			fastd_protocol_ec25519_fhmqvc_send_empty(peer, &peer->protocol_state->session);
+	}
+
+	check_session_refresh(peer);
+}
+
+/** Passes on a decrypted payload packet (empty packets are keepalives) */
+static inline void handle_decrypted(fastd_peer_t *peer, fastd_buffer_t buffer, bool reordered, fastd_packet_seq_t seq) {
+	fastd_peer_seen(peer);
+
+	if (buffer.len)
+		fastd_reorder_receive(peer, seq, buffer, reordered);
+	else
+		fastd_buffer_free(buffer);
+}
+
+/** Handles a payload packet received from a peer (with the peer lock held) */
+static void handle_recv(fastd_peer_t *peer, fastd_buffer_t buffer) {
 	if (!peer->protocol_state || !check_session(peer))
 		goto fail;
 
 	fastd_buffer_t recv_buffer;
+	const protocol_session_t *session = &peer->protocol_state->old_session;
 	bool ok = false, reordered = false;
+	fastd_packet_seq_t seq = {};
 
-	if (is_session_valid(&peer->protocol_state->old_session))
-		ok = peer->protocol_state->old_session.method->provider->decrypt(peer, peer->protocol_state->old_session.method_state, &recv_buffer, buffer, &reordered);
+	if (is_session_valid(session))
+		ok = fastd_method_decrypt(session->method->provider, peer, session->method_state, &recv_buffer, buffer, &reordered, &seq);
 
 	if (!ok) {
-		ok = peer->protocol_state->session.method->provider->decrypt(peer, peer->protocol_state->session.method_state, &recv_buffer, buffer, &reordered);
+		session = &peer->protocol_state->session;
+
+		ok = fastd_method_decrypt(session->method->provider, peer, session->method_state, &recv_buffer, buffer, &reordered, &seq);
 		if (!ok) {
 			pr_debug2("verification failed for packet received from %P", peer);
 			goto fail;
 		}
 
-		if (peer->protocol_state->old_session.method) {
-			pr_debug("invalidating old session with %P", peer);
-			peer->protocol_state->old_session.method->provider->session_free(peer->protocol_state->old_session.method_state);
-			peer->protocol_state->old_session = (protocol_session_t){};
-		}
+		session_received(peer);
+	}
 
-		if (!peer->protocol_state->session.handshakes_cleaned) {
-			pr_debug("cleaning left handshakes with %P", peer);
-			fastd_peer_unschedule_handshake(peer);
-			peer->protocol_state->session.handshakes_cleaned = true;
+	handle_decrypted(peer, recv_buffer, reordered, seq);
+	return;
 
-			if (peer->protocol_state->session.method->provider->session_is_initiator(peer->protocol_state->session.method_state))
-				fastd_protocol_ec25519_fhmqvc_send_empty(peer, &peer->protocol_state->session);
-		}
+ fail:
+	fastd_buffer_free(buffer);
+}
 
-		check_session_refresh(peer);
+/** Handles a payload packet received from a peer */
+static void protocol_handle_recv(fastd_peer_t *peer, fastd_buffer_t buffer) {
+	fastd_worker_peer_lock(peer);
+	handle_recv(peer, buffer);
+	fastd_worker_peer_unlock(peer);
+}
+
+/** Handles a batch of payload packets received from a peer (with the peer lock held) */
+static void handle_recv_batch(fastd_peer_t *peer, fastd_buffer_t *buffers, size_t n) {
+	size_t i;
+
+	if (!peer->protocol_state || !check_session(peer)) {
+		for (i = 0; i < n; i++)
+			fastd_buffer_free(buffers[i]);
+		return;
 	}
 
-	fastd_peer_seen(peer);
+	if (is_session_valid(&peer->protocol_state->old_session)) {
+		for (i = 0; i < n; i++)
+			handle_recv(peer, buffers[i]);
+		return;
+	}
 
-	if (recv_buffer.len)
-		fastd_handle_receive(peer, recv_buffer, reordered);
-	else
-		fastd_buffer_free(recv_buffer);
+	protocol_session_t *session = &peer->protocol_state->session;
+	bool ok[CRYPTO_BATCH_SIZE], reordered[CRYPTO_BATCH_SIZE];
+	fastd_packet_seq_t seq[CRYPTO_BATCH_SIZE];
+	bool received = false;
 
-	return;
+	fastd_method_decrypt_batch(session->method->provider, peer, session->method_state, buffers, n, ok, reordered, seq);
 
- fail:
-	fastd_buffer_free(buffer);
+	for (i = 0; i < n; i++) {
+		if (!ok[i]) {
+			pr_debug2("verification failed for packet received from %P", peer);
+			fastd_buffer_free(buffers[i]);
+			continue;
+		}
+
+		if (!received) {
+			session_received(peer);
+			received = true;
+		}
+
+		handle_decrypted(peer, buffers[i], reordered[i], seq[i]);
+	}
+}
+
+/**
+   Handles a batch of payload packets received from a peer
+
+   While an old session is still valid, each packet may belong to either session, so
+   the packets are handled one by one.
+*/
+static void protocol_handle_recv_batch(fastd_peer_t *peer, fastd_buffer_t *buffers, size_t n) {
+	fastd_worker_peer_lock(peer);
+	handle_recv_batch(peer, buffers, n);
+	fastd_worker_peer_unlock(peer);
 }
 
 /** Encrypts and sends a packet to a peer using a specified session */
@@ -178,37 +249,154 @@ static void session_send(fastd_peer_t *peer, fastd_buffer_t buffer, protocol_ses
 	size_t stat_size = buffer.len;
 
 	fastd_buffer_t send_buffer;
-	if (!session->method->provider->encrypt(peer, session->method_state, &send_buffer, buffer)) {
+	if (!fastd_method_encrypt(session->method->provider, peer, session->method_state, &send_buffer, buffer)) {
 		fastd_buffer_free(buffer);
 		pr_error("failed to encrypt packet for %P", peer);
 		return;
 	}
 
 	fastd_send(peer->sock, &peer->local_address, &peer->address, peer, send_buffer, stat_size);
-	fastd_peer_clear_keepalive(peer);
+
+	/* Keep sending keepalives from the main thread when the payload is sent by workers, so send errors are noticed */
+	if (!fastd_in_worker())
+		fastd_peer_clear_keepalive(peer);
+}
+
+/**
+   Returns the session to use for sending packets to a peer
+
+   Returns NULL when the session isn't valid anymore and the packets must be dropped. On the
+   main thread, the peer is reset in this case and a session refresh is started when necessary;
+   on worker threads, this is left to the main thread.
+*/
+static protocol_session_t * send_session(fastd_peer_t *peer) {
+	if (!fastd_in_worker()) {
+		if (!check_session(peer))
+			return NULL;
+
+		check_session_refresh(peer);
+	}
+
+	if (use_old_session(peer->protocol_state)) {
+		pr_debug2("sending packet for old session to %P", peer);
+		return &peer->protocol_state->old_session;
+	}
+
+	protocol_session_t *session = &peer->protocol_state->session;
+	return is_session_valid(session) ? session : NULL;
+}
+
+/** Drops a packet that can't be sent as no session is available */
+static void drop_send(fastd_peer_t *peer, fastd_buffer_t buffer) {
+	fastd_stats_add(peer, STAT_TX_DROPPED, buffer.len);
+	fastd_buffer_free(buffer);
 }
 
 /** Encrypts and sends a packet to a peer */
 static void protocol_send(fastd_peer_t *peer, fastd_buffer_t buffer) {
-	if (!peer->protocol_state || !fastd_peer_is_established(peer) || !check_session(peer)) {
+	fastd_worker_peer_lock(peer);
+
+	if (!peer->protocol_state || !fastd_peer_is_established(peer)) {
 		fastd_buffer_free(buffer);
-		return;
+		goto out;
 	}
 
-	check_session_refresh(peer);
+	protocol_session_t *session = send_session(peer);
+	if (session)
+		session_send(peer, buffer, session);
+	else
+		drop_send(peer, buffer);
 
-	if (use_old_session(peer->protocol_state)) {
-		pr_debug2("sending packet for old session to %P", peer);
-		session_send(peer, buffer, &peer->protocol_state->old_session);
+ out:
+	fastd_worker_peer_unlock(peer);
+}
+
+/** Encrypts and sends a batch of packets to a peer */
+static void protocol_send_batch(fastd_peer_t *peer, fastd_buffer_t *buffers, size_t n) {
+	size_t i;
+
+	fastd_worker_peer_lock(peer);
+
+	if (!peer->protocol_state || !fastd_peer_is_established(peer)) {
+		for (i = 0; i < n; i++)
+			fastd_buffer_free(buffers[i]);
+		goto out;
+	}
+
+	protocol_session_t *session = send_session(peer);
+	if (!session) {
+		for (i = 0; i < n; i++)
+			drop_send(peer, buffers[i]);
+		goto out;
 	}
-	else {
-		session_send(peer, buffer, &peer->protocol_state->session);
+
+	size_t stat_size[CRYPTO_BATCH_SIZE];
+	bool ok[CRYPTO_BATCH_SIZE];
+
+	for (i = 0; i < n; i++)
+		stat_size[i] = buffers[i].len;
+
+	fastd_method_encrypt_batch(session->method->provider, peer, session->method_state, buffers, n, ok);
+
+	bool sent = false;
+
+	for (i = 0; i < n; i++) {
+		if (!ok[i]) {
+			fastd_buffer_free(buffers[i]);
+			pr_error("failed to encrypt packet for %P", peer);
+			continue;
+		}
+
+		fastd_send(peer->sock, &peer->local_address, &peer->address, peer, buffers[i], stat_size[i]);
+		sent = true;
 	}
+
+	if (sent && !fastd_in_worker())
+		fastd_peer_clear_keepalive(peer);
+
+ out:
+	fastd_worker_peer_unlock(peer);
 }
 
+#ifdef WITH_WORKERS
+
+/**
+   Handles a payload packet received from a peer on a worker thread
+
+   Packets which might require changes to the peer state (invalid sessions, session
+   refreshes, packets after handshakes) are left to protocol_handle_recv().
+*/
+static bool protocol_handle_recv_worker(fastd_peer_t *peer, fastd_buffer_t buffer) {
+	if (!peer->protocol_state)
+		return false;
+
+	protocol_session_t *session = &peer->protocol_state->session;
+
+	if (!is_session_valid(session) || !session->handshakes_cleaned || peer->protocol_state->old_session.method)
+		return false;
+
+	if (!session->refreshing && session->method->provider->session_want_refresh(session->method_state))
+		return false;
+
+	fastd_buffer_t recv_buffer;
+	bool reordered = false;
+	fastd_packet_seq_t seq = {};
+
+	if (!fastd_method_decrypt(session->method->provider, peer, session->method_state, &recv_buffer, buffer, &reordered, &seq)) {
+		pr_debug2("verification failed for packet received from %P", peer);
+		fastd_buffer_free(buffer);
+		return true;
+	}
+
+	handle_decrypted(peer, recv_buffer, reordered, seq);
+	return true;
+}
+
+#endif
+
 /** Sends an empty payload packet (i.e. keepalive) to a peer using a specified session */
 void fastd_protocol_ec25519_fhmqvc_send_empty(fastd_peer_t *peer, protocol_session_t *session) {
-	session_send(peer, fastd_buffer_alloc(0, alignto(session->method->provider->min_encrypt_head_space, 8), session->method->provider->min_encrypt_tail_space), session);
+	session_send(peer, fastd_buffer_alloc(0, alignto(session->method->provider->min_encrypt_head_space, 16), session->method->provider->min_encrypt_tail_space), session);
 }
 
 /** get_current_method implementation for ec25519-fhmqvp */
@@ -216,10 +404,18 @@ const fastd_method_info_t * protocol_get_current_method(const fastd_peer_t *peer
 	if (!peer->protocol_state || !fastd_peer_is_established(peer))
 		return NULL;
 
+	/* The session states are modified by the workers */
+	fastd_worker_peer_lock(peer);
+
+	const fastd_method_info_t *method;
 	if (use_old_session(peer->protocol_state))
-		return peer->protocol_state->old_session.method;
+		method = peer->protocol_state->old_session.method;
 	else
-		return peer->protocol_state->session.method;
+		method = peer->protocol_state->session.method;
+
+	fastd_worker_peer_unlock(peer);
+
+	return method;
 }
 
 
@@ -237,6 +433,11 @@ const fastd_protocol_t fastd_protocol_ec25519_fhmqvc = {
 
 	.handle_recv = protocol_handle_recv,
 	.send = protocol_send,
+	.handle_recv_batch = protocol_handle_recv_batch,
+	.send_batch = protocol_send_batch,
+#ifdef WITH_WORKERS
+	.handle_recv_worker = protocol_handle_recv_worker,
+#endif
 
 	.init_peer_state = fastd_protocol_ec25519_fhmqvc_init_peer_state,
 	.reset_peer_state = fastd_protocol_ec25519_fhmqvc_reset_peer_state,
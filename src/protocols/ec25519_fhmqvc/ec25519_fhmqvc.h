@@ -35,6 +35,7 @@
 #include "../../fastd.h"
 #include "../../method.h"
 #include "../../peer.h"
+#include "../../reorder.h"
 #include "../../sha256.h"
 
 #include <libuecc/ecc.h>
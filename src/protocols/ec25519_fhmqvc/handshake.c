@@ -33,6 +33,7 @@
 #include "../../crypto.h"
 #include "../../handshake.h"
 #include "../../hkdf_sha256.h"
+#include "../../offload.h"
 #include "../../peer_group.h"
 #include "../../verify.h"
 
@@ -145,21 +146,24 @@ static bool establish(fastd_peer_t *peer, const fastd_method_info_t *method, fas
 
 	pr_verbose("%I authorized as %P", remote_addr, peer);
 
+	bool ret = false;
+	fastd_worker_peer_lock(peer);
+
 	if (!fastd_peer_claim_address(peer, sock, local_addr, remote_addr, true)) {
 		pr_warn("can't establish session with %P[%I] as the address is used by another peer", peer, remote_addr);
 		fastd_peer_reset(peer);
-		return false;
+		goto out;
 	}
 
 	if (!new_session(peer, method, initiator, A, B, X, Y, sigma, salt, serial)) {
 		pr_error("failed to initialize method session for %P (method `%s'%s)", peer, method->name, salt ? "" : ", compat mode");
 		fastd_peer_reset(peer);
-		return false;
+		goto out;
 	}
 
 	if (!fastd_peer_set_established(peer)) {
 		fastd_peer_reset(peer);
-		return false;
+		goto out;
 	}
 
 	peer->establish_handshake_timeout = ctx.now + MIN_HANDSHAKE_INTERVAL;
@@ -171,7 +175,11 @@ static bool establish(fastd_peer_t *peer, const fastd_method_info_t *method, fas
 	else
 		fastd_protocol_ec25519_fhmqvc_send_empty(peer, &peer->protocol_state->session);
 
-	return true;
+	ret = true;
+
+ out:
+	fastd_worker_peer_unlock(peer);
+	return ret;
 }
 
 
@@ -271,12 +279,16 @@ static bool make_shared_handshake_key(bool initiator, const keypair_t *handshake
 	return true;
 }
 
+/** Checks if the shared handshake key cached for a peer belongs to the given handshake keys */
+static inline bool shared_handshake_key_cached(const fastd_peer_t *peer, const handshake_key_t *handshake_key, const aligned_int256_t *peer_handshake_key) {
+	return (peer->protocol_state->last_handshake_serial == handshake_key->serial
+		&& secure_memequal(&peer->protocol_state->peer_handshake_key, peer_handshake_key, PUBLICKEYBYTES));
+}
+
 /** Checks if the currently cached shared handshake key is valid and generates a new one otherwise  */
 static bool update_shared_handshake_key(const fastd_peer_t *peer, const handshake_key_t *handshake_key, const aligned_int256_t *peer_handshake_key) {
-	if (peer->protocol_state->last_handshake_serial == handshake_key->serial) {
-		if (secure_memequal(&peer->protocol_state->peer_handshake_key, peer_handshake_key, PUBLICKEYBYTES))
-			return true;
-	}
+	if (shared_handshake_key_cached(peer, handshake_key, peer_handshake_key))
+		return true;
 
 	bool compat = !conf.secure_handshakes;
 
@@ -306,11 +318,9 @@ static void clear_shared_handshake_key(const fastd_peer_t *peer) {
 
 /** Sends a reply to an initial handshake (type 1) */
 static void respond_handshake(const fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr, fastd_peer_t *peer,
-			      const aligned_int256_t *peer_handshake_key, const fastd_method_info_t *method, bool little_endian) {
+			      const handshake_key_t *handshake_key, const aligned_int256_t *peer_handshake_key, const fastd_method_info_t *method, bool little_endian) {
 	pr_debug("responding handshake with %P[%I]...", peer, remote_addr);
 
-	const handshake_key_t *handshake_key = &ctx.protocol_state->handshake_key;
-
 	if (!update_shared_handshake_key(peer, handshake_key, peer_handshake_key))
 		return;
 
@@ -335,33 +345,24 @@ static void respond_handshake(const fastd_socket_t *sock, const fastd_peer_addre
 	fastd_send_handshake(sock, local_addr, remote_addr, peer, buffer.buffer);
 }
 
-/** Sends a reply to a handshake response (type 2) */
+/** Sends a reply to a handshake response (type 2) after the shared handshake key has been derived */
 static void finish_handshake(fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr, fastd_peer_t *peer, const handshake_key_t *handshake_key, const aligned_int256_t *peer_handshake_key,
-			     const fastd_handshake_t *handshake, const fastd_method_info_t *method) {
+			     const fastd_handshake_t *handshake, const fastd_method_info_t *method,
+			     const aligned_int256_t *sigma, const fastd_sha256_t *shared_handshake_key, const fastd_sha256_t *shared_handshake_key_compat) {
 	pr_debug("finishing handshake with %P[%I]...", peer, remote_addr);
 
 	bool compat = !secure_handshake(handshake);
 
-	aligned_int256_t sigma;
-	fastd_sha256_t shared_handshake_key, shared_handshake_key_compat;
-	if (!make_shared_handshake_key(true, &handshake_key->key,
-				       peer->key,
-				       peer_handshake_key,
-				       &sigma,
-				       compat ? NULL : &shared_handshake_key,
-				       compat ? &shared_handshake_key_compat : NULL))
-		return;
-
 	bool valid;
 	if (!compat) {
 		uint8_t mac[HASHBYTES] __attribute__((aligned(8)));
 		memcpy(mac, handshake->records[RECORD_TLV_MAC].data, HASHBYTES);
 		memset(handshake->records[RECORD_TLV_MAC].data, 0, HASHBYTES);
 
-		valid = fastd_hmacsha256_verify(mac, shared_handshake_key.w, handshake->tlv_data, handshake->tlv_len);
+		valid = fastd_hmacsha256_verify(mac, shared_handshake_key->w, handshake->tlv_data, handshake->tlv_len);
 	}
 	else {
-		valid = fastd_hmacsha256_blocks_verify(handshake->records[RECORD_HANDSHAKE_TAG].data, shared_handshake_key_compat.w, peer->key->key.u32, peer_handshake_key->u32, NULL);
+		valid = fastd_hmacsha256_blocks_verify(handshake->records[RECORD_HANDSHAKE_TAG].data, shared_handshake_key_compat->w, peer->key->key.u32, peer_handshake_key->u32, NULL);
 	}
 
 	if (!valid) {
@@ -370,7 +371,7 @@ static void finish_handshake(fastd_socket_t *sock, const fastd_peer_address_t *l
 	}
 
 	if (!establish(peer, method, sock, local_addr, remote_addr, true, &handshake_key->key.public, peer_handshake_key, &conf.protocol_config->key.public,
-		       &peer->key->key, &sigma, compat ? NULL : shared_handshake_key.w, handshake_key->serial))
+		       &peer->key->key, sigma, compat ? NULL : shared_handshake_key->w, handshake_key->serial))
 		return;
 
 	fastd_handshake_buffer_t buffer = fastd_handshake_new_reply(3, handshake->little_endian, fastd_peer_get_mtu(peer), method, NULL, 4*(4+PUBLICKEYBYTES) + 2*(4+HASHBYTES));
@@ -383,18 +384,37 @@ static void finish_handshake(fastd_socket_t *sock, const fastd_peer_address_t *l
 	if (!compat) {
 		fastd_sha256_t hmacbuf;
 		uint8_t *mac = fastd_handshake_add_zero(&buffer, RECORD_TLV_MAC, HASHBYTES);
-		fastd_hmacsha256(&hmacbuf, shared_handshake_key.w, fastd_handshake_tlv_data(&buffer.buffer), fastd_handshake_tlv_len(&buffer.buffer));
+		fastd_hmacsha256(&hmacbuf, shared_handshake_key->w, fastd_handshake_tlv_data(&buffer.buffer), fastd_handshake_tlv_len(&buffer.buffer));
 		memcpy(mac, hmacbuf.b, HASHBYTES);
 	}
 	else {
 		fastd_sha256_t hmacbuf;
-		fastd_hmacsha256_blocks(&hmacbuf, shared_handshake_key_compat.w, conf.protocol_config->key.public.u32, handshake_key->key.public.u32, NULL);
+		fastd_hmacsha256_blocks(&hmacbuf, shared_handshake_key_compat->w, conf.protocol_config->key.public.u32, handshake_key->key.public.u32, NULL);
 		fastd_handshake_add(&buffer, RECORD_HANDSHAKE_TAG, HASHBYTES, hmacbuf.b);
 	}
 
 	fastd_send_handshake(sock, local_addr, remote_addr, peer, buffer.buffer);
 }
 
+/** Handles a handshake response (type 2) */
+static void handle_handshake_response(fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr, fastd_peer_t *peer, const handshake_key_t *handshake_key, const aligned_int256_t *peer_handshake_key,
+				      const fastd_handshake_t *handshake, const fastd_method_info_t *method) {
+	bool compat = !secure_handshake(handshake);
+
+	aligned_int256_t sigma;
+	fastd_sha256_t shared_handshake_key, shared_handshake_key_compat;
+	if (!make_shared_handshake_key(true, &handshake_key->key,
+				       peer->key,
+				       peer_handshake_key,
+				       &sigma,
+				       compat ? NULL : &shared_handshake_key,
+				       compat ? &shared_handshake_key_compat : NULL))
+		return;
+
+	finish_handshake(sock, local_addr, remote_addr, peer, handshake_key, peer_handshake_key, handshake, method,
+			 &sigma, &shared_handshake_key, &shared_handshake_key_compat);
+}
+
 /** Handles a reply to a handshake response (type 3) */
 static void handle_finish_handshake(fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr,
 				    fastd_peer_t *peer, const handshake_key_t *handshake_key, const aligned_int256_t *peer_handshake_key,
@@ -429,6 +449,204 @@ static void handle_finish_handshake(fastd_socket_t *sock, const fastd_peer_addre
 	clear_shared_handshake_key(peer);
 }
 
+/**
+   A handshake whose shared handshake key is derived by a handshake thread
+
+   The job holds copies of everything the derivation needs, so the main thread is free to change
+   its state in the meantime. The handshake is handled further by handshake_job_done().
+*/
+typedef struct handshake_job {
+	fastd_offload_job_t job;		/**< The offload job */
+
+	uint64_t peer_id;			/**< The ID of the peer the handshake was received from */
+	fastd_socket_t *sock;			/**< The socket the handshake was received on (NULL if it was the peer's own socket) */
+	fastd_peer_address_t local_addr;	/**< The local address the handshake was received on */
+	fastd_peer_address_t remote_addr;	/**< The address the handshake was received from */
+	const fastd_method_info_t *method;	/**< The method supplied in the handshake */
+
+	bool initiator;				/**< Specifies if we have initiated the handshake (i.e. a type 2 handshake is handled) */
+	bool want_shared_handshake_key;		/**< Specifies if \e shared_handshake_key is needed */
+	bool want_shared_handshake_key_compat;	/**< Specifies if \e shared_handshake_key_compat is needed */
+
+	uint64_t serial;			/**< The serial of the handshake keypair */
+	keypair_t handshake_key;		/**< A copy of the handshake keypair */
+	fastd_protocol_key_t peer_key;		/**< A copy of the peer's public key */
+	aligned_int256_t peer_handshake_key;	/**< The peer's public handshake key */
+
+	bool ok;				/**< Set by the handshake thread if the key could be derived */
+	aligned_int256_t sigma;			/**< The derived shared secret */
+	fastd_sha256_t shared_handshake_key;	/**< The derived shared handshake key */
+	fastd_sha256_t shared_handshake_key_compat; /**< The derived shared handshake key (compat mode) */
+
+	fastd_handshake_t handshake;		/**< The handshake (with its records pointing into \e tlv_data) */
+	uint8_t tlv_data[] __attribute__((aligned(8))); /**< A copy of the handshake's TLV record data (only for types 2 and 3) */
+} handshake_job_t;
+
+
+/** Derives the shared handshake key of a handshake job (called on a handshake thread) */
+static void handshake_job_run(fastd_offload_job_t *offload_job) {
+	handshake_job_t *job = container_of(offload_job, handshake_job_t, job);
+
+	job->ok = make_shared_handshake_key(job->initiator, &job->handshake_key,
+					    &job->peer_key,
+					    &job->peer_handshake_key,
+					    &job->sigma,
+					    job->want_shared_handshake_key ? &job->shared_handshake_key : NULL,
+					    job->want_shared_handshake_key_compat ? &job->shared_handshake_key_compat : NULL);
+}
+
+/** Frees a handshake job */
+static void handshake_job_free(handshake_job_t *job) {
+	secure_memzero(job, sizeof(*job) + job->handshake.tlv_len);
+	free(job);
+}
+
+/** Discards a handshake job which hasn't been handled */
+static void handshake_job_drop(fastd_offload_job_t *offload_job) {
+	handshake_job_free(container_of(offload_job, handshake_job_t, job));
+}
+
+/** Returns the handshake keypair with the given serial if it is still valid */
+static const handshake_key_t * get_handshake_key(uint64_t serial) {
+	if (ctx.protocol_state->handshake_key.serial == serial && is_handshake_key_valid(&ctx.protocol_state->handshake_key))
+		return &ctx.protocol_state->handshake_key;
+
+	if (ctx.protocol_state->prev_handshake_key.serial == serial && is_handshake_key_valid(&ctx.protocol_state->prev_handshake_key))
+		return &ctx.protocol_state->prev_handshake_key;
+
+	return NULL;
+}
+
+/**
+   Continues handling a handshake after its shared handshake key has been derived by a handshake thread
+
+   As the main thread has kept running in the meantime, everything the handshake refers to is looked up again.
+*/
+static void handshake_job_done(fastd_offload_job_t *offload_job) {
+	handshake_job_t *job = container_of(offload_job, handshake_job_t, job);
+
+	if (!job->ok)
+		goto out;
+
+	fastd_peer_t *peer = fastd_peer_find_by_id(job->peer_id);
+	if (!peer || !peer->protocol_state || !secure_memequal(&peer->key->key, &job->peer_key.key, PUBLICKEYBYTES))
+		goto out;
+
+	if (!fastd_peer_may_connect(peer)) {
+		pr_debug("ignoring handshake from %P[%I] because of local constraints", peer, &job->remote_addr);
+		goto out;
+	}
+
+	fastd_socket_t *sock = job->sock;
+	if (!sock) {
+		sock = peer->sock;
+
+		if (!sock || sock->peer != peer) {
+			pr_debug("ignoring handshake from %P[%I] as the socket it was received on has been closed", peer, &job->remote_addr);
+			goto out;
+		}
+	}
+
+	const handshake_key_t *handshake_key = get_handshake_key(job->serial);
+	if (!handshake_key) {
+		pr_debug("ignoring handshake from %P[%I] as the handshake key has expired", peer, &job->remote_addr);
+		goto out;
+	}
+
+	if (job->handshake.type > 1 && !fastd_timed_out(peer->establish_handshake_timeout)) {
+		pr_debug("received repeated handshakes from %P[%I], ignoring", peer, &job->remote_addr);
+		goto out;
+	}
+
+	if (job->initiator) {
+		finish_handshake(sock, &job->local_addr, &job->remote_addr, peer, handshake_key, &job->peer_handshake_key, &job->handshake, job->method,
+				 &job->sigma, &job->shared_handshake_key, &job->shared_handshake_key_compat);
+		goto out;
+	}
+
+	peer->protocol_state->sigma = job->sigma;
+	peer->protocol_state->shared_handshake_key = job->shared_handshake_key;
+	peer->protocol_state->shared_handshake_key_compat = job->shared_handshake_key_compat;
+	peer->protocol_state->last_handshake_serial = job->serial;
+	peer->protocol_state->peer_handshake_key = job->peer_handshake_key;
+
+	if (job->handshake.type == 1)
+		respond_handshake(sock, &job->local_addr, &job->remote_addr, peer, handshake_key, &job->peer_handshake_key, job->method, job->handshake.little_endian);
+	else
+		handle_finish_handshake(sock, &job->local_addr, &job->remote_addr, peer, handshake_key, &job->peer_handshake_key, &job->handshake, job->method);
+
+ out:
+	handshake_job_free(job);
+}
+
+/**
+   Passes the derivation of the shared handshake key on to the handshake threads
+
+   Returns false if the handshake must be handled on the main thread instead, either because there
+   are no handshake threads or because the shared handshake key is cached already.
+*/
+static bool offload_handshake(fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr,
+			      const fastd_peer_t *peer, const handshake_key_t *handshake_key, const aligned_int256_t *peer_handshake_key,
+			      const fastd_handshake_t *handshake, const fastd_method_info_t *method) {
+	if (!fastd_offload_enabled())
+		return false;
+
+	bool initiator = (handshake->type == 2);
+	if (!initiator && shared_handshake_key_cached(peer, handshake_key, peer_handshake_key))
+		return false;
+
+	size_t tlv_len = (handshake->type > 1) ? handshake->tlv_len : 0;
+	handshake_job_t *job = fastd_alloc0(sizeof(handshake_job_t) + tlv_len);
+
+	job->job.run = handshake_job_run;
+	job->job.done = handshake_job_done;
+	job->job.drop = handshake_job_drop;
+
+	job->peer_id = peer->id;
+	job->sock = sock->peer ? NULL : sock;
+	job->local_addr = *local_addr;
+	job->remote_addr = *remote_addr;
+	job->method = method;
+
+	job->initiator = initiator;
+	if (initiator) {
+		bool compat = !secure_handshake(handshake);
+		job->want_shared_handshake_key = !compat;
+		job->want_shared_handshake_key_compat = compat;
+	}
+	else {
+		job->want_shared_handshake_key = true;
+		job->want_shared_handshake_key_compat = !conf.secure_handshakes;
+	}
+
+	job->serial = handshake_key->serial;
+	job->handshake_key = handshake_key->key;
+	job->peer_key = *peer->key;
+	job->peer_handshake_key = *peer_handshake_key;
+
+	job->handshake.type = handshake->type;
+	job->handshake.little_endian = handshake->little_endian;
+
+	if (tlv_len) {
+		memcpy(job->tlv_data, handshake->tlv_data, tlv_len);
+		job->handshake.tlv_data = job->tlv_data;
+		job->handshake.tlv_len = tlv_len;
+
+		size_t i;
+		for (i = 0; i < RECORD_MAX; i++) {
+			const fastd_handshake_record_t *record = &handshake->records[i];
+			if (!record->data)
+				continue;
+
+			job->handshake.records[i].length = record->length;
+			job->handshake.records[i].data = job->tlv_data + ((const uint8_t *)record->data - (const uint8_t *)handshake->tlv_data);
+		}
+	}
+
+	fastd_offload_submit(&job->job);
+	return true;
+}
+
 /** Searches the peer a public key belongs to, optionally restricting matches to a specific sender address */
 static fastd_peer_t * find_key(const uint8_t key[PUBLICKEYBYTES], const fastd_peer_address_t *address) {
 	errno = 0;
@@ -627,7 +845,12 @@ void fastd_protocol_ec25519_fhmqvc_handle_verify_return(fastd_peer_t *peer, fast
 
 	peer->last_handshake_response_timeout = ctx.now + MIN_HANDSHAKE_INTERVAL;
 	peer->last_handshake_response_address = *remote_addr;
-	respond_handshake(sock, local_addr, remote_addr, peer, &data->peer_handshake_key, method, data->little_endian);
+
+	const fastd_handshake_t handshake = { .type = 1, .little_endian = data->little_endian };
+	if (offload_handshake(sock, local_addr, remote_addr, peer, &ctx.protocol_state->handshake_key, &data->peer_handshake_key, &handshake, method))
+		return;
+
+	respond_handshake(sock, local_addr, remote_addr, peer, &ctx.protocol_state->handshake_key, &data->peer_handshake_key, method, data->little_endian);
 }
 
 #else
@@ -718,7 +941,11 @@ void fastd_protocol_ec25519_fhmqvc_handshake_handle(fastd_socket_t *sock, const
 
 		peer->last_handshake_response_timeout = ctx.now + MIN_HANDSHAKE_INTERVAL;
 		peer->last_handshake_response_address = *remote_addr;
-		respond_handshake(sock, local_addr, remote_addr, peer, &peer_handshake_key, method, handshake->little_endian);
+
+		if (offload_handshake(sock, local_addr, remote_addr, peer, &ctx.protocol_state->handshake_key, &peer_handshake_key, handshake, method))
+			return;
+
+		respond_handshake(sock, local_addr, remote_addr, peer, &ctx.protocol_state->handshake_key, &peer_handshake_key, method, handshake->little_endian);
 		return;
 	}
 
@@ -762,13 +989,15 @@ void fastd_protocol_ec25519_fhmqvc_handshake_handle(fastd_socket_t *sock, const
 	case 2:
 		pr_verbose("received handshake response from %P[%I]%s%s", peer, remote_addr, handshake->peer_version ? " using fastd " : "", handshake->peer_version ?: "");
 
-		finish_handshake(sock, local_addr, remote_addr, peer, handshake_key, &peer_handshake_key, handshake, method);
+		if (!offload_handshake(sock, local_addr, remote_addr, peer, handshake_key, &peer_handshake_key, handshake, method))
+			handle_handshake_response(sock, local_addr, remote_addr, peer, handshake_key, &peer_handshake_key, handshake, method);
 		break;
 
 	case 3:
 		pr_debug("received handshake finish from %P[%I]%s%s", peer, remote_addr, handshake->peer_version ? " using fastd " : "", handshake->peer_version ?: "");
 
-		handle_finish_handshake(sock, local_addr, remote_addr, peer, handshake_key, &peer_handshake_key, handshake, method);
+		if (!offload_handshake(sock, local_addr, remote_addr, peer, handshake_key, &peer_handshake_key, handshake, method))
+			handle_finish_handshake(sock, local_addr, remote_addr, peer, handshake_key, &peer_handshake_key, handshake, method);
 		break;
 
 	default:
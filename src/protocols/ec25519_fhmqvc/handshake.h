@@ -64,6 +64,10 @@ typedef struct handshake_key {
 struct fastd_protocol_state {
 	handshake_key_t prev_handshake_key;	/**< The previously generated handshake keypair */
 	handshake_key_t handshake_key;		/**< The newest handshake keypair */
+
+	keypair_t next_handshake_key;		/**< A keypair computed in advance by a handshake thread for the next key change */
+	bool next_handshake_key_ready;		/**< Specifies if \e next_handshake_key has been computed */
+	bool next_handshake_key_pending;	/**< Specifies if \e next_handshake_key is currently being computed */
 };
 
 
@@ -32,6 +32,14 @@
 
 #include "handshake.h"
 #include "../../crypto.h"
+#include "../../offload.h"
+
+
+/** A handshake keypair computed in advance by a handshake thread */
+typedef struct handshake_key_job {
+	fastd_offload_job_t job;		/**< The offload job */
+	keypair_t key;				/**< The keypair (only the secret key is set when the job is submitted) */
+} handshake_key_job_t;
 
 
 /** Allocates the protocol-specific state */
@@ -44,11 +52,14 @@ static void init_protocol_state(void) {
 	}
 }
 
-/** Generates a new ephemeral keypair */
-static void new_handshake_key(keypair_t *key) {
+/** Generates the random secret key of a new ephemeral keypair */
+static void new_handshake_secret(keypair_t *key) {
 	fastd_random_bytes(key->secret.p, SECRETKEYBYTES, false);
 	ecc_25519_gf_sanitize_secret(&key->secret, &key->secret);
+}
 
+/** Computes the public key of a new ephemeral keypair and prepares the secret key for use in handshakes */
+static void derive_handshake_key(keypair_t *key) {
 	ecc_25519_work_t work;
 	ecc_25519_scalarmult_base(&work, &key->secret);
 	ecc_25519_store_packed_legacy(&key->public.int256, &work);
@@ -57,11 +68,86 @@ static void new_handshake_key(keypair_t *key) {
 		exit_bug("generated invalid ephemeral key");
 }
 
+/** Generates a new ephemeral keypair */
+static void new_handshake_key(keypair_t *key) {
+	new_handshake_secret(key);
+	derive_handshake_key(key);
+}
+
+/** Computes a keypair in advance (called on a handshake thread) */
+static void handshake_key_job_run(fastd_offload_job_t *offload_job) {
+	handshake_key_job_t *job = container_of(offload_job, handshake_key_job_t, job);
+	derive_handshake_key(&job->key);
+}
+
+/** Frees a keypair job */
+static void handshake_key_job_free(handshake_key_job_t *job) {
+	secure_memzero(job, sizeof(*job));
+	free(job);
+}
+
+/** Stores a keypair computed in advance for the next key change */
+static void handshake_key_job_done(fastd_offload_job_t *offload_job) {
+	handshake_key_job_t *job = container_of(offload_job, handshake_key_job_t, job);
+
+	ctx.protocol_state->next_handshake_key = job->key;
+	ctx.protocol_state->next_handshake_key_ready = true;
+	ctx.protocol_state->next_handshake_key_pending = false;
+
+	handshake_key_job_free(job);
+}
+
+/** Discards a keypair job without using its result */
+static void handshake_key_job_drop(fastd_offload_job_t *offload_job) {
+	handshake_key_job_t *job = container_of(offload_job, handshake_key_job_t, job);
+
+	ctx.protocol_state->next_handshake_key_pending = false;
+
+	handshake_key_job_free(job);
+}
+
+/**
+   Lets a handshake thread compute the keypair for the next key change in advance
+
+   The random secret is generated on the main thread, so only the scalar multiplication is offloaded.
+*/
+static void prepare_handshake_key(void) {
+	if (!fastd_offload_enabled())
+		return;
+
+	if (ctx.protocol_state->next_handshake_key_ready || ctx.protocol_state->next_handshake_key_pending)
+		return;
+
+	handshake_key_job_t *job = fastd_new0(handshake_key_job_t);
+	job->job.run = handshake_key_job_run;
+	job->job.done = handshake_key_job_done;
+	job->job.drop = handshake_key_job_drop;
+
+	new_handshake_secret(&job->key);
+
+	ctx.protocol_state->next_handshake_key_pending = true;
+	fastd_offload_submit(&job->job);
+}
+
+/** Returns a new ephemeral keypair, using the one computed in advance if it is available */
+static void next_handshake_key(keypair_t *key) {
+	if (!ctx.protocol_state->next_handshake_key_ready) {
+		new_handshake_key(key);
+		return;
+	}
+
+	*key = ctx.protocol_state->next_handshake_key;
+
+	secure_memzero(&ctx.protocol_state->next_handshake_key, sizeof(ctx.protocol_state->next_handshake_key));
+	ctx.protocol_state->next_handshake_key_ready = false;
+}
+
 /**
    Performs maintenance tasks on the protocol state
 
    If there is currently no preferred ephemeral keypair, a new one
-   will be generated.
+   will be generated. When handshake threads are used, the keypair for the
+   next change is computed in advance.
 */
 void fastd_protocol_ec25519_fhmqvc_maintenance(void) {
 	init_protocol_state();
@@ -73,11 +159,13 @@ void fastd_protocol_ec25519_fhmqvc_maintenance(void) {
 
 		ctx.protocol_state->handshake_key.serial++;
 
-		new_handshake_key(&ctx.protocol_state->handshake_key.key);
+		next_handshake_key(&ctx.protocol_state->handshake_key.key);
 
 		ctx.protocol_state->handshake_key.preferred_till = ctx.now + 15000;
 		ctx.protocol_state->handshake_key.valid_till = ctx.now + 30000;
 	}
+
+	prepare_handshake_key();
 }
 
 /** Allocated protocol-specific peer state */
@@ -31,17 +31,56 @@
 
 
 #include "fastd.h"
+#include "async.h"
 #include "handshake.h"
 #include "hash.h"
 #include "peer.h"
 #include "peer_hashtable.h"
+#include "worker.h"
 
 #include <sys/uio.h>
 
 
-/** Handles the ancillary control messages of received packets */
-static inline void handle_socket_control(struct msghdr *message, const fastd_socket_t *sock, fastd_peer_address_t *local_addr) {
+/** The size of the control message buffer of each packet of a receive batch */
+#define RECEIVE_CONTROL_LEN 256
+
+
+/**
+   Packets read from a socket with a single recvmmsg() call
+
+   With UDP GRO, the kernel may coalesce multiple packets into a single
+   datagram. The buffers are large enough for such datagrams then, and are
+   kept for the next recvmmsg() call, while each segment is copied into a
+   buffer of its own.
+*/
+struct fastd_receive_batch {
+	bool gro;					/**< Specifies if the batch is set up for datagrams coalesced by UDP GRO */
+	size_t buffer_len;				/**< The packet size the buffers have been allocated for */
+	size_t n_packets;				/**< The number of packets (or coalesced datagrams) that have been read */
+	size_t next;					/**< The index of the next packet to handle */
+
+	size_t offset;					/**< The offset of the next segment of a coalesced datagram */
+	size_t segment_size;				/**< The segment size of the current datagram */
+	fastd_peer_address_t local_addr;		/**< The local address of the current datagram */
+
+	fastd_buffer_t buffers[RECEIVE_BATCH_SIZE];	/**< The receive buffers (base is NULL after a buffer has been passed on) */
+	struct iovec iov[RECEIVE_BATCH_SIZE];		/**< The I/O vectors pointing to the buffers */
+	fastd_peer_address_t addrs[RECEIVE_BATCH_SIZE];	/**< The source addresses */
+	struct mmsghdr msgs[RECEIVE_BATCH_SIZE];	/**< The message headers */
+
+	/** The ancillary data */
+	uint8_t cbufs[RECEIVE_BATCH_SIZE][RECEIVE_CONTROL_LEN] __attribute__((aligned(8)));
+};
+
+
+/**
+   Handles the ancillary control messages of received packets
+
+   \e segment_size is set to the segment size of datagrams coalesced by UDP GRO, and to 0 for other datagrams.
+*/
+static inline void handle_socket_control(struct msghdr *message, const fastd_socket_t *sock, fastd_peer_address_t *local_addr, size_t *segment_size) {
 	memset(local_addr, 0, sizeof(fastd_peer_address_t));
+	*segment_size = 0;
 
 	const uint8_t *end = (const uint8_t *)message->msg_control + message->msg_controllen;
 
@@ -63,7 +102,23 @@ static inline void handle_socket_control(struct msghdr *message, const fastd_soc
 			local_addr->in.sin_addr = pktinfo.ipi_addr;
 			local_addr->in.sin_port = fastd_peer_address_get_port(sock->bound_addr);
 
-			return;
+			continue;
+		}
+#endif
+
+#ifdef USE_UDP_GRO
+		if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+			int segment;
+
+			if ((const uint8_t *)CMSG_DATA(cmsg) + sizeof(segment) > end)
+				return;
+
+			memcpy(&segment, CMSG_DATA(cmsg), sizeof(segment));
+
+			if (segment > 0)
+				*segment_size = segment;
+
+			continue;
 		}
 #endif
 
@@ -81,8 +136,6 @@ static inline void handle_socket_control(struct msghdr *message, const fastd_soc
 
 			if (IN6_IS_ADDR_LINKLOCAL(&local_addr->in6.sin6_addr))
 				local_addr->in6.sin6_scope_id = pktinfo.ipi6_ifindex;
-
-			return;
 		}
 	}
 }
@@ -159,20 +212,46 @@ static bool backoff_unknown(const fastd_peer_address_t *addr) {
 	return false;
 }
 
-/** Handles a packet received from a known peer address */
-static inline void handle_socket_receive_known(fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr, fastd_peer_t *peer, fastd_buffer_t buffer) {
+/** Frees the buffers of a number of packets */
+static inline void free_buffers(fastd_buffer_t *buffers, size_t n) {
+	size_t i;
+	for (i = 0; i < n; i++)
+		fastd_buffer_free(buffers[i]);
+}
+
+/** Passes payload packets received from a peer on to the protocol */
+static inline void handle_recv(fastd_peer_t *peer, fastd_buffer_t *buffers, size_t n) {
+	if (n > 1 && conf.protocol->handle_recv_batch) {
+		conf.protocol->handle_recv_batch(peer, buffers, n);
+		return;
+	}
+
+	size_t i;
+	for (i = 0; i < n; i++)
+		conf.protocol->handle_recv(peer, buffers[i]);
+}
+
+/**
+   Handles packets received from a known peer address
+
+   All packets must have the same type; handshake packets are always handled one at a time.
+*/
+static inline void handle_socket_receive_known(fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr, fastd_peer_t *peer, fastd_buffer_t *buffers, size_t n) {
 	if (!fastd_peer_may_connect(peer)) {
-		fastd_buffer_free(buffer);
+		free_buffers(buffers, n);
 		return;
 	}
 
-	const uint8_t *packet_type = buffer.data;
-	fastd_buffer_push_head(&buffer, 1);
+	const uint8_t *packet_type = buffers[0].data;
+
+	size_t i;
+	for (i = 0; i < n; i++)
+		fastd_buffer_push_head(&buffers[i], 1);
 
 	switch (*packet_type) {
 	case PACKET_DATA:
 		if (!fastd_peer_is_established(peer) || !fastd_peer_address_equal(&peer->local_address, local_addr)) {
-			fastd_buffer_free(buffer);
+			free_buffers(buffers, n);
 
 			if (!backoff_unknown(remote_addr)) {
 				pr_debug("unexpectedly received payload data from %P[%I]", peer, remote_addr);
@@ -181,11 +260,11 @@ static inline void handle_socket_receive_known(fastd_socket_t *sock, const fastd
 			return;
 		}
 
-		conf.protocol->handle_recv(peer, buffer);
+		handle_recv(peer, buffers, n);
 		break;
 
 	case PACKET_HANDSHAKE:
-		fastd_handshake_handle(sock, local_addr, remote_addr, peer, buffer);
+		fastd_handshake_handle(sock, local_addr, remote_addr, peer, buffers[0]);
 	}
 }
 
@@ -194,14 +273,14 @@ static inline bool allow_unknown_peers(void) {
 	return ctx.has_floating || fastd_allow_verify();
 }
 
-/** Handles a packet received from an unknown address */
-static inline void handle_socket_receive_unknown(fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr, fastd_buffer_t buffer) {
-	const uint8_t *packet_type = buffer.data;
-	fastd_buffer_push_head(&buffer, 1);
+/** Handles packets received from an unknown address */
+static inline void handle_socket_receive_unknown(fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr, fastd_buffer_t *buffers, size_t n) {
+	const uint8_t *packet_type = buffers[0].data;
+	fastd_buffer_push_head(&buffers[0], 1);
 
 	switch (*packet_type) {
 	case PACKET_DATA:
-		fastd_buffer_free(buffer);
+		free_buffers(buffers, n);
 
 		if (!backoff_unknown(remote_addr)) {
 			pr_debug("unexpectedly received payload data from unknown address %I", remote_addr);
@@ -210,17 +289,21 @@ static inline void handle_socket_receive_unknown(fastd_socket_t *sock, const fas
 		break;
 
 	case PACKET_HANDSHAKE:
-		fastd_handshake_handle(sock, local_addr, remote_addr, NULL, buffer);
+		fastd_handshake_handle(sock, local_addr, remote_addr, NULL, buffers[0]);
 	}
 }
 
-/** Handles a packet read from a socket */
-static inline void handle_socket_receive(fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr, fastd_buffer_t buffer) {
+/**
+   Handles packets read from a socket
+
+   The packets must have the same source and destination addresses and the same type.
+*/
+static void handle_socket_receive_batch(fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr, fastd_buffer_t *buffers, size_t n) {
 	fastd_peer_t *peer = NULL;
 
 	if (sock->peer) {
 		if (!fastd_peer_address_equal(&sock->peer->address, remote_addr)) {
-			fastd_buffer_free(buffer);
+			free_buffers(buffers, n);
 			return;
 		}
 
@@ -231,61 +314,398 @@ static inline void handle_socket_receive(fastd_socket_t *sock, const fastd_peer_
 	}
 
 	if (peer) {
-		handle_socket_receive_known(sock, local_addr, remote_addr, peer, buffer);
+		handle_socket_receive_known(sock, local_addr, remote_addr, peer, buffers, n);
 	}
 	else if (allow_unknown_peers()) {
-		handle_socket_receive_unknown(sock, local_addr, remote_addr, buffer);
+		handle_socket_receive_unknown(sock, local_addr, remote_addr, buffers, n);
 	}
 	else  {
 		pr_debug("received packet from unknown peer %I", remote_addr);
-		fastd_buffer_free(buffer);
+		free_buffers(buffers, n);
+	}
+}
+
+/** Handles a packet read from a socket */
+static inline void handle_socket_receive(fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr, fastd_buffer_t buffer) {
+	handle_socket_receive_batch(sock, local_addr, remote_addr, &buffer, 1);
+}
+
+/** Evaluates the source address and ancillary data of a received packet, returning false if the packet must be dropped */
+static bool handle_socket_message(fastd_socket_t *sock, struct msghdr *message, fastd_peer_address_t *local_addr, size_t *segment_size) {
+	handle_socket_control(message, sock, local_addr, segment_size);
+
+#ifdef USE_PKTINFO
+	if (!local_addr->sa.sa_family) {
+		pr_error("received packet without packet info");
+		return false;
+	}
+#endif
+
+	fastd_peer_address_simplify(message->msg_name);
+
+	return true;
+}
+
+/** The result of receive_packet() */
+typedef enum receive_result {
+	RECEIVE_OK,				/**< A packet has been read */
+	RECEIVE_DROPPED,			/**< A packet has been read, but was dropped */
+	RECEIVE_EMPTY,				/**< No packet could be read */
+} receive_result_t;
+
+/** Frees the buffers of a receive batch which haven't been passed on */
+static void batch_free_buffers(fastd_receive_batch_t *batch) {
+	size_t i;
+	for (i = 0; i < RECEIVE_BATCH_SIZE; i++) {
+		if (batch->buffers[i].base)
+			fastd_buffer_free(batch->buffers[i]);
+
+		batch->buffers[i].base = NULL;
+	}
+}
+
+/** Returns the size of the largest packet that can be received */
+static inline size_t max_packet_len(void) {
+#ifdef WITH_WORKERS
+	/* ctx.max_mtu may be changed by the main thread while a worker is receiving */
+	if (fastd_in_worker())
+		return fastd_worker_self->max_packet_len;
+#endif
+
+	return 1 + fastd_max_payload(ctx.max_mtu) + conf.max_overhead;
+}
+
+/** Returns the number of messages received at once */
+static inline size_t batch_size(const fastd_receive_batch_t *batch) {
+	return batch->gro ? RECEIVE_GRO_BATCH_SIZE : RECEIVE_BATCH_SIZE;
+}
+
+/**
+   Allocates the missing buffers of a receive batch and resets the message headers
+
+   \return The number of messages that can be received
+*/
+static size_t batch_prepare(fastd_receive_batch_t *batch) {
+	bool gro = false;
+#ifdef USE_UDP_GRO
+	gro = conf.offload_gro;
+#endif
+
+	size_t buffer_len = gro ? GRO_BUFFER_SIZE : max_packet_len();
+
+	/* The maximum MTU may have changed after the peer configuration has been reloaded */
+	if (batch->gro != gro || batch->buffer_len != buffer_len) {
+		batch_free_buffers(batch);
+		batch->gro = gro;
+		batch->buffer_len = buffer_len;
+	}
+
+	size_t i, n = batch_size(batch);
+	for (i = 0; i < n; i++) {
+		fastd_buffer_t *buffer = &batch->buffers[i];
+		if (!buffer->base)
+			*buffer = fastd_buffer_alloc(buffer_len, conf.min_decrypt_head_space, conf.min_decrypt_tail_space);
+
+		batch->iov[i] = (struct iovec){ .iov_base = buffer->data, .iov_len = buffer->len };
+
+		batch->msgs[i].msg_hdr = (struct msghdr){
+			.msg_name = &batch->addrs[i],
+			.msg_namelen = sizeof(batch->addrs[i]),
+			.msg_iov = &batch->iov[i],
+			.msg_iovlen = 1,
+			.msg_control = batch->cbufs[i],
+			.msg_controllen = sizeof(batch->cbufs[i]),
+		};
+	}
+
+	return n;
+}
+
+/** Reads as many packets as possible into the receive batch of a socket, returning false if there was nothing to read */
+static bool batch_receive(fastd_socket_t *sock) {
+	fastd_receive_batch_t *batch = sock->receive_batch;
+	if (!batch)
+		batch = sock->receive_batch = fastd_new0(fastd_receive_batch_t);
+
+	size_t n = batch_prepare(batch);
+
+	batch->n_packets = batch->next = batch->offset = 0;
+
+	int ret = recvmmsg(sock->fd.fd, batch->msgs, n, 0, NULL);
+	if (ret < 0) {
+		if (errno != EAGAIN && errno != EWOULDBLOCK)
+			pr_warn_errno("recvmmsg");
+
+		return false;
+	}
+
+	batch->n_packets = ret;
+	return ret > 0;
+}
+
+/**
+   Reads a packet from a socket
+
+   Packets are read from the kernel in batches; a new batch is only read when
+   all packets of the previous one have been handled. Datagrams coalesced by
+   UDP GRO are split into their segments here.
+*/
+static receive_result_t receive_packet(fastd_socket_t *sock, fastd_buffer_t *buffer, fastd_peer_address_t *local_addr, fastd_peer_address_t *recvaddr) {
+	fastd_receive_batch_t *batch = sock->receive_batch;
+
+	if (!batch || batch->next == batch->n_packets) {
+		if (!batch_receive(sock))
+			return RECEIVE_EMPTY;
+
+		batch = sock->receive_batch;
+	}
+
+	size_t i = batch->next;
+	struct mmsghdr *msg = &batch->msgs[i];
+
+	if (!batch->offset) {
+		if (!msg->msg_len || !handle_socket_message(sock, &msg->msg_hdr, &batch->local_addr, &batch->segment_size)) {
+			batch->next++;
+
+			if (!batch->gro) {
+				fastd_buffer_free(batch->buffers[i]);
+				batch->buffers[i].base = NULL;
+			}
+
+			return RECEIVE_DROPPED;
+		}
+
+		if (!batch->gro || !batch->segment_size || batch->segment_size > msg->msg_len)
+			batch->segment_size = msg->msg_len;
+	}
+
+	size_t len = msg->msg_len - batch->offset;
+	if (len > batch->segment_size)
+		len = batch->segment_size;
+
+	if (batch->gro) {
+		*buffer = fastd_buffer_alloc(len, conf.min_decrypt_head_space, conf.min_decrypt_tail_space);
+		memcpy(buffer->data, (const uint8_t *)batch->buffers[i].data + batch->offset, len);
+	}
+	else {
+		*buffer = batch->buffers[i];
+		batch->buffers[i].base = NULL;
+		buffer->len = len;
 	}
+
+	/* The batch is freed when the socket is closed while the packet is handled */
+	*local_addr = batch->local_addr;
+	*recvaddr = batch->addrs[i];
+
+	batch->offset += len;
+	if (batch->offset == msg->msg_len) {
+		batch->offset = 0;
+		batch->next++;
+	}
+
+	return RECEIVE_OK;
 }
 
-/** Reads a packet from a socket */
-void fastd_receive(fastd_socket_t *sock) {
-	size_t max_len = 1 + fastd_max_payload(ctx.max_mtu) + conf.max_overhead;
-	fastd_buffer_t buffer = fastd_buffer_alloc(max_len, conf.min_decrypt_head_space, conf.min_decrypt_tail_space);
+/** Frees the receive batch of a socket, dropping the packets that haven't been handled */
+void fastd_receive_batch_free(fastd_socket_t *sock) {
+	if (!sock->receive_batch)
+		return;
+
+	batch_free_buffers(sock->receive_batch);
+	free(sock->receive_batch);
+	sock->receive_batch = NULL;
+}
+
+/**
+   Checks if the next packet of the receive batch of a socket is a payload packet with the given addresses
+
+   This doesn't modify the batch or read a new one.
+*/
+static bool batch_next_is_data(const fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr) {
+	fastd_receive_batch_t *batch = sock->receive_batch;
+	if (!batch || batch->next == batch->n_packets)
+		return false;
+
+	size_t i = batch->next;
+	struct mmsghdr *msg = &batch->msgs[i];
+	if (!msg->msg_len)
+		return false;
+
+	/* The addresses of further segments of a coalesced datagram are known to match already */
+	if (!batch->offset) {
+		fastd_peer_address_t addr = batch->addrs[i];
+		fastd_peer_address_simplify(&addr);
+		if (!fastd_peer_address_equal(&addr, remote_addr))
+			return false;
+
+		fastd_peer_address_t next_local_addr;
+		size_t segment_size;
+		handle_socket_control(&msg->msg_hdr, sock, &next_local_addr, &segment_size);
+		if (!fastd_peer_address_equal(&next_local_addr, local_addr))
+			return false;
+	}
+
+	const uint8_t *data = batch->buffers[i].data;
+	return data[batch->offset] == PACKET_DATA;
+}
+
+/**
+   Reads a packet from a socket, returning the number of packets handled (0 if there was no packet to read)
+
+   A payload packet is handled together with the payload packets directly following it in the
+   receive batch which have the same addresses, so the protocol can decrypt them as a batch.
+   At most \e max packets are handled.
+*/
+size_t fastd_receive(fastd_socket_t *sock, size_t max) {
+	fastd_buffer_t buffers[CRYPTO_BATCH_SIZE];
 	fastd_peer_address_t local_addr;
 	fastd_peer_address_t recvaddr;
-	struct iovec buffer_vec = { .iov_base = buffer.data, .iov_len = buffer.len };
-	uint8_t cbuf[1024] __attribute__((aligned(8)));
-
-	struct msghdr message = {
-		.msg_name = &recvaddr,
-		.msg_namelen = sizeof(recvaddr),
-		.msg_iov = &buffer_vec,
-		.msg_iovlen = 1,
-		.msg_control = cbuf,
-		.msg_controllen = sizeof(cbuf),
-	};
-
-	ssize_t len = recvmsg(sock->fd.fd, &message, 0);
-	if (len <= 0) {
-		if (len < 0)
-			pr_warn_errno("recvmsg");
 
-		fastd_buffer_free(buffer);
-		return;
+	switch (receive_packet(sock, &buffers[0], &local_addr, &recvaddr)) {
+	case RECEIVE_OK:
+		break;
+
+	case RECEIVE_DROPPED:
+		return 1;
+
+	default:
+		return 0;
 	}
 
-	buffer.len = len;
+	size_t n = 1, handled = 1;
 
-	handle_socket_control(&message, sock, &local_addr);
+	if (*(const uint8_t *)buffers[0].data == PACKET_DATA) {
+		while (n < CRYPTO_BATCH_SIZE && handled < max && batch_next_is_data(sock, &local_addr, &recvaddr)) {
+			fastd_peer_address_t next_local_addr, next_recvaddr;
+			receive_result_t ret = receive_packet(sock, &buffers[n], &next_local_addr, &next_recvaddr);
 
-#ifdef USE_PKTINFO
-	if (!local_addr.sa.sa_family) {
-		pr_error("received packet without packet info");
+			if (ret == RECEIVE_EMPTY)
+				break;
+
+			handled++;
+
+			if (ret == RECEIVE_OK)
+				n++;
+		}
+	}
+
+	handle_socket_receive_batch(sock, &local_addr, &recvaddr, buffers, n);
+	return handled;
+}
+
+#ifdef USE_IO_URING
+
+/** Handles a packet received by the io_uring poll backend; message must contain the source address and ancillary data */
+void fastd_receive_message(fastd_socket_t *sock, struct msghdr *message, fastd_buffer_t buffer) {
+	fastd_peer_address_t local_addr;
+	size_t segment_size;
+
+	if (!handle_socket_message(sock, message, &local_addr, &segment_size)) {
 		fastd_buffer_free(buffer);
 		return;
 	}
+
+	handle_socket_receive(sock, &local_addr, message->msg_name, buffer);
+}
+
 #endif
 
-	fastd_peer_address_simplify(&recvaddr);
+#ifdef WITH_WORKERS
+
+/** Checks if packets have been read from a socket which haven't been handled yet */
+bool fastd_receive_pending(const fastd_socket_t *sock) {
+	const fastd_receive_batch_t *batch = sock->receive_batch;
+	return batch && batch->next < batch->n_packets;
+}
+
+/**
+   Handles a packet on a worker thread
+
+   Only payload packets of established connections are handled here.
+
+   \return false if the packet must be handled by the main thread instead (the buffer isn't freed in this case)
+*/
+static bool handle_socket_receive_worker(const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr, fastd_buffer_t buffer) {
+	const uint8_t *packet_type = buffer.data;
+	if (*packet_type != PACKET_DATA)
+		return false;
+
+	fastd_peer_t *peer = fastd_worker_peer_lookup(remote_addr);
+	if (!peer)
+		return false;
+
+	fastd_worker_peer_lock(peer);
 
-	handle_socket_receive(sock, &local_addr, &recvaddr, buffer);
+	/* The peer may have changed since the peer table was created */
+	bool handled = false;
+	if (fastd_peer_is_established(peer) && fastd_peer_address_equal(&peer->address, remote_addr)
+	    && fastd_peer_address_equal(&peer->local_address, local_addr)) {
+		fastd_buffer_push_head(&buffer, 1);
+
+		handled = conf.protocol->handle_recv_worker(peer, buffer);
+	}
+
+	fastd_worker_peer_unlock(peer);
+
+	return handled;
 }
 
+/**
+   Reads a packet from a worker's socket, passing it on to the main thread if the worker can't handle it
+
+   \return false if there was no packet to read
+*/
+bool fastd_receive_worker(fastd_socket_t *sock, size_t sock_index) {
+	fastd_buffer_t buffer;
+	fastd_peer_address_t local_addr;
+	fastd_peer_address_t recvaddr;
+
+	switch (receive_packet(sock, &buffer, &local_addr, &recvaddr)) {
+	case RECEIVE_OK:
+		break;
+
+	case RECEIVE_DROPPED:
+		return true;
+
+	default:
+		return false;
+	}
+
+	if (handle_socket_receive_worker(&local_addr, &recvaddr, buffer))
+		return true;
+
+	size_t len = sizeof(fastd_async_receive_t) + buffer.len;
+	fastd_async_receive_t *receive = fastd_alloc(len);
+
+	receive->sock_index = sock_index;
+	receive->local_addr = local_addr;
+	receive->remote_addr = recvaddr;
+	receive->len = buffer.len;
+	memcpy(receive->data, buffer.data, buffer.len);
+
+	fastd_buffer_free(buffer);
+
+	fastd_async_enqueue(ASYNC_TYPE_RECEIVE, receive, len);
+	free(receive);
+
+	return true;
+}
+
+/** Handles a packet that was passed on to the main thread by a worker */
+void fastd_receive_async(const fastd_async_receive_t *receive) {
+	/* The socket may have been closed after an error in the meantime */
+	fastd_socket_t *sock = &ctx.socks[receive->sock_index];
+	if (sock->fd.fd < 0)
+		return;
+
+	fastd_buffer_t buffer = fastd_buffer_alloc(receive->len, conf.min_decrypt_head_space, conf.min_decrypt_tail_space);
+	memcpy(buffer.data, receive->data, receive->len);
+
+	handle_socket_receive(sock, &receive->local_addr, &receive->remote_addr, buffer);
+}
+
+#endif
+
 /** Handles a received and decrypted payload packet */
 void fastd_handle_receive(fastd_peer_t *peer, fastd_buffer_t buffer, bool reordered) {
 	if (conf.mode == MODE_TAP) {
@@ -306,12 +726,8 @@ void fastd_handle_receive(fastd_peer_t *peer, fastd_buffer_t buffer, bool reorde
 	if (reordered)
 		fastd_stats_add(peer, STAT_RX_REORDERED, buffer.len);
 
-	fastd_iface_write(peer->iface, buffer);
-
-	if (conf.mode == MODE_TAP && conf.forward) {
-		fastd_send_data(buffer, peer, NULL);
-		return;
-	}
+	if (conf.mode == MODE_TAP && conf.forward)
+		fastd_send_data(fastd_buffer_dup(buffer, conf.min_encrypt_head_space, conf.min_encrypt_tail_space), peer, NULL);
 
-	fastd_buffer_free(buffer);
+	fastd_iface_write(peer->iface, buffer);
 }
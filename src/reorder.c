@@ -0,0 +1,264 @@
+/*
+  Copyright (c) 2012-2016, Matthias Schiffer <mschiffer@universe-factory.net>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   \file
+
+   Per-peer reorder buffer, passing on received payload packets in the order they were sent
+*/
+
+
+#include "reorder.h"
+#include "async.h"
+
+
+/** Returns the slot for a sequence number */
+static inline fastd_reorder_slot_t * get_slot(fastd_reorder_buffer_t *reorder, uint64_t seq) {
+	return &reorder->slots[seq % reorder->size];
+}
+
+/** Passes on a held packet */
+static void release_slot(fastd_reorder_buffer_t *reorder, fastd_reorder_slot_t *slot, bool skipped) {
+	fastd_buffer_t buffer = slot->buffer;
+	slot->buffer = (fastd_buffer_t){};
+	reorder->n_held--;
+
+	if (skipped)
+		fastd_stats_add(reorder->peer, STAT_RX_REORDER_SKIPPED, buffer.len);
+
+	fastd_handle_receive(reorder->peer, buffer, slot->reordered);
+}
+
+/** Passes on the held packets directly following the last packet passed on */
+static void release_consecutive(fastd_reorder_buffer_t *reorder) {
+	while (reorder->n_held) {
+		fastd_reorder_slot_t *slot = get_slot(reorder, reorder->next_seq);
+		if (!slot->buffer.base)
+			break;
+
+		reorder->next_seq++;
+		release_slot(reorder, slot, false);
+	}
+}
+
+/**
+   Stops waiting for the packets before a given sequence number
+
+   All held packets before \e seq are passed on; the held packets are always
+   in the range \e next_seq+1 to \e next_seq+size.
+*/
+static void skip_to(fastd_reorder_buffer_t *reorder, uint64_t seq) {
+	uint64_t end = reorder->next_seq + reorder->size + 1;
+	if (end > seq)
+		end = seq;
+
+	uint64_t i;
+	for (i = reorder->next_seq + 1; i < end && reorder->n_held; i++) {
+		fastd_reorder_slot_t *slot = get_slot(reorder, i);
+		if (slot->buffer.base)
+			release_slot(reorder, slot, true);
+	}
+
+	if (reorder->next_seq < seq)
+		reorder->next_seq = seq;
+
+	release_consecutive(reorder);
+}
+
+/** Holds back a packet which has arrived too early */
+static void hold(fastd_reorder_buffer_t *reorder, uint64_t seq, fastd_buffer_t buffer, bool reordered, fastd_timeout_t now) {
+	fastd_reorder_slot_t *slot = get_slot(reorder, seq);
+	if (slot->buffer.base) {
+		/* can't happen as the method drops duplicates; don't make things worse */
+		fastd_handle_receive(reorder->peer, buffer, reordered);
+		return;
+	}
+
+	fastd_stats_add(reorder->peer, STAT_RX_REORDER_HELD, buffer.len);
+
+	slot->buffer = buffer;
+	slot->timeout = now + conf.reorder_timeout;
+	slot->reordered = reordered;
+
+	if (!reorder->n_held || slot->timeout < reorder->timeout)
+		reorder->timeout = slot->timeout;
+
+	reorder->n_held++;
+}
+
+/** Passes on all held packets whose timeout has been reached, including the ones before them */
+static void expire(fastd_reorder_buffer_t *reorder, fastd_timeout_t now) {
+	if (!reorder->n_held || reorder->timeout > now)
+		return;
+
+	uint64_t i, last = 0;
+	for (i = reorder->next_seq + 1; i <= reorder->next_seq + reorder->size; i++) {
+		const fastd_reorder_slot_t *slot = get_slot(reorder, i);
+		if (slot->buffer.base && slot->timeout <= now)
+			last = i;
+	}
+
+	if (last)
+		skip_to(reorder, last + 1);
+
+	reorder->timeout = FASTD_TIMEOUT_INV;
+
+	for (i = reorder->next_seq + 1; i <= reorder->next_seq + reorder->size && reorder->n_held; i++) {
+		const fastd_reorder_slot_t *slot = get_slot(reorder, i);
+		if (slot->buffer.base)
+			reorder->timeout = fastd_timeout_min(reorder->timeout, slot->timeout);
+	}
+}
+
+/**
+   Makes sure the task is scheduled for the earliest timeout of the held packets
+
+   Only the main thread may access the task queue, so the workers notify it through
+   an asynchronous notification, and the task's timeout is tracked in \e task_timeout.
+*/
+static void schedule(fastd_reorder_buffer_t *reorder) {
+	if (!reorder->n_held || reorder->task_timeout <= reorder->timeout)
+		return;
+
+	if (fastd_in_worker()) {
+#ifdef WITH_WORKERS
+		if (reorder->task_requested)
+			return;
+
+		fastd_async_reorder_t reorder_async = { .peer_id = reorder->peer->id };
+
+		/* If the request couldn't be sent, it is retried with the next received packet */
+		reorder->task_requested = fastd_async_enqueue(ASYNC_TYPE_REORDER, &reorder_async, sizeof(reorder_async));
+#endif
+		return;
+	}
+
+	fastd_task_unschedule(&reorder->task);
+	fastd_task_schedule(&reorder->task, TASK_TYPE_REORDER, reorder->timeout);
+	reorder->task_timeout = reorder->timeout;
+}
+
+/**
+   Handles a received and decrypted payload packet, holding it back when packets sent before it are still missing
+
+   @param peer		the peer the packet was received from
+   @param packet_seq	the packet's session and sequence number (the sequence number is 0 if the method doesn't number its packets)
+   @param buffer	the packet
+   @param reordered	passed on to fastd_handle_receive()
+*/
+void fastd_reorder_receive(fastd_peer_t *peer, fastd_packet_seq_t packet_seq, fastd_buffer_t buffer, bool reordered) {
+	fastd_reorder_buffer_t *reorder = peer->reorder;
+	uint64_t seq = packet_seq.seq;
+
+	if (!seq || (!reorder && !conf.reorder_buffer)) {
+		fastd_handle_receive(peer, buffer, reordered);
+		return;
+	}
+
+	if (!reorder) {
+		reorder = fastd_alloc0(sizeof(fastd_reorder_buffer_t) + conf.reorder_buffer * sizeof(fastd_reorder_slot_t));
+		reorder->peer = peer;
+		reorder->size = conf.reorder_buffer;
+		reorder->session = packet_seq.session;
+		reorder->next_seq = seq;
+		reorder->task_timeout = FASTD_TIMEOUT_INV;
+
+		peer->reorder = reorder;
+	}
+	else if (reorder->session != packet_seq.session) {
+		/* A packet of a different session, which has its own sequence numbers */
+		skip_to(reorder, reorder->next_seq + reorder->size + 1);
+
+		reorder->session = packet_seq.session;
+		reorder->next_seq = seq;
+	}
+
+	fastd_timeout_t now = fastd_now();
+
+	if (seq > reorder->next_seq + reorder->size)
+		skip_to(reorder, seq - reorder->size);
+
+	if (seq < reorder->next_seq) {
+		/* We have stopped waiting for this packet already */
+		fastd_handle_receive(peer, buffer, reordered);
+	}
+	else if (seq == reorder->next_seq) {
+		reorder->next_seq++;
+		fastd_handle_receive(peer, buffer, reordered);
+		release_consecutive(reorder);
+	}
+	else {
+		hold(reorder, seq, buffer, reordered, now);
+	}
+
+	expire(reorder, now);
+	schedule(reorder);
+}
+
+/** Drops all held packets and frees a peer's reorder buffer */
+void fastd_reorder_free(fastd_peer_t *peer) {
+	fastd_reorder_buffer_t *reorder = peer->reorder;
+	if (!reorder)
+		return;
+
+	fastd_task_unschedule(&reorder->task);
+
+	size_t i;
+	for (i = 0; i < reorder->size; i++) {
+		if (reorder->slots[i].buffer.base)
+			fastd_buffer_free(reorder->slots[i].buffer);
+	}
+
+	free(reorder);
+	peer->reorder = NULL;
+}
+
+/** Schedules the reorder task of a peer on request of a worker */
+void fastd_reorder_schedule(fastd_peer_t *peer) {
+	fastd_worker_peer_lock(peer);
+
+	fastd_reorder_buffer_t *reorder = peer->reorder;
+	if (reorder) {
+		reorder->task_requested = false;
+		schedule(reorder);
+	}
+
+	fastd_worker_peer_unlock(peer);
+}
+
+/** Passes on the held packets whose timeout has been reached */
+void fastd_reorder_handle_task(fastd_task_t *task) {
+	fastd_reorder_buffer_t *reorder = container_of(task, fastd_reorder_buffer_t, task);
+	fastd_peer_t *peer = reorder->peer;
+
+	fastd_worker_peer_lock(peer);
+
+	reorder->task_timeout = FASTD_TIMEOUT_INV;
+
+	expire(reorder, ctx.now);
+	schedule(reorder);
+
+	fastd_worker_peer_unlock(peer);
+}
@@ -0,0 +1,74 @@
+/*
+  Copyright (c) 2012-2016, Matthias Schiffer <mschiffer@universe-factory.net>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   \file
+
+   Per-peer reorder buffer, passing on received payload packets in the order they were sent
+*/
+
+
+#pragma once
+
+#include "method.h"
+#include "peer.h"
+#include "task.h"
+
+
+/** A packet held back by a reorder buffer */
+typedef struct fastd_reorder_slot {
+	fastd_buffer_t buffer;			/**< The packet (\e buffer.base is NULL for unused slots) */
+	fastd_timeout_t timeout;		/**< The time the packet must be passed on at the latest */
+	bool reordered;				/**< Specifies if the method has reported the packet as reordered */
+} fastd_reorder_slot_t;
+
+/**
+   A reorder buffer
+
+   Packets which arrive before some of the packets sent before them are held back until
+   either the missing packets arrive, the buffer is full or the reorder timeout is reached.
+   When worker threads are used, the buffer is only accessed with the peer lock held.
+*/
+struct fastd_reorder_buffer {
+	fastd_task_t task;			/**< Task queue entry for passing on held packets when their timeout is reached */
+	fastd_peer_t *peer;			/**< The peer the buffer belongs to */
+
+	uint64_t session;			/**< The serial number of the method session the sequence numbers belong to */
+	uint64_t next_seq;			/**< The sequence number of the next packet to pass on */
+
+	fastd_timeout_t timeout;		/**< The earliest timeout of the held packets (may be too early after packets have been passed on) */
+	fastd_timeout_t task_timeout;		/**< The timeout the task is scheduled for (FASTD_TIMEOUT_INV if it isn't scheduled) */
+	bool task_requested;			/**< Set when a worker has asked the main thread to schedule the task */
+
+	size_t size;				/**< The number of slots */
+	size_t n_held;				/**< The number of packets currently held */
+	fastd_reorder_slot_t slots[];		/**< The held packets, indexed by their sequence numbers modulo \e size */
+};
+
+
+void fastd_reorder_receive(fastd_peer_t *peer, fastd_packet_seq_t packet_seq, fastd_buffer_t buffer, bool reordered);
+void fastd_reorder_free(fastd_peer_t *peer);
+void fastd_reorder_schedule(fastd_peer_t *peer);
+void fastd_reorder_handle_task(fastd_task_t *task);
@@ -36,9 +36,19 @@
 
 #include "fastd.h"
 #include "peer.h"
+#include "poll.h"
+#include "worker.h"
 
 #include <sys/uio.h>
 
+#ifdef USE_UDP_GSO
+/** The maximum total size of the packets coalesced into a single datagram */
+#define GSO_MAX_SIZE 65000
+
+/** The space needed for the ancillary data of a coalesced datagram */
+#define GSO_CONTROL_LEN (CMSG_SPACE(sizeof(struct in6_pktinfo)) + CMSG_SPACE(sizeof(uint16_t)))
+#endif
+
 
 /** Adds packet info to ancillary control messages */
 static inline void add_pktinfo(struct msghdr *msg, const fastd_peer_address_t *local_addr) {
@@ -84,24 +94,19 @@ static inline void add_pktinfo(struct msghdr *msg, const fastd_peer_address_t *l
 	}
 }
 
-/** Sends a packet of a given type */
-static void send_type(const fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr, fastd_peer_t *peer, uint8_t packet_type, fastd_buffer_t buffer, size_t stat_size) {
-	if (!sock)
-		exit_bug("send: sock == NULL");
-
-	struct msghdr msg = {};
-	uint8_t cbuf[1024] __attribute__((aligned(8))) = {};
-	fastd_peer_address_t remote_addr6;
+/** Prepares the message header for sending a packet */
+static void send_msg_init(fastd_send_msg_t *send, const fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr, fastd_peer_t *peer, uint8_t packet_type, fastd_buffer_t buffer, size_t stat_size) {
+	send->remote_addr = *remote_addr;
 
 	switch (remote_addr->sa.sa_family) {
 	case AF_INET:
-		msg.msg_name = (void *)&remote_addr->in;
-		msg.msg_namelen = sizeof(struct sockaddr_in);
+		send->msg.msg_name = &send->remote_addr.in;
+		send->msg.msg_namelen = sizeof(struct sockaddr_in);
 		break;
 
 	case AF_INET6:
-		msg.msg_name = (void *)&remote_addr->in6;
-		msg.msg_namelen = sizeof(struct sockaddr_in6);
+		send->msg.msg_name = &send->remote_addr.in6;
+		send->msg.msg_namelen = sizeof(struct sockaddr_in6);
 		break;
 
 	default:
@@ -109,73 +114,555 @@ static void send_type(const fastd_socket_t *sock, const fastd_peer_address_t *lo
 	}
 
 	if (sock->bound_addr->sa.sa_family == AF_INET6) {
-		remote_addr6 = *remote_addr;
-		fastd_peer_address_widen(&remote_addr6);
+		fastd_peer_address_widen(&send->remote_addr);
 
-		msg.msg_name = (void *)&remote_addr6.in6;
-		msg.msg_namelen = sizeof(struct sockaddr_in6);
+		send->msg.msg_name = &send->remote_addr.in6;
+		send->msg.msg_namelen = sizeof(struct sockaddr_in6);
 	}
 
-	struct iovec iov[2] = {
-		{ .iov_base = &packet_type, .iov_len = 1 },
-		{ .iov_base = buffer.data, .iov_len = buffer.len }
-	};
+	send->packet_type = packet_type;
+	send->buffer = buffer;
 
-	msg.msg_iov = iov;
-	msg.msg_iovlen = buffer.len ? 2 : 1;
-	msg.msg_control = cbuf;
-	msg.msg_controllen = 0;
+	send->iov[0] = (struct iovec){ .iov_base = &send->packet_type, .iov_len = 1 };
+	send->iov[1] = (struct iovec){ .iov_base = buffer.data, .iov_len = buffer.len };
 
-	add_pktinfo(&msg, local_addr);
+	send->msg.msg_iov = send->iov;
+	send->msg.msg_iovlen = buffer.len ? 2 : 1;
+	send->msg.msg_control = send->cbuf;
+	send->msg.msg_controllen = 0;
 
-	if (!msg.msg_controllen)
-		msg.msg_control = NULL;
+	add_pktinfo(&send->msg, local_addr);
 
-	int ret = sendmsg(sock->fd.fd, &msg, 0);
+	if (!send->msg.msg_controllen)
+		send->msg.msg_control = NULL;
 
-	if (ret < 0 && msg.msg_controllen) {
-		switch (errno) {
-		case EINVAL:
-		case ENETUNREACH:
-			pr_debug2("sendmsg: %s (trying again without pktinfo)", strerror(errno));
+	send->has_peer = peer;
+	send->peer_id = peer ? peer->id : 0;
+	send->stat_size = stat_size;
+}
+
+/**
+   Checks if a failed send should be retried without packet info
 
-			if (peer && !fastd_peer_handshake_scheduled(peer))
-				fastd_peer_schedule_handshake_default(peer);
+   If it should, the packet info is removed from the message.
+*/
+static bool send_retry(fastd_send_msg_t *send, fastd_peer_t *peer) {
+	if (!send->msg.msg_controllen)
+		return false;
 
-			msg.msg_control = NULL;
-			msg.msg_controllen = 0;
+	switch (errno) {
+	case EINVAL:
+	case ENETUNREACH:
+		pr_debug2("sendmsg: %s (trying again without pktinfo)", strerror(errno));
 
-			ret = sendmsg(sock->fd.fd, &msg, 0);
-		}
+		/* Handshakes can't be scheduled on worker threads; this is left to the keepalives sent by the main thread */
+		if (peer && !fastd_in_worker() && !fastd_peer_handshake_scheduled(peer))
+			fastd_peer_schedule_handshake_default(peer);
+
+		send->msg.msg_control = NULL;
+		send->msg.msg_controllen = 0;
+
+		return true;
+
+	default:
+		return false;
 	}
+}
 
-	if (ret < 0) {
+/** Accounts a sent packet (using errno if the send has failed) and frees its buffer */
+static void send_done(fastd_send_msg_t *send, fastd_peer_t *peer, bool ok) {
+	if (!ok) {
 		switch (errno) {
 		case EAGAIN:
 #if EAGAIN != EWOULDBLOCK
 		case EWOULDBLOCK:
 #endif
 			pr_debug2_errno("sendmsg");
-			fastd_stats_add(peer, STAT_TX_DROPPED, stat_size);
+			fastd_stats_add(peer, STAT_TX_DROPPED, send->stat_size);
 			break;
 
 		case ENETDOWN:
 		case ENETUNREACH:
 		case EHOSTUNREACH:
 			pr_debug_errno("sendmsg");
-			fastd_stats_add(peer, STAT_TX_ERROR, stat_size);
+			fastd_stats_add(peer, STAT_TX_ERROR, send->stat_size);
 			break;
 
 		default:
 			pr_warn_errno("sendmsg");
-			fastd_stats_add(peer, STAT_TX_ERROR, stat_size);
+			fastd_stats_add(peer, STAT_TX_ERROR, send->stat_size);
 		}
 	}
 	else {
-		fastd_stats_add(peer, STAT_TX, stat_size);
+		fastd_stats_add(peer, STAT_TX, send->stat_size);
 	}
 
-	fastd_buffer_free(buffer);
+	fastd_buffer_free(send->buffer);
+}
+
+/**
+   A batch of packets sent on a socket together
+
+   Each message of a batch contains either a single packet, or a run of packets
+   to the same destination which are coalesced using UDP GSO. With io_uring,
+   every message is submitted as a separate operation; the messages are then
+   indexed by their first packet, and the batch is recycled when all of them
+   have completed.
+*/
+struct fastd_send_batch {
+	size_t n_packets;				/**< The number of queued packets */
+	fastd_send_msg_t packets[SEND_BATCH_SIZE];	/**< The queued packets */
+
+	struct mmsghdr msgs[SEND_BATCH_SIZE];		/**< The message headers passed to sendmmsg() */
+	size_t msg_first[SEND_BATCH_SIZE];		/**< The index of the first packet of each message */
+	size_t msg_packets[SEND_BATCH_SIZE];		/**< The number of packets of each message */
+
+#ifdef USE_UDP_GSO
+	struct iovec gso_iov[2*SEND_BATCH_SIZE];	/**< The I/O vectors of coalesced packets (two for each packet) */
+
+	/** The ancillary data of coalesced datagrams (indexed by their first packet) */
+	uint8_t gso_cbuf[SEND_BATCH_SIZE][GSO_CONTROL_LEN] __attribute__((aligned(8)));
+#endif
+
+#ifdef USE_IO_URING
+	fastd_send_batch_t *next;			/**< The next unused batch in ctx.send_batches */
+	size_t pending;					/**< The number of messages which haven't completed yet */
+#endif
+};
+
+/** The packets sent by the main thread on a socket, which are sent at the end of the main loop iteration */
+struct fastd_send_queue {
+	const fastd_socket_t *sock;			/**< The socket the packets are sent on */
+	bool listed;					/**< Specifies if the queue is in ctx.send_queues */
+	fastd_send_batch_t *batch;			/**< The queued packets */
+
+#ifdef USE_UDP_GSO
+	bool gso_enabled;				/**< Specifies if the kernel supports UDP GSO on the socket */
+	size_t gso_max_segment;				/**< The maximum segment size which hasn't been rejected by the kernel yet */
+#endif
+};
+
+
+/** Returns the peer a queued packet is sent to, if it still exists */
+static inline fastd_peer_t * queued_peer(const fastd_send_msg_t *send, bool closing) {
+	/* Peers are being reset while their sockets are closed, so they are left alone */
+	if (closing || !send->has_peer)
+		return NULL;
+
+	return fastd_peer_find_by_id(send->peer_id);
+}
+
+#ifdef USE_UDP_GSO
+
+/** Checks if a packet can be sent as a segment of the same datagram as a previous packet */
+static inline bool gso_match(const fastd_send_msg_t *first, const fastd_send_msg_t *send) {
+	return send->buffer.len <= first->buffer.len
+		&& send->msg.msg_namelen == first->msg.msg_namelen
+		&& !memcmp(send->msg.msg_name, first->msg.msg_name, first->msg.msg_namelen)
+		&& send->msg.msg_controllen == first->msg.msg_controllen
+		&& !memcmp(send->cbuf, first->cbuf, first->msg.msg_controllen);
+}
+
+/**
+   Returns the number of packets starting at index \e first which can be coalesced into a single datagram
+
+   All segments except for the last one must have the same size.
+*/
+static size_t gso_run(const fastd_send_queue_t *queue, const fastd_send_batch_t *batch, size_t first, size_t n) {
+	const fastd_send_msg_t *send = &batch->packets[first];
+	size_t segment = 1 + send->buffer.len, size = segment, count = 1;
+
+	if (!queue->gso_enabled || segment > queue->gso_max_segment)
+		return 1;
+
+	while (first + count < n) {
+		const fastd_send_msg_t *next = &batch->packets[first + count];
+		if (!gso_match(send, next) || size + 1 + next->buffer.len > GSO_MAX_SIZE)
+			break;
+
+		size += 1 + next->buffer.len;
+		count++;
+
+		if (next->buffer.len < send->buffer.len)
+			break;
+	}
+
+	return count;
+}
+
+/** Sets up a message coalescing the packets first to first+count-1 */
+static void gso_build_msg(fastd_send_batch_t *batch, struct msghdr *msg, size_t first, size_t count) {
+	const fastd_send_msg_t *send = &batch->packets[first];
+	struct iovec *iov = &batch->gso_iov[2*first];
+	uint8_t *cbuf = batch->gso_cbuf[first];
+
+	size_t i;
+	for (i = 0; i < count; i++) {
+		iov[2*i] = batch->packets[first + i].iov[0];
+		iov[2*i+1] = batch->packets[first + i].iov[1];
+	}
+
+	/* The segment size is added after the packet info (if there is any) */
+	size_t controllen = CMSG_ALIGN(send->msg.msg_controllen);
+	memcpy(cbuf, send->cbuf, send->msg.msg_controllen);
+
+	struct cmsghdr *cmsg = (struct cmsghdr *)(cbuf + controllen);
+	cmsg->cmsg_level = SOL_UDP;
+	cmsg->cmsg_type = UDP_SEGMENT;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+
+	uint16_t segment = 1 + send->buffer.len;
+	memcpy(CMSG_DATA(cmsg), &segment, sizeof(segment));
+
+	*msg = (struct msghdr){
+		.msg_name = send->msg.msg_name,
+		.msg_namelen = send->msg.msg_namelen,
+		.msg_iov = iov,
+		.msg_iovlen = 2*count,
+		.msg_control = cbuf,
+		.msg_controllen = controllen + CMSG_SPACE(sizeof(uint16_t)),
+	};
+}
+
+/** Handles a coalesced datagram that has been rejected by the kernel (using errno) */
+static void gso_failed(fastd_send_queue_t *queue, size_t segment) {
+	ctx.gso_stats.fallbacks++;
+
+	switch (errno) {
+	case EIO:
+	case ENOPROTOOPT:
+	case EOPNOTSUPP:
+		pr_debug("sendmsg: UDP GSO failed: %s (disabling it for the socket)", strerror(errno));
+		queue->gso_enabled = false;
+		break;
+
+	case EINVAL:
+		/* Most likely, the segments are larger than the MTU of the outgoing interface */
+		pr_debug2("sendmsg: UDP GSO with %u byte segments failed: %s", (unsigned)segment, strerror(errno));
+		queue->gso_max_segment = segment - 1;
+		break;
+
+	default:
+		pr_debug2_errno("sendmsg: UDP GSO failed");
+	}
+}
+
+#endif
+
+/**
+   Sets up message \e msg for the queued packets starting with \e first (of \e n)
+
+   \return The number of packets in the message
+*/
+static size_t batch_build_msg(const fastd_send_queue_t *queue, fastd_send_batch_t *batch, size_t msg, size_t first, size_t n, bool gso) {
+	size_t count = 1;
+
+#ifdef USE_UDP_GSO
+	if (gso)
+		count = gso_run(queue, batch, first, n);
+#endif
+
+	batch->msg_first[msg] = first;
+	batch->msg_packets[msg] = count;
+
+	if (count == 1)
+		batch->msgs[msg].msg_hdr = batch->packets[first].msg;
+#ifdef USE_UDP_GSO
+	else
+		gso_build_msg(batch, &batch->msgs[msg].msg_hdr, first, count);
+#endif
+
+	return count;
+}
+
+/** Accounts the packets of a message that has been sent successfully */
+static void batch_msg_done(fastd_send_batch_t *batch, size_t msg, bool closing) {
+	size_t first = batch->msg_first[msg], count = batch->msg_packets[msg], i;
+
+#ifdef USE_UDP_GSO
+	if (count > 1) {
+		ctx.gso_stats.sends++;
+		ctx.gso_stats.segments += count;
+	}
+#endif
+
+	for (i = first; i < first + count; i++)
+		send_done(&batch->packets[i], queued_peer(&batch->packets[i], closing), true);
+}
+
+#ifdef USE_IO_URING
+
+/** Takes an unused batch from ctx.send_batches, allocating a new one if there is none */
+static fastd_send_batch_t * batch_get(void) {
+	fastd_send_batch_t *batch = ctx.send_batches;
+
+	if (batch)
+		ctx.send_batches = batch->next;
+	else
+		batch = fastd_new(fastd_send_batch_t);
+
+	batch->n_packets = 0;
+	batch->pending = 0;
+
+	return batch;
+}
+
+/** Accounts a completed message of a batch, recycling the batch after its last message */
+static void batch_put(fastd_send_batch_t *batch) {
+	if (--batch->pending)
+		return;
+
+	batch->next = ctx.send_batches;
+	ctx.send_batches = batch;
+}
+
+/** Submits the queued packets \e first to \e n-1 of a batch to io_uring, one operation per message */
+static void batch_submit(const fastd_send_queue_t *queue, fastd_send_batch_t *batch, size_t first, size_t n, bool gso) {
+	while (first < n) {
+		/* The messages are indexed by their first packet, so they never overlap */
+		size_t count = batch_build_msg(queue, batch, first, first, n, gso);
+
+		batch->pending++;
+		fastd_poll_sendmsg(&queue->sock->fd, batch, first, &batch->msgs[first].msg_hdr);
+
+		first += count;
+	}
+}
+
+/**
+   Submits all packets of a send queue to io_uring
+
+   The batch stays in use until all of its messages have completed, so the
+   queue continues with an unused one.
+*/
+static void queue_flush(fastd_send_queue_t *queue, UNUSED bool closing) {
+	fastd_send_batch_t *batch = queue->batch;
+	if (!batch->n_packets)
+		return;
+
+	queue->batch = batch_get();
+
+	batch_submit(queue, batch, 0, batch->n_packets, true);
+}
+
+/**
+   Handles the completion of a message submitted with fastd_poll_sendmsg()
+
+   \e fd is NULL when the socket has been closed in the meantime.
+
+   \return true if the message has been modified and must be submitted again
+*/
+bool fastd_send_complete(const fastd_poll_fd_t *fd, fastd_send_batch_t *batch, size_t msg, int res) {
+	size_t first = batch->msg_first[msg], count = batch->msg_packets[msg], i;
+
+	if (res >= 0) {
+		batch_msg_done(batch, msg, false);
+		batch_put(batch);
+		return false;
+	}
+
+	fastd_send_queue_t *queue = fd ? container_of(fd, fastd_socket_t, fd)->send_queue : NULL;
+
+	if (queue) {
+		errno = -res;
+
+#ifdef USE_UDP_GSO
+		if (count > 1) {
+			/* Send the packets of the message separately */
+			gso_failed(queue, 1 + batch->packets[first].buffer.len);
+			batch_submit(queue, batch, first, first + count, false);
+			batch_put(batch);
+			return false;
+		}
+#endif
+
+		/* Retry it without packet info */
+		fastd_send_msg_t *send = &batch->packets[first];
+		if (send_retry(send, queued_peer(send, false))) {
+			batch->msgs[msg].msg_hdr = send->msg;
+			return true;
+		}
+	}
+
+	for (i = first; i < first + count; i++) {
+		errno = -res;
+		send_done(&batch->packets[i], queued_peer(&batch->packets[i], false), false);
+	}
+
+	batch_put(batch);
+	return false;
+}
+
+/** Frees the packets of a message that is still in flight when fastd is terminating */
+void fastd_send_cancel(fastd_send_batch_t *batch, size_t msg) {
+	size_t first = batch->msg_first[msg], count = batch->msg_packets[msg], i;
+
+	for (i = first; i < first + count; i++)
+		fastd_buffer_free(batch->packets[i].buffer);
+
+	batch_put(batch);
+}
+
+/** Frees the unused send batches */
+void fastd_send_batches_free(void) {
+	while (ctx.send_batches) {
+		fastd_send_batch_t *batch = ctx.send_batches;
+		ctx.send_batches = batch->next;
+		free(batch);
+	}
+}
+
+#else
+
+/** Sends all packets of a send queue with sendmmsg(), accounting each packet separately */
+static void queue_flush(fastd_send_queue_t *queue, bool closing) {
+	fastd_send_batch_t *batch = queue->batch;
+	size_t n = batch->n_packets;
+	batch->n_packets = 0;
+
+	size_t n_msgs = 0, first = 0, i = 0;
+	while (first < n)
+		first += batch_build_msg(queue, batch, n_msgs++, first, n, true);
+
+	while (i < n_msgs) {
+		int ret = sendmmsg(queue->sock->fd.fd, &batch->msgs[i], n_msgs - i, 0);
+
+		if (ret > 0) {
+			size_t end = i + ret;
+			for (; i < end; i++)
+				batch_msg_done(batch, i, closing);
+
+			continue;
+		}
+
+		/* The first remaining message has failed */
+		first = batch->msg_first[i];
+
+#ifdef USE_UDP_GSO
+		if (batch->msg_packets[i] > 1) {
+			/* Send the remaining packets separately */
+			gso_failed(queue, 1 + batch->packets[first].buffer.len);
+
+			n_msgs = i;
+			while (first < n)
+				first += batch_build_msg(queue, batch, n_msgs++, first, n, false);
+
+			continue;
+		}
+#endif
+
+		/* Retry it without packet info or skip it */
+		fastd_send_msg_t *send = &batch->packets[first];
+		fastd_peer_t *peer = queued_peer(send, closing);
+
+		if (send_retry(send, peer)) {
+			batch->msgs[i].msg_hdr = send->msg;
+			continue;
+		}
+
+		send_done(send, peer, false);
+		i++;
+	}
+}
+
+#endif
+
+/** Adds a packet to the send queue of a socket (the packet is sent at the end of the main loop iteration) */
+static void queue_packet(fastd_send_queue_t *queue, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr, fastd_peer_t *peer, uint8_t packet_type, fastd_buffer_t buffer, size_t stat_size) {
+	fastd_send_batch_t *batch = queue->batch;
+	send_msg_init(&batch->packets[batch->n_packets], queue->sock, local_addr, remote_addr, peer, packet_type, buffer, stat_size);
+
+	batch->n_packets++;
+
+	if (!queue->listed) {
+		queue->listed = true;
+		VECTOR_ADD(ctx.send_queues, queue);
+	}
+
+	if (batch->n_packets == SEND_BATCH_SIZE)
+		queue_flush(queue, false);
+}
+
+/** Creates the send queue of a newly opened socket */
+void fastd_send_queue_init(fastd_socket_t *sock) {
+	fastd_send_queue_t *queue = fastd_new0(fastd_send_queue_t);
+	queue->sock = sock;
+
+#ifdef USE_IO_URING
+	queue->batch = batch_get();
+#else
+	queue->batch = fastd_new0(fastd_send_batch_t);
+#endif
+
+#ifdef USE_UDP_GSO
+	/* Kernels without UDP GSO support would ignore the segment size when sending */
+	int segment;
+	socklen_t len = sizeof(segment);
+	queue->gso_enabled = !getsockopt(sock->fd.fd, SOL_UDP, UDP_SEGMENT, &segment, &len);
+	queue->gso_max_segment = SIZE_MAX;
+#endif
+
+	sock->send_queue = queue;
+}
+
+/**
+   Sends the queued packets of a socket that is about to be closed and frees its send queue
+
+   With io_uring, batches that are still in flight are recycled when their last message has completed.
+*/
+void fastd_send_queue_free(fastd_socket_t *sock) {
+	fastd_send_queue_t *queue = sock->send_queue;
+	if (!queue)
+		return;
+
+	queue_flush(queue, true);
+
+	if (queue->listed) {
+		size_t i;
+		for (i = 0; i < VECTOR_LEN(ctx.send_queues); i++) {
+			if (VECTOR_INDEX(ctx.send_queues, i) == queue) {
+				VECTOR_DELETE(ctx.send_queues, i);
+				break;
+			}
+		}
+	}
+
+	free(queue->batch);
+	free(queue);
+	sock->send_queue = NULL;
+}
+
+/** Sends all queued packets */
+void fastd_send_flush(void) {
+	size_t i;
+	for (i = 0; i < VECTOR_LEN(ctx.send_queues); i++) {
+		fastd_send_queue_t *queue = VECTOR_INDEX(ctx.send_queues, i);
+		queue->listed = false;
+		queue_flush(queue, false);
+	}
+
+	VECTOR_RESIZE(ctx.send_queues, 0);
+}
+
+/** Sends a packet of a given type */
+static void send_type(const fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr, fastd_peer_t *peer, uint8_t packet_type, fastd_buffer_t buffer, size_t stat_size) {
+	if (!sock)
+		exit_bug("send: sock == NULL");
+
+	/* Worker threads send their packets at once, as the queues belong to the main thread */
+	if (sock->send_queue && !fastd_in_worker()) {
+		queue_packet(sock->send_queue, local_addr, remote_addr, peer, packet_type, buffer, stat_size);
+		return;
+	}
+
+	fastd_send_msg_t send = {};
+	send_msg_init(&send, sock, local_addr, remote_addr, peer, packet_type, buffer, stat_size);
+
+	int ret = sendmsg(sock->fd.fd, &send.msg, 0);
+	if (ret < 0 && send_retry(&send, peer))
+		ret = sendmsg(sock->fd.fd, &send.msg, 0);
+
+	send_done(&send, peer, ret >= 0);
 }
 
 /** Sends a payload packet */
@@ -188,16 +675,28 @@ void fastd_send_handshake(const fastd_socket_t *sock, const fastd_peer_address_t
 	send_type(sock, local_addr, remote_addr, peer, PACKET_HANDSHAKE, buffer, 0);
 }
 
-/** Encrypts and sends a payload packet to all peers */
+/**
+   Encrypts and sends a payload packet to all peers
+
+   Worker threads use the peer table published for them instead of \e ctx.peers.
+   The state of these peers is only checked by the protocol, with the peer lock held.
+*/
 static inline void send_all(fastd_buffer_t buffer, fastd_peer_t *source) {
+	fastd_peer_t *const *peers = VECTOR_DATA(ctx.peers);
+	size_t n_peers = VECTOR_LEN(ctx.peers);
+	bool worker = fastd_in_worker();
+
+	if (worker)
+		n_peers = fastd_worker_peer_list(&peers);
+
 	size_t i;
-	for (i = 0; i < VECTOR_LEN(ctx.peers); i++) {
-		fastd_peer_t *dest = VECTOR_INDEX(ctx.peers, i);
-		if (dest == source || !fastd_peer_is_established(dest))
+	for (i = 0; i < n_peers; i++) {
+		fastd_peer_t *dest = peers[i];
+		if (dest == source || (!worker && !fastd_peer_is_established(dest)))
 			continue;
 
 		/* optimization, primarily for TUN mode: don't duplicate the buffer for the last (or only) peer */
-		if (i == VECTOR_LEN(ctx.peers)-1) {
+		if (i == n_peers-1) {
 			conf.protocol->send(dest, buffer);
 			return;
 		}
@@ -258,3 +757,15 @@ void fastd_send_data(fastd_buffer_t buffer, fastd_peer_t *source, fastd_peer_t *
 	/* TUN mode or multicast packet */
 	send_all(buffer, source);
 }
+
+/** Sends a batch of payload packets to a single peer */
+void fastd_send_data_batch(fastd_buffer_t *buffers, size_t n, fastd_peer_t *dest) {
+	if (conf.protocol->send_batch) {
+		conf.protocol->send_batch(dest, buffers, n);
+		return;
+	}
+
+	size_t i;
+	for (i = 0; i < n; i++)
+		conf.protocol->send(dest, buffers[i]);
+}
@@ -30,7 +30,9 @@
 */
 
 #include "fastd.h"
+#include "peer.h"
 #include "poll.h"
+#include "worker.h"
 
 #include <net/if.h>
 
@@ -38,9 +40,12 @@
 /**
    Creates a new socket bound to a specific address
 
+   When \e reuseport is set, SO_REUSEPORT is enabled on the socket, so multiple sockets can
+   be bound to the same address.
+
    \return The new socket's file descriptor
 */
-static int bind_socket(const fastd_bind_address_t *addr) {
+static int bind_socket(const fastd_bind_address_t *addr, UNUSED bool reuseport) {
 	int fd = -1;
 	int af = AF_UNSPEC;
 
@@ -109,6 +114,15 @@ static int bind_socket(const fastd_bind_address_t *addr) {
 	}
 #endif
 
+#ifdef WITH_WORKERS
+	if (reuseport) {
+		if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one))) {
+			pr_error_errno("setsockopt: unable to set SO_REUSEPORT");
+			goto error;
+		}
+	}
+#endif
+
 #ifdef USE_PACKET_MARK
 	if (conf.packet_mark) {
 		if (setsockopt(fd, SOL_SOCKET, SO_MARK, &conf.packet_mark, sizeof(conf.packet_mark))) {
@@ -118,6 +132,26 @@ static int bind_socket(const fastd_bind_address_t *addr) {
 	}
 #endif
 
+#ifdef USE_UDP_GRO
+	if (conf.offload_gro) {
+		if (setsockopt(fd, SOL_UDP, UDP_GRO, &one, sizeof(one)))
+			pr_warn_errno("setsockopt: unable to enable UDP GRO");
+	}
+#endif
+
+#ifdef USE_BUSY_POLL
+	if (conf.busy_poll_socket) {
+		int busy_poll = conf.busy_poll;
+		if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &busy_poll, sizeof(busy_poll)))
+			pr_warn_errno("setsockopt: unable to set SO_BUSY_POLL");
+
+#ifdef SO_PREFER_BUSY_POLL
+		if (setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &one, sizeof(one)))
+			pr_warn_errno("setsockopt: unable to set SO_PREFER_BUSY_POLL");
+#endif
+	}
+#endif
+
 	fastd_peer_address_t bind_address = addr->addr;
 
 	if (fastd_peer_address_is_v6_ll(&addr->addr) && addr->bindtodev) {
@@ -193,7 +227,7 @@ void fastd_socket_bind_all(void) {
 		if (!sock->addr)
 			continue;
 
-		sock->fd = FASTD_POLL_FD(POLL_TYPE_SOCKET, bind_socket(sock->addr));
+		sock->fd = FASTD_POLL_FD(POLL_TYPE_SOCKET, bind_socket(sock->addr, fastd_workers_enabled()));
 		if (sock->fd.fd < 0)
 			exit(1); /* message has already been printed */
 
@@ -209,6 +243,7 @@ void fastd_socket_bind_all(void) {
 			pr_info("bound to %B", &bound_addr);
 
 		fastd_poll_fd_register(&sock->fd);
+		fastd_send_queue_init(sock);
 	}
 }
 
@@ -232,7 +267,7 @@ fastd_socket_t * fastd_socket_open(fastd_peer_t *peer, int af) {
 		return NULL;
 	}
 
-	int fd = bind_socket(bind_address);
+	int fd = bind_socket(bind_address, false);
 	if (fd < 0)
 		return NULL;
 
@@ -241,16 +276,55 @@ fastd_socket_t * fastd_socket_open(fastd_peer_t *peer, int af) {
 	sock->fd = FASTD_POLL_FD(POLL_TYPE_SOCKET, fd);
 	sock->addr = NULL;
 	sock->peer = peer;
+	sock->receive_batch = NULL;
 
 	set_bound_address(sock);
 
 	fastd_poll_fd_register(&sock->fd);
+	fastd_send_queue_init(sock);
 
 	return sock;
 }
 
+#ifdef WITH_WORKERS
+
+/**
+   Opens a copy of a bound socket for a worker thread
+
+   The new socket is bound to the same address and port as \e sock; SO_REUSEPORT makes the
+   kernel distribute the incoming packets between them. The copy isn't registered with the
+   main thread's poll facility.
+*/
+bool fastd_socket_open_sibling(fastd_socket_t *sibling, const fastd_socket_t *sock) {
+	*sibling = (fastd_socket_t){ .fd = FASTD_POLL_FD(POLL_TYPE_SOCKET, -1), .addr = sock->addr };
+
+	if (sock->fd.fd < 0)
+		return true;
+
+	/* Use the actual port in case a random port was configured */
+	fastd_bind_address_t bind_address = *sock->addr;
+	uint16_t port = fastd_peer_address_get_port(sock->bound_addr);
+
+	if (bind_address.addr.sa.sa_family == AF_INET6)
+		bind_address.addr.in6.sin6_port = port;
+	else
+		bind_address.addr.in.sin_port = port;
+
+	sibling->fd.fd = bind_socket(&bind_address, true);
+	if (sibling->fd.fd < 0)
+		return false;
+
+	set_bound_address(sibling);
+
+	return true;
+}
+
+#endif
+
 /** Closes a socket */
 void fastd_socket_close(fastd_socket_t *sock) {
+	fastd_send_queue_free(sock);
+
 	if (sock->fd.fd >= 0) {
 		if (!fastd_poll_fd_close(&sock->fd))
 			pr_error_errno("closing socket: close");
@@ -258,6 +332,8 @@ void fastd_socket_close(fastd_socket_t *sock) {
 		sock->fd.fd = -1;
 	}
 
+	fastd_receive_batch_free(sock);
+
 	if (sock->bound_addr) {
 		free(sock->bound_addr);
 		sock->bound_addr = NULL;
@@ -35,7 +35,9 @@
 
 #ifdef WITH_STATUS_SOCKET
 
+#include "crypto.h"
 #include "method.h"
+#include "offload.h"
 #include "peer.h"
 
 #include <json-c/json.h>
@@ -76,12 +78,50 @@ static void * dump_thread(void *p) {
 }
 
 
-/** Dumps a single traffic stat as a JSON object */
+/** Dumps the status of a cipher or MAC implementation as a JSON object */
+static json_object * dump_crypto_impl(const fastd_crypto_impl_status_t *status) {
+	struct json_object *ret = json_object_new_object();
+
+	json_object_object_add(ret, "implementation", json_object_new_string(status->impl));
+	json_object_object_add(ret, "auto", json_object_new_boolean(status->autoselected));
+
+	if (status->autoselected)
+		json_object_object_add(ret, "throughput", json_object_new_int64(status->throughput));
+
+	return ret;
+}
+
+/** Dumps the chosen cipher and MAC implementations */
+static json_object * dump_crypto(void) {
+	struct json_object *ret = json_object_new_object();
+	struct json_object *ciphers = json_object_new_object();
+	struct json_object *macs = json_object_new_object();
+	fastd_crypto_impl_status_t status;
+	size_t i;
+
+	for (i = 0; fastd_cipher_get_status(i, &status); i++) {
+		if (status.impl)
+			json_object_object_add(ciphers, status.name, dump_crypto_impl(&status));
+	}
+
+	for (i = 0; fastd_mac_get_status(i, &status); i++) {
+		if (status.impl)
+			json_object_object_add(macs, status.name, dump_crypto_impl(&status));
+	}
+
+	json_object_object_add(ret, "ciphers", ciphers);
+	json_object_object_add(ret, "macs", macs);
+
+	return ret;
+}
+
+
+/** Dumps a single traffic stat as a JSON object (the counters may be updated by worker threads concurrently) */
 static json_object * dump_stat(const fastd_stats_t *stats, fastd_stat_type_t type) {
 	struct json_object *ret = json_object_new_object();
 
-	json_object_object_add(ret, "packets", json_object_new_int64(stats->packets[type]));
-	json_object_object_add(ret, "bytes", json_object_new_int64(stats->bytes[type]));
+	json_object_object_add(ret, "packets", json_object_new_int64(__atomic_load_n(&stats->packets[type], __ATOMIC_RELAXED)));
+	json_object_object_add(ret, "bytes", json_object_new_int64(__atomic_load_n(&stats->bytes[type], __ATOMIC_RELAXED)));
 
 	return ret;
 }
@@ -97,6 +137,9 @@ static json_object * dump_stats(const fastd_stats_t *stats) {
 
 	json_object_object_add(statistics, "rx", dump_stat(stats, STAT_RX));
 	json_object_object_add(statistics, "rx_reordered", dump_stat(stats, STAT_RX_REORDERED));
+	json_object_object_add(statistics, "rx_window_dropped", dump_stat(stats, STAT_RX_WINDOW_DROPPED));
+	json_object_object_add(statistics, "rx_reorder_held", dump_stat(stats, STAT_RX_REORDER_HELD));
+	json_object_object_add(statistics, "rx_reorder_skipped", dump_stat(stats, STAT_RX_REORDER_SKIPPED));
 
 	json_object_object_add(statistics, "tx", dump_stat(stats, STAT_TX));
 	json_object_object_add(statistics, "tx_dropped", dump_stat(stats, STAT_TX_DROPPED));
@@ -105,6 +148,89 @@ static json_object * dump_stats(const fastd_stats_t *stats) {
 	return statistics;
 }
 
+/** Dumps the main loop statistics as a JSON object */
+static json_object * dump_poll_stats(void) {
+	struct json_object *ret = json_object_new_object();
+
+	json_object_object_add(ret, "packet_budget", json_object_new_int64(conf.packet_budget));
+	json_object_object_add(ret, "loops", json_object_new_int64(ctx.poll_stats.loops));
+	json_object_object_add(ret, "events", json_object_new_int64(ctx.poll_stats.events));
+	json_object_object_add(ret, "packets", json_object_new_int64(ctx.poll_stats.packets));
+	json_object_object_add(ret, "budget_exhausted", json_object_new_int64(ctx.poll_stats.budget_exhausted));
+
+	if (conf.busy_poll) {
+		struct json_object *busy_poll = json_object_new_object();
+		uint64_t wakeups = ctx.poll_stats.spin_wakeups + ctx.poll_stats.sleep_wakeups;
+
+		json_object_object_add(busy_poll, "max_time", json_object_new_int64(conf.busy_poll));
+		json_object_object_add(busy_poll, "time", json_object_new_int64(ctx.busy_poll_window));
+		json_object_object_add(busy_poll, "spin_wakeups", json_object_new_int64(ctx.poll_stats.spin_wakeups));
+		json_object_object_add(busy_poll, "sleep_wakeups", json_object_new_int64(ctx.poll_stats.sleep_wakeups));
+		json_object_object_add(busy_poll, "spin_ratio", json_object_new_double(wakeups ? (double)ctx.poll_stats.spin_wakeups / wakeups : 0));
+		json_object_object_add(busy_poll, "spin_time", json_object_new_int64(ctx.poll_stats.spin_time));
+
+		json_object_object_add(ret, "busy_poll", busy_poll);
+	}
+
+	return ret;
+}
+
+/** Dumps the statistics of a size class of the buffer pool as a JSON object */
+static json_object * dump_buffer_class(const fastd_buffer_freelist_t *class) {
+	struct json_object *ret = json_object_new_object();
+
+	json_object_object_add(ret, "size", json_object_new_int64(class->size));
+	json_object_object_add(ret, "hits", json_object_new_int64(class->hits));
+	json_object_object_add(ret, "misses", json_object_new_int64(class->misses));
+
+	return ret;
+}
+
+/** Dumps the buffer pool statistics of all threads as a JSON object */
+static json_object * dump_buffer_pool_stats(void) {
+	fastd_buffer_pool_t stats;
+	fastd_buffer_pool_get_stats(&stats);
+
+	struct json_object *ret = json_object_new_object();
+
+	json_object_object_add(ret, "handshake", dump_buffer_class(&stats.classes[BUFFER_CLASS_HANDSHAKE]));
+	json_object_object_add(ret, "data", dump_buffer_class(&stats.classes[BUFFER_CLASS_DATA]));
+	json_object_object_add(ret, "oversized", json_object_new_int64(stats.oversized));
+
+	return ret;
+}
+
+#ifdef USE_UDP_GSO
+
+/** Dumps the UDP GSO statistics as a JSON object */
+static json_object * dump_gso_stats(void) {
+	struct json_object *ret = json_object_new_object();
+
+	json_object_object_add(ret, "sends", json_object_new_int64(ctx.gso_stats.sends));
+	json_object_object_add(ret, "segments", json_object_new_int64(ctx.gso_stats.segments));
+	json_object_object_add(ret, "fallbacks", json_object_new_int64(ctx.gso_stats.fallbacks));
+
+	return ret;
+}
+
+#endif
+
+/** Dumps the statistics of the handshake thread pool as a JSON object */
+static json_object * dump_offload_stats(void) {
+	fastd_offload_stats_t stats;
+	fastd_offload_get_stats(&stats);
+
+	struct json_object *ret = json_object_new_object();
+
+	json_object_object_add(ret, "threads", json_object_new_int64(conf.n_handshake_workers));
+	json_object_object_add(ret, "queued", json_object_new_int64(stats.queued));
+	json_object_object_add(ret, "submitted", json_object_new_int64(stats.submitted));
+	json_object_object_add(ret, "completed", json_object_new_int64(stats.completed));
+	json_object_object_add(ret, "shed", json_object_new_int64(stats.shed));
+
+	return ret;
+}
+
 
 /** Dumps a peer's status as a JSON object */
 static json_object * dump_peer(const fastd_peer_t *peer) {
@@ -142,6 +268,8 @@ static json_object * dump_peer(const fastd_peer_t *peer) {
 			struct json_object *mac_addresses = json_object_new_array();
 			json_object_object_add(connection, "mac_addresses", mac_addresses);
 
+			fastd_worker_eth_addr_lock();
+
 			size_t i;
 			for (i = 0; i < VECTOR_LEN(ctx.eth_addrs); i++) {
 				fastd_peer_eth_addr_t *addr = &VECTOR_INDEX(ctx.eth_addrs, i);
@@ -158,6 +286,8 @@ static json_object * dump_peer(const fastd_peer_t *peer) {
 
 				json_object_array_add(mac_addresses, json_object_new_string(eth_addr_buf));
 			}
+
+			fastd_worker_eth_addr_unlock();
 		}
 	}
 
@@ -175,7 +305,17 @@ static void dump_status(int fd) {
 	if (ctx.iface)
 		json_object_object_add(json, "interface", dump_iface(ctx.iface));
 
-	json_object_object_add(json, "statistics", dump_stats(&ctx.stats));
+	fastd_stats_t stats = ctx.stats;
+	fastd_workers_add_stats(&stats);
+	json_object_object_add(json, "statistics", dump_stats(&stats));
+	json_object_object_add(json, "poll", dump_poll_stats());
+	json_object_object_add(json, "buffers", dump_buffer_pool_stats());
+	json_object_object_add(json, "crypto", dump_crypto());
+#ifdef USE_UDP_GSO
+	json_object_object_add(json, "gso", dump_gso_stats());
+#endif
+	if (fastd_offload_enabled())
+		json_object_object_add(json, "handshake_threads", dump_offload_stats());
 
 	struct json_object *peers = json_object_new_object();
 	json_object_object_add(json, "peers", peers);
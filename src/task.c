@@ -30,20 +30,20 @@
 */
 
 #include "task.h"
+#include "offload.h"
 #include "peer.h"
+#include "reorder.h"
 
 
 /** Performs periodic maintenance tasks */
 static inline void maintenance(void) {
 	fastd_peer_eth_addr_cleanup();
+	fastd_offload_handle();
 	fastd_task_reschedule_relative(&ctx.next_maintenance, MAINTENANCE_INTERVAL);
 }
 
-/** Handles one task */
-static void handle_task(void) {
-	fastd_task_t *task = container_of(ctx.task_queue, fastd_task_t, entry);
-	fastd_pqueue_remove(ctx.task_queue);
-
+/** Handles one task that has been removed from the queue */
+static void handle_task(fastd_task_t *task) {
 	switch (task->type) {
 	case TASK_TYPE_MAINTENANCE:
 		maintenance();
@@ -53,6 +53,10 @@ static void handle_task(void) {
 		fastd_peer_handle_task(task);
 		break;
 
+	case TASK_TYPE_REORDER:
+		fastd_reorder_handle_task(task);
+		break;
+
 	default:
 		exit_bug("unknown task type");
 	}
@@ -60,20 +64,24 @@ static void handle_task(void) {
 
 /** Handles all tasks whose timeout has been reached */
 void fastd_task_handle(void) {
-	while (ctx.task_queue && fastd_timed_out(ctx.task_queue->value))
-		handle_task();
+	fastd_timer_wheel_entry_t *entry;
+
+	while ((entry = fastd_timer_wheel_expire(&ctx.task_queue, ctx.now)))
+		handle_task(container_of(entry, fastd_task_t, entry));
 }
 
 /** Puts a task back into the queue with a new timeout */
 void fastd_task_reschedule(fastd_task_t *task, fastd_timeout_t timeout) {
 	task->entry.value = timeout;
-	fastd_pqueue_insert(&ctx.task_queue, &task->entry);
+	fastd_timer_wheel_insert(&ctx.task_queue, &task->entry);
+}
+
+/** Removes a task from the queue */
+void fastd_task_unschedule(fastd_task_t *task) {
+	fastd_timer_wheel_remove(&ctx.task_queue, &task->entry);
 }
 
 /** Gets the timeout of the next task in the task queue */
 fastd_timeout_t fastd_task_queue_timeout(void) {
-	if (!ctx.task_queue)
-		return FASTD_TIMEOUT_INV;
-
-	return ctx.task_queue->value;
+	return fastd_timer_wheel_next(&ctx.task_queue);
 }
@@ -31,25 +31,26 @@
 
 #pragma once
 
-#include "pqueue.h"
+#include "timer_wheel.h"
 
 
 /** A scheduled task */
 struct fastd_task {
-	fastd_pqueue_t entry;	/**< Task queue entry */
-	fastd_task_type_t type;	/**< Type of the task */
+	fastd_timer_wheel_entry_t entry;	/**< Task queue entry */
+	fastd_task_type_t type;			/**< Type of the task */
 };
 
 
 void fastd_task_handle(void);
 
 void fastd_task_reschedule(fastd_task_t *task, fastd_timeout_t timeout);
+void fastd_task_unschedule(fastd_task_t *task);
 fastd_timeout_t fastd_task_queue_timeout(void);
 
 
 /** Checks if the given task is currently scheduled */
 static inline bool fastd_task_scheduled(fastd_task_t *task) {
-	return fastd_pqueue_linked(&task->entry);
+	return fastd_timer_wheel_linked(&task->entry);
 }
 
 /** Gets the timeout of a task */
@@ -60,11 +61,6 @@ static inline fastd_timeout_t fastd_task_timeout(fastd_task_t *task) {
 	return task->entry.value;
 }
 
-/** Removes a task from the queue */
-static inline void fastd_task_unschedule(fastd_task_t *task) {
-	fastd_pqueue_remove(&task->entry);
-}
-
 /** Puts a task back into the queue with a new timeout relative to the old one */
 static inline void fastd_task_reschedule_relative(fastd_task_t *task, int64_t delay) {
 	fastd_task_reschedule(task, task->entry.value + delay);
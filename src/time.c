@@ -50,6 +50,17 @@ int64_t fastd_get_time(void) {
 	return nsecs / 1000000;
 }
 
+/** Returns a monotonic timestamp in microseconds */
+int64_t fastd_get_time_usec(void) {
+	static mach_timebase_info_data_t timebase_info = {};
+
+	if (!timebase_info.denom)
+		mach_timebase_info(&timebase_info);
+
+	int64_t nsecs = (((long double)mach_absolute_time())*timebase_info.numer) / timebase_info.denom;
+	return nsecs / 1000;
+}
+
 #else
 
 /** Returns a monotonic timestamp in milliseconds */
@@ -60,4 +71,12 @@ int64_t fastd_get_time(void) {
 	return (1000*(int64_t)ts.tv_sec) + ts.tv_nsec/1000000;
 }
 
+/** Returns a monotonic timestamp in microseconds */
+int64_t fastd_get_time_usec(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (1000000*(int64_t)ts.tv_sec) + ts.tv_nsec/1000;
+}
+
 #endif
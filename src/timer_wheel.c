@@ -0,0 +1,264 @@
+/*
+  Copyright (c) 2012-2016, Matthias Schiffer <mschiffer@universe-factory.net>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   \file
+
+   Timer wheel implementation
+
+   Each element is put into the lowest level whose slots are wider than the
+   distance to the element's timeout, so insertion and removal are O(1). The
+   elements of a higher level slot are distributed among the lower levels when
+   the wheel reaches the beginning of the slot ("cascading").
+
+   The wheel is only advanced by fastd_timer_wheel_expire(); fully empty ranges
+   are skipped using the slot bitmaps.
+*/
+
+
+#include "timer_wheel.h"
+#include "log.h"
+
+
+/** Returns the number of bits of a timeout below level \e level */
+static inline unsigned level_shift(size_t level) {
+	return level * TIMER_WHEEL_BITS;
+}
+
+/** Returns the slot index of a timeout on a level */
+static inline size_t slot_index(int64_t value, size_t level) {
+	return (value >> level_shift(level)) & (TIMER_WHEEL_SLOTS - 1);
+}
+
+
+/** Links an element at the head of a list */
+static inline void wheel_link(fastd_timer_wheel_entry_t **list, fastd_timer_wheel_entry_t *elem) {
+	elem->pprev = list;
+	elem->next = *list;
+	if (elem->next)
+		elem->next->pprev = &elem->next;
+
+	*list = elem;
+}
+
+/** Unlinks an element */
+static inline void wheel_unlink(fastd_timer_wheel_entry_t *elem) {
+	*elem->pprev = elem->next;
+	if (elem->next)
+		elem->next->pprev = elem->pprev;
+
+	elem->pprev = NULL;
+	elem->next = NULL;
+}
+
+/** Puts an element into the right slot for the current time of the wheel */
+static void wheel_place(fastd_timer_wheel_t *wheel, fastd_timer_wheel_entry_t *elem) {
+	/* Elements that are already due go into the current slot of the lowest level */
+	int64_t value = (elem->value > wheel->now) ? elem->value : wheel->now;
+
+	size_t level;
+	for (level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+		unsigned shift = level_shift(level+1);
+
+		if ((value >> shift) == (wheel->now >> shift)) {
+			size_t slot = slot_index(value, level);
+
+			wheel->occupied[level][slot/64] |= UINT64_C(1) << (slot%64);
+			wheel_link(&wheel->slots[level][slot], elem);
+			return;
+		}
+	}
+
+	wheel_link(&wheel->overflow, elem);
+}
+
+/**
+   Finds the first slot at or after \e start that has an element
+
+   Stale bits of empty slots are cleared on the way.
+
+   \return The slot index, or TIMER_WHEEL_SLOTS if there is no such slot
+*/
+static size_t find_slot(fastd_timer_wheel_t *wheel, size_t level, size_t start) {
+	size_t word;
+	for (word = start/64; word < TIMER_WHEEL_SLOTS/64; word++) {
+		uint64_t bits = wheel->occupied[level][word];
+		if (word == start/64)
+			bits &= ~UINT64_C(0) << (start%64);
+
+		while (bits) {
+			size_t slot = word*64 + __builtin_ctzll(bits);
+			if (wheel->slots[level][slot])
+				return slot;
+
+			wheel->occupied[level][word] &= ~(UINT64_C(1) << (slot%64));
+			bits &= bits - 1;
+		}
+	}
+
+	return TIMER_WHEEL_SLOTS;
+}
+
+/**
+   Returns the earliest time at which the wheel has to do something after wheel->now
+
+   This is the beginning of the next non-empty slot of any level, which is a
+   lower bound of the timeouts of the elements in that slot.
+*/
+static int64_t next_event(fastd_timer_wheel_t *wheel) {
+	int64_t ret = INT64_MAX;
+
+	size_t level;
+	for (level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+		size_t slot = find_slot(wheel, level, slot_index(wheel->now, level) + 1);
+		if (slot == TIMER_WHEEL_SLOTS)
+			continue;
+
+		unsigned shift = level_shift(level+1);
+		int64_t start = ((wheel->now >> shift) << shift) + ((int64_t)slot << level_shift(level));
+
+		if (start < ret)
+			ret = start;
+	}
+
+	if (wheel->overflow) {
+		unsigned shift = level_shift(TIMER_WHEEL_LEVELS);
+		int64_t start = ((wheel->now >> shift) + 1) << shift;
+
+		if (start < ret)
+			ret = start;
+	}
+
+	return ret;
+}
+
+/** Redistributes the elements of a list */
+static void cascade(fastd_timer_wheel_t *wheel, fastd_timer_wheel_entry_t **list) {
+	fastd_timer_wheel_entry_t *elem = *list;
+	*list = NULL;
+
+	while (elem) {
+		fastd_timer_wheel_entry_t *next = elem->next;
+		elem->pprev = NULL;
+		elem->next = NULL;
+
+		wheel_place(wheel, elem);
+
+		elem = next;
+	}
+}
+
+/** Moves the wheel forward to a new time, cascading the slots beginning at that time */
+static void advance(fastd_timer_wheel_t *wheel, int64_t now) {
+	wheel->now = now;
+
+	/* Start with the highest level, as its elements may end up in the lower level slots starting now */
+	if (!(now & ((INT64_C(1) << level_shift(TIMER_WHEEL_LEVELS)) - 1)))
+		cascade(wheel, &wheel->overflow);
+
+	size_t level;
+	for (level = TIMER_WHEEL_LEVELS-1; level > 0; level--) {
+		if (!(now & ((INT64_C(1) << level_shift(level)) - 1)))
+			cascade(wheel, &wheel->slots[level][slot_index(now, level)]);
+	}
+}
+
+
+/** Inserts a new element into a timer wheel */
+void fastd_timer_wheel_insert(fastd_timer_wheel_t *wheel, fastd_timer_wheel_entry_t *elem) {
+	if (elem->pprev || elem->next)
+		exit_bug("fastd_timer_wheel_insert: tried to insert linked timer wheel element");
+
+	wheel_place(wheel, elem);
+	wheel->n_entries++;
+}
+
+/** Removes an element from a timer wheel */
+void fastd_timer_wheel_remove(fastd_timer_wheel_t *wheel, fastd_timer_wheel_entry_t *elem) {
+	if (!fastd_timer_wheel_linked(elem)) {
+		if (elem->next)
+			exit_bug("fastd_timer_wheel_remove: corrupted timer wheel item");
+
+		return;
+	}
+
+	wheel_unlink(elem);
+	wheel->n_entries--;
+}
+
+/**
+   Removes and returns an element whose timeout has been reached at time \e now
+
+   Elements are returned in the order of their timeouts (elements with the same
+   timeout are returned in no particular order).
+
+   \return An element, or NULL if no more elements are due
+*/
+fastd_timer_wheel_entry_t * fastd_timer_wheel_expire(fastd_timer_wheel_t *wheel, int64_t now) {
+	if (!wheel->n_entries) {
+		if (now > wheel->now)
+			wheel->now = now;
+
+		return NULL;
+	}
+
+	while (true) {
+		fastd_timer_wheel_entry_t *elem = wheel->slots[0][slot_index(wheel->now, 0)];
+		if (elem) {
+			fastd_timer_wheel_remove(wheel, elem);
+			return elem;
+		}
+
+		if (wheel->now >= now)
+			return NULL;
+
+		int64_t next = next_event(wheel);
+		if (next > now) {
+			wheel->now = now;
+			return NULL;
+		}
+
+		advance(wheel, next);
+	}
+}
+
+/**
+   Returns a lower bound for the timeout of the next element
+
+   The returned value is exact unless the next element is still on a higher
+   level; in this case, the wheel needs to be expired at the returned time to
+   move the element down.
+
+   \return The time, or INT64_MAX if the wheel is empty
+*/
+int64_t fastd_timer_wheel_next(fastd_timer_wheel_t *wheel) {
+	if (!wheel->n_entries)
+		return INT64_MAX;
+
+	if (wheel->slots[0][slot_index(wheel->now, 0)])
+		return wheel->now;
+
+	return next_event(wheel);
+}
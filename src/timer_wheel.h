@@ -0,0 +1,76 @@
+/*
+  Copyright (c) 2012-2016, Matthias Schiffer <mschiffer@universe-factory.net>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   \file
+
+   Hierarchical timer wheels
+*/
+
+#pragma once
+
+#include "types.h"
+
+
+/** The number of bits of a timeout handled by each level of a timer wheel */
+#define TIMER_WHEEL_BITS 8
+
+/** The number of slots per level of a timer wheel */
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+
+/** The number of levels of a timer wheel (covering 2^32 milliseconds, the rest goes into the overflow list) */
+#define TIMER_WHEEL_LEVELS 4
+
+
+/** Element of a timer wheel */
+struct fastd_timer_wheel_entry {
+	fastd_timer_wheel_entry_t **pprev;	/**< \e next element of the previous element (or the slot the element is in) */
+	fastd_timer_wheel_entry_t *next;	/**< Next element in the same slot */
+
+	int64_t value;				/**< The timeout */
+};
+
+/** A hierarchical timer wheel */
+struct fastd_timer_wheel {
+	int64_t now;				/**< The time up to which the wheel has been advanced */
+	size_t n_entries;			/**< The number of elements in the wheel */
+
+	/** Bitmaps of the slots which may contain elements (bits may be set for empty slots) */
+	uint64_t occupied[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS/64];
+
+	fastd_timer_wheel_entry_t *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS]; /**< The slots of each level */
+	fastd_timer_wheel_entry_t *overflow;	/**< Elements too far in the future for the highest level */
+};
+
+
+/** Checks if an element is currently part of a timer wheel */
+static inline bool fastd_timer_wheel_linked(const fastd_timer_wheel_entry_t *elem) {
+	return elem->pprev;
+}
+
+void fastd_timer_wheel_insert(fastd_timer_wheel_t *wheel, fastd_timer_wheel_entry_t *elem);
+void fastd_timer_wheel_remove(fastd_timer_wheel_t *wheel, fastd_timer_wheel_entry_t *elem);
+fastd_timer_wheel_entry_t * fastd_timer_wheel_expire(fastd_timer_wheel_t *wheel, int64_t now);
+int64_t fastd_timer_wheel_next(fastd_timer_wheel_t *wheel);
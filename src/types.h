@@ -91,6 +91,7 @@ typedef enum fastd_task_type {
 	TASK_TYPE_UNSPEC = 0,	/**< Unspecified task type */
 	TASK_TYPE_MAINTENANCE,	/**< Scheduled maintenance */
 	TASK_TYPE_PEER,		/**< Peer maintenance (handshake, reset, keepalive) */
+	TASK_TYPE_REORDER,	/**< Passing on packets held back by a reorder buffer */
 } fastd_task_type_t;
 
 
@@ -102,22 +103,39 @@ typedef int64_t fastd_timeout_t;
 
 
 typedef struct fastd_buffer fastd_buffer_t;
+typedef struct fastd_buffer_pool fastd_buffer_pool_t;
 typedef struct fastd_poll_fd fastd_poll_fd_t;
+typedef struct fastd_poll_stats fastd_poll_stats_t;
+typedef struct fastd_gso_stats fastd_gso_stats_t;
+typedef struct fastd_receive_batch fastd_receive_batch_t;
+typedef struct fastd_send_batch fastd_send_batch_t;
+typedef struct fastd_send_queue fastd_send_queue_t;
 typedef struct fastd_pqueue fastd_pqueue_t;
 typedef struct fastd_task fastd_task_t;
+typedef struct fastd_timer_wheel fastd_timer_wheel_t;
+typedef struct fastd_timer_wheel_entry fastd_timer_wheel_entry_t;
 
 typedef union fastd_peer_address fastd_peer_address_t;
 typedef struct fastd_bind_address fastd_bind_address_t;
 typedef struct fastd_iface fastd_iface_t;
 typedef struct fastd_socket fastd_socket_t;
+typedef struct fastd_send_msg fastd_send_msg_t;
 typedef struct fastd_peer_group fastd_peer_group_t;
 typedef struct fastd_eth_addr fastd_eth_addr_t;
 typedef struct fastd_eth_header fastd_eth_header_t;
 typedef struct fastd_peer fastd_peer_t;
 typedef struct fastd_peer_eth_addr fastd_peer_eth_addr_t;
 typedef struct fastd_remote fastd_remote_t;
+typedef struct fastd_reorder_buffer fastd_reorder_buffer_t;
 typedef struct fastd_stats fastd_stats_t;
 typedef struct fastd_handshake_timeout fastd_handshake_timeout_t;
+typedef struct fastd_worker fastd_worker_t;
+typedef struct fastd_worker_peers fastd_worker_peers_t;
+typedef struct fastd_worker_garbage fastd_worker_garbage_t;
+typedef struct fastd_offload_job fastd_offload_job_t;
+typedef struct fastd_offload_pool fastd_offload_pool_t;
+typedef struct fastd_offload_stats fastd_offload_stats_t;
+typedef struct fastd_uring fastd_uring_t;
 
 typedef struct fastd_config fastd_config_t;
 typedef struct fastd_context fastd_context_t;
@@ -132,6 +150,10 @@ typedef struct fastd_cipher fastd_cipher_t;
 typedef struct fastd_mac_info fastd_mac_info_t;
 typedef struct fastd_mac fastd_mac_t;
 
+typedef struct fastd_crypto_impl_status fastd_crypto_impl_status_t;
+
+typedef struct fastd_benchmark_result fastd_benchmark_result_t;
+
 typedef struct fastd_handshake fastd_handshake_t;
 typedef struct fastd_handshake_buffer fastd_handshake_buffer_t;
 
@@ -159,6 +181,7 @@ typedef struct fastd_protocol_peer_state fastd_protocol_peer_state_t;
 
 typedef struct fastd_method fastd_method_t;
 typedef struct fastd_method_session_state fastd_method_session_state_t;
+typedef struct fastd_packet_seq fastd_packet_seq_t;
 
 typedef struct fastd_cipher_state fastd_cipher_state_t;
 typedef struct fastd_mac_state fastd_mac_state_t;
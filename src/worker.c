@@ -0,0 +1,598 @@
+/*
+  Copyright (c) 2012-2016, Matthias Schiffer <mschiffer@universe-factory.net>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   \file
+
+   Worker threads for payload packet processing
+*/
+
+
+#include "worker.h"
+#include "peer.h"
+#include "peer_hashtable.h"
+
+
+#ifdef WITH_WORKERS
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+
+__thread fastd_worker_t *fastd_worker_self = NULL;
+__thread int64_t *fastd_thread_now = &ctx.now;
+
+
+/** Adds a file descriptor to a worker's epoll instance */
+static void worker_fd_register(fastd_worker_t *worker, fastd_poll_fd_t *fd) {
+	struct epoll_event event = {
+		.events = EPOLLIN,
+		.data.ptr = fd,
+	};
+
+	if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, fd->fd, &event) < 0)
+		exit_errno("epoll_ctl");
+}
+
+/** Removes a file descriptor from a worker's epoll instance */
+static void worker_fd_unregister(fastd_worker_t *worker, fastd_poll_fd_t *fd) {
+	if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_DEL, fd->fd, NULL) < 0)
+		exit_errno("epoll_ctl");
+}
+
+/** Closes a file descriptor owned by a worker */
+static inline void worker_fd_close(int fd) {
+	if (fd >= 0 && close(fd))
+		pr_error_errno("close");
+}
+
+/** Sets up a worker's epoll instance and sockets */
+static void worker_init(fastd_worker_t *worker) {
+	worker->epoll_fd = epoll_create(1);
+	if (worker->epoll_fd < 0)
+		exit_errno("epoll_create");
+
+	worker->socks = fastd_new_array(ctx.n_socks, fastd_socket_t);
+
+	size_t i;
+	for (i = 0; i < ctx.n_socks; i++) {
+		if (!fastd_socket_open_sibling(&worker->socks[i], &ctx.socks[i]))
+			exit(1); /* message has already been printed */
+
+		if (worker->socks[i].fd.fd >= 0)
+			worker_fd_register(worker, &worker->socks[i].fd);
+	}
+
+	worker->wake_fd = FASTD_POLL_FD(POLL_TYPE_ASYNC, eventfd(0, EFD_NONBLOCK));
+	if (worker->wake_fd.fd < 0)
+		exit_errno("eventfd");
+
+	worker_fd_register(worker, &worker->wake_fd);
+}
+
+/** Handles a file descriptor a worker has polled on */
+static void handle_fd(fastd_worker_t *worker, fastd_poll_fd_t *fd, bool input, bool error) {
+	switch (fd->type) {
+	case POLL_TYPE_ASYNC:
+	{
+		/* The worker is only woken up to end its loop iteration */
+		uint64_t value;
+		if (read(fd->fd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+			exit_errno("worker wakeup: read");
+
+		break;
+	}
+
+	case POLL_TYPE_IFACE:
+	{
+		fastd_iface_t *iface = container_of(fd, fastd_iface_t, fd);
+
+		if (input) {
+			unsigned i;
+			for (i = 0; i < conf.packet_budget;) {
+				size_t n = fastd_iface_handle(iface, CRYPTO_BATCH_SIZE);
+				if (!n)
+					break;
+
+				i += n;
+			}
+		}
+
+		break;
+	}
+
+	case POLL_TYPE_SOCKET:
+	{
+		fastd_socket_t *sock = container_of(fd, fastd_socket_t, fd);
+		size_t sock_index = sock - worker->socks;
+
+		if (error) {
+			/* The socket is owned by the worker, so it is just dropped; the kernel
+			   will distribute its packets among the remaining sockets bound to the same address */
+			pr_warn("worker socket error on %B, closing", sock->bound_addr);
+
+			worker_fd_unregister(worker, fd);
+			worker_fd_close(fd->fd);
+			fd->fd = -1;
+
+			fastd_receive_batch_free(sock);
+
+			return;
+		}
+
+		if (input) {
+			unsigned i;
+			for (i = 0; i < conf.packet_budget; i++) {
+				if (!fastd_receive_worker(sock, sock_index))
+					break;
+			}
+
+			/* The socket won't be polled as readable again for packets that have already been read from the kernel */
+			while (fastd_receive_pending(sock))
+				fastd_receive_worker(sock, sock_index);
+		}
+
+		break;
+	}
+
+	default:
+		exit_bug("unknown FD type");
+	}
+
+	if (error)
+		exit_error("unexpected poll error");
+}
+
+/**
+   Marks a quiescent state of a worker
+
+   Between two iterations of its loop, a worker doesn't hold any references to peers,
+   interfaces or other shared memory (not even through the events returned by epoll), so
+   memory that has become unreachable before the epoch was incremented may be freed.
+   The sequentially consistent store orders the epoch update before the following
+   loads of shared pointers.
+*/
+static inline void worker_advance_epoch(fastd_worker_t *worker) {
+	__atomic_store_n(&worker->epoch, worker->epoch + 1, __ATOMIC_SEQ_CST);
+}
+
+/** Wakes up a worker waiting for input */
+static void worker_wake(fastd_worker_t *worker) {
+	static const uint64_t one = 1;
+	if (write(worker->wake_fd.fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+		exit_errno("worker wakeup: write");
+}
+
+/** The main loop of a worker thread */
+static void * worker_thread(void *p) {
+	fastd_worker_t *worker = p;
+	fastd_worker_self = worker;
+	fastd_thread_now = &worker->now;
+
+	while (!__atomic_load_n(&worker->stop, __ATOMIC_ACQUIRE)) {
+		struct epoll_event events[16];
+		int ret = epoll_wait(worker->epoll_fd, events, 16, -1);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+
+			exit_errno("epoll_wait");
+		}
+
+		fastd_update_time();
+		fastd_buffer_pool_update_worker();
+
+		size_t i;
+		for (i = 0; i < (size_t)ret; i++)
+			handle_fd(worker, events[i].data.ptr,
+				  events[i].events & EPOLLIN,
+				  events[i].events & (EPOLLERR|EPOLLHUP));
+
+		worker_advance_epoch(worker);
+	}
+
+	return NULL;
+}
+
+
+/** Frees a peer table */
+static void free_peers(void *arg) {
+	fastd_worker_peers_t *peers = arg;
+
+	free(peers->peers);
+	free(peers->buckets);
+	free(peers);
+}
+
+/** Returns the bucket an address is expected in */
+static inline size_t peers_bucket(const fastd_worker_peers_t *peers, const fastd_peer_address_t *addr) {
+	uint32_t hash = peers->seed;
+	fastd_peer_address_hash(&hash, addr);
+	fastd_hash_final(&hash);
+
+	return hash & (peers->n_buckets - 1);
+}
+
+/** Creates a new peer table for the workers, replacing the old one */
+static void publish_peers(void) {
+	fastd_worker_peers_t *peers = fastd_new0(fastd_worker_peers_t);
+
+	size_t i;
+	for (i = 0; i < VECTOR_LEN(ctx.peers); i++) {
+		if (VECTOR_INDEX(ctx.peers, i)->address.sa.sa_family != AF_UNSPEC)
+			peers->n_peers++;
+	}
+
+	fastd_random_bytes(&peers->seed, sizeof(peers->seed), false);
+
+	peers->n_buckets = 16;
+	while (peers->n_buckets < 2*peers->n_peers)
+		peers->n_buckets *= 2;
+
+	peers->peers = fastd_new_array(peers->n_peers, fastd_peer_t *);
+	peers->buckets = fastd_new0_array(peers->n_buckets, fastd_worker_peer_entry_t);
+
+	size_t n = 0;
+	for (i = 0; i < VECTOR_LEN(ctx.peers); i++) {
+		fastd_peer_t *peer = VECTOR_INDEX(ctx.peers, i);
+		if (peer->address.sa.sa_family == AF_UNSPEC)
+			continue;
+
+		peers->peers[n++] = peer;
+
+		size_t b = peers_bucket(peers, &peer->address);
+		while (peers->buckets[b].peer)
+			b = (b + 1) & (peers->n_buckets - 1);
+
+		peers->buckets[b] = (fastd_worker_peer_entry_t){ .address = peer->address, .peer = peer };
+	}
+
+	fastd_worker_peers_t *old = __atomic_exchange_n(&ctx.worker_peers, peers, __ATOMIC_SEQ_CST);
+	if (old)
+		fastd_workers_defer(free_peers, old);
+
+	ctx.worker_peers_dirty = false;
+}
+
+/** Checks if each worker has passed through a quiescent state since the current grace period has started */
+static bool grace_period_over(void) {
+	size_t i;
+	for (i = 0; i < conf.n_workers; i++) {
+		fastd_worker_t *worker = &ctx.workers[i];
+
+		if (__atomic_load_n(&worker->epoch, __ATOMIC_SEQ_CST) == worker->grace_epoch)
+			return false;
+	}
+
+	return true;
+}
+
+/** Frees the garbage entries in an array */
+static void free_garbage(const fastd_worker_garbage_t *entries, size_t n) {
+	size_t i;
+	for (i = 0; i < n; i++)
+		entries[i].free_fn(entries[i].arg);
+}
+
+/**
+   Performs the maintenance of the shared state of the workers
+
+   Publishes a new peer table if the peer addresses have changed and frees the memory
+   the workers can't reference anymore. Must be called by the main thread before it
+   waits for input.
+*/
+void fastd_workers_maintain(void) {
+	if (!fastd_workers_enabled())
+		return;
+
+	if (ctx.worker_peers_dirty)
+		publish_peers();
+
+	if (VECTOR_LEN(ctx.worker_garbage_pending)) {
+		if (!grace_period_over())
+			return;
+
+		free_garbage(VECTOR_DATA(ctx.worker_garbage_pending), VECTOR_LEN(ctx.worker_garbage_pending));
+		VECTOR_RESIZE(ctx.worker_garbage_pending, 0);
+	}
+
+	if (!VECTOR_LEN(ctx.worker_garbage))
+		return;
+
+	/* Start a new grace period for the garbage collected since the last one */
+	size_t i;
+	for (i = 0; i < VECTOR_LEN(ctx.worker_garbage); i++)
+		VECTOR_ADD(ctx.worker_garbage_pending, VECTOR_INDEX(ctx.worker_garbage, i));
+
+	VECTOR_RESIZE(ctx.worker_garbage, 0);
+
+	for (i = 0; i < conf.n_workers; i++) {
+		fastd_worker_t *worker = &ctx.workers[i];
+		worker->grace_epoch = __atomic_load_n(&worker->epoch, __ATOMIC_SEQ_CST);
+
+		/* Make sure idle workers pass through a quiescent state soon */
+		worker_wake(worker);
+	}
+}
+
+/**
+   Frees memory the workers might still be using
+
+   The memory must already be unreachable for the workers (except through the current peer
+   table, which is replaced by fastd_workers_maintain() first). \e free_fn is called with \e arg
+   once no worker can hold a reference anymore; when the workers aren't running, this
+   happens immediately.
+*/
+void fastd_workers_defer(void (*free_fn)(void *arg), void *arg) {
+	if (!ctx.workers_running) {
+		free_fn(arg);
+		return;
+	}
+
+	VECTOR_ADD(ctx.worker_garbage, ((fastd_worker_garbage_t){ .free_fn = free_fn, .arg = arg }));
+}
+
+
+/**
+   Initializes the worker threads
+
+   This must be called after the sockets have been bound.
+*/
+void fastd_workers_init(void) {
+	if (!fastd_workers_enabled())
+		return;
+
+	pthread_mutexattr_t attr;
+	if (pthread_mutexattr_init(&attr))
+		exit_bug("pthread_mutexattr_init");
+
+	/* The main thread may need to modify a peer while it is already handling the same or another peer with the same lock */
+	if (pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE))
+		exit_bug("pthread_mutexattr_settype");
+
+	size_t i;
+	for (i = 0; i < WORKER_PEER_LOCKS; i++) {
+		if (pthread_mutex_init(&ctx.worker_peer_locks[i], &attr))
+			exit_bug("pthread_mutex_init");
+	}
+
+	pthread_mutexattr_destroy(&attr);
+
+	if (pthread_mutex_init(&ctx.eth_addr_lock, NULL))
+		exit_bug("pthread_mutex_init");
+
+	if (pthread_mutex_init(&ctx.buffer_pool_lock, NULL))
+		exit_bug("pthread_mutex_init");
+
+	ctx.workers = fastd_new0_array(conf.n_workers, fastd_worker_t);
+
+	for (i = 0; i < conf.n_workers; i++)
+		worker_init(&ctx.workers[i]);
+}
+
+/** Starts the worker threads */
+void fastd_workers_start(void) {
+	if (!fastd_workers_enabled())
+		return;
+
+	publish_peers();
+	ctx.workers_running = true;
+
+	size_t i;
+	for (i = 0; i < conf.n_workers; i++) {
+		ctx.workers[i].now = ctx.now;
+
+		if ((errno = pthread_create(&ctx.workers[i].thread, NULL, worker_thread, &ctx.workers[i])) != 0)
+			exit_errno("unable to create worker thread");
+	}
+
+	pr_verbose("started %u worker threads", conf.n_workers);
+}
+
+/** Stops the worker threads and waits for them to terminate */
+void fastd_workers_stop(void) {
+	if (!fastd_workers_enabled())
+		return;
+
+	size_t i;
+	for (i = 0; i < conf.n_workers; i++) {
+		fastd_worker_t *worker = &ctx.workers[i];
+		__atomic_store_n(&worker->stop, true, __ATOMIC_RELEASE);
+		worker_wake(worker);
+	}
+
+	for (i = 0; i < conf.n_workers; i++) {
+		if ((errno = pthread_join(ctx.workers[i].thread, NULL)) != 0)
+			exit_errno("pthread_join");
+	}
+
+	ctx.workers_running = false;
+
+	free_garbage(VECTOR_DATA(ctx.worker_garbage_pending), VECTOR_LEN(ctx.worker_garbage_pending));
+	VECTOR_RESIZE(ctx.worker_garbage_pending, 0);
+
+	free_garbage(VECTOR_DATA(ctx.worker_garbage), VECTOR_LEN(ctx.worker_garbage));
+	VECTOR_RESIZE(ctx.worker_garbage, 0);
+}
+
+/** Frees the resources used by the (already stopped) worker threads */
+void fastd_workers_free(void) {
+	if (!fastd_workers_enabled())
+		return;
+
+	size_t i, j;
+	for (i = 0; i < conf.n_workers; i++) {
+		fastd_worker_t *worker = &ctx.workers[i];
+
+		worker_fd_close(worker->wake_fd.fd);
+
+		for (j = 0; j < ctx.n_socks; j++) {
+			worker_fd_close(worker->socks[j].fd.fd);
+			fastd_receive_batch_free(&worker->socks[j]);
+			free(worker->socks[j].bound_addr);
+		}
+
+		free(worker->socks);
+
+		worker_fd_close(worker->epoll_fd);
+
+		fastd_buffer_pool_free(&worker->buffer_pool);
+	}
+
+	free(ctx.workers);
+
+	if (ctx.worker_peers)
+		free_peers(ctx.worker_peers);
+
+	VECTOR_FREE(ctx.worker_garbage);
+	VECTOR_FREE(ctx.worker_garbage_pending);
+
+	for (i = 0; i < WORKER_PEER_LOCKS; i++)
+		pthread_mutex_destroy(&ctx.worker_peer_locks[i]);
+
+	pthread_mutex_destroy(&ctx.eth_addr_lock);
+	pthread_mutex_destroy(&ctx.buffer_pool_lock);
+}
+
+
+/** Returns the worker polling the TUN/TAP interface of a peer (or the main queue of the shared interface) */
+static inline fastd_worker_t * iface_worker(const fastd_iface_t *iface) {
+	return &ctx.workers[iface->peer ? iface->peer->id % conf.n_workers : 0];
+}
+
+/**
+   Lets the workers poll a TUN/TAP interface instead of the main thread
+
+   The interface of a peer is polled by the worker the peer is assigned to. The shared
+   interface must have been opened in multi-queue mode; the first worker polls its
+   initial queue and each of the other workers gets a queue of its own.
+*/
+void fastd_workers_iface_register(fastd_iface_t *iface) {
+	worker_fd_register(iface_worker(iface), &iface->fd);
+
+	if (iface->peer)
+		return;
+
+	size_t i;
+	for (i = 1; i < conf.n_workers; i++) {
+		fastd_worker_t *worker = &ctx.workers[i];
+
+		worker->iface_queue = fastd_iface_open_queue(iface);
+		worker_fd_register(worker, &worker->iface_queue->fd);
+	}
+}
+
+/**
+   Stops polling a TUN/TAP interface registered with fastd_workers_iface_register()
+
+   The workers may still be using the interface afterwards, so it must be freed using
+   fastd_workers_defer(). The additional queues of the shared interface are closed.
+*/
+void fastd_workers_iface_unregister(fastd_iface_t *iface) {
+	worker_fd_unregister(iface_worker(iface), &iface->fd);
+
+	if (iface->peer)
+		return;
+
+	size_t i;
+	for (i = 1; i < conf.n_workers; i++) {
+		fastd_worker_t *worker = &ctx.workers[i];
+		if (!worker->iface_queue)
+			continue;
+
+		worker_fd_unregister(worker, &worker->iface_queue->fd);
+		fastd_iface_close_queue(worker->iface_queue);
+		worker->iface_queue = NULL;
+	}
+}
+
+
+/**
+   Acquires the lock protecting the state of a peer
+
+   The locks are recursive, so the main thread may acquire them repeatedly. Worker threads
+   must not acquire more than one peer lock at a time. Does nothing when no worker threads
+   are used.
+*/
+void fastd_worker_peer_lock(const fastd_peer_t *peer) {
+	if (fastd_workers_enabled() && pthread_mutex_lock(&ctx.worker_peer_locks[peer->id % WORKER_PEER_LOCKS]))
+		exit_bug("pthread_mutex_lock");
+}
+
+/** Releases the lock acquired by fastd_worker_peer_lock() */
+void fastd_worker_peer_unlock(const fastd_peer_t *peer) {
+	if (fastd_workers_enabled() && pthread_mutex_unlock(&ctx.worker_peer_locks[peer->id % WORKER_PEER_LOCKS]))
+		exit_bug("pthread_mutex_unlock");
+}
+
+/**
+   Looks up a peer by its address on a worker thread
+
+   The peer's address may have changed since the peer table was created, so it
+   must be checked again after acquiring the peer lock.
+*/
+fastd_peer_t * fastd_worker_peer_lookup(const fastd_peer_address_t *addr) {
+	const fastd_worker_peers_t *peers = __atomic_load_n(&ctx.worker_peers, __ATOMIC_SEQ_CST);
+
+	size_t b;
+	for (b = peers_bucket(peers, addr); peers->buckets[b].peer; b = (b + 1) & (peers->n_buckets - 1)) {
+		if (fastd_peer_address_equal(&peers->buckets[b].address, addr))
+			return peers->buckets[b].peer;
+	}
+
+	return NULL;
+}
+
+/** Returns the list of peers with known addresses on a worker thread */
+size_t fastd_worker_peer_list(fastd_peer_t *const **peers) {
+	const fastd_worker_peers_t *table = __atomic_load_n(&ctx.worker_peers, __ATOMIC_SEQ_CST);
+
+	*peers = table->peers;
+	return table->n_peers;
+}
+
+/** Adds the statistics of \e src to \e dest, reading \e src atomically */
+static void add_stats(UNUSED fastd_stats_t *dest, UNUSED const fastd_stats_t *src) {
+#ifdef WITH_STATUS_SOCKET
+	size_t i;
+	for (i = 0; i < STAT_MAX; i++) {
+		dest->packets[i] += __atomic_load_n(&src->packets[i], __ATOMIC_RELAXED);
+		dest->bytes[i] += __atomic_load_n(&src->bytes[i], __ATOMIC_RELAXED);
+	}
+#endif
+}
+
+/**
+   Adds up the traffic statistics of all workers
+
+   Must be called on the main thread.
+*/
+void fastd_workers_add_stats(fastd_stats_t *stats) {
+	size_t i;
+	for (i = 0; i < conf.n_workers; i++)
+		add_stats(stats, &ctx.workers[i].stats);
+}
+
+#endif /* WITH_WORKERS */
@@ -0,0 +1,202 @@
+/*
+  Copyright (c) 2012-2016, Matthias Schiffer <mschiffer@universe-factory.net>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   \file
+
+   Worker threads for payload packet processing
+
+   When worker threads are enabled, each worker runs its own event loop over its
+   own epoll instance. It holds a SO_REUSEPORT copy of each bound socket, so the
+   kernel distributes the incoming packets between the workers by their addresses,
+   and it polls the TUN/TAP interfaces of the peers assigned to it (by their IDs) and
+   one queue of the shared multi-queue interface. Payload packets are encrypted and
+   decrypted by the worker that has read them; everything else, like handshakes
+   and the configuration, is left to the main thread.
+
+   The state of a peer is only modified and used with its peer lock held, on all threads.
+   The workers find peers using a snapshot of the peer address table published by the
+   main thread. Memory the workers may still reference (peers, interfaces, old snapshots)
+   is freed by the main thread only after each worker has passed through a quiescent
+   state, i.e. has finished an iteration of its event loop.
+*/
+
+
+#pragma once
+
+#include "fastd.h"
+
+
+#ifdef WITH_WORKERS
+
+/** A worker thread */
+struct fastd_worker {
+	pthread_t thread;			/**< The thread handle */
+	bool stop;				/**< Set by the main thread to make the worker terminate */
+
+	int epoll_fd;				/**< The worker's epoll instance */
+	fastd_poll_fd_t wake_fd;		/**< An eventfd used to wake up the worker for termination and grace periods */
+	fastd_socket_t *socks;			/**< The worker's copies of the sockets in ctx.socks (ctx.n_socks elements) */
+	fastd_iface_t *iface_queue;		/**< The worker's queue of the shared TUN/TAP interface (NULL if the worker doesn't have a queue of its own) */
+
+	unsigned epoch;				/**< Incremented whenever the worker has finished an iteration of its event loop (accessed atomically) */
+	unsigned grace_epoch;			/**< The epoch of the worker when the current grace period has started (main thread only) */
+
+	int64_t now;				/**< The current time of the worker (see fastd_update_time()) */
+
+	fastd_stats_t stats;			/**< Traffic statistics of the packets handled by the worker */
+	fastd_buffer_pool_t buffer_pool;	/**< The worker's packet buffer pool */
+	unsigned buffer_pool_generation;	/**< The generation of the buffer pool configuration the worker's pool uses */
+	size_t max_packet_len;			/**< The size of the largest packet the worker can receive (copied from ctx.worker_max_packet_len) */
+};
+
+/** An entry of the peer table used by the workers */
+typedef struct fastd_worker_peer_entry {
+	fastd_peer_address_t address;		/**< The peer's address at the time the table was created */
+	fastd_peer_t *peer;			/**< The peer (NULL for empty buckets) */
+} fastd_worker_peer_entry_t;
+
+/**
+   An immutable snapshot of the peers with known addresses
+
+   The table is replaced by the main thread whenever the peer address hashtable changes.
+   As the peers may have changed their addresses since, the workers must check the
+   addresses again after acquiring the peer lock.
+*/
+struct fastd_worker_peers {
+	size_t n_peers;				/**< The number of peers in the table */
+	fastd_peer_t **peers;			/**< The peers in the table */
+
+	uint32_t seed;				/**< The hash seed */
+	size_t n_buckets;			/**< The number of buckets (a power of two) */
+	fastd_worker_peer_entry_t *buckets;	/**< The buckets of the hashtable (using linear probing) */
+};
+
+/** Memory that is freed after the workers have stopped using it */
+struct fastd_worker_garbage {
+	void (*free_fn)(void *arg);		/**< The function freeing the memory */
+	void *arg;				/**< The argument passed to \e free_fn */
+};
+
+
+/** The worker the current thread belongs to (NULL on the main thread) */
+extern __thread fastd_worker_t *fastd_worker_self;
+
+
+void fastd_workers_init(void);
+void fastd_workers_start(void);
+void fastd_workers_stop(void);
+void fastd_workers_free(void);
+void fastd_workers_maintain(void);
+
+void fastd_workers_defer(void (*free_fn)(void *arg), void *arg);
+void fastd_workers_iface_register(fastd_iface_t *iface);
+void fastd_workers_iface_unregister(fastd_iface_t *iface);
+
+void fastd_worker_peer_lock(const fastd_peer_t *peer);
+void fastd_worker_peer_unlock(const fastd_peer_t *peer);
+fastd_peer_t * fastd_worker_peer_lookup(const fastd_peer_address_t *addr);
+size_t fastd_worker_peer_list(fastd_peer_t *const **peers);
+
+void fastd_workers_add_stats(fastd_stats_t *stats);
+
+
+/** Checks if payload packets are processed on worker threads */
+static inline bool fastd_workers_enabled(void) {
+	return conf.n_workers;
+}
+
+/** Checks if the current thread is a worker thread */
+static inline bool fastd_in_worker(void) {
+	return fastd_worker_self;
+}
+
+/** Must be called whenever the peer address hashtable is modified, so the peer table of the workers is updated */
+static inline void fastd_workers_peers_changed(void) {
+	ctx.worker_peers_dirty = true;
+}
+
+/** Locks the ethernet address table when worker threads are used */
+static inline void fastd_worker_eth_addr_lock(void) {
+	if (fastd_workers_enabled() && pthread_mutex_lock(&ctx.eth_addr_lock))
+		exit_bug("pthread_mutex_lock");
+}
+
+/** Unlocks the ethernet address table when worker threads are used */
+static inline void fastd_worker_eth_addr_unlock(void) {
+	if (fastd_workers_enabled() && pthread_mutex_unlock(&ctx.eth_addr_lock))
+		exit_bug("pthread_mutex_unlock");
+}
+
+/**
+   Returns the statistics the current thread accounts the traffic it handles to
+
+   These statistics are only written by the current thread, but they may be read by the
+   main thread at the same time.
+*/
+static inline fastd_stats_t * fastd_worker_stats(void) {
+	return fastd_worker_self ? &fastd_worker_self->stats : &ctx.stats;
+}
+
+#else /* WITH_WORKERS */
+
+static inline void fastd_workers_init(void) {}
+static inline void fastd_workers_start(void) {}
+static inline void fastd_workers_stop(void) {}
+static inline void fastd_workers_free(void) {}
+static inline void fastd_workers_maintain(void) {}
+
+/** Frees memory immediately, as there are no workers that could still use it */
+static inline void fastd_workers_defer(void (*free_fn)(void *arg), void *arg) {
+	free_fn(arg);
+}
+
+static inline void fastd_worker_peer_lock(UNUSED const fastd_peer_t *peer) {}
+static inline void fastd_worker_peer_unlock(UNUSED const fastd_peer_t *peer) {}
+
+static inline size_t fastd_worker_peer_list(UNUSED fastd_peer_t *const **peers) {
+	return 0;
+}
+
+static inline void fastd_workers_add_stats(UNUSED fastd_stats_t *stats) {}
+
+static inline bool fastd_workers_enabled(void) {
+	return false;
+}
+
+static inline bool fastd_in_worker(void) {
+	return false;
+}
+
+static inline void fastd_workers_peers_changed(void) {}
+
+static inline void fastd_worker_eth_addr_lock(void) {}
+static inline void fastd_worker_eth_addr_unlock(void) {}
+
+static inline fastd_stats_t * fastd_worker_stats(void) {
+	return &ctx.stats;
+}
+
+#endif /* WITH_WORKERS */